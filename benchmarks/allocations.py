@@ -0,0 +1,105 @@
+"""Memory allocations per period and per blocking call.
+
+CPython has no allocation counter, so this reports what it can observe:
+the growth of allocated memory blocks (sys.getallocatedblocks()) per period
+or call, which should stay at zero, and with tracemalloc, the peak bytes
+allocated above the steady state while streams run, which bounds what a
+period allocates transiently.
+
+Usage: python benchmarks/allocations.py [--device NAME] [--quick]
+"""
+
+import gc
+import sys
+import tracemalloc
+
+import pyaudio
+
+import common
+
+RATE = 48000
+CHANNELS = 2
+WIDTH = 2
+FRAMES_PER_BUFFER = 256
+
+
+def run_callback_stream(p, options, num_periods):
+    """Runs a duplex callback stream for num_periods periods."""
+    output = b'\0' * WIDTH * CHANNELS * FRAMES_PER_BUFFER
+    calls = [0]
+
+    def callback(in_data, frame_count, time_info, status):
+        calls[0] += 1
+        if calls[0] >= num_periods:
+            return (output, pyaudio.paComplete)
+        return (output, pyaudio.paContinue)
+
+    stream = p.open(format=pyaudio.paInt16, channels=CHANNELS, rate=RATE,
+                    input=True, output=True,
+                    frames_per_buffer=FRAMES_PER_BUFFER,
+                    stream_callback=callback,
+                    **common.stream_kwargs(p, options))
+    stream.wait()
+    stream.close()
+
+
+def run_blocking_stream(p, options, num_calls):
+    """Writes and reads num_calls buffers on a blocking duplex stream."""
+    data = b'\0' * WIDTH * CHANNELS * FRAMES_PER_BUFFER
+    stream = p.open(format=pyaudio.paInt16, channels=CHANNELS, rate=RATE,
+                    input=True, output=True,
+                    frames_per_buffer=FRAMES_PER_BUFFER,
+                    **common.stream_kwargs(p, options))
+    for _ in range(num_calls):
+        stream.write(data, FRAMES_PER_BUFFER)
+        stream.read(FRAMES_PER_BUFFER, exception_on_overflow=False)
+    stream.close()
+
+
+def measure(name, func, count):
+    """Returns the allocation record of func(count)."""
+    # Warm up, so that caches and free lists are populated, then compare a
+    # short and a long run: the difference of their growth is per period.
+    func(count // 10)
+    gc.collect()
+    growth = []
+    for num in (count // 10, count):
+        before = sys.getallocatedblocks()
+        func(num)
+        gc.collect()
+        growth.append(sys.getallocatedblocks() - before)
+
+    tracemalloc.start()
+    func(count // 10)
+    baseline, _ = tracemalloc.get_traced_memory()
+    tracemalloc.reset_peak()
+    func(count)
+    _, peak = tracemalloc.get_traced_memory()
+    tracemalloc.stop()
+
+    return {
+        'name': name,
+        'iterations': count,
+        'net_blocks_per_iteration':
+            (growth[1] - growth[0]) / (count - count // 10),
+        'peak_bytes': peak - baseline,
+    }
+
+
+def run(options):
+    """Returns the allocation records."""
+    count = common.iterations(options, 5000)
+    p = pyaudio.PyAudio()
+    try:
+        return [
+            measure('allocations_callback_period',
+                    lambda num: run_callback_stream(p, options, num), count),
+            measure('allocations_blocking_io',
+                    lambda num: run_blocking_stream(p, options, num), count),
+        ]
+    finally:
+        p.terminate()
+
+
+if __name__ == '__main__':
+    common.main(run, __doc__.splitlines()[0])
@@ -0,0 +1,74 @@
+"""Blocking read/write throughput and per-call overhead.
+
+Writes and reads a fixed number of frames in chunks of several sizes, on a
+blocking duplex stream, and reports frames per second and the time per call.
+On the virtual device, which runs as fast as it is serviced, small chunks
+measure the per-call overhead and large ones the copying throughput.
+
+Usage: python benchmarks/blocking_io.py [--device NAME] [--quick]
+"""
+
+import time
+
+import pyaudio
+
+import common
+
+CHUNK_FRAMES = (64, 256, 1024, 4096)
+CHANNELS = 2
+RATE = 48000
+WIDTH = 2
+
+
+def measure(stream, direction, chunk_frames, total_frames):
+    """Returns the record of one direction and chunk size."""
+    num_calls = max(1, total_frames // chunk_frames)
+    if direction == 'write':
+        data = b'\0' * WIDTH * CHANNELS * chunk_frames
+
+        def call():
+            stream.write(data, chunk_frames)
+    else:
+
+        def call():
+            stream.read(chunk_frames, exception_on_overflow=False)
+
+    start = time.perf_counter_ns()
+    for _ in range(num_calls):
+        call()
+    elapsed = time.perf_counter_ns() - start
+    return {
+        'name': 'blocking_io',
+        'direction': direction,
+        'chunk_frames': chunk_frames,
+        'channels': CHANNELS,
+        'calls': num_calls,
+        'ns_per_call': elapsed / num_calls,
+        'frames_per_second': num_calls * chunk_frames * 1e9 / elapsed,
+        'bytes_per_second':
+            num_calls * chunk_frames * WIDTH * CHANNELS * 1e9 / elapsed,
+    }
+
+
+def run(options):
+    """Returns the records of all directions and chunk sizes."""
+    total_frames = common.iterations(options, 20 * RATE)
+    p = pyaudio.PyAudio()
+    try:
+        records = []
+        for chunk_frames in CHUNK_FRAMES:
+            stream = p.open(format=pyaudio.paInt16, channels=CHANNELS,
+                            rate=RATE, input=True, output=True,
+                            frames_per_buffer=min(chunk_frames, 1024),
+                            **common.stream_kwargs(p, options))
+            for direction in ('write', 'read'):
+                records.append(
+                    measure(stream, direction, chunk_frames, total_frames))
+            stream.close()
+        return records
+    finally:
+        p.terminate()
+
+
+if __name__ == '__main__':
+    common.main(run, __doc__.splitlines()[0])
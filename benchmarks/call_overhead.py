@@ -0,0 +1,62 @@
+"""Per-call overhead of the _portaudio stream entry points.
+
+Times the functions that blocking-mode loops call once per buffer, on a
+blocking duplex stream. Reads and writes move zero frames, so the results
+measure argument handling and the GIL round-trip rather than audio I/O.
+
+Usage: python benchmarks/call_overhead.py [--device NAME] [--quick]
+"""
+
+import pyaudio
+from pyaudio import _portaudio as pa
+
+import common
+
+RATE = 44100
+CHANNELS = 1
+FORMAT = pyaudio.paInt16
+
+
+def run(options):
+    """Returns the per-call time of each entry point."""
+    num_calls = common.iterations(options, 10000)
+    p = pyaudio.PyAudio()
+    stream = p.open(format=FORMAT, channels=CHANNELS, rate=RATE, input=True,
+                    output=True, **common.stream_kwargs(p, options))
+    # pylint: disable=protected-access
+    handle = stream._stream
+
+    cases = [
+        ('write_stream', pa.write_stream, (handle, b'', 0, False)),
+        ('read_stream', pa.read_stream, (handle, 0, False)),
+        ('get_stream_read_available', pa.get_stream_read_available,
+         (handle,)),
+        ('get_stream_write_available', pa.get_stream_write_available,
+         (handle,)),
+        ('is_stream_active', pa.is_stream_active, (handle,)),
+        ('is_stream_stopped', pa.is_stream_stopped, (handle,)),
+        ('get_stream_time', pa.get_stream_time, (handle,)),
+    ]
+    # The baseline separates the cost of calling into the extension from the
+    # cost of the PortAudio call itself.
+    empty = lambda *args: None  # pylint: disable=unnecessary-lambda-assignment
+    records = [{
+        'name': 'call_overhead',
+        'function': '(empty Python call)',
+        'ns_per_call': common.best_time_ns(lambda: empty(handle), num_calls),
+    }]
+    for name, func, args in cases:
+        records.append({
+            'name': 'call_overhead',
+            'function': name,
+            'ns_per_call': common.best_time_ns(
+                lambda func=func, args=args: func(*args), num_calls),
+        })
+
+    stream.close()
+    p.terminate()
+    return records
+
+
+if __name__ == '__main__':
+    common.main(run, __doc__.splitlines()[0])
@@ -0,0 +1,85 @@
+"""Callback overhead per period, by frames_per_buffer and channel count.
+
+Runs output and duplex callback streams for a fixed number of periods, and
+measures the process CPU time per period. The callback itself, called
+directly with the same arguments, is the baseline: the difference is what
+the binding adds per period (GIL acquisition, argument building, copying
+the returned buffer).
+
+Usage: python benchmarks/callback_overhead.py [--device NAME] [--quick]
+"""
+
+import time
+
+import pyaudio
+
+import common
+
+FRAMES_PER_BUFFER = (64, 256, 1024)
+CHANNELS = (1, 2, 8)
+RATE = 48000
+WIDTH = 2
+
+
+def measure(p, options, frames_per_buffer, channels, duplex):
+    """Returns the record of one callback stream configuration."""
+    num_periods = common.iterations(options, 2000)
+    output = b'\0' * WIDTH * channels * frames_per_buffer
+    calls = [0]
+
+    def callback(in_data, frame_count, time_info, status):
+        calls[0] += 1
+        if calls[0] >= num_periods:
+            return (output, pyaudio.paComplete)
+        return (output, pyaudio.paContinue)
+
+    stream = p.open(format=pyaudio.paInt16, channels=channels, rate=RATE,
+                    input=duplex, output=True,
+                    frames_per_buffer=frames_per_buffer,
+                    stream_callback=callback, start=False,
+                    **common.stream_kwargs(p, options))
+    wall_start = time.perf_counter_ns()
+    cpu_start = time.process_time_ns()
+    stream.start_stream()
+    stream.wait()
+    cpu = time.process_time_ns() - cpu_start
+    wall = time.perf_counter_ns() - wall_start
+    stream.close()
+
+    # The callback alone, as the binding calls it.
+    calls[0] = 0
+    in_data = output if duplex else None
+    time_info = {'input_buffer_adc_time': 0.0, 'current_time': 0.0,
+                 'output_buffer_dac_time': 0.0}
+    baseline = common.best_time_ns(
+        lambda: callback(in_data, frames_per_buffer, time_info, 0),
+        num_periods)
+
+    cpu_per_period = cpu / num_periods
+    return {
+        'name': 'callback_overhead',
+        'mode': 'duplex' if duplex else 'output',
+        'frames_per_buffer': frames_per_buffer,
+        'channels': channels,
+        'periods': num_periods,
+        'wall_ns_per_period': wall / num_periods,
+        'cpu_ns_per_period': cpu_per_period,
+        'callback_ns': baseline,
+        'overhead_ns_per_period': cpu_per_period - baseline,
+    }
+
+
+def run(options):
+    """Returns the records of all configurations."""
+    p = pyaudio.PyAudio()
+    try:
+        return [measure(p, options, frames_per_buffer, channels, duplex)
+                for duplex in (False, True)
+                for frames_per_buffer in FRAMES_PER_BUFFER
+                for channels in CHANNELS]
+    finally:
+        p.terminate()
+
+
+if __name__ == '__main__':
+    common.main(run, __doc__.splitlines()[0])
@@ -0,0 +1,101 @@
+"""Helpers shared by the benchmarks.
+
+Each benchmark module has a ``run(options)`` function returning a list of
+result records (dicts with a ``name`` and its measurements), and can be run
+on its own, printing its records as JSON. ``run_all.py`` runs all of them
+into one JSON report.
+
+Streams run on the virtual null device by default, so no audio hardware is
+needed; ``--device NAME`` runs them on the first PortAudio device whose name
+contains NAME instead, e.g. ALSA's ``null`` PCM.
+"""
+
+import argparse
+import json
+import sys
+import time
+
+import pyaudio
+
+
+def parse_args(description, argv=None):
+    """Parses the command line options common to all benchmarks."""
+    parser = argparse.ArgumentParser(description=description)
+    parser.add_argument(
+        '--device', default=None,
+        help='run streams on the PortAudio device whose name contains '
+        'DEVICE, instead of the virtual null device')
+    parser.add_argument(
+        '--quick', action='store_true',
+        help='run fewer iterations, e.g. to check that benchmarks work')
+    parser.add_argument(
+        '--output', default=None,
+        help='write the JSON results to this file instead of stdout')
+    return parser.parse_args(argv)
+
+
+def iterations(options, count):
+    """Returns count, scaled down for --quick runs."""
+    return max(1, count // 20) if options.quick else count
+
+
+def best_time_ns(func, num_calls, repeat=5):
+    """Returns the best per-call time of func(), in nanoseconds."""
+    best = float('inf')
+    for _ in range(repeat):
+        start = time.perf_counter_ns()
+        for _ in range(num_calls):
+            func()
+        best = min(best, (time.perf_counter_ns() - start) / num_calls)
+    return best
+
+
+def find_device(p, name):
+    """Returns the index of the first device whose name contains name."""
+    for index in range(p.get_device_count()):
+        if name in p.get_device_info_by_index(index)['name']:
+            return index
+    raise ValueError(f'No device matching {name!r}')
+
+
+def stream_kwargs(p, options, realtime=False):
+    """Returns the open() arguments selecting the benchmarked device.
+
+    On the virtual device, streams run as fast as possible unless realtime.
+    """
+    if options.device is None:
+        return {'virtual_device': 'realtime' if realtime else 'fast'}
+    index = find_device(p, options.device)
+    return {'input_device_index': index, 'output_device_index': index}
+
+
+def environment():
+    """Returns a description of the environment benchmarks ran in."""
+    return {
+        'python': sys.version.split()[0],
+        'platform': sys.platform,
+        'pyaudio': pyaudio.__version__,
+        'portaudio': pyaudio.get_portaudio_version_text(),
+    }
+
+
+def write_report(records, options):
+    """Writes records, with the environment, as JSON."""
+    report = {
+        'environment': environment(),
+        'device': options.device or 'virtual',
+        'results': records,
+    }
+    if options.output:
+        with open(options.output, 'w', encoding='utf-8') as output:
+            json.dump(report, output, indent=2)
+            output.write('\n')
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        sys.stdout.write('\n')
+
+
+def main(run, description):
+    """Runs a benchmark module's run() from the command line."""
+    options = parse_args(description)
+    write_report(run(options), options)
@@ -0,0 +1,78 @@
+"""PortAudio initialization and device enumeration time.
+
+Times Pa_Initialize()/Pa_Terminate() through the extension (the first
+PyAudio() of a process pays for them; later ones share the initialization),
+and enumerating all devices, one call at a time and from the cached snapshot
+of get_all_devices().
+
+Usage: python benchmarks/init_enumeration.py [--quick]
+"""
+
+import time
+
+import pyaudio
+from pyaudio import _portaudio as pa
+
+import common
+
+
+def time_once_ns(func):
+    """Returns the time of one call of func(), in nanoseconds."""
+    start = time.perf_counter_ns()
+    func()
+    return time.perf_counter_ns() - start
+
+
+def enumerate_devices(p):
+    """Returns the info of every device, one call at a time."""
+    return [p.get_device_info_by_index(index)
+            for index in range(p.get_device_count())]
+
+
+def run(options):
+    """Returns the initialization and enumeration records."""
+    num_calls = common.iterations(options, 20)
+    records = []
+
+    # Initialization is shared by the whole process, so only time it while
+    # no PyAudio holds it.
+    if pa.get_init_count() == 0:
+        initialize = []
+        terminate = []
+        for _ in range(num_calls):
+            initialize.append(time_once_ns(pa.initialize))
+            terminate.append(time_once_ns(pa.terminate))
+        records.append({
+            'name': 'initialize',
+            'calls': num_calls,
+            'best_ns': min(initialize),
+            'mean_ns': sum(initialize) / num_calls,
+        })
+        records.append({
+            'name': 'terminate',
+            'calls': num_calls,
+            'best_ns': min(terminate),
+            'mean_ns': sum(terminate) / num_calls,
+        })
+
+    p = pyaudio.PyAudio()
+    try:
+        device_count = p.get_device_count()
+        records.append({
+            'name': 'enumerate_devices',
+            'devices': device_count,
+            'best_ns': common.best_time_ns(lambda: enumerate_devices(p),
+                                           num_calls),
+        })
+        records.append({
+            'name': 'get_all_devices_cached',
+            'devices': device_count,
+            'best_ns': common.best_time_ns(pa.get_all_devices, num_calls),
+        })
+        return records
+    finally:
+        p.terminate()
+
+
+if __name__ == '__main__':
+    common.main(run, __doc__.splitlines()[0])
@@ -0,0 +1,68 @@
+"""Stream open, start, stop and close latency.
+
+Times each step of a stream's lifecycle, for blocking and callback output
+streams and blocking duplex streams.
+
+Usage: python benchmarks/open_close.py [--device NAME] [--quick]
+"""
+
+import time
+
+import pyaudio
+
+import common
+
+RATE = 48000
+CHANNELS = 2
+FRAMES_PER_BUFFER = 256
+
+
+def callback(in_data, frame_count, time_info, status):
+    return (b'\0' * 2 * CHANNELS * frame_count, pyaudio.paContinue)
+
+
+def measure(p, options, mode):
+    """Returns the record of one kind of stream."""
+    num_streams = common.iterations(options, 200)
+    steps = {'open': [], 'start': [], 'stop': [], 'close': []}
+    kwargs = dict(format=pyaudio.paInt16, channels=CHANNELS, rate=RATE,
+                  output=True, input=mode == 'duplex', start=False,
+                  frames_per_buffer=FRAMES_PER_BUFFER,
+                  **common.stream_kwargs(p, options))
+    if mode == 'callback':
+        kwargs['stream_callback'] = callback
+
+    for _ in range(num_streams):
+        start = time.perf_counter_ns()
+        stream = p.open(**kwargs)
+        opened = time.perf_counter_ns()
+        stream.start_stream()
+        started = time.perf_counter_ns()
+        stream.stop_stream()
+        stopped = time.perf_counter_ns()
+        stream.close()
+        closed = time.perf_counter_ns()
+        steps['open'].append(opened - start)
+        steps['start'].append(started - opened)
+        steps['stop'].append(stopped - started)
+        steps['close'].append(closed - stopped)
+
+    record = {'name': 'open_close', 'mode': mode, 'streams': num_streams}
+    for step, times in steps.items():
+        record[f'{step}_best_ns'] = min(times)
+        record[f'{step}_mean_ns'] = sum(times) / num_streams
+    return record
+
+
+def run(options):
+    """Returns the records of all kinds of streams."""
+    p = pyaudio.PyAudio()
+    try:
+        return [measure(p, options, mode)
+                for mode in ('blocking', 'callback', 'duplex')]
+    finally:
+        p.terminate()
+
+
+if __name__ == '__main__':
+    common.main(run, __doc__.splitlines()[0])
@@ -0,0 +1,38 @@
+"""Runs all benchmarks into one JSON report.
+
+The report holds the environment (Python, PyAudio and PortAudio versions),
+the device benchmarked, and the records of every benchmark, so that results
+of different revisions can be compared to track regressions.
+
+Usage: python benchmarks/run_all.py [--device NAME] [--quick] [--output FILE]
+"""
+
+import allocations
+import blocking_io
+import call_overhead
+import callback_overhead
+import common
+import init_enumeration
+import open_close
+
+# Initialization runs first, while no PyAudio holds PortAudio.
+BENCHMARKS = (
+    init_enumeration,
+    open_close,
+    call_overhead,
+    callback_overhead,
+    blocking_io,
+    allocations,
+)
+
+
+def main():
+    options = common.parse_args(__doc__.splitlines()[0])
+    records = []
+    for benchmark in BENCHMARKS:
+        records.extend(benchmark.run(options))
+    common.write_report(records, options)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,7 +1,6 @@
 """PyAudio Example: Play a wave file (callback version)."""
 
 import wave
-import time
 import sys
 
 import pyaudio
@@ -30,8 +29,7 @@ with wave.open(sys.argv[1], 'rb') as wf:
                     stream_callback=callback)
 
     # Wait for stream to finish (4)
-    while stream.is_active():
-        time.sleep(0.1)
+    stream.wait()
 
     # Close the stream (5)
     stream.close()
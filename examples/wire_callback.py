@@ -1,6 +1,5 @@
 """PyAudio Example: Audio wire between input and output. Callback version."""
 
-import time
 import sys
 
 import pyaudio
@@ -19,9 +18,7 @@ stream = p.open(format=p.get_format_from_width(2),
                 output=True,
                 stream_callback=callback)
 
-start = time.time()
-while stream.is_active() and (time.time() - start) < DURATION:
-    time.sleep(0.1)
+stream.wait(timeout=DURATION)
 
 stream.close()
 p.terminate()
@@ -50,14 +50,29 @@ WIN_VCPKG_PATH = os.environ.get("VCPKG_PATH", None)
 def setup_extension():
     pyaudio_module_sources = [
         'src/pyaudio/main.c',
+        'src/pyaudio/alsa_stream_info.c',
         'src/pyaudio/device_api.c',
+        'src/pyaudio/device_snapshot.c',
         'src/pyaudio/host_api.c',
         'src/pyaudio/init.c',
         'src/pyaudio/mac_core_stream_info.c',
         'src/pyaudio/misc.c',
+        'src/pyaudio/null_device.c',
+        'src/pyaudio/output_broker.c',
+        'src/pyaudio/probes.c',
+        'src/pyaudio/ring_buffer.c',
+        'src/pyaudio/shared_capture.c',
         'src/pyaudio/stream.c',
+        'src/pyaudio/stream_deadline.c',
+        'src/pyaudio/stream_isolated.c',
         'src/pyaudio/stream_io.c',
         'src/pyaudio/stream_lifecycle.c',
+        'src/pyaudio/stream_lookahead.c',
+        'src/pyaudio/stream_reader.c',
+        'src/pyaudio/stream_reblock.c',
+        'src/pyaudio/stream_schedule.c',
+        'src/pyaudio/stream_trace.c',
+        'src/pyaudio/thread_tuning.c',
     ]
     include_dirs = []
     external_libraries = ["portaudio"]
@@ -116,6 +131,10 @@ def setup_extension():
         # portaudio, installed by the package manager.
         include_dirs += ['/usr/local/include', '/usr/include']
         external_libraries_path += ['/usr/local/lib', '/usr/lib']
+        if sys.platform.startswith('linux'):
+            # shm_open, for shared capture, and dlopen, for rtkit (part of
+            # libc since glibc 2.34).
+            external_libraries += ["rt", "dl"]
 
     return Extension(
         'pyaudio._portaudio',
@@ -144,6 +163,7 @@ setup(
     scripts=[],
     packages=['pyaudio'],
     package_dir={'': 'src'},
+    python_requires='>=3.9',
     extras_require={
         "test": ["numpy"],
     },
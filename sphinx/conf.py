@@ -255,3 +255,10 @@ except ImportError:
     pass
 else:
     tags.add('pamac')
+
+try:
+    from pyaudio._portaudio import paAlsaStreamInfo
+except ImportError:
+    pass
+else:
+    tags.add('paalsa')
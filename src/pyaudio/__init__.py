@@ -31,19 +31,39 @@ Overview
 --------
 
 **Classes**
-  :py:class:`PyAudio`, :py:class:`PyAudio.Stream`
+  :py:class:`PyAudio`, :py:class:`PyAudio.Stream`,
+  :py:class:`SharedCaptureReader`, :py:class:`BrokerClient`
 
 .. only:: pamac
 
    **Host Specific Classes**
      :py:class:`PaMacCoreStreamInfo`
 
+.. only:: paalsa
+
+   **Host Specific Classes**
+     :py:class:`PaAlsaStreamInfo`, :py:func:`alsa_set_num_periods`,
+     :py:func:`alsa_set_retries_busy`
+
 **Stream Conversion Convenience Functions**
   :py:func:`get_sample_size`, :py:func:`get_format_from_width`
 
 **PortAudio version**
   :py:func:`get_portaudio_version`, :py:func:`get_portaudio_version_text`
 
+**Initialization**
+  :py:func:`initialize_in_background`, :py:data:`ready`
+
+**Callback Traces**
+  :py:func:`read_trace`, :py:func:`PyAudio.replay_trace`
+
+**Profiling**
+  :py:func:`start_probe_recording`, :py:func:`stop_probe_recording`,
+  :py:func:`get_chrome_trace`, :py:func:`write_chrome_trace`
+
+**Real-time Scheduling**
+  :py:func:`set_thread_scheduling`
+
 .. |PaSampleFormat| replace:: :ref:`PortAudio Sample Format <PaSampleFormat>`
 .. _PaSampleFormat:
 
@@ -104,7 +124,13 @@ __author__ = "Hubert Pham"
 __version__ = "0.2.14"
 __docformat__ = "restructuredtext en"
 
+import atexit
+import json
 import locale
+import os
+import struct
+import threading
+import time
 import warnings
 
 try:
@@ -246,6 +272,250 @@ def get_portaudio_version_text():
     return pa.get_version_text()
 
 
+# Initialization
+
+#: A :py:class:`concurrent.futures.Future` that completes once PortAudio is
+#: initialized in the background (see :py:func:`initialize_in_background`),
+#: or ``None`` if that was not requested.
+ready = None
+_ready_lock = threading.Lock()
+
+
+def initialize_in_background():
+    """Starts initializing PortAudio on a background thread.
+
+    PortAudio initialization enumerates every device, which may take a
+    while. It is shared by all :py:class:`PyAudio` instances in the process,
+    and only undone when the last reference to it is released; this takes a
+    reference of its own, released at exit (before the interpreter
+    finalizes), so instances created later (e.g., one per job) never wait
+    for it. An instance created before it completes waits for it.
+
+    Set the ``PYAUDIO_INIT_IN_BACKGROUND`` environment variable to call this
+    when the module is imported. Later calls return the same future.
+
+    :returns: :py:data:`ready`, which raises ``IOError`` if initialization
+       fails.
+    :rtype: concurrent.futures.Future
+    """
+    global ready
+    import concurrent.futures
+
+    with _ready_lock:
+        if ready is not None:
+            return ready
+        future = concurrent.futures.Future()
+
+        def initialize():
+            try:
+                pa.initialize()
+            except BaseException as e:
+                future.set_exception(e)
+            else:
+                atexit.register(pa.terminate)
+                future.set_result(None)
+
+        threading.Thread(target=initialize,
+                         name='pyaudio-initialize',
+                         daemon=True).start()
+        ready = future
+    return future
+
+
+# Callback Traces
+
+# Layout of trace files (see the trace_path stream argument), in the byte
+# order of the recording machine.
+_TRACE_HEADER = struct.Struct('=8sIIQIId')
+_TRACE_RECORD = struct.Struct('=IIQddd')
+_TRACE_MAGIC = b'PYATRACE'
+_TRACE_VERSION = 1
+_TRACE_INPUT = 1
+_TRACE_STREAM_INPUT = 2
+_TRACE_STREAM_OUTPUT = 4
+
+
+def _read_trace_header(trace):
+    """Reads the header of an open trace file. (Internal)
+
+    :returns: The header, and the size of a frame in bytes.
+    """
+    data = trace.read(_TRACE_HEADER.size)
+    if len(data) < _TRACE_HEADER.size:
+        raise ValueError("Not a PyAudio trace file")
+    (magic, version, flags, format, channels, frame_size,
+     rate) = _TRACE_HEADER.unpack(data)
+    if magic != _TRACE_MAGIC:
+        raise ValueError("Not a PyAudio trace file")
+    if version != _TRACE_VERSION:
+        raise ValueError(
+            f"Unsupported trace version {version} (or byte order)")
+    header = {
+        'format': format,
+        'channels': channels,
+        'rate': rate,
+        'input': bool(flags & _TRACE_STREAM_INPUT),
+        'output': bool(flags & _TRACE_STREAM_OUTPUT),
+        'has_input_frames': bool(flags & _TRACE_INPUT),
+    }
+    return header, frame_size
+
+
+def read_trace(path, input=False):
+    """Reads a callback trace, as recorded with `trace_path` (see
+    :py:func:`PyAudio.Stream.__init__`).
+
+    The header describes the recorded stream: its ``'format'``,
+    ``'channels'`` and ``'rate'``, whether it had ``'input'`` and
+    ``'output'``, and whether records hold input frames
+    (``'has_input_frames'``). Each record holds the arguments of one
+    PortAudio callback: ``'frame_count'``, ``'time_info'`` (as passed to
+    stream callbacks), ``'status_flags'``, and the number of records
+    ``'dropped'`` just before it because the trace writer fell behind.
+
+    :param path: Path of the trace file.
+    :param input: Whether to include the input frames of each record, as
+        bytes under ``'input'`` (or ``None`` if not recorded).
+    :raises ValueError: if the file is not a trace.
+    :returns: The header and the list of records.
+    :rtype: tuple(dict, list)
+    """
+    with open(path, 'rb') as trace:
+        header, frame_size = _read_trace_header(trace)
+        records = []
+        while True:
+            data = trace.read(_TRACE_RECORD.size)
+            if len(data) < _TRACE_RECORD.size:
+                break
+            (frame_count, dropped, status_flags, input_buffer_adc_time,
+             current_time, output_buffer_dac_time) = _TRACE_RECORD.unpack(data)
+            record = {
+                'frame_count': frame_count,
+                'time_info': {
+                    'input_buffer_adc_time': input_buffer_adc_time,
+                    'current_time': current_time,
+                    'output_buffer_dac_time': output_buffer_dac_time,
+                },
+                'status_flags': status_flags,
+                'dropped': dropped,
+            }
+            frames = None
+            if header['has_input_frames'] and input:
+                frames = trace.read(frame_count * frame_size)
+            elif header['has_input_frames']:
+                trace.seek(frame_count * frame_size, os.SEEK_CUR)
+            if input:
+                record['input'] = frames
+            records.append(record)
+    return header, records
+
+
+# Profiling
+
+# Name of the argument of each probe event, in Chrome traces.
+_PROBE_ARGS = {
+    ('callback', 'B'): 'frame_count',
+    ('callback', 'E'): 'result',
+    ('read', 'B'): 'frames',
+    ('read', 'E'): 'error',
+    ('write', 'B'): 'frames',
+    ('write', 'E'): 'error',
+    ('memcpy_done', 'i'): 'bytes',
+    ('xrun', 'i'): 'status',
+}
+
+
+def start_probe_recording(capacity=65536):
+    """Starts recording the hot path's probe events, for all streams.
+
+    The PortAudio callback and blocking reads and writes record events
+    (callback entry and return, GIL acquired, Python callback returned,
+    output copied, read and write begin and end, and xruns) into a ring
+    of the last `capacity` events, without blocking. Export them with
+    :py:func:`get_chrome_trace`. When built with ``sys/sdt.h``, the same
+    points are also USDT probes of provider ``pyaudio``, for ``perf`` or
+    ``bpftrace``, recording or not.
+
+    Starting again discards the events recorded so far.
+
+    :param capacity: Number of events to keep (rounded up to a power of
+        two). Defaults to 65536.
+    """
+    pa.start_probe_recording(capacity)
+
+
+def stop_probe_recording():
+    """Stops recording probe events, keeping those recorded."""
+    pa.stop_probe_recording()
+
+
+def get_chrome_trace():
+    """Returns the recorded probe events as a Chrome trace.
+
+    Callbacks, reads and writes are spans on the thread that ran them, and
+    the other events are instants. Load the JSON of the trace (see
+    :py:func:`write_chrome_trace`) in Perfetto or ``chrome://tracing``.
+
+    :rtype: dict
+    """
+    pid = os.getpid()
+    trace_events = []
+    for event, phase, timestamp, thread, stream, arg in pa.get_probe_events():
+        trace_event = {
+            'name': event,
+            'ph': phase,
+            'ts': timestamp * 1e6,
+            'pid': pid,
+            'tid': thread,
+            'args': {'stream': hex(stream)},
+        }
+        if phase == 'i':
+            trace_event['s'] = 't'
+        if (event, phase) in _PROBE_ARGS:
+            trace_event['args'][_PROBE_ARGS[(event, phase)]] = arg
+        trace_events.append(trace_event)
+    return {'traceEvents': trace_events, 'displayTimeUnit': 'ms'}
+
+
+def write_chrome_trace(path):
+    """Writes the recorded probe events to a Chrome trace JSON file.
+
+    :param path: Path of the file.
+    """
+    with open(path, 'w', encoding='utf-8') as trace:
+        json.dump(get_chrome_trace(), trace)
+
+
+# Real-time scheduling
+
+def set_thread_scheduling(policy=None, priority=0, cpus=None):
+    """Applies real-time scheduling and CPU affinity to the calling thread.
+
+    For threads doing blocking reads or writes; callback streams tune
+    their own threads (see the `realtime_policy` stream argument).
+
+    On Linux, real-time scheduling needs ``CAP_SYS_NICE`` or an
+    ``RLIMIT_RTPRIO`` allowance. Without them, PyAudio asks RealtimeKit
+    (rtkit) over D-Bus, which grants ``'rr'`` up to its own maximum
+    priority, and, once the system bus is reachable, limits
+    ``RLIMIT_RTTIME`` to 200 ms if unlimited. If neither works, the thread
+    keeps its scheduling: check the result.
+
+    :param policy: ``'fifo'`` or ``'rr'``, or ``None`` to leave scheduling
+        alone. On Windows, either sets time-critical priority.
+    :param priority: Real-time priority. Defaults to 10.
+    :param cpus: Iterable of the CPU indices the thread may run on, or
+        ``None`` to leave affinity alone.
+    :raise ValueError: Invalid policy, priority or CPUs.
+    :returns: What the thread got: a dict of ``'policy'`` (``'fifo'``,
+        ``'rr'``, ``'other'``, or ``'time_critical'`` on Windows),
+        ``'priority'``, ``'rtkit'`` (whether granted by rtkit) and
+        ``'cpus'`` (a tuple, or ``None`` where unknown).
+    :rtype: dict
+    """
+    return pa.set_thread_scheduling(policy, priority, cpus)
+
+
 class PyAudio:
     """Python interface to PortAudio.
 
@@ -256,7 +526,7 @@ class PyAudio:
      - query and inspect the available PortAudio audio devices.
 
     **Stream Management**
-      :py:func:`open`, :py:func:`close`
+      :py:func:`open`, :py:func:`close`, :py:func:`render`
 
     **Host API**
       :py:func:`get_host_api_count`, :py:func:`get_default_host_api_info`,
@@ -266,9 +536,10 @@ class PyAudio:
 
     **Device API**
       :py:func:`get_device_count`, :py:func:`is_format_supported`,
+      :py:func:`probe_formats`,
       :py:func:`get_default_input_device_info`,
       :py:func:`get_default_output_device_info`,
-      :py:func:`get_device_info_by_index`
+      :py:func:`get_device_info_by_index`, :py:func:`get_device_snapshot`
 
     **Stream Format Conversion**
       :py:func:`get_sample_size`, :py:func:`get_format_from_width`
@@ -276,23 +547,49 @@ class PyAudio:
     **Details**
     """
 
-    class Stream:
+    class Stream(pa.Stream):
         """PortAudio Stream Wrapper. Use :py:func:`PyAudio.open` to instantiate.
 
+        The stream's I/O and lifecycle methods are implemented by the
+        extension type ``_portaudio.Stream``, so per-buffer calls like
+        :py:func:`write` and :py:func:`read` go straight to C.
+
         **Opening and Closing**
           :py:func:`__init__`, :py:func:`close`
 
         **Stream Info**
           :py:func:`get_input_latency`, :py:func:`get_output_latency`,
-          :py:func:`get_time`, :py:func:`get_cpu_load`
+          :py:func:`get_reblock_latency`, :py:func:`get_time`,
+          :py:func:`get_cpu_load`, :py:func:`get_deadline_misses`
 
         **Stream Management**
           :py:func:`start_stream`, :py:func:`stop_stream`, :py:func:`is_active`,
-          :py:func:`is_stopped`
+          :py:func:`is_stopped`, :py:func:`wait`
 
         **Input Output**
-          :py:func:`write`, :py:func:`read`, :py:func:`get_read_available`,
-          :py:func:`get_write_available`
+          :py:func:`write`, :py:func:`flush`, :py:func:`read`,
+          :py:func:`get_read_available`, :py:func:`get_write_available`
+
+        **Scheduled Playback**
+          :py:func:`schedule`, :py:func:`get_scheduled_start_time`
+
+        **Multiple Readers**
+          :py:func:`open_reader`, :py:func:`open_result_reader`
+
+        **Lookahead**
+          :py:func:`set_lookahead`, :py:func:`get_lookahead`
+
+        **Virtual Device**
+          :py:func:`take_virtual_output`
+
+        **Threads**
+          A duplex blocking stream may be read from one thread while another
+          thread writes to it; each call releases the GIL while it blocks.
+          Other methods may also be called from any thread. :py:func:`close`
+          waits for calls in progress to return, after which calls on any
+          thread raise ``IOError``; a blocking read or write in progress
+          stops within about 0.1 seconds, and raises ``IOError``. Concurrent calls to :py:func:`read` (or
+          to :py:func:`write`) from several threads are not supported.
         """
         def __init__(self,
                      PA_manager,
@@ -307,7 +604,33 @@ class PyAudio:
                      start=True,
                      input_host_api_specific_stream_info=None,
                      output_host_api_specific_stream_info=None,
-                     stream_callback=None):
+                     stream_callback=None,
+                     capture_ring_frames=None,
+                     shared_capture_name=None,
+                     shared_capture_frames=None,
+                     broker_path=None,
+                     broker_client_frames=None,
+                     callback_block_size=None,
+                     callback_hop_size=None,
+                     write_coalesce_frames=None,
+                     write_coalesce_max_age=None,
+                     lookahead_buffers=None,
+                     lookahead_max_buffers=None,
+                     callback_deadline=None,
+                     deadline_fallback=None,
+                     isolated_callback=None,
+                     result_ring_frames=None,
+                     result_frame_size=None,
+                     virtual_device=None,
+                     virtual_input=None,
+                     virtual_output_path=None,
+                     trace_path=None,
+                     trace_input=False,
+                     virtual_trace=None,
+                     realtime_policy=None,
+                     realtime_priority=0,
+                     cpu_affinity=None,
+                     lock_memory=False):
             """Initialize an audio stream.
 
             Do not call directly. Use :py:func:`PyAudio.open`.
@@ -341,6 +664,10 @@ class PyAudio:
 
                    See :py:class:`PaMacCoreStreamInfo`.
 
+                .. only:: paalsa
+
+                   See :py:class:`PaAlsaStreamInfo`.
+
             :param output_host_api_specific_stream_info: Specifies a host API
                 specific stream information data structure for output.
 
@@ -348,6 +675,10 @@ class PyAudio:
 
                    See :py:class:`PaMacCoreStreamInfo`.
 
+                .. only:: paalsa
+
+                   See :py:class:`PaAlsaStreamInfo`.
+
             :param stream_callback: Specifies a callback function for
                 *non-blocking* (callback) operation.  Default is
                 ``None``, which indicates *blocking* operation (i.e.,
@@ -399,15 +730,172 @@ class PyAudio:
                 **See:** PortAudio's callback signature for additional
                 details: http://portaudio.com/docs/v19-doxydocs/portaudio_8h.html#a8a60fb2a5ec9cbade3f54a9c978e2710
 
+            :param capture_ring_frames: For input streams, the number of
+                recent input frames to retain in a shared ring for
+                independent readers (see :py:func:`open_reader`). The audio
+                thread writes each captured buffer to the ring once, without
+                the GIL. If no `stream_callback` is specified, the stream runs
+                solely to feed readers, and
+                :py:func:`PyAudio.Stream.read` is unavailable.
+                Defaults to ``None`` (no ring).
+            :param shared_capture_name: For input streams, the name of a
+                POSIX shared-memory segment to publish captured frames into,
+                so other processes can read them with
+                :py:class:`SharedCaptureReader`. The segment is created when
+                the stream opens (it must not already exist) and removed when
+                the stream closes. As with `capture_ring_frames`, the audio
+                thread writes each captured buffer once, without the GIL.
+                Defaults to ``None`` (no export). Unavailable on Windows.
+            :param shared_capture_frames: The number of recent input frames
+                the shared segment retains. Defaults to one second of audio.
+            :param broker_path: For output streams, a Unix socket path at
+                which to accept :py:class:`BrokerClient` connections from
+                other processes. The stream's callback mixes every client's
+                audio into its output, in C, with saturation, so several
+                processes can share a device that only one of them can
+                open. If no `stream_callback` is specified, the stream plays
+                only its clients' audio, and :py:func:`PyAudio.Stream.write`
+                is unavailable. Requires a format of :py:data:`paInt16`,
+                :py:data:`paInt32`, or :py:data:`paFloat32`. Linux only.
+                Defaults to ``None`` (no broker).
+            :param broker_client_frames: The number of frames each client can
+                queue ahead of the device, which bounds the latency the
+                broker adds. Defaults to four buffers of `frames_per_buffer`
+                frames, or 1/10 second if `frames_per_buffer` is unspecified.
+            :param callback_block_size: For callback-mode streams, the exact
+                number of frames the `stream_callback` receives per call,
+                regardless of the host's buffer size. This lets the host run
+                with :py:data:`paFramesPerBufferUnspecified` (its lowest
+                latency), while the callback still gets fixed-size blocks
+                (e.g., for an FFT). The reblocking is done in C, and adds the
+                latency reported by :py:func:`get_reblock_latency`.
+                Defaults to ``None`` (the callback receives host buffers).
+            :param callback_hop_size: With `callback_block_size`, the number
+                of frames between the starts of consecutive input blocks, so
+                that blocks overlap when smaller than `callback_block_size`.
+                The callback then returns `callback_hop_size` frames of
+                output per call. Output-only streams do not support overlap.
+                Defaults to `callback_block_size` (no overlap).
+            :param write_coalesce_frames: For blocking output streams, buffer
+                small :py:func:`write` calls in C until this many frames
+                have accumulated, then hand them to PortAudio in one call.
+                This saves a GIL release and device call per write when
+                writing many small packets, at the cost of up to
+                `write_coalesce_frames` frames of latency. Use
+                :py:func:`flush` to write buffered frames out early.
+                Defaults to ``None`` (each write goes straight to PortAudio).
+            :param write_coalesce_max_age: With `write_coalesce_frames`, the
+                age, in seconds, of the oldest buffered frame at which the
+                buffer is handed to PortAudio even if the block is not full,
+                by the next :py:func:`write`, or by a background thread if
+                none arrives in time. Defaults to the duration of
+                `write_coalesce_frames` frames.
+            :param lookahead_buffers: For callback-mode output-only streams
+                opened with `frames_per_buffer`, run the `stream_callback`
+                on a dedicated thread, this many buffers ahead of the device.
+                The PortAudio callback then only copies queued frames, and
+                never waits for the GIL, so other Python threads cannot
+                cause underruns; the cost is `lookahead_buffers` buffers of
+                latency. The callback's `time_info` still gives the DAC time
+                of the buffer it produces. Adjust with
+                :py:func:`set_lookahead`. Defaults to ``None`` (the callback
+                runs on the PortAudio callback thread).
+            :param lookahead_max_buffers: With `lookahead_buffers`, the most
+                buffers :py:func:`set_lookahead` may queue. Defaults to four
+                times `lookahead_buffers`.
+            :param callback_deadline: For callback-mode streams with output,
+                opened with `frames_per_buffer`, run the `stream_callback`
+                on a dedicated thread, and wait at most this fraction (0 to
+                1) of each buffer period for it. If the callback misses the
+                deadline, e.g. because another thread holds the GIL, the
+                device plays `deadline_fallback` instead, the miss is counted
+                (see :py:func:`get_deadline_misses`), and the late output
+                plays in the next period instead of calling the callback
+                again. Defaults to ``None`` (the PortAudio callback waits for
+                the GIL and the callback as long as they take).
+            :param deadline_fallback: With `callback_deadline`, what to play
+                for a missed deadline: ``'silence'``, ``'repeat'`` (the
+                previous buffer again) or ``'fade'`` (the previous buffer,
+                faded out; silence for 24-bit and unsigned 8-bit formats).
+                Defaults to ``'silence'``.
+            :param isolated_callback: Instead of `stream_callback`, the
+                callback as ``'module:function'``, to run in a
+                subinterpreter of its own, with its own GIL (Python 3.12
+                or later). The callbacks of isolated streams then run in
+                parallel with each other and with the main interpreter.
+                The module is imported in the subinterpreter, with the
+                current ``sys.path``, and cannot share objects with the
+                main interpreter; its exceptions are printed, not raised.
+                Cannot be combined with `lookahead_buffers`.
+                Defaults to ``None``.
+            :param result_ring_frames: With `isolated_callback`, keep this
+                many frames of results in a ring, for
+                :py:func:`open_result_reader`. The callback may then return
+                a third item, bytes of whole result frames. Defaults to
+                ``None`` (no results).
+            :param result_frame_size: With `result_ring_frames`, the size of
+                a result frame, in bytes. Defaults to 1.
+            :param virtual_device: Open the stream on a virtual null device
+                instead of audio hardware, ignoring the device indexes:
+                ``'realtime'`` runs its clock at the sample rate, like a
+                device would, and ``'fast'`` as fast as the stream is
+                written, read or its callback returns. Callbacks and
+                blocking reads and writes behave as on a device, so
+                streams can be tested and benchmarked on machines without
+                audio. ``'offline'`` runs as fast, plays the input once,
+                and completes the stream at its end, for processing
+                recordings with callbacks (see :py:func:`PyAudio.render`).
+                Defaults to ``None`` (PortAudio).
+            :param virtual_input: With `virtual_device`, the input:
+                ``'silence'``, ``'tone'`` (a 440 Hz sine at half scale),
+                the path of a file of raw frames in the stream's format, or
+                a bytes-like object of such frames, played in a loop
+                (once, offline). Defaults to ``'silence'``.
+            :param virtual_output_path: With `virtual_device`, the path of
+                a file to write the output frames to. Defaults to ``None``
+                (output is discarded, or kept in memory offline: see
+                :py:func:`take_virtual_output`).
+            :param trace_path: For callback streams, record the arguments
+                PortAudio passes each callback (frame count, time info and
+                status flags) to a trace file at this path, to reproduce
+                glitches offline (see :py:func:`read_trace` and
+                :py:func:`PyAudio.replay_trace`). The callback only copies
+                them into memory; a separate thread writes the file, and
+                records are dropped if it falls behind. Defaults to
+                ``None``.
+            :param trace_input: With `trace_path`, also record the input
+                frames. Defaults to False.
+            :param virtual_trace: With ``virtual_device='offline'``, the
+                path of a trace to replay: each callback then gets the
+                recorded frame count, time info, status flags, and input
+                (or silence), and the stream completes at the end of the
+                trace. The stream's format, channels and rate must match
+                the trace's. Defaults to ``None``.
+            :param realtime_policy: For callback streams, the real-time
+                scheduling policy of the callback thread, and of the threads
+                running the Python callback with `lookahead_buffers` or
+                `callback_deadline`: ``'fifo'`` or ``'rr'`` (see
+                :py:func:`set_thread_scheduling`). Applied on the first
+                callback; rtkit, if needed, is asked from a helper thread,
+                so that the callback does not wait for it. Defaults to
+                ``None`` (scheduling is left alone).
+            :param realtime_priority: With `realtime_policy`, the priority.
+                Defaults to 10.
+            :param cpu_affinity: For callback streams, an iterable of the CPU
+                indices those threads may run on. Defaults to ``None``.
+                :py:func:`Stream.get_thread_scheduling` reports what the
+                threads got.
+            :param lock_memory: Lock the stream's buffers (rings, FIFOs and
+                trace buffers) in memory, so that the real-time path never
+                faults on them, as far as ``RLIMIT_MEMLOCK`` allows (see
+                :py:func:`Stream.get_locked_memory`). Defaults to False.
+
             :raise ValueError: Neither input nor output are set True.
             """
             if not (input or output):
                 raise ValueError("Must specify an input or output " + "stream.")
 
             self._parent = PA_manager
-            self._is_input = input
-            self._is_output = output
-            self._is_running = start
             self._rate = rate
             self._channels = channels
             self._format = format
@@ -437,19 +925,91 @@ class PyAudio:
             if stream_callback:
                 arguments['stream_callback'] = stream_callback
 
-            # calling pa.open returns a stream object
-            self._stream = pa.open(**arguments)
-
-            self._input_latency = self._stream.inputLatency
-            self._output_latency = self._stream.outputLatency
-
-            if self._is_running:
-                pa.start_stream(self._stream)
+            if isolated_callback:
+                arguments['isolated_callback'] = isolated_callback
+                if result_ring_frames:
+                    arguments['result_ring_frames'] = result_ring_frames
+                    if result_frame_size:
+                        arguments['result_frame_size'] = result_frame_size
+
+            if capture_ring_frames:
+                arguments['capture_ring_frames'] = capture_ring_frames
+
+            if shared_capture_name:
+                arguments['shared_capture_name'] = shared_capture_name
+                if shared_capture_frames:
+                    arguments['shared_capture_frames'] = shared_capture_frames
+
+            if callback_block_size:
+                arguments['callback_block_size'] = callback_block_size
+                if callback_hop_size:
+                    arguments['callback_hop_size'] = callback_hop_size
+
+            if write_coalesce_frames:
+                arguments['write_coalesce_frames'] = write_coalesce_frames
+                if write_coalesce_max_age is not None:
+                    arguments['write_coalesce_max_age'] = write_coalesce_max_age
+
+            if callback_deadline:
+                arguments['callback_deadline'] = callback_deadline
+                if deadline_fallback:
+                    arguments['deadline_fallback'] = deadline_fallback
+
+            if lookahead_buffers:
+                arguments['lookahead_buffers'] = lookahead_buffers
+                if lookahead_max_buffers:
+                    arguments['lookahead_max_buffers'] = lookahead_max_buffers
+
+            if broker_path:
+                arguments['broker_path'] = broker_path
+                if broker_client_frames:
+                    arguments['broker_client_frames'] = broker_client_frames
+
+            if virtual_device:
+                arguments['virtual_device'] = virtual_device
+                if isinstance(virtual_input, os.PathLike):
+                    virtual_input = os.fspath(virtual_input)
+                if virtual_input is not None:
+                    arguments['virtual_input'] = virtual_input
+                if virtual_output_path:
+                    arguments['virtual_output_path'] = os.fspath(
+                        virtual_output_path)
+                if virtual_trace:
+                    arguments['virtual_trace'] = os.fspath(virtual_trace)
+
+            if trace_path:
+                arguments['trace_path'] = os.fspath(trace_path)
+                if trace_input:
+                    arguments['trace_input'] = trace_input
+
+            if realtime_policy:
+                arguments['realtime_policy'] = realtime_policy
+                if realtime_priority:
+                    arguments['realtime_priority'] = realtime_priority
+            if cpu_affinity is not None:
+                arguments['cpu_affinity'] = cpu_affinity
+            if lock_memory:
+                arguments['lock_memory'] = lock_memory
+
+            # pa.Stream.__init__ opens the PortAudio stream
+            super().__init__(**arguments)
+
+            if start:
+                self.start_stream()
+
+        @property
+        def _stream(self):
+            # Kept for code written against the old wrapper, which held the
+            # _portaudio.Stream in this attribute.
+            return self
 
         def close(self):
-            """Closes the stream."""
-            pa.close(self._stream)
-            self._is_running = False
+            """Closes the stream.
+
+            Waits for reads and writes in progress on other threads to
+            return; later calls raise ``IOError``.
+            """
+            super().close()
             self._parent._remove_stream(self)
 
         # Stream Info
@@ -459,141 +1019,159 @@ class PyAudio:
 
             :rtype: float
             """
-            return self._stream.inputLatency
+            return self.inputLatency
 
         def get_output_latency(self):
             """Returns the output latency.
 
             :rtype: float
             """
-            return self._stream.outputLatency
+            return self.outputLatency
 
-        def get_time(self):
-            """Returns stream time.
+        def get_reblock_latency(self):
+            """Returns the latency added by `callback_block_size` reblocking.
+
+            For duplex streams, this is the delay between input and output
+            added by the reblocking stage; for input-only or output-only
+            streams, the longest time a frame waits for its block. Zero if
+            the stream does not reblock.
 
             :rtype: float
             """
-            return pa.get_stream_time(self._stream)
+            return self.reblockLatency
 
-        def get_cpu_load(self):
-            """Return the CPU load. Always 0.0 when using the blocking API.
+        def get_deadline_misses(self):
+            """Returns how many periods missed the `callback_deadline`.
 
-            :rtype: float
+            Counts buffers the device played `deadline_fallback` for, since
+            the stream opened. Zero if the stream has no `callback_deadline`.
+
+            :rtype: integer
             """
-            return pa.get_stream_cpu_load(self._stream)
+            return self.deadlineMisses
+
+        def get_thread_scheduling(self):
+            """Returns the scheduling and CPU affinity the threads got.
 
-        # Stream Lifecycle
+            A dict of ``'callback'`` and ``'worker'`` (threads running the
+            Python callback with `lookahead_buffers` or
+            `callback_deadline`), each ``None`` until the thread started,
+            or a dict as returned by :py:func:`set_thread_scheduling`.
+            ``None`` without `realtime_policy` or `cpu_affinity`.
 
-        def start_stream(self):
-            """Starts the stream."""
-            if self._is_running:
-                return
+            :rtype: dict
+            """
+            return self.threadScheduling
 
-            pa.start_stream(self._stream)
-            self._is_running = True
+        def get_locked_memory(self):
+            """Returns how many bytes of the stream's buffers are locked in
+            memory, with `lock_memory`.
 
-        def stop_stream(self):
-            """Stops the stream."""
-            if not self._is_running:
-                return
+            :rtype: integer
+            """
+            return self.lockedMemory
 
-            pa.stop_stream(self._stream)
-            self._is_running = False
+        # Scheduled playback
 
-        def is_active(self):
-            """Returns whether the stream is active.
+        def schedule(self, frames, at_time):
+            """Schedules samples for playback at a given stream time.
 
-            :rtype: bool
-            """
-            return pa.is_stream_active(self._stream)
+            The samples are spliced into the output at the exact frame that
+            plays at stream time `at_time` (see :py:func:`get_time`),
+            independent of when the Python callback runs. Scheduled samples
+            replace the callback's output for the frames they cover. If
+            `at_time` is in the past, playback starts with the next buffer.
 
-        def is_stopped(self):
-            """Returns whether the stream is stopped.
+            Only available for output streams in callback mode.
 
-            :rtype: bool
+            :param frames: The frames of data to play.
+            :param at_time: The stream time, in seconds, of the first frame.
+            :raises IOError: if the stream is not a callback output stream.
+            :raises ValueError: if `frames` is not a whole number of frames.
+            :returns: An identifier for the scheduled clip, for use with
+               :py:func:`get_scheduled_start_time`.
+            :rtype: integer
             """
-            return pa.is_stream_stopped(self._stream)
+            return pa.schedule_stream(self, frames, at_time)
 
-        # Stream blocking I/O
+        def get_scheduled_start_time(self, clip_id):
+            """Returns the actual start time of a scheduled clip.
 
-        def write(self, frames, num_frames=None, exception_on_underflow=False):
-            """Write samples to the stream for playback.
+            Start times are kept for pending clips and for the 1024 clips
+            that finished most recently.
 
-            Do not call when using non-blocking mode.
+            :param clip_id: The identifier returned by :py:func:`schedule`.
+            :raises KeyError: for an unknown or forgotten `clip_id`.
+            :returns: The stream time, in seconds, at which the clip's first
+               frame plays, or ``None`` if the clip has not started yet.
+            :rtype: float or None
+            """
+            return pa.get_scheduled_start_time(self, clip_id)
 
-            :param frames:
-               The frames of data.
-            :param num_frames:
-               The number of frames to write.
-               Defaults to None, in which this value will be
-               automatically computed.
-            :param exception_on_underflow:
-               Specifies whether an IOError exception should be thrown
-               (or silently ignored) on buffer underflow. Defaults
-               to False for improved performance, especially on
-               slower platforms.
+        # Multiple readers
 
-            :raises IOError: if the stream is not an output stream
-               or if the write operation was unsuccessful.
+        def open_reader(self):
+            """Opens an independent reader of this input stream.
 
-            :rtype: `None`
-            """
-            if not self._is_output:
-                raise IOError("Not output stream",
-                              paCanNotWriteToAnInputOnlyStream)
-
-            if num_frames is None:
-                # Determine how many frames to read:
-                width = get_sample_size(self._format)
-                num_frames = int(len(frames) / (self._channels * width))
-
-            pa.write_stream(self._stream, frames, num_frames,
-                            exception_on_underflow)
-
-        def read(self, num_frames, exception_on_overflow=True):
-            """Read samples from the stream.
-
-            Do not call when using non-blocking mode.
-
-            :param num_frames: The number of frames to read.
-            :param exception_on_overflow:
-               Specifies whether an IOError exception should be thrown
-               (or silently ignored) on input buffer overflow. Defaults
-               to True.
-            :raises IOError: if stream is not an input stream
-              or if the read operation was unsuccessful.
-            :rtype: bytes
-            """
-            if not self._is_input:
-                raise IOError("Not input stream",
-                              paCanNotReadFromAnOutputOnlyStream)
-            return pa.read_stream(self._stream, num_frames,
-                                  exception_on_overflow)
+            Requires a stream opened with `capture_ring_frames`. Each reader
+            has its own position in the stream's capture ring, so any number
+            of consumers can read the same input concurrently. A reader that
+            falls more than `capture_ring_frames` behind loses its oldest
+            frames (counted in its ``overruns`` and ``frames_dropped``
+            attributes), without affecting the stream or other readers.
 
-        def get_read_available(self):
-            """Return the number of frames that can be read without waiting.
+            The returned reader provides:
 
-            :rtype: integer
+            - ``read(num_frames, timeout=None)``: returns `num_frames` frames
+              as bytes, waiting (without the GIL) until they are captured.
+              Returns fewer frames if `timeout` seconds elapse or the stream
+              closes.
+            - ``read_into(buffer, timeout=None)``: like ``read``, but fills a
+              writable buffer with whole frames and returns the number of
+              frames read.
+            - ``get_read_available()``: the number of frames that can be read
+              without waiting.
+
+            A new reader only sees frames captured after it is opened.
+
+            :raises IOError: if the stream has no capture ring.
+            :rtype: ``_portaudio.StreamReader``
             """
-            return pa.get_stream_read_available(self._stream)
+            return pa.open_reader(self)
 
-        def get_write_available(self):
-            """Return the number of frames that can be written without waiting.
+        def open_result_reader(self):
+            """Opens an independent reader of this stream's callback results.
 
-            :rtype: integer
+            Requires a stream opened with `isolated_callback` and
+            `result_ring_frames`. The reader works like those of
+            :py:func:`open_reader`, reading result frames of
+            `result_frame_size` bytes instead of audio frames, and only sees
+            results returned after it is opened.
+
+            :raises IOError: if the stream has no result ring.
+            :rtype: ``_portaudio.StreamReader``
             """
-            return pa.get_stream_write_available(self._stream)
+            return pa.open_result_reader(self)
 
     # Initialization and Termination
 
     def __init__(self):
-        """Initialize PortAudio."""
+        """Initialize PortAudio.
+
+        PortAudio is initialized once per process: only the first instance
+        (or :py:func:`initialize_in_background`) enumerates devices, and
+        later instances share that.
+        """
         pa.initialize()
+        self._initialized = True
         self._streams = set()
 
     def terminate(self):
         """Terminates PortAudio.
 
+        Closes this instance's streams, and terminates PortAudio once no
+        other instance uses it. Calling it again has no effect.
+
         :attention: Be sure to call this method for every instance of this
           object to release PortAudio resources.
         """
@@ -601,7 +1179,9 @@ class PyAudio:
             stream.close()
 
         self._streams = set()
-        pa.terminate()
+        if self._initialized:
+            self._initialized = False
+            pa.terminate()
 
     # Utilities
 
@@ -640,6 +1220,123 @@ class PyAudio:
         self._streams.add(stream)
         return stream
 
+    def render(self, stream_callback, rate, channels, format,
+               input_data=None, input_path=None, output_path=None,
+               output=True, frames_per_buffer=1024, **kwargs):
+        """Runs a stream callback offline, as fast as it goes.
+
+        Processes a recording with the same `stream_callback` as a device
+        stream, called with the same arguments: the virtual device (see
+        `virtual_device` of :py:func:`PyAudio.Stream.__init__`) calls it
+        from a C loop, without waiting for a clock. `time_info` advances by
+        `frames_per_buffer` frames at `rate` per call, and status flags
+        are always 0.
+
+        The stream completes at the end of the input, after a last buffer
+        padded with silence, whose output is cut to the input's length;
+        without input, once the callback returns ``paComplete``.
+
+        :param stream_callback: The callback, as for :py:func:`open`.
+        :param rate: Sampling rate.
+        :param channels: Number of channels.
+        :param format: Sample format, a |PaSampleFormat| constant.
+        :param input_data: Input frames, a bytes-like object.
+        :param input_path: Path of a file of raw input frames, read as the
+            stream goes, instead of `input_data`.
+        :param output_path: Path of a file to write the output frames to,
+            instead of returning them.
+        :param output: Whether the callback produces output.
+            Defaults to True.
+        :param frames_per_buffer: Frames per callback. Defaults to 1024.
+        :param kwargs: Other :py:func:`open` arguments, e.g.
+            `callback_block_size`.
+        :returns: The output frames, unless written to `output_path` or
+            without `output`.
+        :rtype: bytes or None
+        """
+        if input_data is not None and input_path is not None:
+            raise ValueError("Specify input_data or input_path, not both")
+        virtual_input = input_data if input_data is not None else input_path
+        stream = self.open(rate=rate,
+                           channels=channels,
+                           format=format,
+                           input=virtual_input is not None,
+                           output=output,
+                           frames_per_buffer=frames_per_buffer,
+                           stream_callback=stream_callback,
+                           virtual_device='offline',
+                           virtual_input=virtual_input,
+                           virtual_output_path=output_path,
+                           **kwargs)
+        try:
+            stream.wait()
+            if output and output_path is None:
+                return stream.take_virtual_output()
+            return None
+        finally:
+            stream.close()
+
+    def replay_trace(self, path, stream_callback, output_path=None,
+                     **kwargs):
+        """Replays a callback trace through a stream callback, offline.
+
+        Opens an offline virtual stream like the traced one, which calls
+        `stream_callback` with the frame count, time info, status flags
+        and input (or silence, if not recorded) of each recorded period,
+        as fast as it goes, and times each call. Replaying a field trace
+        reproduces its glitches, and profiles the callback under the same
+        conditions.
+
+        :param path: Path of a trace recorded with `trace_path` (see
+            :py:func:`PyAudio.Stream.__init__`).
+        :param stream_callback: The callback, as for :py:func:`open`.
+        :param output_path: Path of a file to write the output frames to,
+            instead of returning them.
+        :param kwargs: Other :py:func:`open` arguments, e.g.
+            `frames_per_buffer` or `callback_block_size`.
+        :raises ValueError: if the file is not a trace.
+        :returns: One dict per callback call, with its ``'frame_count'``,
+            ``'time_info'``, ``'status_flags'`` and ``'duration'`` (in
+            seconds); and the output frames, unless written to
+            `output_path` or the traced stream had no output.
+        :rtype: tuple(list, bytes or None)
+        """
+        with open(path, 'rb') as trace:
+            header, _ = _read_trace_header(trace)
+        calls = []
+
+        def timed_callback(in_data, frame_count, time_info, status_flags):
+            start = time.perf_counter()
+            try:
+                return stream_callback(in_data, frame_count, time_info,
+                                       status_flags)
+            finally:
+                calls.append({
+                    'frame_count': frame_count,
+                    'time_info': time_info,
+                    'status_flags': status_flags,
+                    'duration': time.perf_counter() - start,
+                })
+
+        stream = self.open(rate=int(header['rate']),
+                           channels=header['channels'],
+                           format=header['format'],
+                           input=header['input'],
+                           output=header['output'],
+                           stream_callback=timed_callback,
+                           virtual_device='offline',
+                           virtual_output_path=output_path,
+                           virtual_trace=path,
+                           **kwargs)
+        try:
+            stream.wait()
+            output = None
+            if header['output'] and output_path is None:
+                output = stream.take_virtual_output()
+            return calls, output
+        finally:
+            stream.close()
+
     def close(self, stream):
         """Closes a stream. Use :py:func:`PyAudio.Stream.close` instead.
 
@@ -800,6 +1497,71 @@ class PyAudio:
 
         return pa.is_format_supported(rate, **kwargs)
 
+    def probe_formats(self, device_index, rates, channels, formats,
+                      direction='output', cache_path=None):
+        """Returns the combinations of rates, channels and formats a device
+        supports.
+
+        Probes every combination in one call, with the GIL released, rather
+        than raising an exception for each unsupported one like
+        :py:func:`is_format_supported`.
+
+        :param device_index: The device index.
+        :param rates: Sample rates to probe (in Hz).
+        :param channels: Channel counts to probe.
+        :param formats: |PaSampleFormat| constants to probe.
+        :param direction: ``'input'`` or ``'output'`` (default).
+        :param cache_path: A JSON file to keep results in, keyed by host API
+           and device name, so later calls (e.g., after a restart) skip
+           probing combinations already probed. Defaults to ``None`` (no
+           cache).
+        :raises IOError: for an invalid `device_index`.
+        :raises ValueError: for an invalid `direction`.
+        :returns: ``(rate, channels, format)`` tuples, in the order of the
+           arguments.
+        :rtype: list
+        """
+        if direction not in ('input', 'output'):
+            raise ValueError(f"Invalid direction: {direction}")
+        combinations = [(rate, num_channels, fmt)
+                        for rate in rates
+                        for num_channels in channels
+                        for fmt in formats]
+
+        cache = entry = None
+        if cache_path is not None:
+            device_info = self.get_device_info_by_index(device_index)
+            host_api_info = self.get_host_api_info_by_index(
+                device_info['hostApi'])
+            try:
+                with open(cache_path, encoding='utf-8') as cache_file:
+                    cache = json.load(cache_file)
+            except (OSError, ValueError):
+                cache = {}
+            key = f"{host_api_info['name']}/{device_info['name']}"
+            entry = cache.setdefault(key, {}).setdefault(direction, {})
+            if all('%s/%s/%s' % combination in entry
+                   for combination in combinations):
+                return [combination for combination in combinations
+                        if entry['%s/%s/%s' % combination]]
+
+        table = pa.probe_formats(device_index, rates, channels, formats,
+                                 direction == 'input')
+        supported = [combination
+                     for combination, ok in zip(combinations, table) if ok]
+
+        if entry is not None:
+            for combination, ok in zip(combinations, table):
+                entry['%s/%s/%s' % combination] = bool(ok)
+            # Replace the file atomically, so that concurrent readers never
+            # see it half-written.
+            temp_path = f'{cache_path}.{os.getpid()}.tmp'
+            with open(temp_path, 'w', encoding='utf-8') as cache_file:
+                json.dump(cache, cache_file, indent=1, sort_keys=True)
+            os.replace(temp_path, cache_path)
+
+        return supported
+
     def get_default_input_device_info(self):
         """Returns the default input device parameters as a dictionary.
 
@@ -837,6 +1599,22 @@ class PyAudio:
             device_index,
             pa.get_device_info(device_index))
 
+    def get_device_snapshot(self):
+        """Returns all devices and host APIs, read in one call.
+
+        Returns a tuple ``(devices, host_apis)`` of immutable records,
+        ``_portaudio.DeviceRecord`` and ``_portaudio.HostApiRecord``,
+        indexed by device and host API index. Their fields have the names
+        of the dictionary keys of :py:func:`get_device_info_by_index` and
+        :py:func:`get_host_api_info_by_index`, with device names decoded
+        the same way. The snapshot is cached until PortAudio is initialized
+        again, so repeated calls are cheap.
+
+        :raises IOError: if PortAudio is not initialized.
+        :rtype: tuple
+        """
+        return pa.get_all_devices()
+
     def _make_device_info_dictionary(self, index, device_info):
         """Creates a dictionary like PortAudio's ``PaDeviceInfo`` structure.
 
@@ -872,6 +1650,224 @@ class PyAudio:
                 device_info.defaultSampleRate}
 
 
+# Shared Capture
+
+if hasattr(pa, 'SharedCaptureReader'):
+    class SharedCaptureReader(pa.SharedCaptureReader):
+        """Reads the input of a stream in another process via shared memory.
+
+        A stream opened with ``shared_capture_name`` (see
+        :py:func:`PyAudio.Stream.__init__`) publishes its captured frames
+        into a named shared-memory segment. Instantiate this class with the
+        same name, in any process, to read those frames directly, without
+        pickling or pipes. Any number of readers may attach; each has its own
+        position, and a reader that falls behind by more than the segment's
+        capacity loses its oldest frames (counted in :py:attr:`overruns` and
+        :py:attr:`frames_dropped`) without affecting the stream or other
+        readers.
+
+        A new reader only sees frames captured after it attaches.
+
+        - ``read(num_frames, timeout=None)``: returns `num_frames` frames as
+          bytes, waiting (without the GIL) until they are captured. Returns
+          fewer frames if `timeout` seconds elapse or the stream closes.
+        - ``read_into(buffer, timeout=None)``: like ``read``, but fills a
+          writable buffer with whole frames and returns the number of frames
+          read.
+        - ``get_read_available()``: the number of frames that can be read
+          without waiting.
+        - ``get_frame_time(position)``: the stream time, in seconds, at which
+          frame number `position` was captured, or ``None`` if that frame is
+          no longer in the segment.
+        - ``close()``: detaches from the segment.
+
+        The segment layout is documented in ``src/pyaudio/shared_capture.h``,
+        for consumers written in other languages.
+
+        :note: Unavailable on Windows.
+
+        .. attribute:: format
+
+           The sample format of the frames. See |PaSampleFormat|.
+
+        .. attribute:: channels
+
+           The number of channels.
+
+        .. attribute:: rate
+
+           The actual sample rate of the stream, in Hz.
+
+        .. attribute:: capacity
+
+           The number of frames the segment retains.
+
+        .. attribute:: position
+
+           The number of the next frame to read.
+
+        .. attribute:: closed
+
+           Whether the capturing stream has closed.
+
+        .. attribute:: overruns
+
+           The number of times this reader fell behind.
+
+        .. attribute:: frames_dropped
+
+           The number of frames this reader lost to overruns.
+        """
+
+        def __init__(self, name):
+            """Attach to the shared capture segment `name`.
+
+            :param name: The ``shared_capture_name`` of the stream.
+            :raises FileNotFoundError: if no such segment exists.
+            :raises ValueError: if the segment is not a shared capture
+               segment.
+            """
+            super().__init__(name)
+
+        def __enter__(self):
+            return self
+
+        def __exit__(self, *exc_info):
+            self.close()
+
+
+# Output Broker
+
+if hasattr(pa, 'BrokerClient'):
+    class BrokerClient(pa.BrokerClient):
+        """Plays audio through an output broker in another process.
+
+        A stream opened with ``broker_path`` (see
+        :py:func:`PyAudio.Stream.__init__`) owns the output device and mixes
+        the audio of all connected clients. Instantiate this class with the
+        same path, in any process, to get a writer with the same interface as
+        a blocking output :py:class:`PyAudio.Stream`. The client writes into a
+        private shared-memory ring that the broker's audio callback drains,
+        so no audio passes through the socket.
+
+        The output format (:py:attr:`format`, :py:attr:`channels`,
+        :py:attr:`rate`) is set by the broker; clients must write frames in
+        that format.
+
+        :note: Linux only.
+
+        .. attribute:: format
+
+           The sample format of the broker's stream. See |PaSampleFormat|.
+
+        .. attribute:: channels
+
+           The number of channels.
+
+        .. attribute:: rate
+
+           The actual sample rate of the broker's stream, in Hz.
+
+        .. attribute:: latency
+
+           The worst-case time, in seconds, from a write until its frames
+           reach the device output: the client ring's capacity plus the
+           device's output latency.
+
+        .. attribute:: underflows
+
+           The number of times the broker ran out of this client's frames
+           while playing.
+
+        .. attribute:: closed
+
+           Whether this client is disconnected.
+        """
+
+        def __init__(self, path):
+            """Connect to the output broker at `path`.
+
+            :param path: The ``broker_path`` of the broker's stream.
+            :raises FileNotFoundError: if no broker listens at `path`.
+            :raises IOError: if the broker refused the client (e.g., too many
+               clients).
+            """
+            super().__init__(path)
+
+        def write(self, frames, num_frames=None,
+                  exception_on_underflow=False):
+            """Write samples to the broker.
+
+            Blocks (without the GIL) until the broker has room for all
+            frames.
+
+            :param frames: The frames of data.
+            :param num_frames: The number of frames to write.
+                Defaults to None, in which this value will be
+                automatically computed.
+            :param exception_on_underflow:
+                Specifies whether an IOError exception should be thrown
+                (or silently ignored) on buffer underflow. Defaults
+                to False for improved performance, especially on
+                slower platforms.
+            :raises IOError: if the client or broker is closed, or if
+                `exception_on_underflow` is set and the broker ran out of
+                frames since the previous write.
+            """
+            if num_frames is not None:
+                width = get_sample_size(self.format)
+                frames = memoryview(frames).cast('B')[
+                    :num_frames * self.channels * width]
+            super().write(frames, exception_on_underflow)
+
+        def flush(self, timeout=None):
+            """Wait until the broker has consumed all written frames.
+
+            :param timeout: The maximum time to wait, in seconds. Defaults to
+                ``None`` (wait indefinitely).
+            :returns: Whether all frames were consumed.
+            :rtype: bool
+            """
+            if timeout is None:
+                return super().flush()
+            return super().flush(timeout)
+
+        def get_output_latency(self):
+            """Return the worst-case output latency, in seconds.
+
+            :rtype: float
+            """
+            return self.latency
+
+        def is_active(self):
+            """Return whether the client is connected to a running broker.
+
+            :rtype: bool
+            """
+            if self.closed:
+                return False
+            try:
+                self.get_write_available()
+            except IOError:
+                return False
+            return True
+
+        def close(self):
+            """Wait briefly for written frames to play, then disconnect."""
+            if not self.closed:
+                try:
+                    self.flush(self.latency + 1.0)
+                except IOError:
+                    pass
+            super().close()
+
+        def __enter__(self):
+            return self
+
+        def __exit__(self, *exc_info):
+            self.close()
+
+
 # Host Specific Stream Info
 
 if hasattr(pa, 'paMacCoreStreamInfo'):
@@ -988,6 +1984,84 @@ if hasattr(pa, 'paMacCoreStreamInfo'):
             return self
 
 
+if hasattr(pa, 'paAlsaStreamInfo'):
+    class PaAlsaStreamInfo(pa.paAlsaStreamInfo):
+        """PortAudio Host API Specific Stream Info for ALSA-specific settings.
+
+        To configure ALSA-specific settings, instantiate this class and pass
+        it as the argument in :py:func:`PyAudio.open` to parameters
+        ``input_host_api_specific_stream_info`` or
+        ``output_host_api_specific_stream_info``.  (See
+        :py:func:`PyAudio.Stream.__init__`.)
+
+        The period size is the stream's ``frames_per_buffer``, and the
+        number of periods is set with :py:func:`alsa_set_num_periods`: for
+        minimal latency, open a device string with small values of both.
+
+        :note: Linux-only, with PortAudio's ALSA host API.
+
+        .. attribute:: device_string
+
+           The ALSA device string specified to the constructor.
+
+           :type: str or None if unspecified
+
+        .. attribute:: realtime_scheduling
+
+           Whether the stream's callback thread gets real-time scheduling.
+
+           :type: bool
+        """
+
+        def __init__(self, device_string=None, realtime_scheduling=False):
+            """Initialize with an ALSA device string and scheduling.
+
+            See PortAudio documentation for more details on these parameters.
+
+            :param device_string: ALSA device to open, e.g., ``'hw:1,0'``
+                for direct hardware access, ``'plughw:Loopback'`` or
+                ``'null'``, instead of the ``input_device_index`` or
+                ``output_device_index``. The stream then asks for the lowest
+                latency the device supports. Defaults to ``None`` (the
+                device index is used).
+            :param realtime_scheduling: Give the callback thread of a
+                callback stream ``SCHED_FIFO`` scheduling (see PortAudio's
+                ``PaAlsa_EnableRealtimeScheduling``). The device must belong
+                to ALSA. Defaults to False.
+            """
+            kwargs = {}
+            if device_string is not None:
+                kwargs["device_string"] = device_string
+            if realtime_scheduling:
+                kwargs["realtime_scheduling"] = realtime_scheduling
+            super().__init__(**kwargs)
+
+    def alsa_set_num_periods(num_periods):
+        """Sets the number of periods of the ALSA buffer of streams opened
+        afterwards.
+
+        PortAudio's default is 4. Fewer periods lower the latency, and the
+        margin before an xrun.
+
+        :note: Linux-only, with PortAudio's ALSA host API.
+
+        :param num_periods: Number of periods, at least 2.
+        :raise ValueError: Fewer than 2 periods.
+        """
+        pa.alsa_set_num_periods(num_periods)
+
+    def alsa_set_retries_busy(retries):
+        """Sets how many times opening an ALSA device retries while the device
+        is busy, for streams opened afterwards.
+
+        :note: Linux-only, with PortAudio's ALSA host API.
+
+        :param retries: Number of retries, 0 to fail at once.
+        :raise ValueError: Negative number of retries.
+        """
+        pa.alsa_set_retries_busy(retries)
+
+
 # The top-level Stream class is reserved for future API changes. Users should
 # never instantiate Stream directly. Instead, users must use PyAudio.open()
 # instead, as documented.
@@ -1007,3 +2081,7 @@ class Stream(PyAudio.Stream):
             DeprecationWarning,
             stacklevel=2)
         super().__init__(*args, **kwargs)
+
+
+if os.environ.get('PYAUDIO_INIT_IN_BACKGROUND'):
+    initialize_in_background()
@@ -0,0 +1,150 @@
+#include "alsa_stream_info.h"
+
+#ifdef PYAUDIO_HAVE_ALSA
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+#include "pa_linux_alsa.h"
+
+static void cleanup(PyAudioAlsaStreamInfo *self) {
+  if (self->device_string != NULL) {
+    free(self->device_string);
+    self->device_string = NULL;
+  }
+  self->stream_info.deviceString = NULL;
+  self->realtime_scheduling = 0;
+}
+
+static void dealloc(PyAudioAlsaStreamInfo *self) {
+  cleanup(self);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+static int init(PyObject *_self, PyObject *args, PyObject *kwargs) {
+  PyAudioAlsaStreamInfo *self = (PyAudioAlsaStreamInfo *)_self;
+  // Init struct with default values (and release any from a previous init).
+  cleanup(self);
+  PaAlsa_InitializeStreamInfo(&self->stream_info);
+
+  const char *device_string = NULL;
+  int realtime_scheduling = 0;
+  static char *kwlist[] = {"device_string", "realtime_scheduling", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zp", kwlist,
+                                   &device_string, &realtime_scheduling)) {
+    return -1;
+  }
+
+  if (device_string != NULL) {
+    if (device_string[0] == '\0') {
+      PyErr_SetString(PyExc_ValueError, "Device string must not be empty");
+      return -1;
+    }
+    self->device_string = strdup(device_string);
+    if (self->device_string == NULL) {
+      PyErr_SetString(PyExc_SystemError, "Out of memory");
+      return -1;
+    }
+    self->stream_info.deviceString = self->device_string;
+  }
+  self->realtime_scheduling = realtime_scheduling;
+
+  return 0;
+}
+
+static PyObject *get_device_string(PyAudioAlsaStreamInfo *self,
+                                   void *closure) {
+  if (self->device_string == NULL) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return PyUnicode_FromString(self->device_string);
+}
+
+static PyObject *get_realtime_scheduling(PyAudioAlsaStreamInfo *self,
+                                         void *closure) {
+  return PyBool_FromLong(self->realtime_scheduling);
+}
+
+static int antiset(PyAudioAlsaStreamInfo *self, PyObject *value,
+                   void *closure) {
+  /* read-only: do not allow users to change values */
+  PyErr_SetString(PyExc_AttributeError,
+                  "Fields read-only: cannot modify values");
+  return -1;
+}
+
+static PyGetSetDef get_setters[] = {
+    {"device_string", (getter)get_device_string, (setter)antiset,
+     "ALSA device string", NULL},
+    {"realtime_scheduling", (getter)get_realtime_scheduling, (setter)antiset,
+     "real-time scheduling of the callback thread", NULL},
+    {NULL}};
+
+static PyType_Slot slots[] = {
+    {Py_tp_dealloc, dealloc},
+    {Py_tp_doc, (void *)PyDoc_STR("ALSA Specific HostAPI configuration")},
+    {Py_tp_getset, get_setters},
+    {Py_tp_init, init},
+    {Py_tp_new, PyType_GenericNew},
+    {0, NULL}};
+
+PyType_Spec PyAudioAlsaStreamInfoSpec = {
+    .name = "_portaudio.PaAlsaStreamInfo",
+    .basicsize = sizeof(PyAudioAlsaStreamInfo),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = slots,
+};
+
+int PyAudioAlsa_IsAlsaDevice(PaDeviceIndex device) {
+  // A device string is always routed to the host API of the stream info.
+  if (device == paUseHostApiSpecificDeviceSpecification) {
+    return 1;
+  }
+  const PaDeviceInfo *info = Pa_GetDeviceInfo(device);
+  PaHostApiIndex alsa = Pa_HostApiTypeIdToHostApiIndex(paALSA);
+  return info != NULL && alsa >= 0 && info->hostApi == alsa;
+}
+
+// PortAudio keeps these settings in globals, read when opening a stream.
+static PyObject *set_alsa_setting(PyObject *args, const char *name,
+                                  int min_value,
+                                  PaError (*setter)(int value)) {
+  int value;
+  if (!PyArg_ParseTuple(args, "i", &value)) {
+    return NULL;
+  }
+  if (value < min_value) {
+    PyErr_Format(PyExc_ValueError, "%s must be at least %d", name, min_value);
+    return NULL;
+  }
+
+  PaError err = setter(value);
+  if (err != paNoError) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", err, Pa_GetErrorText(err)));
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyObject *PyAudio_AlsaSetNumPeriods(PyObject *self, PyObject *args) {
+  // ALSA double-buffers at least.
+  return set_alsa_setting(args, "Number of periods", 2, PaAlsa_SetNumPeriods);
+}
+
+PyObject *PyAudio_AlsaSetRetriesBusy(PyObject *self, PyObject *args) {
+  return set_alsa_setting(args, "Number of retries", 0, PaAlsa_SetRetriesBusy);
+}
+
+#endif  // PYAUDIO_HAVE_ALSA
@@ -0,0 +1,51 @@
+// Python wrapper for PaAlsaStreamInfo (ALSA host-specific API), and PortAudio's
+// other ALSA-specific settings.
+//
+// Built on Linux when PortAudio's pa_linux_alsa.h is available. Define
+// PYAUDIO_NO_ALSA to leave it out, e.g., for a PortAudio built without ALSA.
+
+#ifndef ALSA_STREAM_INFO_H_
+#define ALSA_STREAM_INFO_H_
+
+#if defined(__linux__) && !defined(PYAUDIO_NO_ALSA) && defined(__has_include)
+#if __has_include("pa_linux_alsa.h")
+#define PYAUDIO_HAVE_ALSA
+#endif
+#endif
+
+#ifdef PYAUDIO_HAVE_ALSA
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+#include "pa_linux_alsa.h"
+
+typedef struct {
+  // clang-format off
+  PyObject_HEAD
+  // clang-format on
+  PaAlsaStreamInfo stream_info;
+  // The ALSA device (e.g., "hw:1,0") opened instead of a device index, owned
+  // by the object, or NULL. PortAudio only takes the stream info along with a
+  // device string.
+  char *device_string;
+  // Whether the stream's callback thread should get SCHED_FIFO.
+  int realtime_scheduling;
+} PyAudioAlsaStreamInfo;
+
+extern PyType_Spec PyAudioAlsaStreamInfoSpec;
+
+// Returns whether device (an index, or paUseHostApiSpecificDeviceSpecification
+// with a device string) belongs to PortAudio's ALSA host API.
+int PyAudioAlsa_IsAlsaDevice(PaDeviceIndex device);
+
+// Module functions: set the number of periods of the ALSA buffer, and the
+// number of times to retry opening a busy device, for streams opened
+// afterwards.
+PyObject *PyAudio_AlsaSetNumPeriods(PyObject *self, PyObject *args);
+PyObject *PyAudio_AlsaSetRetriesBusy(PyObject *self, PyObject *args);
+
+#endif  // PYAUDIO_HAVE_ALSA
+#endif  // ALSA_STREAM_INFO_H_
@@ -8,6 +8,8 @@
 #include "Python.h"
 #include "portaudio.h"
 
+#include "module_state.h"
+
 // Wrapper object for the PaDeviceInfo struct.
 
 typedef struct {
@@ -112,7 +114,9 @@ static int antiset(PyAudioDeviceInfo *self, PyObject *value, void *closure) {
 
 static void dealloc(PyAudioDeviceInfo *self) {
   self->device_info = NULL;
-  Py_TYPE(self)->tp_free((PyObject *)self);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
 }
 
 static PyGetSetDef get_setters[] = {
@@ -146,23 +150,24 @@ static PyGetSetDef get_setters[] = {
 
     {NULL}};
 
-PyTypeObject PyAudioDeviceInfoType = {
-    // clang-format off
-    PyVarObject_HEAD_INIT(NULL, 0)
-    // clang-format on
-    .tp_name = "_portaudio.paDeviceInfo",
-    .tp_basicsize = sizeof(PyAudioDeviceInfo),
-    .tp_itemsize = 0,
-    .tp_dealloc = (destructor)dealloc,
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_doc = PyDoc_STR("PortAudio PaDeviceInfo"),
-    .tp_getset = get_setters,
-    .tp_new = PyType_GenericNew,
+static PyType_Slot slots[] = {
+    {Py_tp_dealloc, dealloc},
+    {Py_tp_doc, (void *)PyDoc_STR("PortAudio PaDeviceInfo")},
+    {Py_tp_getset, get_setters},
+    {Py_tp_new, PyType_GenericNew},
+    {0, NULL}};
+
+PyType_Spec PyAudioDeviceInfoSpec = {
+    .name = "_portaudio.paDeviceInfo",
+    .basicsize = sizeof(PyAudioDeviceInfo),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = slots,
 };
 
 // Public Device API functions
 
-// Creates and returns a PyAudioDeviceInfo (PyAudioDeviceInfoType).
+// Creates and returns a PyAudioDeviceInfo (paDeviceInfo).
 PyObject *PyAudio_GetDeviceInfo(PyObject *self, PyObject *args) {
   PaDeviceIndex index;
   if (!PyArg_ParseTuple(args, "i", &index)) {
@@ -177,7 +182,10 @@ PyObject *PyAudio_GetDeviceInfo(PyObject *self, PyObject *args) {
   }
 
   PyAudioDeviceInfo *py_device_info = (PyAudioDeviceInfo *)PyObject_New(
-      PyAudioDeviceInfo, &PyAudioDeviceInfoType);
+      PyAudioDeviceInfo, PyAudio_GetModuleState(self)->device_info_type);
+  if (!py_device_info) {
+    return NULL;
+  }
   py_device_info->device_info = pa_device_info;
   return (PyObject *)py_device_info;
 }
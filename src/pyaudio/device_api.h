@@ -7,9 +7,9 @@
 #include "Python.h"
 
 // Python object wrapper for PortAudio's PaDeviceInfo struct.
-extern PyTypeObject PyAudioDeviceInfoType;
+extern PyType_Spec PyAudioDeviceInfoSpec;
 
-// Returns a PyAudioDeviceInfoType object
+// Returns a paDeviceInfo object
 PyObject *PyAudio_GetDeviceInfo(PyObject *self, PyObject *args);
 PyObject *PyAudio_GetDeviceCount(PyObject *self, PyObject *args);
 PyObject *PyAudio_GetDefaultInputDevice(PyObject *self, PyObject *args);
@@ -0,0 +1,228 @@
+#include "device_snapshot.h"
+
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "init.h"
+#include "module_state.h"
+#include "sync.h"
+
+static PyStructSequence_Field device_record_fields[] = {
+    {"index", "device index"},
+    {"structVersion", "struct version"},
+    {"name", "device name (bytes if it cannot be decoded)"},
+    {"hostApi", "host api index"},
+    {"maxInputChannels", "max input channels"},
+    {"maxOutputChannels", "max output channels"},
+    {"defaultLowInputLatency", "default low input latency"},
+    {"defaultLowOutputLatency", "default low output latency"},
+    {"defaultHighInputLatency", "default high input latency"},
+    {"defaultHighOutputLatency", "default high output latency"},
+    {"defaultSampleRate", "default sample rate"},
+    {NULL}};
+
+PyStructSequence_Desc PyAudioDeviceRecordDesc = {
+    .name = "_portaudio.DeviceRecord",
+    .doc = "PortAudio PaDeviceInfo, as of the device snapshot",
+    .fields = device_record_fields,
+    .n_in_sequence = 11,
+};
+
+static PyStructSequence_Field host_api_record_fields[] = {
+    {"index", "host api index"},
+    {"structVersion", "struct version"},
+    {"type", "host api type id"},
+    {"name", "host api name"},
+    {"deviceCount", "number of devices"},
+    {"defaultInputDevice", "default input device index"},
+    {"defaultOutputDevice", "default output device index"},
+    {NULL}};
+
+PyStructSequence_Desc PyAudioHostApiRecordDesc = {
+    .name = "_portaudio.HostApiRecord",
+    .doc = "PortAudio PaHostApiInfo, as of the device snapshot",
+    .fields = host_api_record_fields,
+    .n_in_sequence = 7,
+};
+
+// Decodes a device name like PyAudio._make_device_info_dictionary(): with the
+// locale encoding, then UTF-8, or else returns the raw bytes.
+static PyObject *decode_name(const char *name) {
+  if (name == NULL) {
+    name = "";
+  }
+  PyObject *decoded = PyUnicode_DecodeLocale(name, "strict");
+  if (decoded == NULL && PyErr_ExceptionMatches(PyExc_UnicodeDecodeError)) {
+    PyErr_Clear();
+    decoded = PyUnicode_DecodeUTF8(name, (Py_ssize_t)strlen(name), "strict");
+  }
+  if (decoded == NULL && PyErr_ExceptionMatches(PyExc_UnicodeDecodeError)) {
+    PyErr_Clear();
+    decoded = PyBytes_FromString(name);
+  }
+  return decoded;
+}
+
+// Fills the fields of record from values, stealing the references. Returns
+// 0, or -1 with an exception set if any value is NULL.
+static int set_fields(PyObject *record, PyObject **values, int num_values) {
+  int rv = 0;
+  for (int i = 0; i < num_values; i++) {
+    if (values[i] == NULL) {
+      rv = -1;
+      continue;
+    }
+    PyStructSequence_SetItem(record, i, values[i]);
+  }
+  return rv;
+}
+
+static PyObject *make_device_record(PyTypeObject *type, PaDeviceIndex index,
+                                    const PaDeviceInfo *info) {
+  PyObject *record = PyStructSequence_New(type);
+  if (record == NULL) {
+    return NULL;
+  }
+  PyObject *values[] = {
+      PyLong_FromLong(index),
+      PyLong_FromLong(info->structVersion),
+      decode_name(info->name),
+      PyLong_FromLong(info->hostApi),
+      PyLong_FromLong(info->maxInputChannels),
+      PyLong_FromLong(info->maxOutputChannels),
+      PyFloat_FromDouble(info->defaultLowInputLatency),
+      PyFloat_FromDouble(info->defaultLowOutputLatency),
+      PyFloat_FromDouble(info->defaultHighInputLatency),
+      PyFloat_FromDouble(info->defaultHighOutputLatency),
+      PyFloat_FromDouble(info->defaultSampleRate),
+  };
+  if (set_fields(record, values, 11) < 0) {
+    Py_DECREF(record);
+    return NULL;
+  }
+  return record;
+}
+
+static PyObject *make_host_api_record(PyTypeObject *type, PaHostApiIndex index,
+                                      const PaHostApiInfo *info) {
+  PyObject *record = PyStructSequence_New(type);
+  if (record == NULL) {
+    return NULL;
+  }
+  PyObject *values[] = {
+      PyLong_FromLong(index),
+      PyLong_FromLong(info->structVersion),
+      PyLong_FromLong((long)info->type),
+      PyUnicode_FromString(info->name ? info->name : ""),
+      PyLong_FromLong(info->deviceCount),
+      PyLong_FromLong(info->defaultInputDevice),
+      PyLong_FromLong(info->defaultOutputDevice),
+  };
+  if (set_fields(record, values, 7) < 0) {
+    Py_DECREF(record);
+    return NULL;
+  }
+  return record;
+}
+
+// Builds a new snapshot. Returns NULL with an exception set on failure.
+static PyObject *make_snapshot(PyAudioModuleState *state) {
+  PaDeviceIndex device_count = Pa_GetDeviceCount();
+  if (device_count < 0) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", device_count,
+                                  Pa_GetErrorText(device_count)));
+    return NULL;
+  }
+  PaHostApiIndex host_api_count = Pa_GetHostApiCount();
+  if (host_api_count < 0) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", host_api_count,
+                                  Pa_GetErrorText(host_api_count)));
+    return NULL;
+  }
+
+  PyObject *devices = PyTuple_New(device_count);
+  PyObject *host_apis = PyTuple_New(host_api_count);
+  if (devices == NULL || host_apis == NULL) {
+    goto error;
+  }
+
+  for (PaDeviceIndex i = 0; i < device_count; i++) {
+    const PaDeviceInfo *info = Pa_GetDeviceInfo(i);
+    if (info == NULL) {
+      PyErr_SetObject(PyExc_IOError, Py_BuildValue("(i,s)", paInvalidDevice,
+                                                   "Invalid device info"));
+      goto error;
+    }
+    PyObject *record = make_device_record(state->device_record_type, i, info);
+    if (record == NULL) {
+      goto error;
+    }
+    PyTuple_SET_ITEM(devices, i, record);
+  }
+
+  for (PaHostApiIndex i = 0; i < host_api_count; i++) {
+    const PaHostApiInfo *info = Pa_GetHostApiInfo(i);
+    if (info == NULL) {
+      PyErr_SetObject(PyExc_IOError, Py_BuildValue("(i,s)", paInvalidHostApi,
+                                                   "Invalid host api info"));
+      goto error;
+    }
+    PyObject *record =
+        make_host_api_record(state->host_api_record_type, i, info);
+    if (record == NULL) {
+      goto error;
+    }
+    PyTuple_SET_ITEM(host_apis, i, record);
+  }
+
+  PyObject *snapshot = PyTuple_Pack(2, devices, host_apis);
+  Py_DECREF(devices);
+  Py_DECREF(host_apis);
+  return snapshot;
+
+error:
+  Py_XDECREF(devices);
+  Py_XDECREF(host_apis);
+  return NULL;
+}
+
+PyObject *PyAudio_GetAllDevices(PyObject *self, PyObject *args) {
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  PyAudioModuleState *state = PyAudio_GetModuleState(self);
+  long generation = PyAudio_GetInitGeneration();
+
+  PyAudioMutex_Lock(&state->device_snapshot_lock);
+  PyObject *snapshot = state->device_snapshot;
+  if (snapshot != NULL && state->device_snapshot_generation == generation) {
+    Py_INCREF(snapshot);
+    PyAudioMutex_Unlock(&state->device_snapshot_lock);
+    return snapshot;
+  }
+  PyAudioMutex_Unlock(&state->device_snapshot_lock);
+
+  // Build the snapshot without the lock, which only guards the cache: a
+  // concurrent caller may build one too, and the last one wins.
+  snapshot = make_snapshot(state);
+  if (snapshot == NULL) {
+    return NULL;
+  }
+
+  Py_INCREF(snapshot);
+  PyAudioMutex_Lock(&state->device_snapshot_lock);
+  PyObject *old_snapshot = state->device_snapshot;
+  state->device_snapshot = snapshot;
+  state->device_snapshot_generation = generation;
+  PyAudioMutex_Unlock(&state->device_snapshot_lock);
+  Py_XDECREF(old_snapshot);
+  return snapshot;
+}
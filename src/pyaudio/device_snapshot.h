@@ -0,0 +1,28 @@
+// Snapshot of all devices and host APIs, built in one call.
+//
+// Enumerating devices through get_device_info() creates a wrapper per device
+// and reads each field through a property getter. A snapshot instead copies
+// every PaDeviceInfo and PaHostApiInfo into immutable struct sequence records
+// at once, with device names already decoded, and is cached until PortAudio
+// is initialized (or terminated) again, since only then can the device list
+// change.
+
+#ifndef PYAUDIO_DEVICE_SNAPSHOT_H_
+#define PYAUDIO_DEVICE_SNAPSHOT_H_
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+
+// Struct sequences of the records, with the fields of PaDeviceInfo and
+// PaHostApiInfo, plus their index.
+extern PyStructSequence_Desc PyAudioDeviceRecordDesc;
+extern PyStructSequence_Desc PyAudioHostApiRecordDesc;
+
+// Exported functions.
+
+// Returns (devices, host_apis), tuples of DeviceRecord and HostApiRecord.
+PyObject *PyAudio_GetAllDevices(PyObject *self, PyObject *args);
+
+#endif  // PYAUDIO_DEVICE_SNAPSHOT_H_
@@ -9,9 +9,9 @@
 #include "Python.h"
 
 // Python object wrapper for PortAudio's PaHostApi struct.
-extern PyTypeObject PyAudioHostApiInfoType;
+extern PyType_Spec PyAudioHostApiInfoSpec;
 
-// Returns a PyAudioHostApiInfoType object
+// Returns a paHostApiInfo object
 PyObject *PyAudio_GetHostApiInfo(PyObject *self, PyObject *args);
 PyObject *PyAudio_GetHostApiCount(PyObject *self, PyObject *args);
 PyObject *PyAudio_GetDefaultHostApi(PyObject *self, PyObject *args);
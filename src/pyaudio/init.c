@@ -8,22 +8,45 @@
 #include "Python.h"
 #include "portaudio.h"
 
+#include "sync.h"
+
+// PortAudio is initialized once per process, whichever interpreter does it,
+// and stays initialized while anybody holds a reference. Pa_Initialize() and
+// Pa_Terminate() run under init_lock, so a caller arriving while another
+// initializes waits for it, rather than initializing again.
+static PyAudioStaticMutex init_lock = PYAUDIO_STATIC_MUTEX_INIT;
+// Guarded by init_lock.
+static long init_refcount = 0;
+static volatile long init_generation = 0;
+
+long PyAudio_GetInitGeneration(void) {
+  return PyAudioAtomic_LoadLong(&init_generation);
+}
+
 PyObject *PyAudio_Initialize(PyObject *self, PyObject *args) {
-  int err;
+  int err = paNoError;
 
+  // Device enumeration may take a while, so wait for (and hold) the lock
+  // without the GIL.
   // clang-format off
   Py_BEGIN_ALLOW_THREADS
-  err = Pa_Initialize();
+  PyAudioStaticMutex_Lock(&init_lock);
+  if (init_refcount == 0) {
+    err = Pa_Initialize();
+    if (err != paNoError) {
+      Pa_Terminate();
+    } else {
+      PyAudioAtomic_AddLong(&init_generation, 1);
+    }
+  }
+  if (err == paNoError) {
+    init_refcount++;
+  }
+  PyAudioStaticMutex_Unlock(&init_lock);
   Py_END_ALLOW_THREADS
   // clang-format on
 
   if (err != paNoError) {
-    // clang-format off
-    Py_BEGIN_ALLOW_THREADS
-    Pa_Terminate();
-    Py_END_ALLOW_THREADS
-    // clang-format on
-
 #ifdef VERBOSE
     fprintf(stderr, "An error occured while using the portaudio stream\n");
     fprintf(stderr, "Error number: %d\n", err);
@@ -42,10 +65,32 @@ PyObject *PyAudio_Initialize(PyObject *self, PyObject *args) {
 PyObject *PyAudio_Terminate(PyObject *self, PyObject *args) {
   // clang-format off
   Py_BEGIN_ALLOW_THREADS
-  Pa_Terminate();
+  PyAudioStaticMutex_Lock(&init_lock);
+  // Extra calls are ignored, like Pa_Terminate() ignores them.
+  if (init_refcount > 0 && --init_refcount == 0) {
+    Pa_Terminate();
+    PyAudioAtomic_AddLong(&init_generation, 1);
+  }
+  PyAudioStaticMutex_Unlock(&init_lock);
   Py_END_ALLOW_THREADS
   // clang-format on
 
   Py_INCREF(Py_None);
   return Py_None;
 }
+
+PyObject *PyAudio_GetInitCount(PyObject *self, PyObject *args) {
+  if (!PyArg_ParseTuple(args, "")) {
+    return NULL;
+  }
+
+  long refcount;
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  PyAudioStaticMutex_Lock(&init_lock);
+  refcount = init_refcount;
+  PyAudioStaticMutex_Unlock(&init_lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  return PyLong_FromLong(refcount);
+}
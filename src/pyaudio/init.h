@@ -6,7 +6,17 @@
 #endif
 #include "Python.h"
 
+// Returns a counter bumped each time PortAudio is actually initialized or
+// terminated, after which device and host API indices may refer to different
+// devices.
+long PyAudio_GetInitGeneration(void);
+
+// Take and release a process-wide reference to PortAudio: the first
+// initialize() initializes PortAudio, and the matching last terminate()
+// terminates it.
 PyObject *PyAudio_Initialize(PyObject *self, PyObject *args);
 PyObject *PyAudio_Terminate(PyObject *self, PyObject *args);
+// Returns the number of references held.
+PyObject *PyAudio_GetInitCount(PyObject *self, PyObject *args);
 
 #endif  // INIT_H
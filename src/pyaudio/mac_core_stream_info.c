@@ -20,7 +20,9 @@ static void cleanup(PyAudioMacCoreStreamInfo *self) {
 
 static void dealloc(PyAudioMacCoreStreamInfo *self) {
   cleanup(self);
-  Py_TYPE(self)->tp_free((PyObject *)self);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
 }
 
 static int init(PyObject *_self, PyObject *args, PyObject *kwargs) {
@@ -126,19 +128,20 @@ static PyGetSetDef get_setters[] = {
      NULL},
     {NULL}};
 
-PyTypeObject PyAudioMacCoreStreamInfoType = {
-    // clang-format off
-    PyVarObject_HEAD_INIT(NULL, 0)
-    // clang-format on
-    .tp_name = "_portaudio.PaMacCoreStreamInfo",
-    .tp_basicsize = sizeof(PyAudioMacCoreStreamInfo),
-    .tp_itemsize = 0,
-    .tp_dealloc = (destructor)dealloc,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_doc = PyDoc_STR("macOS Specific HostAPI configuration"),
-    .tp_getset = get_setters,
-    .tp_init = (initproc)init,
-    .tp_new = PyType_GenericNew,
+static PyType_Slot slots[] = {
+    {Py_tp_dealloc, dealloc},
+    {Py_tp_doc, (void *)PyDoc_STR("macOS Specific HostAPI configuration")},
+    {Py_tp_getset, get_setters},
+    {Py_tp_init, init},
+    {Py_tp_new, PyType_GenericNew},
+    {0, NULL}};
+
+PyType_Spec PyAudioMacCoreStreamInfoSpec = {
+    .name = "_portaudio.PaMacCoreStreamInfo",
+    .basicsize = sizeof(PyAudioMacCoreStreamInfo),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = slots,
 };
 
 #endif  // MACOS
@@ -22,7 +22,7 @@ typedef struct {
   int channel_map_size;
 } PyAudioMacCoreStreamInfo;
 
-extern PyTypeObject PyAudioMacCoreStreamInfoType;
+extern PyType_Spec PyAudioMacCoreStreamInfoSpec;
 
 #endif  // MACOS
 #endif  // MAC_CORE_STREAM_INFO_H_
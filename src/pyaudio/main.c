@@ -30,14 +30,23 @@
 #include "Python.h"
 #include "portaudio.h"
 
+#include "alsa_stream_info.h"
 #include "device_api.h"
+#include "device_snapshot.h"
 #include "host_api.h"
 #include "init.h"
 #include "mac_core_stream_info.h"
 #include "misc.h"
+#include "module_state.h"
+#include "output_broker.h"
+#include "probes.h"
+#include "shared_capture.h"
 #include "stream.h"
 #include "stream_io.h"
 #include "stream_lifecycle.h"
+#include "stream_reader.h"
+#include "stream_schedule.h"
+#include "thread_tuning.h"
 
 static PyMethodDef exported_functions[] = {
     // init.h
@@ -45,6 +54,9 @@ static PyMethodDef exported_functions[] = {
 
     {"terminate", PyAudio_Terminate, METH_VARARGS, "Terminates PortAudio"},
 
+    {"get_init_count", PyAudio_GetInitCount, METH_VARARGS,
+     "Returns the number of PortAudio initialization references held"},
+
     // misc.h
     {"get_sample_size", PyAudio_GetSampleSize, METH_VARARGS,
      "Returns sample size of a format in bytes"},
@@ -52,6 +64,10 @@ static PyMethodDef exported_functions[] = {
     {"is_format_supported", (PyCFunction)PyAudio_IsFormatSupported,
      METH_VARARGS | METH_KEYWORDS, "Returns whether format is supported"},
 
+    {"probe_formats", PyAudio_ProbeFormats, METH_VARARGS,
+     "Returns which combinations of rates, channels and formats a device "
+     "supports"},
+
     {"get_version", PyAudio_GetPortAudioVersion, METH_VARARGS,
      "PortAudio version"},
 
@@ -89,12 +105,17 @@ static PyMethodDef exported_functions[] = {
     {"get_device_info", PyAudio_GetDeviceInfo, METH_VARARGS,
      "Returns an object with device properties"},
 
+    // device_snapshot.h
+    {"get_all_devices", PyAudio_GetAllDevices, METH_VARARGS,
+     "Returns records of all devices and host APIs"},
+
     // stream.h
-    {"get_stream_time", PyAudio_GetStreamTime, METH_VARARGS,
+    {"get_stream_time", (PyCFunction)PyAudio_GetStreamTime, METH_FASTCALL,
      "Returns the number of seconds for the stream. See PortAudio docs for "
      "details."},
 
-    {"get_stream_cpu_load", PyAudio_GetStreamCpuLoad, METH_VARARGS,
+    {"get_stream_cpu_load", (PyCFunction)PyAudio_GetStreamCpuLoad,
+     METH_FASTCALL,
      "Returns the stream's CPU load (always 0 for blocking mode)"},
 
     // stream_lifecycle.h (and stream.h)
@@ -110,92 +131,203 @@ static PyMethodDef exported_functions[] = {
 
     {"abort_stream", PyAudio_AbortStream, METH_VARARGS, "Aborts the stream"},
 
-    {"is_stream_stopped", PyAudio_IsStreamStopped, METH_VARARGS,
+    {"is_stream_stopped", (PyCFunction)PyAudio_IsStreamStopped, METH_FASTCALL,
      "Returns whether the stream is stopped"},
 
-    {"is_stream_active", PyAudio_IsStreamActive, METH_VARARGS,
+    {"is_stream_active", (PyCFunction)PyAudio_IsStreamActive, METH_FASTCALL,
      "Returns whether the stream is active"},
 
     // stream_io.h (and stream.h)
-    {"write_stream", PyAudio_WriteStream, METH_VARARGS,
+    {"write_stream", (PyCFunction)PyAudio_WriteStream, METH_FASTCALL,
      "Write samples to stream"},
 
-    {"read_stream", PyAudio_ReadStream, METH_VARARGS,
+    {"flush_stream", (PyCFunction)PyAudio_FlushStream, METH_FASTCALL,
+     "Write coalesced samples to stream"},
+
+    {"read_stream", (PyCFunction)PyAudio_ReadStream, METH_FASTCALL,
      "Read samples from stream"},
 
-    {"get_stream_write_available", PyAudio_GetStreamWriteAvailable,
-     METH_VARARGS,
+    {"get_stream_write_available", (PyCFunction)PyAudio_GetStreamWriteAvailable,
+     METH_FASTCALL,
      "Returns the number of frames that can be written without waiting"},
 
-    {"get_stream_read_available", PyAudio_GetStreamReadAvailable, METH_VARARGS,
+    {"get_stream_read_available", (PyCFunction)PyAudio_GetStreamReadAvailable,
+     METH_FASTCALL,
      "Returns the number of frames that can be read without waiting"},
 
-    {NULL, NULL, 0, NULL}};
+    // stream_reader.h
+    {"open_reader", PyAudio_OpenStreamReader, METH_VARARGS,
+     "Opens an independent reader of an input stream"},
 
-#if PY_MAJOR_VERSION >= 3
-#define ERROR_INIT NULL
-#else
-#define ERROR_INIT /**/
-#endif
+    {"open_result_reader", PyAudio_OpenResultReader, METH_VARARGS,
+     "Opens an independent reader of an isolated callback's results"},
 
-#if PY_MAJOR_VERSION >= 3
-static struct PyModuleDef moduledef = {  //
-    PyModuleDef_HEAD_INIT,
-    "_portaudio",
-    NULL,
-    -1,
-    exported_functions,
-    NULL,
-    NULL,
-    NULL,
-    NULL};
+    // stream_schedule.h
+    {"schedule_stream", PyAudio_ScheduleStream, METH_VARARGS,
+     "Schedules samples for playback at a given stream time"},
+
+    {"get_scheduled_start_time", PyAudio_GetScheduledStartTime, METH_VARARGS,
+     "Returns the actual start time of a scheduled clip"},
+
+    // probes.h
+    {"start_probe_recording", PyAudio_StartProbeRecording, METH_VARARGS,
+     "Starts recording hot path probe events into a ring"},
+
+    {"stop_probe_recording", PyAudio_StopProbeRecording, METH_VARARGS,
+     "Stops recording probe events"},
+
+    {"get_probe_events", PyAudio_GetProbeEvents, METH_VARARGS,
+     "Returns the recorded probe events"},
+
+    // thread_tuning.h
+    {"set_thread_scheduling", (PyCFunction)PyAudio_SetThreadScheduling,
+     METH_VARARGS | METH_KEYWORDS,
+     "Applies real-time scheduling and CPU affinity to the calling thread"},
+
+#ifdef PYAUDIO_HAVE_ALSA
+    // alsa_stream_info.h
+    {"alsa_set_num_periods", PyAudio_AlsaSetNumPeriods, METH_VARARGS,
+     "Sets the number of periods of ALSA buffers"},
+
+    {"alsa_set_retries_busy", PyAudio_AlsaSetRetriesBusy, METH_VARARGS,
+     "Sets the number of retries to open busy ALSA devices"},
 #endif
 
-PyMODINIT_FUNC
-#if PY_MAJOR_VERSION >= 3
-PyInit__portaudio(void)
+    {NULL, NULL, 0, NULL}};
+
+// Creates the heap type for spec, owned by module, and adds it to the module
+// as name. Returns a new reference to the type, for the module state, or NULL
+// with an exception set.
+static PyTypeObject *add_type(PyObject *module, PyType_Spec *spec,
+                              const char *name) {
+  PyObject *type = PyType_FromModuleAndSpec(module, spec, NULL);
+  if (type == NULL) {
+    return NULL;
+  }
+  Py_INCREF(type);
+  if (PyModule_AddObject(module, name, type) < 0) {
+    Py_DECREF(type);
+    Py_DECREF(type);
+    return NULL;
+  }
+  return (PyTypeObject *)type;
+}
+
+// Creates the struct sequence type for desc and adds it to the module as name.
+// Returns a new reference to the type, for the module state, or NULL with an
+// exception set.
+static PyTypeObject *add_struct_sequence(PyObject *module,
+                                         PyStructSequence_Desc *desc,
+                                         const char *name) {
+  PyTypeObject *type = PyStructSequence_NewType(desc);
+  if (type == NULL) {
+    return NULL;
+  }
+  Py_INCREF(type);
+  if (PyModule_AddObject(module, name, (PyObject *)type) < 0) {
+    Py_DECREF(type);
+    Py_DECREF(type);
+    return NULL;
+  }
+  return type;
+}
+
+PyAudioModuleState *PyAudio_GetModuleStateByType(PyTypeObject *type) {
+#if PY_VERSION_HEX >= 0x030B0000
+  PyObject *module = PyType_GetModuleByDef(type, &PyAudioModuleDef);
+  if (module == NULL) {
+    return NULL;
+  }
+  return PyAudio_GetModuleState(module);
 #else
-init_portaudio(void)
+  // Subclasses (e.g., pyaudio.PyAudio.Stream) are not defined by the module,
+  // so look through the bases.
+  PyObject *mro = type->tp_mro;
+  for (Py_ssize_t i = 0; mro != NULL && i < PyTuple_GET_SIZE(mro); i++) {
+    PyTypeObject *base = (PyTypeObject *)PyTuple_GET_ITEM(mro, i);
+    if (!(base->tp_flags & Py_TPFLAGS_HEAPTYPE)) {
+      continue;
+    }
+    PyObject *module = ((PyHeapTypeObject *)base)->ht_module;
+    if (module != NULL && PyModule_GetDef(module) == &PyAudioModuleDef) {
+      return PyAudio_GetModuleState(module);
+    }
+  }
+  PyErr_Format(PyExc_TypeError, "'%s' is not a _portaudio type",
+               type->tp_name);
+  return NULL;
 #endif
-{
-  PyObject *m;
+}
 
-#if PY_MAJOR_VERSION >= 3 && PY_MINOR_VERSION <= 6
-  // Deprecated since Python 3.7; now called by Py_Initialize().
-  PyEval_InitThreads();
-#endif
+static int exec_module(PyObject *m) {
+  PyAudioModuleState *state = PyAudio_GetModuleState(m);
+  PyAudioMutex_Init(&state->device_snapshot_lock);
 
-  if (PyType_Ready(&PyAudioStreamType) < 0) {
-    return ERROR_INIT;
+  state->stream_type = add_type(m, &PyAudioStreamSpec, "Stream");
+  if (state->stream_type == NULL) {
+    return -1;
   }
 
-  if (PyType_Ready(&PyAudioDeviceInfoType) < 0) {
-    return ERROR_INIT;
+  state->stream_reader_type =
+      add_type(m, &PyAudioStreamReaderSpec, "StreamReader");
+  if (state->stream_reader_type == NULL) {
+    return -1;
   }
 
-  if (PyType_Ready(&PyAudioHostApiInfoType) < 0) {
-    return ERROR_INIT;
+  state->device_info_type =
+      add_type(m, &PyAudioDeviceInfoSpec, "paDeviceInfo");
+  if (state->device_info_type == NULL) {
+    return -1;
   }
 
-#ifdef MACOS
-  if (PyType_Ready(&PyAudioMacCoreStreamInfoType) < 0) {
-    return ERROR_INIT;
+  state->host_api_info_type =
+      add_type(m, &PyAudioHostApiInfoSpec, "paHostApiInfo");
+  if (state->host_api_info_type == NULL) {
+    return -1;
+  }
+
+  state->device_record_type =
+      add_struct_sequence(m, &PyAudioDeviceRecordDesc, "DeviceRecord");
+  if (state->device_record_type == NULL) {
+    return -1;
+  }
+
+  state->host_api_record_type =
+      add_struct_sequence(m, &PyAudioHostApiRecordDesc, "HostApiRecord");
+  if (state->host_api_record_type == NULL) {
+    return -1;
+  }
+
+#ifdef PYAUDIO_HAVE_OUTPUT_BROKER
+  state->broker_client_type =
+      add_type(m, &PyAudioBrokerClientSpec, "BrokerClient");
+  if (state->broker_client_type == NULL) {
+    return -1;
   }
 #endif
 
-#if PY_MAJOR_VERSION >= 3
-  m = PyModule_Create(&moduledef);
-#else
-  m = Py_InitModule("_portaudio", exported_functions);
+#ifdef PYAUDIO_HAVE_SHARED_CAPTURE
+  state->shared_capture_reader_type =
+      add_type(m, &PyAudioSharedCaptureReaderSpec, "SharedCaptureReader");
+  if (state->shared_capture_reader_type == NULL) {
+    return -1;
+  }
 #endif
 
-  Py_INCREF(&PyAudioStreamType);
-  Py_INCREF(&PyAudioDeviceInfoType);
-  Py_INCREF(&PyAudioHostApiInfoType);
 #ifdef MACOS
-  Py_INCREF(&PyAudioMacCoreStreamInfoType);
-  PyModule_AddObject(m, "paMacCoreStreamInfo",
-                     (PyObject *)&PyAudioMacCoreStreamInfoType);
+  state->mac_core_stream_info_type =
+      add_type(m, &PyAudioMacCoreStreamInfoSpec, "paMacCoreStreamInfo");
+  if (state->mac_core_stream_info_type == NULL) {
+    return -1;
+  }
+#endif
+
+#ifdef PYAUDIO_HAVE_ALSA
+  state->alsa_stream_info_type =
+      add_type(m, &PyAudioAlsaStreamInfoSpec, "paAlsaStreamInfo");
+  if (state->alsa_stream_info_type == NULL) {
+    return -1;
+  }
 #endif
 
   // Add PortAudio constants
@@ -303,7 +435,74 @@ init_portaudio(void)
   PyModule_AddIntConstant(m, "paMacCoreMinimizeCPU", paMacCoreMinimizeCPU);
 #endif
 
-#if PY_MAJOR_VERSION >= 3
-  return m;
+  return 0;
+}
+
+// The types reference the module, and its state the types.
+static int traverse_module(PyObject *m, visitproc visit, void *arg) {
+  PyAudioModuleState *state = PyAudio_GetModuleState(m);
+  Py_VISIT(state->stream_type);
+  Py_VISIT(state->stream_reader_type);
+  Py_VISIT(state->device_info_type);
+  Py_VISIT(state->host_api_info_type);
+  Py_VISIT(state->device_record_type);
+  Py_VISIT(state->host_api_record_type);
+  Py_VISIT(state->broker_client_type);
+  Py_VISIT(state->shared_capture_reader_type);
+  Py_VISIT(state->mac_core_stream_info_type);
+  Py_VISIT(state->alsa_stream_info_type);
+  Py_VISIT(state->device_snapshot);
+  return 0;
+}
+
+static int clear_module(PyObject *m) {
+  PyAudioModuleState *state = PyAudio_GetModuleState(m);
+  Py_CLEAR(state->stream_type);
+  Py_CLEAR(state->stream_reader_type);
+  Py_CLEAR(state->device_info_type);
+  Py_CLEAR(state->host_api_info_type);
+  Py_CLEAR(state->device_record_type);
+  Py_CLEAR(state->host_api_record_type);
+  Py_CLEAR(state->broker_client_type);
+  Py_CLEAR(state->shared_capture_reader_type);
+  Py_CLEAR(state->mac_core_stream_info_type);
+  Py_CLEAR(state->alsa_stream_info_type);
+  Py_CLEAR(state->device_snapshot);
+  return 0;
+}
+
+static void free_module(void *m) {
+  clear_module((PyObject *)m);
+  PyAudioMutex_Destroy(
+      &PyAudio_GetModuleState((PyObject *)m)->device_snapshot_lock);
+}
+
+static PyModuleDef_Slot module_slots[] = {
+    {Py_mod_exec, exec_module},
+#if PY_VERSION_HEX >= 0x030C0000
+    // Keeps no global Python state, so isolated callbacks, which run in
+    // subinterpreters with their own GIL, can import it too.
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
 #endif
+#if PY_VERSION_HEX >= 0x030D0000
+    // Streams keep their own state consistent with locks and atomics, and
+    // release the GIL around PortAudio calls anyway, so free-threaded builds
+    // can run callbacks of different streams in parallel.
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}};
+
+struct PyModuleDef PyAudioModuleDef = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "_portaudio",
+    .m_size = sizeof(PyAudioModuleState),
+    .m_methods = exported_functions,
+    .m_slots = module_slots,
+    .m_traverse = traverse_module,
+    .m_clear = clear_module,
+    .m_free = free_module,
+};
+
+PyMODINIT_FUNC PyInit__portaudio(void) {
+  return PyModuleDef_Init(&PyAudioModuleDef);
 }
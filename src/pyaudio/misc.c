@@ -1,5 +1,7 @@
 #include "misc.h"
 
+#include <stdlib.h>
+
 #ifndef PY_SSIZE_T_CLEAN
 #define PY_SSIZE_T_CLEAN
 #endif
@@ -111,3 +113,108 @@ PyObject *PyAudio_IsFormatSupported(PyObject *self, PyObject *args,
     return NULL;
   }
 }
+
+// Copies the items of a sequence into a newly allocated array of doubles,
+// which represent unsigned longs exactly if integers is set, in which case
+// the items must be non-negative ints. Returns the array (which the caller
+// must free), or NULL with an exception set. *size receives the number of
+// items.
+static double *sequence_to_doubles(PyObject *sequence, const char *name,
+                                   int integers, Py_ssize_t *size) {
+  PyObject *fast = PySequence_Fast(sequence, name);
+  if (fast == NULL) {
+    return NULL;
+  }
+  *size = PySequence_Fast_GET_SIZE(fast);
+  double *values = (double *)malloc((*size > 0 ? *size : 1) * sizeof(double));
+  if (values == NULL) {
+    Py_DECREF(fast);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  for (Py_ssize_t i = 0; i < *size; i++) {
+    PyObject *item = PySequence_Fast_GET_ITEM(fast, i);
+    values[i] = integers ? (double)PyLong_AsUnsignedLong(item)
+                         : PyFloat_AsDouble(item);
+    if (PyErr_Occurred()) {
+      free(values);
+      Py_DECREF(fast);
+      return NULL;
+    }
+  }
+  Py_DECREF(fast);
+  return values;
+}
+
+PyObject *PyAudio_ProbeFormats(PyObject *self, PyObject *args) {
+  PaDeviceIndex device;
+  PyObject *rates_arg, *channels_arg, *formats_arg;
+  int is_input;
+
+  if (!PyArg_ParseTuple(args, "iOOOp", &device, &rates_arg, &channels_arg,
+                        &formats_arg, &is_input)) {
+    return NULL;
+  }
+
+  if (device < 0 || device >= Pa_GetDeviceCount()) {
+    PyErr_SetObject(PyExc_IOError, Py_BuildValue("(i,s)", paInvalidDevice,
+                                                 "Invalid device"));
+    return NULL;
+  }
+
+  Py_ssize_t num_rates, num_channels, num_formats;
+  double *rates = NULL, *channels = NULL, *formats = NULL;
+  PyObject *table = NULL;
+  rates = sequence_to_doubles(rates_arg, "rates must be a sequence", 0,
+                              &num_rates);
+  if (rates == NULL) {
+    goto end;
+  }
+  channels = sequence_to_doubles(channels_arg, "channels must be a sequence",
+                                 1, &num_channels);
+  if (channels == NULL) {
+    goto end;
+  }
+  formats = sequence_to_doubles(formats_arg, "formats must be a sequence", 1,
+                                &num_formats);
+  if (formats == NULL) {
+    goto end;
+  }
+
+  table = PyBytes_FromStringAndSize(NULL,
+                                    num_rates * num_channels * num_formats);
+  if (table == NULL) {
+    goto end;
+  }
+  char *supported = PyBytes_AS_STRING(table);
+
+  PaStreamParameters params;
+  params.device = device;
+  params.suggestedLatency = 0;
+  params.hostApiSpecificStreamInfo = NULL;
+
+  // Probing may take a while per combination on some host APIs (e.g., ALSA
+  // opens the device), so release the GIL for the whole matrix.
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  for (Py_ssize_t r = 0; r < num_rates; r++) {
+    for (Py_ssize_t c = 0; c < num_channels; c++) {
+      for (Py_ssize_t f = 0; f < num_formats; f++) {
+        params.channelCount = (int)channels[c];
+        params.sampleFormat = (PaSampleFormat)formats[f];
+        PaError error = Pa_IsFormatSupported(is_input ? &params : NULL,
+                                             is_input ? NULL : &params,
+                                             rates[r]);
+        *supported++ = error == paFormatIsSupported;
+      }
+    }
+  }
+  Py_END_ALLOW_THREADS
+  // clang-format on
+
+end:
+  free(rates);
+  free(channels);
+  free(formats);
+  return table;
+}
@@ -11,4 +11,8 @@ PyObject *PyAudio_GetPortAudioVersionText(PyObject *self, PyObject *args);
 PyObject *PyAudio_GetSampleSize(PyObject *self, PyObject *args);
 PyObject *PyAudio_IsFormatSupported(PyObject *self, PyObject *args,
                                     PyObject *kwargs);
+// Probes every combination of rates x channels x formats for a device, as
+// input (or else output), with the GIL released. Returns bytes with one byte
+// per combination, in that order: 1 if supported, 0 otherwise.
+PyObject *PyAudio_ProbeFormats(PyObject *self, PyObject *args);
 #endif  // MISC_H_
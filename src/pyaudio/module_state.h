@@ -0,0 +1,48 @@
+// Per-module state of _portaudio.
+//
+// The module uses multi-phase initialization, so each interpreter importing it
+// gets its own module object, with its own (heap) type objects, kept here.
+
+#ifndef MODULE_STATE_H_
+#define MODULE_STATE_H_
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+
+#include "sync.h"
+
+typedef struct {
+  PyTypeObject *stream_type;
+  PyTypeObject *stream_reader_type;
+  PyTypeObject *device_info_type;
+  PyTypeObject *host_api_info_type;
+  PyTypeObject *device_record_type;
+  PyTypeObject *host_api_record_type;
+  // NULL where unsupported.
+  PyTypeObject *broker_client_type;
+  PyTypeObject *shared_capture_reader_type;
+  PyTypeObject *mac_core_stream_info_type;
+  PyTypeObject *alsa_stream_info_type;
+  // Cached result of get_all_devices(), valid while PortAudio's
+  // initialization generation (see PyAudio_GetInitGeneration()) is
+  // device_snapshot_generation. Guarded by device_snapshot_lock.
+  PyObject *device_snapshot;
+  long device_snapshot_generation;
+  PyAudioMutex device_snapshot_lock;
+} PyAudioModuleState;
+
+extern struct PyModuleDef PyAudioModuleDef;
+
+// Returns the state of the _portaudio module, e.g., the self argument of
+// module functions.
+static inline PyAudioModuleState *PyAudio_GetModuleState(PyObject *module) {
+  return (PyAudioModuleState *)PyModule_GetState(module);
+}
+
+// Returns the state of the _portaudio module defining type, or one of its
+// bases. Returns NULL with a TypeError set if there is none.
+PyAudioModuleState *PyAudio_GetModuleStateByType(PyTypeObject *type);
+
+#endif  // MODULE_STATE_H_
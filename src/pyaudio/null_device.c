@@ -0,0 +1,914 @@
+#include "null_device.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+#include "pythread.h"
+
+#include "stream_backend.h"
+#include "stream_trace.h"
+#include "sync.h"
+
+#define DEFAULT_FRAMES_PER_BUFFER 256
+// Blocking output streams buffer this many periods ahead of the clock, and
+// blocking input streams keep this many periods before overflowing.
+#define BUFFER_PERIODS 4
+#define TONE_FREQUENCY 440.0
+#define TONE_AMPLITUDE 0.5
+// M_PI is not standard C.
+#define TWO_PI 6.283185307179586
+
+typedef enum {
+  INPUT_SILENCE = 0,
+  INPUT_TONE,
+  INPUT_FILE,
+  INPUT_BUFFER,
+} InputSource;
+
+typedef struct {
+  PaStreamInfo info;
+  PaStreamCallback *callback;
+  void *user_data;
+  PaStreamFinishedCallback *finished_callback;
+  int is_input;
+  int is_output;
+  PaSampleFormat format;
+  int channels;
+  unsigned int frame_size;
+  double sample_rate;
+  unsigned long frames_per_buffer;
+  uint64_t buffer_frames;
+  int realtime;
+  // Whether input plays once, completing the stream at its end, rather than
+  // in a loop (offline mode).
+  int offline;
+  // Monotonic time at which the stream opened, the origin of its stream time
+  // in fast mode.
+  double open_time;
+
+  // Input source. Only the thread reading input uses these.
+  InputSource input_source;
+  // For INPUT_FILE, read as the stream goes.
+  FILE *input_file;
+  // For INPUT_BUFFER, a copy of the frames.
+  char *input_data;
+  uint64_t input_frames;
+  // Frames read since the start of the file or buffer.
+  uint64_t input_pos;
+  uint64_t tone_pos;
+  // Output capture, or NULL. Only the thread writing output uses it.
+  FILE *output_file;
+  // Whether to keep output in memory, for PyAudioNull_TakeOutput(), instead.
+  int keep_output;
+  // Trace replayed instead of input, or NULL, and its header.
+  FILE *trace_file;
+  PyAudioTraceHeader trace_header;
+  // Buffers passed to the callback, for callback-mode streams, and their
+  // size in frames. Only the callback thread uses them once started.
+  char *input_buffer;
+  char *output_buffer;
+  unsigned long buffer_capacity;
+
+  PyAudioMutex lock;
+  PyAudioCond cond;
+  // The following are guarded by lock.
+  // Set until the stream starts, and once stopped or aborted.
+  int stopped;
+  // Set to ask the callback thread to exit.
+  int stop_requested;
+  // Whether the callback thread is running, cleared as it exits.
+  int thread_running;
+  unsigned long thread_ident;
+  // Monotonic time at which the clock (re)started, and the frame positions
+  // at that time. In real time, the device consumes output and produces
+  // input at the sample rate from then on.
+  double origin;
+  uint64_t origin_written;
+  uint64_t origin_read;
+  // Total output frames written (or produced by the callback), and input
+  // frames read.
+  uint64_t frames_written;
+  uint64_t frames_read;
+  // Fraction of each period spent in the callback, smoothed.
+  double cpu_load;
+  // Output kept in memory, and whether some was lost for lack of memory.
+  char *output_data;
+  size_t output_size;
+  size_t output_capacity;
+  int output_lost;
+
+  // Whether the stream is active (atomic).
+  volatile long active;
+} NullStream;
+
+int PyAudioNull_ParseMode(const char *mode, PyAudioNullConfig *config) {
+  if (strcmp(mode, "realtime") == 0) {
+    config->realtime = 1;
+  } else if (strcmp(mode, "fast") == 0) {
+    config->realtime = 0;
+  } else if (strcmp(mode, "offline") == 0) {
+    config->realtime = 0;
+    config->offline = 1;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "virtual_device must be 'realtime', 'fast' or 'offline'");
+    return -1;
+  }
+  return 0;
+}
+
+/*************************************************************
+ * Input and output
+ *************************************************************/
+
+// Writes one sample of value (between -1 and 1) in format.
+static void write_sample(char *dst, PaSampleFormat format, double value) {
+  switch (format) {
+    case paFloat32: {
+      float sample = (float)value;
+      memcpy(dst, &sample, sizeof(sample));
+      break;
+    }
+    case paInt32: {
+      int32_t sample = (int32_t)(value * 2147483647.0);
+      memcpy(dst, &sample, sizeof(sample));
+      break;
+    }
+    case paInt24: {
+      int32_t sample = (int32_t)(value * 8388607.0);
+      dst[0] = (char)(sample & 0xff);
+      dst[1] = (char)((sample >> 8) & 0xff);
+      dst[2] = (char)((sample >> 16) & 0xff);
+      break;
+    }
+    case paInt16: {
+      int16_t sample = (int16_t)(value * 32767.0);
+      memcpy(dst, &sample, sizeof(sample));
+      break;
+    }
+    case paInt8:
+      *dst = (char)(int8_t)(value * 127.0);
+      break;
+    case paUInt8:
+      *(unsigned char *)dst = (unsigned char)(128 + (int)(value * 127.0));
+      break;
+    default:
+      memset(dst, 0, (size_t)Pa_GetSampleSize(format));
+      break;
+  }
+}
+
+// Fills num_frames frames of input from the stream's source. Returns the
+// number of frames read before the end of an offline input, after which the
+// rest is silence.
+static unsigned long read_input(NullStream *s, char *dst,
+                                unsigned long num_frames) {
+  unsigned long total = num_frames;
+  switch (s->input_source) {
+    case INPUT_TONE: {
+      unsigned int sample_size = s->frame_size / (unsigned int)s->channels;
+      // Wrap around every second, so that the phase stays precise.
+      uint64_t period = (uint64_t)s->sample_rate;
+      for (unsigned long i = 0; i < num_frames; i++) {
+        double value =
+            TONE_AMPLITUDE * sin(TWO_PI * TONE_FREQUENCY *
+                                 (double)s->tone_pos / s->sample_rate);
+        for (int c = 0; c < s->channels; c++) {
+          write_sample(dst, s->format, value);
+          dst += sample_size;
+        }
+        s->tone_pos = period > 0 ? (s->tone_pos + 1) % period : 0;
+      }
+      return total;
+    }
+    case INPUT_FILE:
+      // fread() skips a partial frame at the end of the file.
+      while (num_frames > 0) {
+        size_t count = fread(dst, s->frame_size, num_frames, s->input_file);
+        dst += count * s->frame_size;
+        num_frames -= (unsigned long)count;
+        s->input_pos += count;
+        // At the end of the file (or a read error), loop, unless offline or
+        // the file has no frames at all.
+        if (num_frames == 0 || s->offline || s->input_pos == 0) {
+          break;
+        }
+        rewind(s->input_file);
+        s->input_pos = 0;
+      }
+      break;
+    case INPUT_BUFFER:
+      while (num_frames > 0 && s->input_frames > 0) {
+        if (s->input_pos == s->input_frames) {
+          if (s->offline) {
+            break;
+          }
+          s->input_pos = 0;
+        }
+        uint64_t count = s->input_frames - s->input_pos;
+        if (count > num_frames) {
+          count = num_frames;
+        }
+        memcpy(dst, s->input_data + s->input_pos * s->frame_size,
+               (size_t)(count * s->frame_size));
+        dst += count * s->frame_size;
+        num_frames -= (unsigned long)count;
+        s->input_pos += count;
+      }
+      break;
+    default:
+      // Silence never runs out.
+      memset(dst, 0, (size_t)num_frames * s->frame_size);
+      return total;
+  }
+  memset(dst, 0, (size_t)num_frames * s->frame_size);
+  return total - num_frames;
+}
+
+// Appends output frames to those kept in memory.
+static void keep_output(NullStream *s, const char *src, size_t size) {
+  PyAudioMutex_Lock(&s->lock);
+  if (s->output_size + size > s->output_capacity) {
+    size_t capacity = s->output_capacity ? s->output_capacity : 65536;
+    while (capacity < s->output_size + size) {
+      capacity *= 2;
+    }
+    char *data = (char *)realloc(s->output_data, capacity);
+    if (data == NULL) {
+      s->output_lost = 1;
+      PyAudioMutex_Unlock(&s->lock);
+      return;
+    }
+    s->output_data = data;
+    s->output_capacity = capacity;
+  }
+  memcpy(s->output_data + s->output_size, src, size);
+  s->output_size += size;
+  PyAudioMutex_Unlock(&s->lock);
+}
+
+static void write_output(NullStream *s, const char *src,
+                         unsigned long num_frames) {
+  if (s->output_file != NULL) {
+    fwrite(src, s->frame_size, num_frames, s->output_file);
+  } else if (s->keep_output) {
+    keep_output(s, src, (size_t)num_frames * s->frame_size);
+  }
+}
+
+// Sets up the stream's input source from config. Returns 0, or -1 with an
+// exception set.
+static int open_input(NullStream *s, const PyAudioNullConfig *config) {
+  if (config->input_data != NULL) {
+    // Ignore any partial frame at the end.
+    s->input_frames = (uint64_t)config->input_size / s->frame_size;
+    s->input_data = (char *)malloc(
+        s->input_frames > 0 ? (size_t)(s->input_frames * s->frame_size) : 1);
+    if (s->input_data == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    memcpy(s->input_data, config->input_data,
+           (size_t)(s->input_frames * s->frame_size));
+    s->input_source = INPUT_BUFFER;
+  } else if (config->input == NULL || strcmp(config->input, "silence") == 0) {
+    s->input_source = INPUT_SILENCE;
+  } else if (strcmp(config->input, "tone") == 0) {
+    s->input_source = INPUT_TONE;
+  } else {
+    s->input_file = fopen(config->input, "rb");
+    if (s->input_file == NULL) {
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, config->input);
+      return -1;
+    }
+    s->input_source = INPUT_FILE;
+  }
+  return 0;
+}
+
+// Opens the trace to replay. Returns 0, or -1 with an exception set.
+static int open_trace(NullStream *s, const char *path) {
+  if (!s->offline || s->callback == NULL) {
+    PyErr_SetString(PyExc_ValueError,
+                    "virtual_trace requires virtual_device='offline' and a "
+                    "callback-mode stream");
+    return -1;
+  }
+  s->trace_file = fopen(path, "rb");
+  if (s->trace_file == NULL) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    return -1;
+  }
+  if (PyAudioTrace_ReadHeader(s->trace_file, &s->trace_header) < 0) {
+    return -1;
+  }
+  if (s->trace_header.sample_format != s->format ||
+      s->trace_header.channels != (uint32_t)s->channels ||
+      s->trace_header.frame_size != s->frame_size ||
+      s->trace_header.sample_rate != s->sample_rate) {
+    PyErr_SetString(PyExc_ValueError,
+                    "virtual_trace was recorded with a different format, "
+                    "channel count or rate");
+    return -1;
+  }
+  return 0;
+}
+
+// Grows the callback buffers to hold num_frames frames. Returns 0, or -1 if
+// out of memory.
+static int reserve_buffers(NullStream *s, unsigned long num_frames) {
+  if (num_frames <= s->buffer_capacity) {
+    return 0;
+  }
+  size_t size = (size_t)num_frames * s->frame_size;
+  if (s->is_input) {
+    char *buffer = (char *)realloc(s->input_buffer, size);
+    if (buffer == NULL) {
+      return -1;
+    }
+    s->input_buffer = buffer;
+  }
+  if (s->is_output) {
+    char *buffer = (char *)realloc(s->output_buffer, size);
+    if (buffer == NULL) {
+      return -1;
+    }
+    s->output_buffer = buffer;
+  }
+  s->buffer_capacity = num_frames;
+  return 0;
+}
+
+// Reads the next period of the replayed trace: the callback arguments, and
+// its input. Returns 0, or -1 at the end of the trace.
+static int read_trace_period(NullStream *s, unsigned long *frame_count,
+                             PaStreamCallbackTimeInfo *time_info,
+                             PaStreamCallbackFlags *status_flags) {
+  PyAudioTraceRecord record;
+  if (fread(&record, sizeof(record), 1, s->trace_file) != 1 ||
+      reserve_buffers(s, record.frame_count) < 0) {
+    return -1;
+  }
+  size_t size = (size_t)record.frame_count * s->frame_size;
+  if (s->trace_header.flags & PYAUDIO_TRACE_INPUT) {
+    if (s->is_input ? fread(s->input_buffer, 1, size, s->trace_file) != size
+                    : fseek(s->trace_file, (long)size, SEEK_CUR) != 0) {
+      return -1;
+    }
+  } else if (s->is_input) {
+    memset(s->input_buffer, 0, size);
+  }
+  *frame_count = record.frame_count;
+  time_info->inputBufferAdcTime = record.input_buffer_adc_time;
+  time_info->currentTime = record.current_time;
+  time_info->outputBufferDacTime = record.output_buffer_dac_time;
+  *status_flags = (PaStreamCallbackFlags)record.status_flags;
+  return 0;
+}
+
+/*************************************************************
+ * Clock
+ *************************************************************/
+
+// Returns the stream time: the monotonic clock, like host APIs, or in fast
+// mode, the time the stream opened plus that of the frames processed so far.
+// Never 0, which PortAudio reserves for errors. Call with lock held.
+static double stream_time(NullStream *s) {
+  if (s->realtime) {
+    return PyAudioTime_Now();
+  }
+  uint64_t frames =
+      s->frames_written > s->frames_read ? s->frames_written : s->frames_read;
+  return s->open_time + (double)frames / s->sample_rate;
+}
+
+// Returns the number of frames the clock has advanced since it started. Call
+// with lock held.
+static uint64_t clock_frames(NullStream *s) {
+  double elapsed = PyAudioTime_Now() - s->origin;
+  return elapsed > 0 ? (uint64_t)(elapsed * s->sample_rate) : 0;
+}
+
+// Returns the number of output frames played, in real time. If the device ran
+// out of frames (an underflow), restarts the clock, as the device would idle
+// until it gets more. Call with lock held.
+static uint64_t frames_played(NullStream *s) {
+  uint64_t played = s->origin_written + clock_frames(s);
+  if (played > s->frames_written) {
+    s->origin = PyAudioTime_Now();
+    s->origin_written = s->frames_written;
+    s->origin_read = s->frames_read + clock_frames(s);
+    played = s->frames_written;
+  }
+  return played;
+}
+
+// Restarts the clock from now, at the current positions. Call with lock held.
+static void start_clock(NullStream *s) {
+  s->origin = PyAudioTime_Now();
+  s->origin_written = s->frames_written;
+  s->origin_read = s->frames_read;
+}
+
+/*************************************************************
+ * Callback thread
+ *************************************************************/
+
+static void callback_thread(void *arg) {
+  NullStream *s = (NullStream *)arg;
+  double period = (double)s->frames_per_buffer / s->sample_rate;
+
+  PyAudioMutex_Lock(&s->lock);
+  uint64_t num_periods = 0;
+  for (;;) {
+    if (s->realtime) {
+      // Wait for the clock to reach this period, like a device would.
+      double wait = s->origin + num_periods * period - PyAudioTime_Now();
+      while (!s->stop_requested && wait > 0) {
+        PyAudioCond_TimedWait(&s->cond, &s->lock, wait);
+        wait = s->origin + num_periods * period - PyAudioTime_Now();
+      }
+    }
+    if (s->stop_requested) {
+      break;
+    }
+    PaStreamCallbackTimeInfo time_info;
+    time_info.currentTime = stream_time(s);
+    time_info.inputBufferAdcTime =
+        time_info.currentTime - s->info.inputLatency;
+    time_info.outputBufferDacTime =
+        time_info.currentTime + s->info.outputLatency;
+    PyAudioMutex_Unlock(&s->lock);
+
+    unsigned long frame_count = s->frames_per_buffer;
+    PaStreamCallbackFlags status_flags = 0;
+    // Offline input ends the stream, after a last, partial, buffer; so does
+    // the end of a replayed trace.
+    unsigned long num_frames = frame_count;
+    if (s->trace_file != NULL) {
+      if (read_trace_period(s, &frame_count, &time_info, &status_flags) < 0) {
+        PyAudioMutex_Lock(&s->lock);
+        break;
+      }
+      num_frames = frame_count;
+    } else if (s->is_input) {
+      num_frames = read_input(s, s->input_buffer, frame_count);
+      if (!s->offline) {
+        // Only an empty input file runs out: the rest is silence.
+        num_frames = frame_count;
+      } else if (num_frames == 0) {
+        PyAudioMutex_Lock(&s->lock);
+        break;
+      }
+    }
+    double start = PyAudioTime_Now();
+    int result = s->callback(s->input_buffer, s->output_buffer, frame_count,
+                             &time_info, status_flags, s->user_data);
+    double busy = PyAudioTime_Now() - start;
+    if (s->is_output && result != paAbort) {
+      write_output(s, s->output_buffer, num_frames);
+    }
+
+    PyAudioMutex_Lock(&s->lock);
+    s->cpu_load = 0.9 * s->cpu_load + 0.1 * (busy / period);
+    if (s->is_input) {
+      s->frames_read += frame_count;
+    }
+    if (s->is_output) {
+      s->frames_written += frame_count;
+    }
+    num_periods++;
+    if (result != paContinue || num_frames < frame_count) {
+      break;
+    }
+  }
+  PyAudioMutex_Unlock(&s->lock);
+
+  PyAudioAtomic_StoreLong(&s->active, 0);
+  if (s->finished_callback != NULL) {
+    s->finished_callback(s->user_data);
+  }
+
+  PyAudioMutex_Lock(&s->lock);
+  s->thread_running = 0;
+  PyAudioCond_Broadcast(&s->cond);
+  PyAudioMutex_Unlock(&s->lock);
+}
+
+/*************************************************************
+ * Backend
+ *************************************************************/
+
+// Stops the stream; drains blocking output first unless aborting.
+static PaError stop_stream(PaStream *stream, int drain) {
+  NullStream *s = (NullStream *)stream;
+  PyAudioMutex_Lock(&s->lock);
+  if (s->stopped) {
+    PyAudioMutex_Unlock(&s->lock);
+    return paStreamIsStopped;
+  }
+
+  if (s->callback != NULL) {
+    s->stop_requested = 1;
+    PyAudioCond_Broadcast(&s->cond);
+    // Stopped from the callback itself, on the callback thread, which exits
+    // once the callback returns.
+    if (PyThread_get_thread_ident() != s->thread_ident) {
+      while (s->thread_running) {
+        PyAudioCond_TimedWait(&s->cond, &s->lock, -1);
+      }
+    }
+    s->stopped = 1;
+    PyAudioMutex_Unlock(&s->lock);
+    return paNoError;
+  }
+
+  if (drain && s->realtime && s->is_output) {
+    uint64_t played;
+    while ((played = frames_played(s)) < s->frames_written) {
+      PyAudioCond_TimedWait(&s->cond, &s->lock,
+                            (double)(s->frames_written - played) /
+                                s->sample_rate);
+    }
+  }
+  s->stopped = 1;
+  PyAudioCond_Broadcast(&s->cond);
+  PyAudioMutex_Unlock(&s->lock);
+
+  if (PyAudioAtomic_ExchangeLong(&s->active, 0) &&
+      s->finished_callback != NULL) {
+    s->finished_callback(s->user_data);
+  }
+  return paNoError;
+}
+
+static PaError null_stop(PaStream *stream) { return stop_stream(stream, 1); }
+
+static PaError null_abort(PaStream *stream) { return stop_stream(stream, 0); }
+
+static PaError null_close(PaStream *stream) {
+  NullStream *s = (NullStream *)stream;
+  stop_stream(stream, 0);
+  if (s->input_file != NULL) {
+    fclose(s->input_file);
+  }
+  if (s->trace_file != NULL) {
+    fclose(s->trace_file);
+  }
+  if (s->output_file != NULL) {
+    fclose(s->output_file);
+  }
+  free(s->input_data);
+  free(s->output_data);
+  free(s->input_buffer);
+  free(s->output_buffer);
+  PyAudioCond_Destroy(&s->cond);
+  PyAudioMutex_Destroy(&s->lock);
+  free(s);
+  return paNoError;
+}
+
+static PaError null_set_finished_callback(PaStream *stream,
+                                          PaStreamFinishedCallback *callback) {
+  NullStream *s = (NullStream *)stream;
+  PyAudioMutex_Lock(&s->lock);
+  int stopped = s->stopped;
+  if (stopped) {
+    s->finished_callback = callback;
+  }
+  PyAudioMutex_Unlock(&s->lock);
+  return stopped ? paNoError : paStreamIsNotStopped;
+}
+
+static PaError null_start(PaStream *stream) {
+  NullStream *s = (NullStream *)stream;
+  PyAudioMutex_Lock(&s->lock);
+  if (!s->stopped) {
+    PyAudioMutex_Unlock(&s->lock);
+    return paStreamIsNotStopped;
+  }
+  s->stopped = 0;
+  s->stop_requested = 0;
+  start_clock(s);
+  PyAudioAtomic_StoreLong(&s->active, 1);
+
+  if (s->callback != NULL) {
+    s->thread_running = 1;
+    s->thread_ident = PyThread_start_new_thread(callback_thread, s);
+    if (s->thread_ident == PYTHREAD_INVALID_THREAD_ID) {
+      s->thread_running = 0;
+      s->stopped = 1;
+      PyAudioAtomic_StoreLong(&s->active, 0);
+      PyAudioMutex_Unlock(&s->lock);
+      return paInternalError;
+    }
+  }
+  PyAudioMutex_Unlock(&s->lock);
+  return paNoError;
+}
+
+static PaError null_is_stopped(PaStream *stream) {
+  NullStream *s = (NullStream *)stream;
+  PyAudioMutex_Lock(&s->lock);
+  int stopped = s->stopped;
+  PyAudioMutex_Unlock(&s->lock);
+  return stopped;
+}
+
+static PaError null_is_active(PaStream *stream) {
+  return (PaError)PyAudioAtomic_LoadLong(&((NullStream *)stream)->active);
+}
+
+static const PaStreamInfo *null_get_info(PaStream *stream) {
+  return &((NullStream *)stream)->info;
+}
+
+static PaTime null_get_time(PaStream *stream) {
+  NullStream *s = (NullStream *)stream;
+  PyAudioMutex_Lock(&s->lock);
+  double time = stream_time(s);
+  PyAudioMutex_Unlock(&s->lock);
+  return time;
+}
+
+static double null_get_cpu_load(PaStream *stream) {
+  NullStream *s = (NullStream *)stream;
+  PyAudioMutex_Lock(&s->lock);
+  double cpu_load = s->cpu_load;
+  PyAudioMutex_Unlock(&s->lock);
+  return cpu_load;
+}
+
+static PaError null_read(PaStream *stream, void *buffer,
+                         unsigned long frames) {
+  NullStream *s = (NullStream *)stream;
+  if (s->callback != NULL) {
+    return paCanNotReadFromACallbackStream;
+  }
+  if (!s->is_input) {
+    return paCanNotReadFromAnOutputOnlyStream;
+  }
+
+  PaError err = paNoError;
+  char *dst = (char *)buffer;
+  while (frames > 0) {
+    PyAudioMutex_Lock(&s->lock);
+    if (s->stopped) {
+      PyAudioMutex_Unlock(&s->lock);
+      return paStreamIsStopped;
+    }
+    unsigned long count = frames;
+    if (s->realtime) {
+      uint64_t captured = s->origin_read + clock_frames(s);
+      if (captured > s->frames_read + s->buffer_frames) {
+        // Fell behind by more than the buffer: drop the oldest frames.
+        s->frames_read = captured - s->buffer_frames;
+        err = paInputOverflowed;
+      }
+      uint64_t available = captured - s->frames_read;
+      if (available == 0) {
+        uint64_t needed = frames < s->buffer_frames ? frames : s->buffer_frames;
+        PyAudioCond_TimedWait(&s->cond, &s->lock,
+                              (double)needed / s->sample_rate);
+        PyAudioMutex_Unlock(&s->lock);
+        continue;
+      }
+      if (count > available) {
+        count = (unsigned long)available;
+      }
+    }
+    s->frames_read += count;
+    PyAudioMutex_Unlock(&s->lock);
+
+    read_input(s, dst, count);
+    dst += (size_t)count * s->frame_size;
+    frames -= count;
+  }
+  return err;
+}
+
+static PaError null_write(PaStream *stream, const void *buffer,
+                          unsigned long frames) {
+  NullStream *s = (NullStream *)stream;
+  if (s->callback != NULL) {
+    return paCanNotWriteToACallbackStream;
+  }
+  if (!s->is_output) {
+    return paCanNotWriteToAnInputOnlyStream;
+  }
+
+  const char *src = (const char *)buffer;
+  while (frames > 0) {
+    PyAudioMutex_Lock(&s->lock);
+    if (s->stopped) {
+      PyAudioMutex_Unlock(&s->lock);
+      return paStreamIsStopped;
+    }
+    unsigned long count = frames;
+    if (s->realtime) {
+      uint64_t space =
+          s->buffer_frames - (s->frames_written - frames_played(s));
+      if (space == 0) {
+        uint64_t needed = frames < s->buffer_frames ? frames : s->buffer_frames;
+        PyAudioCond_TimedWait(&s->cond, &s->lock,
+                              (double)needed / s->sample_rate);
+        PyAudioMutex_Unlock(&s->lock);
+        continue;
+      }
+      if (count > space) {
+        count = (unsigned long)space;
+      }
+    }
+    s->frames_written += count;
+    PyAudioMutex_Unlock(&s->lock);
+
+    write_output(s, src, count);
+    src += (size_t)count * s->frame_size;
+    frames -= count;
+  }
+  return paNoError;
+}
+
+static signed long null_get_read_available(PaStream *stream) {
+  NullStream *s = (NullStream *)stream;
+  if (s->callback != NULL) {
+    return paCanNotReadFromACallbackStream;
+  }
+  if (!s->is_input) {
+    return paCanNotReadFromAnOutputOnlyStream;
+  }
+  if (!s->realtime) {
+    return (signed long)s->buffer_frames;
+  }
+  PyAudioMutex_Lock(&s->lock);
+  uint64_t available = 0;
+  if (!s->stopped) {
+    uint64_t captured = s->origin_read + clock_frames(s);
+    available = captured > s->frames_read ? captured - s->frames_read : 0;
+    if (available > s->buffer_frames) {
+      available = s->buffer_frames;
+    }
+  }
+  PyAudioMutex_Unlock(&s->lock);
+  return (signed long)available;
+}
+
+static signed long null_get_write_available(PaStream *stream) {
+  NullStream *s = (NullStream *)stream;
+  if (s->callback != NULL) {
+    return paCanNotWriteToACallbackStream;
+  }
+  if (!s->is_output) {
+    return paCanNotWriteToAnInputOnlyStream;
+  }
+  if (!s->realtime) {
+    return (signed long)s->buffer_frames;
+  }
+  PyAudioMutex_Lock(&s->lock);
+  uint64_t space = s->buffer_frames;
+  if (!s->stopped) {
+    space -= s->frames_written - frames_played(s);
+  }
+  PyAudioMutex_Unlock(&s->lock);
+  return (signed long)space;
+}
+
+const PyAudioStreamBackend PyAudioNullBackend = {
+    .close = null_close,
+    .set_finished_callback = null_set_finished_callback,
+    .start = null_start,
+    .stop = null_stop,
+    .abort = null_abort,
+    .is_stopped = null_is_stopped,
+    .is_active = null_is_active,
+    .get_info = null_get_info,
+    .get_time = null_get_time,
+    .get_cpu_load = null_get_cpu_load,
+    .read = null_read,
+    .write = null_write,
+    .get_read_available = null_get_read_available,
+    .get_write_available = null_get_write_available,
+};
+
+PaStream *PyAudioNull_OpenStream(const PaStreamParameters *input_parameters,
+                                 const PaStreamParameters *output_parameters,
+                                 double sample_rate,
+                                 unsigned long frames_per_buffer,
+                                 PaStreamCallback *callback, void *user_data,
+                                 const PyAudioNullConfig *config) {
+  const PaStreamParameters *parameters =
+      input_parameters ? input_parameters : output_parameters;
+  if (sample_rate <= 0 ||
+      (parameters->sampleFormat & paNonInterleaved) ||
+      Pa_GetSampleSize(parameters->sampleFormat) <= 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "virtual_device requires a positive rate and an "
+                    "interleaved sample format");
+    return NULL;
+  }
+
+  NullStream *s = (NullStream *)calloc(1, sizeof(NullStream));
+  if (s == NULL) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  PyAudioMutex_Init(&s->lock);
+  PyAudioCond_Init(&s->cond);
+  s->callback = callback;
+  s->user_data = user_data;
+  s->is_input = input_parameters != NULL;
+  s->is_output = output_parameters != NULL;
+  s->format = parameters->sampleFormat;
+  s->channels = parameters->channelCount;
+  s->frame_size =
+      (unsigned int)(Pa_GetSampleSize(s->format) * parameters->channelCount);
+  s->sample_rate = sample_rate;
+  s->frames_per_buffer = frames_per_buffer != paFramesPerBufferUnspecified
+                             ? frames_per_buffer
+                             : DEFAULT_FRAMES_PER_BUFFER;
+  s->buffer_frames = BUFFER_PERIODS * (uint64_t)s->frames_per_buffer;
+  s->realtime = config->realtime;
+  s->offline = config->offline;
+  s->open_time = PyAudioTime_Now();
+  s->stopped = 1;
+
+  s->info.structVersion = 1;
+  s->info.sampleRate = sample_rate;
+  if (s->is_input) {
+    s->info.inputLatency = s->frames_per_buffer / sample_rate;
+  }
+  if (s->is_output) {
+    s->info.outputLatency =
+        (callback ? s->frames_per_buffer : s->buffer_frames) / sample_rate;
+  }
+
+  if (s->is_input && open_input(s, config) < 0) {
+    null_close(s);
+    return NULL;
+  }
+
+  if (s->is_output && config->output_path != NULL) {
+    s->output_file = fopen(config->output_path, "wb");
+    if (s->output_file == NULL) {
+      PyErr_SetFromErrnoWithFilename(PyExc_IOError, config->output_path);
+      null_close(s);
+      return NULL;
+    }
+  }
+  s->keep_output =
+      s->offline && s->is_output && config->output_path == NULL;
+
+  if (callback != NULL) {
+    size_t buffer_size = (size_t)s->frames_per_buffer * s->frame_size;
+    if (s->is_input) {
+      s->input_buffer = (char *)malloc(buffer_size);
+    }
+    if (s->is_output) {
+      s->output_buffer = (char *)calloc(1, buffer_size);
+    }
+    if ((s->is_input && s->input_buffer == NULL) ||
+        (s->is_output && s->output_buffer == NULL)) {
+      null_close(s);
+      PyErr_NoMemory();
+      return NULL;
+    }
+    s->buffer_capacity = s->frames_per_buffer;
+  }
+  if (config->trace_path != NULL && open_trace(s, config->trace_path) < 0) {
+    null_close(s);
+    return NULL;
+  }
+  return s;
+}
+
+PyObject *PyAudioNull_TakeOutput(PaStream *stream) {
+  NullStream *s = (NullStream *)stream;
+  PyAudioMutex_Lock(&s->lock);
+  char *data = s->output_data;
+  size_t size = s->output_size;
+  int lost = s->output_lost;
+  s->output_data = NULL;
+  s->output_size = 0;
+  s->output_capacity = 0;
+  s->output_lost = 0;
+  PyAudioMutex_Unlock(&s->lock);
+
+  if (lost) {
+    free(data);
+    PyErr_SetString(PyExc_MemoryError,
+                    "Not enough memory to keep the virtual device output");
+    return NULL;
+  }
+  PyObject *output = PyBytes_FromStringAndSize(data, (Py_ssize_t)size);
+  free(data);
+  return output;
+}
@@ -0,0 +1,68 @@
+// Virtual null device: a stream backend without audio hardware.
+//
+// A null device stream behaves like a PortAudio stream, so that streams
+// exercise the same callback and blocking code paths with it, but its clock
+// is a timer: callback-mode streams are driven from a thread of their own,
+// paced at the sample rate or as fast as possible, and blocking reads and
+// writes wait for that clock likewise. Its input plays silence, a test tone,
+// or frames from a file or buffer, and its output may be captured to a file.
+// This makes streams testable and measurable on headless machines.
+//
+// In offline mode, the device runs as fast as possible through its input
+// once, then completes the stream, and keeps the output in memory unless it
+// goes to a file: callbacks then process recordings faster than real time.
+
+#ifndef NULL_DEVICE_H_
+#define NULL_DEVICE_H_
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+typedef struct {
+  // Whether the clock runs in real time at the sample rate, rather than as
+  // fast as possible.
+  int realtime;
+  // Whether input plays once, rather than in a loop, and output without
+  // output_path is kept in memory.
+  int offline;
+  // Input: "silence", "tone" (a 440 Hz sine at half scale), or the path of a
+  // file of raw frames in the stream's format, played in a loop. NULL plays
+  // silence.
+  const char *input;
+  // Input frames to play (copied) instead of input, or NULL.
+  const char *input_data;
+  Py_ssize_t input_size;
+  // Path of a file to write output frames to, or NULL to discard them.
+  const char *output_path;
+  // Path of a callback trace (see stream_trace.h) to replay, or NULL. Offline
+  // callback-mode streams only: each period then takes its frame count, time
+  // info, status flags and input (or silence) from the trace, and the stream
+  // completes at its end.
+  const char *trace_path;
+} PyAudioNullConfig;
+
+// Parses a virtual_device mode ("realtime", "fast" or "offline") into config.
+// Returns 0, or -1 with a ValueError set.
+int PyAudioNull_ParseMode(const char *mode, PyAudioNullConfig *config);
+
+// Opens a null device stream, like Pa_OpenStream(), for the channel count and
+// sample format of the given parameters (their device is ignored). A
+// frames_per_buffer of paFramesPerBufferUnspecified selects 256 frames. Must
+// be called with the GIL held. Returns NULL with an exception set on failure.
+// Operate on the stream through PyAudioNullBackend.
+PaStream *PyAudioNull_OpenStream(const PaStreamParameters *input_parameters,
+                                 const PaStreamParameters *output_parameters,
+                                 double sample_rate,
+                                 unsigned long frames_per_buffer,
+                                 PaStreamCallback *callback, void *user_data,
+                                 const PyAudioNullConfig *config);
+
+// Returns the output an offline stream kept in memory since the last call, as
+// bytes. Must be called with the GIL held. Returns NULL with an exception set
+// on failure.
+PyObject *PyAudioNull_TakeOutput(PaStream *stream);
+
+#endif  // NULL_DEVICE_H_
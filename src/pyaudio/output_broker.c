@@ -0,0 +1,979 @@
+// For accept4, memfd_create and pipe2.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include "output_broker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "sync.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Maximum number of simultaneously connected clients.
+#define MAX_CLIENTS 32
+
+// Maximum time to wait without the GIL before checking for signals (e.g.,
+// KeyboardInterrupt), in seconds.
+#define SIGNAL_CHECK_INTERVAL 0.1
+
+// Frame data starts on a cache line boundary.
+#define RING_HEADER_SIZE \
+  ((sizeof(PyAudioBrokerRingHeader) + 63) & ~(size_t)63)
+
+typedef struct {
+  // 1 while the callback may mix this client (atomic).
+  volatile long active;
+  PyAudioBrokerRingHeader *ring;
+  size_t size;
+  int sock;
+  // Whether the client had frames in the previous callback. Only accessed by
+  // the callback.
+  int playing;
+} ClientSlot;
+
+struct PyAudioBroker {
+  PaSampleFormat format;
+  unsigned int channels;
+  unsigned int frame_size;
+  double sample_rate;
+  double latency;
+  uint64_t client_frames;
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  int listen_fd;
+  // Written to stop the service thread.
+  int wake_pipe[2];
+  pthread_t thread;
+  // Set while the callback is mixing (atomic); see remove_client.
+  volatile long mixing;
+  ClientSlot clients[MAX_CLIENTS];
+};
+
+static void futex_wake(volatile uint32_t *word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static void futex_wait(volatile uint32_t *word, uint32_t expected,
+                       double timeout) {
+  struct timespec ts;
+  ts.tv_sec = (time_t)timeout;
+  ts.tv_nsec = (long)((timeout - (double)ts.tv_sec) * 1e9);
+  syscall(SYS_futex, word, FUTEX_WAIT, expected, &ts, NULL, 0);
+}
+
+static void wake_client(PyAudioBrokerRingHeader *ring) {
+  PyAudioAtomic_AddU32(&ring->seq, 1);
+  if (PyAudioAtomic_LoadU32(&ring->waiters) > 0) {
+    futex_wake(&ring->seq);
+  }
+}
+
+/*************************************************************
+ * Mixing
+ *************************************************************/
+
+// Adds num_samples samples from src into dst, saturating.
+static void mix_samples(PaSampleFormat format, char *dst, const char *src,
+                        size_t num_samples) {
+  switch (format) {
+    case paInt16: {
+      int16_t *d = (int16_t *)dst;
+      const int16_t *s = (const int16_t *)src;
+      for (size_t i = 0; i < num_samples; i++) {
+        int32_t sum = (int32_t)d[i] + s[i];
+        d[i] = (int16_t)(sum > INT16_MAX   ? INT16_MAX
+                         : sum < INT16_MIN ? INT16_MIN
+                                           : sum);
+      }
+      break;
+    }
+    case paInt32: {
+      int32_t *d = (int32_t *)dst;
+      const int32_t *s = (const int32_t *)src;
+      for (size_t i = 0; i < num_samples; i++) {
+        int64_t sum = (int64_t)d[i] + s[i];
+        d[i] = (int32_t)(sum > INT32_MAX   ? INT32_MAX
+                         : sum < INT32_MIN ? INT32_MIN
+                                           : sum);
+      }
+      break;
+    }
+    case paFloat32: {
+      float *d = (float *)dst;
+      const float *s = (const float *)src;
+      for (size_t i = 0; i < num_samples; i++) {
+        float sum = d[i] + s[i];
+        d[i] = sum > 1.0f ? 1.0f : sum < -1.0f ? -1.0f : sum;
+      }
+      break;
+    }
+  }
+}
+
+static void mix_client(PyAudioBroker *broker, ClientSlot *client, char *output,
+                       unsigned long frame_count) {
+  PyAudioBrokerRingHeader *ring = client->ring;
+  // Only trust the broker's own copy of the ring geometry, since clients can
+  // write to the header.
+  uint64_t capacity = broker->client_frames;
+  uint64_t read_pos = ring->read_pos;
+  uint64_t available = PyAudioAtomic_LoadU64(&ring->write_pos) - read_pos;
+  if (available > capacity) {
+    available = capacity;
+  }
+
+  // Running short while playing (as opposed to being idle) is an underflow.
+  if (available < frame_count && (client->playing || available > 0)) {
+    PyAudioAtomic_AddU32(&ring->underflows, 1);
+  }
+  client->playing = available > 0;
+  if (available == 0) {
+    return;
+  }
+
+  uint64_t num_frames = available < frame_count ? available : frame_count;
+  const char *data = (const char *)ring + RING_HEADER_SIZE;
+  uint64_t index = read_pos % capacity;
+  uint64_t first = capacity - index;
+  if (first > num_frames) {
+    first = num_frames;
+  }
+  mix_samples(broker->format, output, data + index * broker->frame_size,
+              (size_t)(first * broker->channels));
+  mix_samples(broker->format, output + first * broker->frame_size, data,
+              (size_t)((num_frames - first) * broker->channels));
+
+  PyAudioAtomic_StoreU64(&ring->read_pos, read_pos + num_frames);
+  wake_client(ring);
+}
+
+void PyAudioBroker_Mix(PyAudioBroker *broker, void *output,
+                       unsigned long frame_count) {
+  PyAudioAtomic_StoreLong(&broker->mixing, 1);
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (PyAudioAtomic_LoadLong(&broker->clients[i].active)) {
+      mix_client(broker, &broker->clients[i], (char *)output, frame_count);
+    }
+  }
+  PyAudioAtomic_StoreLong(&broker->mixing, 0);
+}
+
+/*************************************************************
+ * Service thread
+ *************************************************************/
+
+static void release_client(ClientSlot *client) {
+  if (client->ring != NULL) {
+    PyAudioAtomic_StoreU32(&client->ring->closed, 1);
+    wake_client(client->ring);
+    munmap(client->ring, client->size);
+    client->ring = NULL;
+  }
+  if (client->sock >= 0) {
+    close(client->sock);
+    client->sock = -1;
+  }
+}
+
+static void remove_client(PyAudioBroker *broker, ClientSlot *client) {
+  PyAudioAtomic_StoreLong(&client->active, 0);
+  // Both stores and loads are sequentially consistent: once mixing reads 0,
+  // any later callback observes active == 0, so the ring can be unmapped.
+  while (PyAudioAtomic_LoadLong(&broker->mixing)) {
+    usleep(500);
+  }
+  release_client(client);
+}
+
+static void refuse(int sock, PaError status) {
+  PyAudioBrokerReply reply;
+  memset(&reply, 0, sizeof(reply));
+  reply.magic = PYAUDIO_BROKER_MAGIC;
+  reply.version = PYAUDIO_BROKER_VERSION;
+  reply.status = status;
+  send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+  close(sock);
+}
+
+static void accept_client(PyAudioBroker *broker) {
+  int sock = accept4(broker->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  if (sock < 0) {
+    return;
+  }
+
+  // Clients send their request right after connecting; don't let a
+  // misbehaving one stall the service thread.
+  struct timeval tv = {1, 0};
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  PyAudioBrokerRequest request;
+  if (recv(sock, &request, sizeof(request), MSG_WAITALL) != sizeof(request) ||
+      request.magic != PYAUDIO_BROKER_MAGIC) {
+    close(sock);
+    return;
+  }
+  if (request.version != PYAUDIO_BROKER_VERSION) {
+    refuse(sock, paIncompatibleStreamHostApi);
+    return;
+  }
+
+  ClientSlot *client = NULL;
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (broker->clients[i].sock < 0) {
+      client = &broker->clients[i];
+      break;
+    }
+  }
+  if (client == NULL) {
+    refuse(sock, paDeviceUnavailable);
+    return;
+  }
+
+  size_t size =
+      RING_HEADER_SIZE + (size_t)(broker->client_frames * broker->frame_size);
+  int fd = memfd_create("pyaudio-broker", MFD_CLOEXEC);
+  if (fd < 0) {
+    refuse(sock, paInsufficientMemory);
+    return;
+  }
+  void *addr = MAP_FAILED;
+  if (ftruncate(fd, (off_t)size) == 0) {
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (addr == MAP_FAILED) {
+    close(fd);
+    refuse(sock, paInsufficientMemory);
+    return;
+  }
+
+  PyAudioBrokerRingHeader *ring = (PyAudioBrokerRingHeader *)addr;
+  ring->magic = PYAUDIO_BROKER_MAGIC;
+  ring->version = PYAUDIO_BROKER_VERSION;
+  ring->header_size = (uint32_t)RING_HEADER_SIZE;
+  ring->frame_size = broker->frame_size;
+  ring->capacity = broker->client_frames;
+
+  PyAudioBrokerReply reply;
+  memset(&reply, 0, sizeof(reply));
+  reply.magic = PYAUDIO_BROKER_MAGIC;
+  reply.version = PYAUDIO_BROKER_VERSION;
+  reply.status = paNoError;
+  reply.channels = broker->channels;
+  reply.sample_format = broker->format;
+  reply.sample_rate = broker->sample_rate;
+  reply.latency = broker->latency;
+
+  struct iovec iov = {&reply, sizeof(reply)};
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  close(fd);
+  if (sent != sizeof(reply)) {
+    munmap(addr, size);
+    close(sock);
+    return;
+  }
+
+  client->ring = ring;
+  client->size = size;
+  client->sock = sock;
+  client->playing = 0;
+  PyAudioAtomic_StoreLong(&client->active, 1);
+}
+
+static void *service_thread(void *arg) {
+  PyAudioBroker *broker = (PyAudioBroker *)arg;
+  struct pollfd fds[MAX_CLIENTS + 2];
+
+  while (1) {
+    int num_fds = 0;
+    fds[num_fds].fd = broker->wake_pipe[0];
+    fds[num_fds++].events = POLLIN;
+    fds[num_fds].fd = broker->listen_fd;
+    fds[num_fds++].events = POLLIN;
+    int slot_of_fd[MAX_CLIENTS + 2];
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+      if (broker->clients[i].sock >= 0) {
+        slot_of_fd[num_fds] = i;
+        fds[num_fds].fd = broker->clients[i].sock;
+        fds[num_fds++].events = POLLIN;
+      }
+    }
+
+    if (poll(fds, (nfds_t)num_fds, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    if (fds[0].revents) {
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      accept_client(broker);
+    }
+    for (int i = 2; i < num_fds; i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      // Clients never send anything after the handshake, so any event means
+      // the client went away.
+      char byte;
+      if (recv(fds[i].fd, &byte, 1, MSG_DONTWAIT) <= 0 ||
+          (fds[i].revents & (POLLHUP | POLLERR))) {
+        remove_client(broker, &broker->clients[slot_of_fd[i]]);
+      }
+    }
+  }
+  return NULL;
+}
+
+/*************************************************************
+ * Broker lifecycle
+ *************************************************************/
+
+// Binds a listening socket at path, replacing a stale socket file left by a
+// broker that exited without cleaning up. Returns the socket, or -1 with errno
+// set.
+static int listen_at(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (errno != EADDRINUSE) {
+      close(fd);
+      return -1;
+    }
+    // Only take over the path if nobody is listening there.
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int live =
+        connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    close(probe);
+    if (live) {
+      close(fd);
+      errno = EADDRINUSE;
+      return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  if (listen(fd, MAX_CLIENTS) < 0) {
+    int saved_errno = errno;
+    close(fd);
+    unlink(path);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
+
+PyAudioBroker *PyAudioBroker_Create(const char *path, PaSampleFormat format,
+                                    unsigned int channels,
+                                    unsigned int frame_size,
+                                    double sample_rate, double device_latency,
+                                    uint64_t client_frames) {
+  if (format != paInt16 && format != paInt32 && format != paFloat32) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Output broker supports paInt16, paInt32 and paFloat32");
+    return NULL;
+  }
+  if (strlen(path) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+    PyErr_SetString(PyExc_ValueError, "broker_path is too long");
+    return NULL;
+  }
+
+  PyAudioBroker *broker = (PyAudioBroker *)calloc(1, sizeof(PyAudioBroker));
+  if (!broker) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  broker->format = format;
+  broker->channels = channels;
+  broker->frame_size = frame_size;
+  broker->sample_rate = sample_rate;
+  broker->client_frames = client_frames;
+  broker->latency = (double)client_frames / sample_rate + device_latency;
+  strcpy(broker->path, path);
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    broker->clients[i].sock = -1;
+  }
+
+  broker->listen_fd = listen_at(path);
+  if (broker->listen_fd < 0) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    free(broker);
+    return NULL;
+  }
+  if (pipe2(broker->wake_pipe, O_CLOEXEC) < 0) {
+    PyErr_SetFromErrno(PyExc_OSError);
+    close(broker->listen_fd);
+    unlink(path);
+    free(broker);
+    return NULL;
+  }
+  int err = pthread_create(&broker->thread, NULL, service_thread, broker);
+  if (err != 0) {
+    errno = err;
+    PyErr_SetFromErrno(PyExc_OSError);
+    close(broker->wake_pipe[0]);
+    close(broker->wake_pipe[1]);
+    close(broker->listen_fd);
+    unlink(path);
+    free(broker);
+    return NULL;
+  }
+  return broker;
+}
+
+void PyAudioBroker_Destroy(PyAudioBroker *broker) {
+  if (broker == NULL) {
+    return;
+  }
+  char byte = 0;
+  if (write(broker->wake_pipe[1], &byte, 1) == 1) {
+    pthread_join(broker->thread, NULL);
+  }
+  close(broker->wake_pipe[0]);
+  close(broker->wake_pipe[1]);
+  close(broker->listen_fd);
+  unlink(broker->path);
+  // The stream is closed, so the callback no longer mixes.
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    release_client(&broker->clients[i]);
+  }
+  free(broker);
+}
+
+/*************************************************************
+ * BrokerClient
+ *************************************************************/
+
+// Disconnects, once calls using the mapping (e.g., a write() on another
+// thread, which gives up once woken) are done with it.
+static void client_cleanup(PyAudioBrokerClient *self) {
+  PyAudioMutex_Lock(&self->lock);
+  PyAudioBrokerRingHeader *ring = self->ring;
+  size_t size = self->size;
+  int sock = self->sock;
+  self->ring = NULL;
+  self->sock = -1;
+  int in_use = self->in_use > 0;
+  PyAudioMutex_Unlock(&self->lock);
+
+  if (in_use && ring != NULL) {
+    PyAudioAtomic_StoreLong(&self->closing, 1);
+    wake_client(ring);
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    PyAudioMutex_Lock(&self->lock);
+    while (self->in_use > 0) {
+      PyAudioCond_TimedWait(&self->cond, &self->lock, -1);
+    }
+    PyAudioMutex_Unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+  }
+  if (ring != NULL) {
+    munmap(ring, size);
+  }
+  if (sock >= 0) {
+    close(sock);
+  }
+}
+
+static void client_dealloc(PyAudioBrokerClient *self) {
+  client_cleanup(self);
+  PyAudioCond_Destroy(&self->cond);
+  PyAudioMutex_Destroy(&self->lock);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+static PyObject *client_new(PyTypeObject *type, PyObject *args,
+                            PyObject *kwargs) {
+  PyAudioBrokerClient *self = (PyAudioBrokerClient *)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    self->sock = -1;
+    PyAudioMutex_Init(&self->lock);
+    PyAudioCond_Init(&self->cond);
+  }
+  return (PyObject *)self;
+}
+
+// Connects to the broker at path and maps the client ring. Returns 0, -1 with
+// errno set, or the PaError with which the broker refused the client.
+static int connect_broker(PyAudioBrokerClient *self, const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  self->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (self->sock < 0 ||
+      connect(self->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    return -1;
+  }
+
+  PyAudioBrokerRequest request = {PYAUDIO_BROKER_MAGIC,
+                                  PYAUDIO_BROKER_VERSION};
+  if (send(self->sock, &request, sizeof(request), MSG_NOSIGNAL) !=
+      sizeof(request)) {
+    return -1;
+  }
+
+  struct iovec iov = {&self->reply, sizeof(self->reply)};
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t received = recvmsg(self->sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+  if (received != sizeof(self->reply) ||
+      self->reply.magic != PYAUDIO_BROKER_MAGIC) {
+    errno = EPROTO;
+    return -1;
+  }
+  if (self->reply.status != paNoError) {
+    return self->reply.status;
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+    errno = EPROTO;
+    return -1;
+  }
+  int fd;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  off_t size = lseek(fd, 0, SEEK_END);
+  void *addr_ring = MAP_FAILED;
+  if (size >= (off_t)sizeof(PyAudioBrokerRingHeader)) {
+    addr_ring =
+        mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (addr_ring == MAP_FAILED) {
+    errno = EPROTO;
+    return -1;
+  }
+  PyAudioMutex_Lock(&self->lock);
+  PyAudioAtomic_StoreLong(&self->closing, 0);
+  self->ring = (PyAudioBrokerRingHeader *)addr_ring;
+  self->size = (size_t)size;
+  self->underflows_seen = PyAudioAtomic_LoadU32(&self->ring->underflows);
+  PyAudioMutex_Unlock(&self->lock);
+  return 0;
+}
+
+static int client_init(PyAudioBrokerClient *self, PyObject *args,
+                       PyObject *kwargs) {
+  const char *path;
+  static char *kwlist[] = {"path", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &path)) {
+    return -1;
+  }
+
+  client_cleanup(self);
+  int result;
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  result = connect_broker(self, path);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+
+  if (result != 0) {
+    if (result < -1) {
+      PyErr_SetObject(PyExc_IOError,
+                      Py_BuildValue("(i,s)", result, Pa_GetErrorText(result)));
+    } else {
+      PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    }
+    client_cleanup(self);
+    return -1;
+  }
+  return 0;
+}
+
+// Fails with an exception set if the client is closing, or the broker went
+// away.
+static int check_connected(PyAudioBrokerClient *self,
+                           PyAudioBrokerRingHeader *ring) {
+  if (PyAudioAtomic_LoadLong(&self->closing)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Client closed"));
+    return -1;
+  }
+  if (PyAudioAtomic_LoadU32(&ring->closed)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paDeviceUnavailable,
+                                  "Broker closed"));
+    return -1;
+  }
+  return 0;
+}
+
+// Brackets a use of the mapping, which keeps it mapped. begin_use() returns
+// the ring, or NULL with an exception set if the client is not connected, in
+// which case end_use() must not be called.
+static PyAudioBrokerRingHeader *begin_use(PyAudioBrokerClient *self) {
+  PyAudioMutex_Lock(&self->lock);
+  PyAudioBrokerRingHeader *ring = self->ring;
+  if (ring != NULL) {
+    self->in_use++;
+  }
+  PyAudioMutex_Unlock(&self->lock);
+  if (ring == NULL) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Client closed"));
+    return NULL;
+  }
+  return ring;
+}
+
+static void end_use(PyAudioBrokerClient *self) {
+  PyAudioMutex_Lock(&self->lock);
+  if (--self->in_use == 0) {
+    PyAudioCond_Broadcast(&self->cond);
+  }
+  PyAudioMutex_Unlock(&self->lock);
+}
+
+// Blocks until the ring has at least min_space free frames, the broker goes
+// away, the client starts closing, or timeout seconds elapse. Must be called
+// without the GIL.
+static void wait_for_space(PyAudioBrokerClient *self,
+                           PyAudioBrokerRingHeader *ring, uint64_t min_space,
+                           double timeout) {
+  double deadline = PyAudioTime_Now() + timeout;
+  while (1) {
+    uint32_t seq = PyAudioAtomic_LoadU32(&ring->seq);
+    uint64_t used = PyAudioAtomic_LoadU64(&ring->write_pos) -
+                    PyAudioAtomic_LoadU64(&ring->read_pos);
+    if (ring->capacity - used >= min_space ||
+        PyAudioAtomic_LoadU32(&ring->closed) ||
+        PyAudioAtomic_LoadLong(&self->closing)) {
+      return;
+    }
+    double remaining = deadline - PyAudioTime_Now();
+    if (remaining <= 0) {
+      return;
+    }
+    PyAudioAtomic_AddU32(&ring->waiters, 1);
+    futex_wait(&ring->seq, seq, remaining);
+    PyAudioAtomic_AddU32(&ring->waiters, (uint32_t)-1);
+  }
+}
+
+// Copies frames into the ring, waiting for room. Returns 0, or -1 with an
+// exception set. The caller must be using the mapping.
+static int write_frames(PyAudioBrokerClient *self,
+                        PyAudioBrokerRingHeader *ring, const char *src,
+                        uint64_t num_frames) {
+  char *data = (char *)ring + ring->header_size;
+  while (num_frames > 0) {
+    if (check_connected(self, ring) < 0) {
+      return -1;
+    }
+
+    // Other threads may write too, so claim the room under the lock.
+    PyAudioMutex_Lock(&self->lock);
+    uint64_t write_pos = ring->write_pos;
+    uint64_t space =
+        ring->capacity - (write_pos - PyAudioAtomic_LoadU64(&ring->read_pos));
+    uint64_t count = space < num_frames ? space : num_frames;
+    uint64_t index = write_pos % ring->capacity;
+    uint64_t first = ring->capacity - index;
+    if (first > count) {
+      first = count;
+    }
+    memcpy(data + index * ring->frame_size, src,
+           (size_t)(first * ring->frame_size));
+    memcpy(data, src + first * ring->frame_size,
+           (size_t)((count - first) * ring->frame_size));
+    PyAudioAtomic_StoreU64(&ring->write_pos, write_pos + count);
+    PyAudioMutex_Unlock(&self->lock);
+
+    src += count * ring->frame_size;
+    num_frames -= count;
+    if (space == 0) {
+      // clang-format off
+      Py_BEGIN_ALLOW_THREADS
+      wait_for_space(self, ring, 1, SIGNAL_CHECK_INTERVAL);
+      Py_END_ALLOW_THREADS
+      // clang-format on
+      if (PyErr_CheckSignals() < 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static PyObject *client_write(PyAudioBrokerClient *self, PyObject *args,
+                              PyObject *kwargs) {
+  Py_buffer frames;
+  int exception_on_underflow = 0;
+
+  static char *kwlist[] = {"frames", "exception_on_underflow", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|p", kwlist, &frames,
+                                   &exception_on_underflow)) {
+    return NULL;
+  }
+
+  PyAudioBrokerRingHeader *ring = begin_use(self);
+  if (ring == NULL) {
+    PyBuffer_Release(&frames);
+    return NULL;
+  }
+
+  int result = -1;
+  if (frames.len % ring->frame_size != 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Data must contain a whole number of frames");
+  } else {
+    result = write_frames(self, ring, (const char *)frames.buf,
+                          (uint64_t)frames.len / ring->frame_size);
+  }
+  PyBuffer_Release(&frames);
+
+  PyAudioMutex_Lock(&self->lock);
+  uint32_t underflows = PyAudioAtomic_LoadU32(&ring->underflows);
+  int underflowed = underflows != self->underflows_seen;
+  self->underflows_seen = underflows;
+  PyAudioMutex_Unlock(&self->lock);
+  end_use(self);
+  if (result < 0) {
+    return NULL;
+  }
+
+  if (exception_on_underflow && underflowed) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paOutputUnderflowed,
+                                  Pa_GetErrorText(paOutputUnderflowed)));
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *client_get_write_available(PyAudioBrokerClient *self,
+                                            PyObject *args) {
+  PyAudioBrokerRingHeader *ring = begin_use(self);
+  if (ring == NULL) {
+    return NULL;
+  }
+  PyObject *rv = NULL;
+  if (check_connected(self, ring) == 0) {
+    uint64_t used = PyAudioAtomic_LoadU64(&ring->write_pos) -
+                    PyAudioAtomic_LoadU64(&ring->read_pos);
+    rv = PyLong_FromUnsignedLongLong(ring->capacity - used);
+  }
+  end_use(self);
+  return rv;
+}
+
+// Waits until the broker consumed all frames written to the ring. Returns 1,
+// 0 on timeout, or -1 with an exception set. The caller must be using the
+// mapping.
+static int flush_frames(PyAudioBrokerClient *self,
+                        PyAudioBrokerRingHeader *ring, double timeout) {
+  double deadline = PyAudioTime_Now() + timeout;
+  while (1) {
+    if (check_connected(self, ring) < 0) {
+      return -1;
+    }
+    double wait = SIGNAL_CHECK_INTERVAL;
+    if (timeout >= 0) {
+      double remaining = deadline - PyAudioTime_Now();
+      if (remaining <= 0) {
+        return 0;
+      }
+      if (remaining < wait) {
+        wait = remaining;
+      }
+    }
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    wait_for_space(self, ring, ring->capacity, wait);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+    if (PyAudioAtomic_LoadU64(&ring->read_pos) ==
+        PyAudioAtomic_LoadU64(&ring->write_pos)) {
+      return 1;
+    }
+    if (PyErr_CheckSignals() < 0) {
+      return -1;
+    }
+  }
+}
+
+static PyObject *client_flush(PyAudioBrokerClient *self, PyObject *args) {
+  double timeout = -1;
+  if (!PyArg_ParseTuple(args, "|d", &timeout)) {
+    return NULL;
+  }
+  PyAudioBrokerRingHeader *ring = begin_use(self);
+  if (ring == NULL) {
+    return NULL;
+  }
+  int result = flush_frames(self, ring, timeout);
+  end_use(self);
+  if (result < 0) {
+    return NULL;
+  }
+  return PyBool_FromLong(result);
+}
+
+static PyObject *client_close(PyAudioBrokerClient *self, PyObject *args) {
+  client_cleanup(self);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *get_format(PyAudioBrokerClient *self, void *closure) {
+  return PyLong_FromUnsignedLongLong(self->reply.sample_format);
+}
+
+static PyObject *get_channels(PyAudioBrokerClient *self, void *closure) {
+  return PyLong_FromUnsignedLong(self->reply.channels);
+}
+
+static PyObject *get_rate(PyAudioBrokerClient *self, void *closure) {
+  return PyFloat_FromDouble(self->reply.sample_rate);
+}
+
+static PyObject *get_latency(PyAudioBrokerClient *self, void *closure) {
+  return PyFloat_FromDouble(self->reply.latency);
+}
+
+static PyObject *get_underflows(PyAudioBrokerClient *self, void *closure) {
+  // The mapping stays until closing clears ring under the lock.
+  PyAudioMutex_Lock(&self->lock);
+  uint32_t underflows = self->ring == NULL
+                            ? self->underflows_seen
+                            : PyAudioAtomic_LoadU32(&self->ring->underflows);
+  PyAudioMutex_Unlock(&self->lock);
+  return PyLong_FromUnsignedLong(underflows);
+}
+
+static PyObject *get_closed(PyAudioBrokerClient *self, void *closure) {
+  PyAudioMutex_Lock(&self->lock);
+  int closed = self->ring == NULL;
+  PyAudioMutex_Unlock(&self->lock);
+  return PyBool_FromLong(closed);
+}
+
+static int antiset(PyAudioBrokerClient *self, PyObject *value, void *closure) {
+  /* read-only: do not allow users to change values */
+  PyErr_SetString(PyExc_AttributeError,
+                  "Fields read-only: cannot modify values");
+  return -1;
+}
+
+static PyMethodDef client_methods[] = {
+    {"write", (PyCFunction)client_write, METH_VARARGS | METH_KEYWORDS,
+     "Writes frames, waiting for room in the client ring"},
+
+    {"get_write_available", (PyCFunction)client_get_write_available,
+     METH_NOARGS,
+     "Returns the number of frames that can be written without waiting"},
+
+    {"flush", (PyCFunction)client_flush, METH_VARARGS,
+     "Waits until the broker has consumed all written frames"},
+
+    {"close", (PyCFunction)client_close, METH_NOARGS,
+     "Disconnects from the broker"},
+
+    {NULL, NULL, 0, NULL}};
+
+static PyGetSetDef client_get_setters[] = {
+    {"format", (getter)get_format, (setter)antiset, "sample format", NULL},
+    {"channels", (getter)get_channels, (setter)antiset, "number of channels",
+     NULL},
+    {"rate", (getter)get_rate, (setter)antiset, "sample rate", NULL},
+    {"latency", (getter)get_latency, (setter)antiset,
+     "worst-case output latency, in seconds", NULL},
+    {"underflows", (getter)get_underflows, (setter)antiset,
+     "number of times the broker ran out of frames", NULL},
+    {"closed", (getter)get_closed, (setter)antiset,
+     "whether the client is disconnected", NULL},
+    {NULL}};
+
+static PyType_Slot client_slots[] = {
+    {Py_tp_dealloc, client_dealloc},
+    {Py_tp_doc, (void *)PyDoc_STR("Client of an output broker")},
+    {Py_tp_methods, client_methods},
+    {Py_tp_getset, client_get_setters},
+    {Py_tp_init, client_init},
+    {Py_tp_new, client_new},
+    {0, NULL}};
+
+PyType_Spec PyAudioBrokerClientSpec = {
+    .name = "_portaudio.BrokerClient",
+    .basicsize = sizeof(PyAudioBrokerClient),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = client_slots,
+};
+
+#else  // __linux__
+
+PyAudioBroker *PyAudioBroker_Create(const char *path, PaSampleFormat format,
+                                    unsigned int channels,
+                                    unsigned int frame_size,
+                                    double sample_rate, double device_latency,
+                                    uint64_t client_frames) {
+  PyErr_SetString(PyExc_NotImplementedError,
+                  "Output broker requires Linux");
+  return NULL;
+}
+
+void PyAudioBroker_Mix(PyAudioBroker *broker, void *output,
+                       unsigned long frame_count) {}
+
+void PyAudioBroker_Destroy(PyAudioBroker *broker) {}
+
+#endif  // __linux__
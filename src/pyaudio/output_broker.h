@@ -0,0 +1,127 @@
+// Output broker, so several processes can share one (exclusive) output device.
+//
+// A broker is an output stream opened with broker_path. It listens on a Unix
+// socket at that path; each client process connects and receives, over the
+// socket, a file descriptor of a private shared-memory ring (memfd). Clients
+// write frames into their ring; the stream's callback mixes all rings into the
+// device output, in C, without the GIL. A client leaves by closing its socket.
+//
+// Handshake: the client sends a PyAudioBrokerRequest; the broker replies with
+// a PyAudioBrokerReply, with the ring's file descriptor attached (SCM_RIGHTS)
+// if status is paNoError.
+//
+// Each client ring is a single-producer (client), single-consumer (broker)
+// FIFO. Its capacity bounds the latency the broker adds on top of the
+// device's, and is reported to clients.
+//
+// Linux only.
+
+#ifndef OUTPUT_BROKER_H_
+#define OUTPUT_BROKER_H_
+
+#include <stdint.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "sync.h"
+
+// "PABR"
+#define PYAUDIO_BROKER_MAGIC 0x52424150u
+#define PYAUDIO_BROKER_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+} PyAudioBrokerRequest;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  // paNoError, or why the client was refused.
+  int32_t status;
+  uint32_t channels;
+  uint64_t sample_format;
+  double sample_rate;
+  // Worst-case latency from a client write to the device output, in seconds:
+  // the ring capacity plus the device's output latency.
+  double latency;
+} PyAudioBrokerReply;
+
+// Header of a client ring, at the start of the memfd. Frame data follows at
+// header_size.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t frame_size;
+  // Capacity, in frames.
+  uint64_t capacity;
+  // Total frames written by the client (atomic).
+  volatile uint64_t write_pos;
+  // Total frames consumed by the broker (atomic).
+  volatile uint64_t read_pos;
+  // Futex word (atomic), incremented by the broker after consuming frames and
+  // on close.
+  volatile uint32_t seq;
+  // Number of client threads blocked on seq (atomic).
+  volatile uint32_t waiters;
+  // Set once the broker is gone (atomic).
+  volatile uint32_t closed;
+  // Number of times the broker ran out of frames while the client was
+  // playing (atomic).
+  volatile uint32_t underflows;
+} PyAudioBrokerRingHeader;
+
+typedef struct PyAudioBroker PyAudioBroker;
+
+// Starts a broker for a stream with the given output format, listening at
+// path. Each client ring holds client_frames frames. Returns NULL with an
+// exception set on failure.
+PyAudioBroker *PyAudioBroker_Create(const char *path, PaSampleFormat format,
+                                    unsigned int channels,
+                                    unsigned int frame_size,
+                                    double sample_rate, double device_latency,
+                                    uint64_t client_frames);
+// Adds the clients' pending frames into output, with saturation. Never blocks;
+// called from the PortAudio callback thread.
+void PyAudioBroker_Mix(PyAudioBroker *broker, void *output,
+                       unsigned long frame_count);
+// Stops accepting clients, disconnects all clients, and removes the socket.
+// The stream must already be closed.
+void PyAudioBroker_Destroy(PyAudioBroker *broker);
+
+// Client side: _portaudio.BrokerClient.
+typedef struct {
+  // clang-format off
+  PyObject_HEAD
+  // clang-format on
+  // Connection to the broker. -1 until connected, or once closed.
+  int sock;
+  // Mapped client ring. NULL until connected, or once closed.
+  PyAudioBrokerRingHeader *ring;
+  size_t size;
+  PyAudioBrokerReply reply;
+  // Value of ring->underflows at the previous write.
+  uint32_t underflows_seen;
+  // Guards the fields above, for threads sharing the client, and serializes
+  // writes into the ring. Never held while waiting for room.
+  PyAudioMutex lock;
+  // Number of calls using the mapping (e.g., a write() waiting for room
+  // without the GIL), which closing waits for before unmapping it. Guarded by
+  // lock, and signalled on cond when it drops to 0.
+  long in_use;
+  PyAudioCond cond;
+  // Set (atomic) once closing, so that calls waiting for room give up.
+  volatile long closing;
+} PyAudioBrokerClient;
+
+#ifdef __linux__
+#define PYAUDIO_HAVE_OUTPUT_BROKER
+extern PyType_Spec PyAudioBrokerClientSpec;
+#endif
+
+#endif  // OUTPUT_BROKER_H_
@@ -0,0 +1,159 @@
+#include "probes.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "pythread.h"
+
+#include "sync.h"
+
+#define DEFAULT_CAPACITY 65536
+#define MAX_CAPACITY (1u << 24)
+
+typedef struct {
+  // Index of the event in the ring, plus 1, once written; 0 while writing
+  // (atomic).
+  volatile uint32_t sequence;
+  char phase;
+  const char *event;
+  double time;
+  unsigned long thread;
+  const void *stream;
+  int64_t arg;
+} ProbeEvent;
+
+volatile long PyAudioProbes_Recording = 0;
+
+// Start, stop and reading run under lock. Recorders only use the ring while
+// counted in writers, so stopping can wait for them before freeing it.
+static PyAudioStaticMutex lock = PYAUDIO_STATIC_MUTEX_INIT;
+static ProbeEvent *events = NULL;
+static uint32_t capacity = 0;
+// Number of events recorded since the start, wrapping around (atomic).
+static volatile uint32_t next_index = 0;
+static volatile long writers = 0;
+
+static unsigned long current_thread(void) {
+#ifdef PY_HAVE_THREAD_NATIVE_ID
+  return PyThread_get_thread_native_id();
+#else
+  return PyThread_get_thread_ident();
+#endif
+}
+
+void PyAudioProbes_Record(const char *event, char phase, const void *stream,
+                          int64_t arg) {
+  PyAudioAtomic_AddLong(&writers, 1);
+  if (PyAudioAtomic_LoadLong(&PyAudioProbes_Recording)) {
+    uint32_t index = PyAudioAtomic_AddU32(&next_index, 1) - 1;
+    ProbeEvent *e = &events[index & (capacity - 1)];
+    PyAudioAtomic_StoreU32(&e->sequence, 0);
+    e->phase = phase;
+    e->event = event;
+    e->time = PyAudioTime_Now();
+    e->thread = current_thread();
+    e->stream = stream;
+    e->arg = arg;
+    PyAudioAtomic_StoreU32(&e->sequence, index + 1);
+  }
+  PyAudioAtomic_AddLong(&writers, -1);
+}
+
+// Stops recording, and waits for recorders in progress. Called under lock.
+static void stop_recording(void) {
+  PyAudioAtomic_StoreLong(&PyAudioProbes_Recording, 0);
+  while (PyAudioAtomic_LoadLong(&writers) != 0) {
+  }
+}
+
+PyObject *PyAudio_StartProbeRecording(PyObject *self, PyObject *args) {
+  unsigned int requested = DEFAULT_CAPACITY;
+  if (!PyArg_ParseTuple(args, "|I", &requested)) {
+    return NULL;
+  }
+  if (requested == 0 || requested > MAX_CAPACITY) {
+    PyErr_SetString(PyExc_ValueError, "Invalid probe event capacity");
+    return NULL;
+  }
+  // A power of two, so that indices wrap around with the ring.
+  uint32_t new_capacity = 1;
+  while (new_capacity < requested) {
+    new_capacity <<= 1;
+  }
+
+  PyAudioStaticMutex_Lock(&lock);
+  stop_recording();
+  if (new_capacity != capacity) {
+    free(events);
+    capacity = 0;
+    events = (ProbeEvent *)malloc(new_capacity * sizeof(ProbeEvent));
+    if (events == NULL) {
+      PyAudioStaticMutex_Unlock(&lock);
+      return PyErr_NoMemory();
+    }
+    capacity = new_capacity;
+  }
+  for (uint32_t i = 0; i < capacity; i++) {
+    events[i].sequence = 0;
+  }
+  PyAudioAtomic_StoreU32(&next_index, 0);
+  PyAudioAtomic_StoreLong(&PyAudioProbes_Recording, 1);
+  PyAudioStaticMutex_Unlock(&lock);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyObject *PyAudio_StopProbeRecording(PyObject *self, PyObject *args) {
+  PyAudioStaticMutex_Lock(&lock);
+  stop_recording();
+  PyAudioStaticMutex_Unlock(&lock);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyObject *PyAudio_GetProbeEvents(PyObject *self, PyObject *args) {
+  PyObject *list = PyList_New(0);
+  if (list == NULL) {
+    return NULL;
+  }
+
+  PyAudioStaticMutex_Lock(&lock);
+  uint32_t end = PyAudioAtomic_LoadU32(&next_index);
+  // The ring keeps the last capacity events. Any overwritten while reading
+  // are skipped.
+  uint32_t count = end < capacity ? end : capacity;
+  for (uint32_t index = end - count; index != end; index++) {
+    ProbeEvent *e = &events[index & (capacity - 1)];
+    if (PyAudioAtomic_LoadU32(&e->sequence) != index + 1) {
+      continue;
+    }
+    ProbeEvent copy = *e;
+    if (PyAudioAtomic_LoadU32(&e->sequence) != index + 1) {
+      continue;
+    }
+    // clang-format off
+    PyObject *item = Py_BuildValue("(sCdknL)",
+                                   copy.event,
+                                   (int)copy.phase,
+                                   copy.time,
+                                   copy.thread,
+                                   (Py_ssize_t)(intptr_t)copy.stream,
+                                   (long long)copy.arg);
+    // clang-format on
+    if (item == NULL || PyList_Append(list, item) < 0) {
+      Py_XDECREF(item);
+      Py_DECREF(list);
+      PyAudioStaticMutex_Unlock(&lock);
+      return NULL;
+    }
+    Py_DECREF(item);
+  }
+  PyAudioStaticMutex_Unlock(&lock);
+  return list;
+}
@@ -0,0 +1,83 @@
+// Static tracepoints on the audio hot path, to tie profiles to stream periods.
+//
+// Each probe is a USDT probe of provider "pyaudio", when built with
+// <sys/sdt.h> (systemtap-sdt-dev), for perf, bpftrace or SystemTap:
+//
+//   callback__entry(stream, frame_count)   a PortAudio callback begins
+//   gil__acquired(stream, 0)               it holds the GIL
+//   python__returned(stream, 0)            the Python callback returned
+//   memcpy__done(stream, bytes)            its output is copied
+//   callback__return(stream, result)       the PortAudio callback returns
+//   read__begin(stream, frames), read__end(stream, error)
+//   write__begin(stream, frames), write__end(stream, error)
+//   xrun(stream, status flags or error)    an underflow or overflow
+//
+// USDT probes are a nop until attached. Define PYAUDIO_NO_USDT to leave them
+// out.
+//
+// Probes also record events into a process-wide ring while recording is
+// started (see PyAudioProbes_Start()), to export as a Chrome trace. While
+// stopped, a probe costs one predictable branch.
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+#include <stdint.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+
+#if !defined(PYAUDIO_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PYAUDIO_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef PYAUDIO_HAVE_USDT
+#define PYAUDIO_USDT(probe, stream, arg) \
+  DTRACE_PROBE2(pyaudio, probe, (void *)(stream), (int64_t)(arg))
+#else
+#define PYAUDIO_USDT(probe, stream, arg) ((void)0)
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PYAUDIO_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define PYAUDIO_UNLIKELY(x) (x)
+#endif
+
+// Whether events are being recorded. Read without synchronization by probes;
+// PyAudioProbes_Record() checks again.
+extern volatile long PyAudioProbes_Recording;
+
+// Fires USDT probe `probe`, and records a Chrome trace event named `event`,
+// of phase 'B' (begin), 'E' (end) or 'i' (instant), if recording.
+#define PYAUDIO_PROBE(probe, event, phase, stream, arg)             \
+  do {                                                              \
+    PYAUDIO_USDT(probe, stream, arg);                               \
+    if (PYAUDIO_UNLIKELY(PyAudioProbes_Recording)) {                \
+      PyAudioProbes_Record(event, phase, (stream), (int64_t)(arg)); \
+    }                                                               \
+  } while (0)
+
+// Records an event, from any thread, without blocking. event must be a
+// string literal.
+void PyAudioProbes_Record(const char *event, char phase, const void *stream,
+                          int64_t arg);
+
+// Module functions.
+// Starts recording events into a ring of (at least) the given number of
+// events, discarding those recorded so far.
+PyObject *PyAudio_StartProbeRecording(PyObject *self, PyObject *args);
+// Stops recording. Recorded events remain until the next start.
+PyObject *PyAudio_StopProbeRecording(PyObject *self, PyObject *args);
+// Returns the recorded events, oldest first, as a list of
+// (event, phase, time, thread, stream, arg) tuples, where time is in seconds
+// of a monotonic clock (see PyAudioTime_Now()), thread a native thread ID and
+// stream an address identifying the stream.
+PyObject *PyAudio_GetProbeEvents(PyObject *self, PyObject *args);
+
+#endif  // PROBES_H_
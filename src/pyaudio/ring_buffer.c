@@ -0,0 +1,200 @@
+#include "ring_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sync.h"
+
+PyAudioRing *PyAudioRing_Create(uint64_t capacity, unsigned int frame_size) {
+  if (capacity == 0 || frame_size == 0) {
+    return NULL;
+  }
+
+  PyAudioRing *ring = (PyAudioRing *)calloc(1, sizeof(PyAudioRing));
+  if (!ring) {
+    return NULL;
+  }
+
+  ring->data = (char *)malloc((size_t)(capacity * frame_size));
+  if (!ring->data) {
+    free(ring);
+    return NULL;
+  }
+  ring->capacity = capacity;
+  ring->frame_size = frame_size;
+  ring->refcount = 1;
+  PyAudioMutex_Init(&ring->lock);
+  PyAudioCond_Init(&ring->cond);
+  return ring;
+}
+
+void PyAudioRing_Incref(PyAudioRing *ring) {
+  PyAudioAtomic_AddLong(&ring->refcount, 1);
+}
+
+void PyAudioRing_Decref(PyAudioRing *ring) {
+  if (ring == NULL || PyAudioAtomic_AddLong(&ring->refcount, -1) > 0) {
+    return;
+  }
+  PyAudioCond_Destroy(&ring->cond);
+  PyAudioMutex_Destroy(&ring->lock);
+  free(ring->data);
+  free(ring);
+}
+
+static void wake_readers(PyAudioRing *ring) {
+  // The store to write_pos/closed and the load of waiters are sequentially
+  // consistent, so either a reader about to wait observes the new state, or
+  // we observe the waiter and take the lock it holds until it sleeps.
+  if (PyAudioAtomic_LoadLong(&ring->waiters) > 0) {
+    PyAudioMutex_Lock(&ring->lock);
+    PyAudioCond_Broadcast(&ring->cond);
+    PyAudioMutex_Unlock(&ring->lock);
+  }
+}
+
+void PyAudioRing_Close(PyAudioRing *ring) {
+  PyAudioAtomic_StoreLong(&ring->closed, 1);
+  wake_readers(ring);
+}
+
+void PyAudioRingView_Write(const PyAudioRingView *view, const char *frames,
+                           uint64_t num_frames) {
+  uint64_t pos = *view->write_pos;
+  if (num_frames > view->capacity) {
+    // Only the newest frames fit.
+    pos += num_frames - view->capacity;
+    frames += (num_frames - view->capacity) * view->frame_size;
+    num_frames = view->capacity;
+  }
+
+  // Announce which frames are about to be overwritten before touching them.
+  // The fence keeps the copy below from becoming visible before the store.
+  PyAudioAtomic_StoreU64(view->reserve_pos, pos + num_frames);
+  PyAudioAtomic_ReleaseFence();
+
+  uint64_t index = pos % view->capacity;
+  uint64_t first = view->capacity - index;
+  if (first > num_frames) {
+    first = num_frames;
+  }
+  memcpy(view->data + index * view->frame_size, frames,
+         (size_t)(first * view->frame_size));
+  memcpy(view->data, frames + first * view->frame_size,
+         (size_t)((num_frames - first) * view->frame_size));
+
+  PyAudioAtomic_StoreU64(view->write_pos, pos + num_frames);
+}
+
+uint64_t PyAudioRingView_Available(const PyAudioRingView *view,
+                                   uint64_t *cursor, uint64_t *dropped) {
+  uint64_t write_pos = PyAudioAtomic_LoadU64(view->write_pos);
+  uint64_t reserve_pos = PyAudioAtomic_LoadU64(view->reserve_pos);
+  uint64_t oldest =
+      reserve_pos > view->capacity ? reserve_pos - view->capacity : 0;
+  if (*cursor < oldest) {
+    *dropped += oldest - *cursor;
+    *cursor = oldest;
+  }
+  return write_pos > *cursor ? write_pos - *cursor : 0;
+}
+
+uint64_t PyAudioRingView_Read(const PyAudioRingView *view, uint64_t *cursor,
+                              char *buffer, uint64_t max_frames,
+                              uint64_t *dropped) {
+  uint64_t num_frames = PyAudioRingView_Available(view, cursor, dropped);
+  if (num_frames > max_frames) {
+    num_frames = max_frames;
+  }
+  if (num_frames == 0) {
+    return 0;
+  }
+
+  uint64_t index = *cursor % view->capacity;
+  uint64_t first = view->capacity - index;
+  if (first > num_frames) {
+    first = num_frames;
+  }
+  memcpy(buffer, view->data + index * view->frame_size,
+         (size_t)(first * view->frame_size));
+  memcpy(buffer + first * view->frame_size, view->data,
+         (size_t)((num_frames - first) * view->frame_size));
+
+  // If the writer started overwriting part of what we just copied, the oldest
+  // copied frames may be torn. Discard them. The fence keeps the copy above
+  // from being reordered after the load, which would miss an overwrite.
+  PyAudioAtomic_AcquireFence();
+  uint64_t reserve_pos = PyAudioAtomic_LoadU64(view->reserve_pos);
+  uint64_t oldest =
+      reserve_pos > view->capacity ? reserve_pos - view->capacity : 0;
+  if (oldest > *cursor) {
+    uint64_t torn = oldest - *cursor;
+    if (torn > num_frames) {
+      torn = num_frames;
+    }
+    memmove(buffer, buffer + torn * view->frame_size,
+            (size_t)((num_frames - torn) * view->frame_size));
+    *dropped += torn;
+    num_frames -= torn;
+    *cursor += torn;
+  }
+
+  *cursor += num_frames;
+  return num_frames;
+}
+
+static PyAudioRingView view_of(PyAudioRing *ring) {
+  PyAudioRingView view = {ring->data, ring->capacity, ring->frame_size,
+                          &ring->reserve_pos, &ring->write_pos};
+  return view;
+}
+
+void PyAudioRing_Write(PyAudioRing *ring, const char *frames,
+                       uint64_t num_frames) {
+  PyAudioRingView view = view_of(ring);
+  PyAudioRingView_Write(&view, frames, num_frames);
+  wake_readers(ring);
+}
+
+uint64_t PyAudioRing_Available(PyAudioRing *ring, uint64_t *cursor,
+                               uint64_t *dropped) {
+  PyAudioRingView view = view_of(ring);
+  return PyAudioRingView_Available(&view, cursor, dropped);
+}
+
+uint64_t PyAudioRing_Read(PyAudioRing *ring, uint64_t *cursor, char *buffer,
+                          uint64_t max_frames, uint64_t *dropped) {
+  PyAudioRingView view = view_of(ring);
+  return PyAudioRingView_Read(&view, cursor, buffer, max_frames, dropped);
+}
+
+int PyAudioRing_Wait(PyAudioRing *ring, uint64_t cursor, uint64_t num_frames,
+                     double timeout) {
+  int result;
+  double deadline = PyAudioTime_Now() + timeout;
+  uint64_t max_frames = ring->capacity > 1 ? ring->capacity / 2 : 1;
+  if (num_frames > max_frames) {
+    num_frames = max_frames;
+  }
+  PyAudioMutex_Lock(&ring->lock);
+  PyAudioAtomic_AddLong(&ring->waiters, 1);
+  while (1) {
+    if (PyAudioAtomic_LoadU64(&ring->write_pos) >= cursor + num_frames) {
+      result = 0;
+      break;
+    }
+    if (PyAudioAtomic_LoadLong(&ring->closed)) {
+      result = -2;
+      break;
+    }
+    double remaining = timeout < 0 ? -1 : deadline - PyAudioTime_Now();
+    if (timeout >= 0 && remaining <= 0) {
+      result = -1;
+      break;
+    }
+    PyAudioCond_TimedWait(&ring->cond, &ring->lock, remaining);
+  }
+  PyAudioAtomic_AddLong(&ring->waiters, -1);
+  PyAudioMutex_Unlock(&ring->lock);
+  return result;
+}
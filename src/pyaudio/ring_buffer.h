@@ -0,0 +1,91 @@
+// Single-writer, multi-reader frame ring.
+//
+// The writer (typically the PortAudio callback thread) never blocks and never
+// waits for readers: it overwrites the oldest frames once the ring is full.
+// Each reader keeps its own cursor, so a slow reader only loses its own data
+// (an "overrun") and never holds back the writer or the other readers.
+
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <stdint.h>
+
+#include "sync.h"
+
+// Storage and counters of a ring, which may live in process-private or shared
+// memory. The low-level functions below implement the ring protocol on a view.
+typedef struct {
+  char *data;
+  // Capacity, in frames.
+  uint64_t capacity;
+  // Frame size, in bytes.
+  unsigned int frame_size;
+  // See PyAudioRing.
+  volatile uint64_t *reserve_pos;
+  volatile uint64_t *write_pos;
+} PyAudioRingView;
+
+void PyAudioRingView_Write(const PyAudioRingView *view, const char *frames,
+                           uint64_t num_frames);
+uint64_t PyAudioRingView_Available(const PyAudioRingView *view,
+                                   uint64_t *cursor, uint64_t *dropped);
+uint64_t PyAudioRingView_Read(const PyAudioRingView *view, uint64_t *cursor,
+                              char *buffer, uint64_t max_frames,
+                              uint64_t *dropped);
+
+typedef struct {
+  char *data;
+  // Capacity, in frames.
+  uint64_t capacity;
+  // Frame size, in bytes.
+  unsigned int frame_size;
+  // Total number of frames the writer has started writing (atomic). Frames
+  // below reserve_pos - capacity may be overwritten at any time.
+  volatile uint64_t reserve_pos;
+  // Total number of frames written and visible to readers (atomic).
+  volatile uint64_t write_pos;
+  // Set once the writer is gone; wakes up and fails blocked readers.
+  volatile long closed;
+  // Number of readers blocked in PyAudioRing_Wait (atomic). Lets the writer
+  // skip the wakeup when nobody is waiting.
+  volatile long waiters;
+  // Reference count (atomic): one for the writer, plus one per reader.
+  volatile long refcount;
+  PyAudioMutex lock;
+  PyAudioCond cond;
+} PyAudioRing;
+
+// Allocates a ring with room for capacity frames of frame_size bytes, with a
+// reference count of 1. Returns NULL if memory allocation fails.
+PyAudioRing *PyAudioRing_Create(uint64_t capacity, unsigned int frame_size);
+void PyAudioRing_Incref(PyAudioRing *ring);
+// Releases a reference. Frees the ring when the last reference is released.
+void PyAudioRing_Decref(PyAudioRing *ring);
+// Marks the ring as closed and wakes up all blocked readers.
+void PyAudioRing_Close(PyAudioRing *ring);
+
+// Appends frames to the ring. Only one thread may write. Never blocks on
+// readers.
+void PyAudioRing_Write(PyAudioRing *ring, const char *frames,
+                       uint64_t num_frames);
+
+// Returns the number of frames available to a reader at *cursor. If the
+// writer has lapped the reader, advances *cursor to the oldest valid frame and
+// adds the number of skipped frames to *dropped.
+uint64_t PyAudioRing_Available(PyAudioRing *ring, uint64_t *cursor,
+                               uint64_t *dropped);
+// Copies up to max_frames frames from *cursor into buffer, and advances
+// *cursor. Frames overwritten by the writer during the copy are discarded and
+// added to *dropped. Returns the number of frames copied. Does not block.
+uint64_t PyAudioRing_Read(PyAudioRing *ring, uint64_t *cursor, char *buffer,
+                          uint64_t max_frames, uint64_t *dropped);
+// Blocks until at least num_frames frames are available at cursor, the ring is
+// closed, or timeout seconds elapse (negative waits indefinitely). Returns 0
+// if the frames are available, -1 on timeout, or -2 if the ring is closed.
+// Waits for at most half the capacity, which returns before the writer laps
+// the reader: a reader wanting more copies what is available and waits again.
+// Must be called without the GIL.
+int PyAudioRing_Wait(PyAudioRing *ring, uint64_t cursor, uint64_t num_frames,
+                     double timeout);
+
+#endif  // RING_BUFFER_H_
@@ -0,0 +1,738 @@
+#include "shared_capture.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "ring_buffer.h"
+#include "stream_reader.h"
+#include "sync.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+// Maximum time to wait without the GIL before checking for signals (e.g.,
+// KeyboardInterrupt), in seconds.
+#define SIGNAL_CHECK_INTERVAL 0.1
+
+// Polling interval for platforms without futexes, in seconds.
+#define POLL_INTERVAL 0.001
+
+// Frame data starts on a cache line boundary.
+#define HEADER_SIZE \
+  ((sizeof(PyAudioSharedCaptureHeader) + 63) & ~(size_t)63)
+
+struct PyAudioSharedCapture {
+  PyAudioSharedCaptureHeader *header;
+  size_t size;
+  char name[256];
+  // The writer's own copy of the ring geometry. Any process that can open the
+  // segment can also write to its header, so the callback never trusts it.
+  size_t header_size;
+  uint64_t capacity;
+  unsigned int frame_size;
+};
+
+// Converts a user-facing segment name (e.g., "mic") into a POSIX shm name
+// ("/mic"). Returns 0 on success, or -1 with an exception set.
+static int shm_name(const char *name, char *out, size_t out_size) {
+  const char *base = name[0] == '/' ? name + 1 : name;
+  if (base[0] == '\0' || strchr(base, '/') != NULL ||
+      strlen(base) + 2 > out_size) {
+    PyErr_SetString(PyExc_ValueError, "Invalid shared capture name");
+    return -1;
+  }
+  snprintf(out, out_size, "/%s", base);
+  return 0;
+}
+
+// Returns a ring view of the segment, from geometry validated (or chosen) by
+// the caller rather than read back from the header.
+static PyAudioRingView view_of(PyAudioSharedCaptureHeader *header,
+                               size_t header_size, uint64_t capacity,
+                               unsigned int frame_size) {
+  PyAudioRingView view = {(char *)header + header_size, capacity, frame_size,
+                          &header->reserve_pos, &header->write_pos};
+  return view;
+}
+
+static void wake_readers(PyAudioSharedCaptureHeader *header) {
+  PyAudioAtomic_AddU32(&header->seq, 1);
+  // Readers map the segment read-only, so they cannot announce themselves;
+  // always wake. Without waiters, this is a cheap, non-blocking syscall.
+#ifdef __linux__
+  syscall(SYS_futex, &header->seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#endif
+}
+
+// Sleeps until seq changes from expected, or timeout seconds elapse.
+static void wait_seq(PyAudioSharedCaptureHeader *header, uint32_t expected,
+                     double timeout) {
+#ifdef __linux__
+  struct timespec ts;
+  ts.tv_sec = (time_t)timeout;
+  ts.tv_nsec = (long)((timeout - (double)ts.tv_sec) * 1e9);
+  syscall(SYS_futex, &header->seq, FUTEX_WAIT, expected, &ts, NULL, 0);
+#else
+  (void)expected;
+  if (timeout > POLL_INTERVAL) {
+    timeout = POLL_INTERVAL;
+  }
+  struct timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = (long)(timeout * 1e9);
+  nanosleep(&ts, NULL);
+#endif
+}
+
+PyAudioSharedCapture *PyAudioSharedCapture_Create(const char *name,
+                                                  uint64_t capacity,
+                                                  PaSampleFormat format,
+                                                  unsigned int channels,
+                                                  unsigned int frame_size,
+                                                  double sample_rate) {
+  PyAudioSharedCapture *capture =
+      (PyAudioSharedCapture *)calloc(1, sizeof(PyAudioSharedCapture));
+  if (!capture) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  if (shm_name(name, capture->name, sizeof(capture->name)) < 0) {
+    free(capture);
+    return NULL;
+  }
+
+  capture->size = HEADER_SIZE + (size_t)(capacity * frame_size);
+  int fd = shm_open(capture->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, capture->name);
+    free(capture);
+    return NULL;
+  }
+  if (ftruncate(fd, (off_t)capture->size) < 0) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, capture->name);
+    close(fd);
+    shm_unlink(capture->name);
+    free(capture);
+    return NULL;
+  }
+  void *addr =
+      mmap(NULL, capture->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, capture->name);
+    shm_unlink(capture->name);
+    free(capture);
+    return NULL;
+  }
+
+  // The segment is zero-filled by ftruncate.
+  PyAudioSharedCaptureHeader *header = (PyAudioSharedCaptureHeader *)addr;
+  header->version = PYAUDIO_SHARED_CAPTURE_VERSION;
+  header->header_size = (uint32_t)HEADER_SIZE;
+  header->block_capacity = PYAUDIO_SHARED_CAPTURE_BLOCKS;
+  header->sample_format = format;
+  header->channels = channels;
+  header->frame_size = frame_size;
+  header->sample_rate = sample_rate;
+  header->capacity = capacity;
+  // Publish the magic last, so readers never attach to a partial header.
+  PyAudioAtomic_StoreU32(&header->magic, PYAUDIO_SHARED_CAPTURE_MAGIC);
+
+  capture->header = header;
+  capture->header_size = HEADER_SIZE;
+  capture->capacity = capacity;
+  capture->frame_size = frame_size;
+  return capture;
+}
+
+void PyAudioSharedCapture_Write(PyAudioSharedCapture *capture,
+                                const char *frames, uint64_t num_frames,
+                                double adc_time,
+                                PaStreamCallbackFlags status_flags) {
+  PyAudioSharedCaptureHeader *header = capture->header;
+
+  // Record the block before its frames become visible.
+  uint64_t block_count = header->block_count;
+  PyAudioSharedCaptureBlock *block =
+      &header->blocks[block_count % PYAUDIO_SHARED_CAPTURE_BLOCKS];
+  block->start_frame = header->write_pos;
+  block->num_frames = num_frames;
+  block->adc_time = adc_time;
+  block->status_flags = status_flags;
+
+  PyAudioRingView view = view_of(header, capture->header_size,
+                                 capture->capacity, capture->frame_size);
+  PyAudioRingView_Write(&view, frames, num_frames);
+  PyAudioAtomic_StoreU64(&header->block_count, block_count + 1);
+  wake_readers(header);
+}
+
+void PyAudioSharedCapture_Destroy(PyAudioSharedCapture *capture) {
+  if (capture == NULL) {
+    return;
+  }
+  PyAudioAtomic_StoreU32(&capture->header->closed, 1);
+  wake_readers(capture->header);
+  munmap(capture->header, capture->size);
+  shm_unlink(capture->name);
+  free(capture);
+}
+
+/*************************************************************
+ * SharedCaptureReader
+ *************************************************************/
+
+// Detaches from the segment, once calls using the mapping (e.g., a read() on
+// another thread, which notices the next time it wakes up) are done with it.
+static void reader_cleanup(PyAudioSharedCaptureReader *self) {
+  PyAudioMutex_Lock(&self->lock);
+  PyAudioSharedCaptureHeader *header = self->header;
+  size_t size = self->size;
+  self->header = NULL;
+  int in_use = self->in_use > 0;
+  PyAudioMutex_Unlock(&self->lock);
+
+  if (in_use) {
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    PyAudioMutex_Lock(&self->lock);
+    while (self->in_use > 0) {
+      PyAudioCond_TimedWait(&self->cond, &self->lock, -1);
+    }
+    PyAudioMutex_Unlock(&self->lock);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+  }
+  if (header != NULL) {
+    munmap(header, size);
+  }
+}
+
+static PyObject *reader_new(PyTypeObject *type, PyObject *args,
+                            PyObject *kwargs) {
+  PyAudioSharedCaptureReader *self =
+      (PyAudioSharedCaptureReader *)PyType_GenericNew(type, args, kwargs);
+  if (self != NULL) {
+    PyAudioMutex_Init(&self->lock);
+    PyAudioCond_Init(&self->cond);
+  }
+  return (PyObject *)self;
+}
+
+static void reader_dealloc(PyAudioSharedCaptureReader *self) {
+  reader_cleanup(self);
+  PyAudioCond_Destroy(&self->cond);
+  PyAudioMutex_Destroy(&self->lock);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+static int reader_init(PyAudioSharedCaptureReader *self, PyObject *args,
+                       PyObject *kwargs) {
+  const char *name;
+  char path[256];
+
+  static char *kwlist[] = {"name", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &name)) {
+    return -1;
+  }
+
+  reader_cleanup(self);
+  if (shm_name(name, path, sizeof(path)) < 0) {
+    return -1;
+  }
+
+  // Map the segment read-only: readers never write to it.
+  int fd = shm_open(path, O_RDONLY, 0);
+  if (fd < 0) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    close(fd);
+    return -1;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size < sizeof(PyAudioSharedCaptureHeader)) {
+    close(fd);
+    PyErr_SetString(PyExc_ValueError, "Not a shared capture segment");
+    return -1;
+  }
+  void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    return -1;
+  }
+
+  // Validate one snapshot of the geometry, which is then the only one used: the
+  // header may change under us.
+  PyAudioSharedCaptureHeader *header = (PyAudioSharedCaptureHeader *)addr;
+  uint32_t magic = PyAudioAtomic_LoadU32(&header->magic);
+  size_t header_size = header->header_size;
+  uint64_t capacity = header->capacity;
+  unsigned int frame_size = header->frame_size;
+  if (magic != PYAUDIO_SHARED_CAPTURE_MAGIC ||
+      header->version != PYAUDIO_SHARED_CAPTURE_VERSION || frame_size == 0 ||
+      capacity == 0 || header_size < sizeof(PyAudioSharedCaptureHeader) ||
+      header->block_capacity != PYAUDIO_SHARED_CAPTURE_BLOCKS ||
+      header_size > size || capacity > (size - header_size) / frame_size) {
+    munmap(addr, size);
+    PyErr_SetString(PyExc_ValueError,
+                    "Not a shared capture segment, or unsupported version");
+    return -1;
+  }
+
+  // Another thread may have attached meanwhile.
+  while (1) {
+    PyAudioMutex_Lock(&self->lock);
+    if (self->header == NULL) {
+      break;
+    }
+    PyAudioMutex_Unlock(&self->lock);
+    reader_cleanup(self);
+  }
+  self->header = header;
+  self->size = size;
+  self->header_size = header_size;
+  self->capacity = capacity;
+  self->frame_size = frame_size;
+  // Readers only see frames captured after they attach.
+  self->cursor = PyAudioAtomic_LoadU64(&header->write_pos);
+  self->overruns = 0;
+  self->frames_dropped = 0;
+  PyAudioMutex_Unlock(&self->lock);
+  return 0;
+}
+
+// Brackets a use of the mapping, which keeps it mapped. begin_use() returns 0,
+// or -1 with an exception set if the reader is not attached, in which case
+// end_use() must not be called.
+static int begin_use(PyAudioSharedCaptureReader *self) {
+  PyAudioMutex_Lock(&self->lock);
+  int attached = self->header != NULL;
+  if (attached) {
+    self->in_use++;
+  }
+  PyAudioMutex_Unlock(&self->lock);
+  if (!attached) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Reader closed"));
+    return -1;
+  }
+  return 0;
+}
+
+static void end_use(PyAudioSharedCaptureReader *self) {
+  PyAudioMutex_Lock(&self->lock);
+  if (--self->in_use == 0) {
+    PyAudioCond_Broadcast(&self->cond);
+  }
+  PyAudioMutex_Unlock(&self->lock);
+}
+
+// Returns the number of frames the reader can read without waiting, counting
+// an overrun if it fell behind. The caller must be using the mapping.
+static uint64_t available(PyAudioSharedCaptureReader *self,
+                          const PyAudioRingView *view) {
+  uint64_t dropped = 0;
+  PyAudioMutex_Lock(&self->lock);
+  uint64_t frames = PyAudioRingView_Available(view, &self->cursor, &dropped);
+  if (dropped > 0) {
+    self->overruns++;
+    self->frames_dropped += dropped;
+  }
+  PyAudioMutex_Unlock(&self->lock);
+  return frames;
+}
+
+// Blocks until at least num_frames frames are available at cursor, the
+// stream closes, or timeout seconds elapse. Returns 0, -2, or -1,
+// respectively. As PyAudioRing_Wait(), waits for at most half the capacity of
+// the ring. Must be called without the GIL.
+static int wait_frames(PyAudioSharedCaptureHeader *header, uint64_t capacity,
+                       uint64_t cursor, uint64_t num_frames, double timeout) {
+  double deadline = PyAudioTime_Now() + timeout;
+  uint64_t max_frames = capacity > 1 ? capacity / 2 : 1;
+  if (num_frames > max_frames) {
+    num_frames = max_frames;
+  }
+  while (1) {
+    uint32_t seq = PyAudioAtomic_LoadU32(&header->seq);
+    if (PyAudioAtomic_LoadU64(&header->write_pos) >= cursor + num_frames) {
+      return 0;
+    }
+    if (PyAudioAtomic_LoadU32(&header->closed)) {
+      return -2;
+    }
+    double remaining = deadline - PyAudioTime_Now();
+    if (remaining <= 0) {
+      return -1;
+    }
+    wait_seq(header, seq, remaining);
+  }
+}
+
+// Same contract as read_frames in stream_reader.c, but also stops if the
+// reader is closed. The caller must be using the mapping.
+static int read_frames(PyAudioSharedCaptureReader *self, char *buffer,
+                       uint64_t num_frames, double timeout,
+                       uint64_t *frames_read) {
+  PyAudioSharedCaptureHeader *header = self->header;
+  PyAudioRingView view =
+      view_of(header, self->header_size, self->capacity, self->frame_size);
+  uint64_t total = 0;
+  double deadline = PyAudioTime_Now() + timeout;
+
+  while (1) {
+    uint64_t dropped = 0;
+    PyAudioMutex_Lock(&self->lock);
+    total += PyAudioRingView_Read(&view, &self->cursor,
+                                  buffer + total * view.frame_size,
+                                  num_frames - total, &dropped);
+    if (dropped > 0) {
+      self->overruns++;
+      self->frames_dropped += dropped;
+    }
+    uint64_t cursor = self->cursor;
+    int closed = self->header == NULL;
+    PyAudioMutex_Unlock(&self->lock);
+    if (total == num_frames) {
+      break;
+    }
+    if (closed) {
+      if (total > 0) {
+        break;
+      }
+      PyErr_SetObject(PyExc_IOError,
+                      Py_BuildValue("(i,s)", paBadStreamPtr, "Reader closed"));
+      return -1;
+    }
+
+    double wait = SIGNAL_CHECK_INTERVAL;
+    if (timeout >= 0) {
+      double remaining = deadline - PyAudioTime_Now();
+      if (remaining < wait) {
+        wait = remaining > 0 ? remaining : 0;
+      }
+    }
+
+    int result;
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    result = wait_frames(header, view.capacity, cursor, num_frames - total,
+                         wait);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+
+    if (result == -2 && available(self, &view) == 0) {
+      if (total > 0) {
+        break;
+      }
+      PyErr_SetObject(PyExc_IOError,
+                      Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+      return -1;
+    }
+
+    if (PyErr_CheckSignals() < 0) {
+      return -1;
+    }
+
+    if (result == -1 && timeout >= 0 && PyAudioTime_Now() >= deadline) {
+      break;
+    }
+  }
+
+  *frames_read = total;
+  return 0;
+}
+
+static PyObject *reader_read(PyAudioSharedCaptureReader *self, PyObject *args,
+                             PyObject *kwargs) {
+  int num_frames;
+  PyObject *timeout_arg = NULL;
+  double timeout;
+
+  static char *kwlist[] = {"num_frames", "timeout", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|O", kwlist, &num_frames,
+                                   &timeout_arg)) {
+    return NULL;
+  }
+
+  if (num_frames < 0) {
+    PyErr_SetString(PyExc_ValueError, "Invalid number of frames");
+    return NULL;
+  }
+
+  if (PyAudioStreamReader_ParseTimeout(timeout_arg, &timeout) < 0 ||
+      begin_use(self) < 0) {
+    return NULL;
+  }
+
+  unsigned int frame_size = self->frame_size;
+  PyObject *rv =
+      PyBytes_FromStringAndSize(NULL, (Py_ssize_t)num_frames * frame_size);
+  uint64_t frames_read;
+  if (rv != NULL && read_frames(self, PyBytes_AS_STRING(rv),
+                                (uint64_t)num_frames, timeout,
+                                &frames_read) < 0) {
+    Py_CLEAR(rv);
+  }
+  end_use(self);
+  if (rv == NULL) {
+    return NULL;
+  }
+
+  if (frames_read < (uint64_t)num_frames) {
+    if (_PyBytes_Resize(&rv, (Py_ssize_t)(frames_read * frame_size)) < 0) {
+      return NULL;
+    }
+  }
+  return rv;
+}
+
+static PyObject *reader_read_into(PyAudioSharedCaptureReader *self,
+                                  PyObject *args, PyObject *kwargs) {
+  Py_buffer buffer;
+  PyObject *timeout_arg = NULL;
+  double timeout;
+
+  static char *kwlist[] = {"buffer", "timeout", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "w*|O", kwlist, &buffer,
+                                   &timeout_arg)) {
+    return NULL;
+  }
+
+  if (PyAudioStreamReader_ParseTimeout(timeout_arg, &timeout) < 0 ||
+      begin_use(self) < 0) {
+    PyBuffer_Release(&buffer);
+    return NULL;
+  }
+
+  uint64_t frames_read;
+  uint64_t num_frames = (uint64_t)buffer.len / self->frame_size;
+  int result =
+      read_frames(self, (char *)buffer.buf, num_frames, timeout, &frames_read);
+  end_use(self);
+  PyBuffer_Release(&buffer);
+  if (result < 0) {
+    return NULL;
+  }
+
+  return PyLong_FromUnsignedLongLong(frames_read);
+}
+
+static PyObject *reader_get_read_available(PyAudioSharedCaptureReader *self,
+                                           PyObject *args) {
+  if (begin_use(self) < 0) {
+    return NULL;
+  }
+
+  PyAudioRingView view = view_of(self->header, self->header_size,
+                                 self->capacity, self->frame_size);
+  uint64_t frames = available(self, &view);
+  end_use(self);
+  return PyLong_FromUnsignedLongLong(frames);
+}
+
+// Returns the capture time of the frame at position, or None if it is no
+// longer in the ring. The caller must be using the mapping.
+static PyObject *frame_time(PyAudioSharedCaptureReader *self,
+                            uint64_t position) {
+  PyAudioSharedCaptureHeader *header = self->header;
+  uint64_t block_count = PyAudioAtomic_LoadU64(&header->block_count);
+
+  // Search from the newest block, which is the common case. Block i is
+  // reliable while the writer has not started reusing its entry, i.e., while
+  // i + PYAUDIO_SHARED_CAPTURE_BLOCKS > block_count.
+  for (uint64_t i = block_count;
+       i > 0 && i - 1 + PYAUDIO_SHARED_CAPTURE_BLOCKS > block_count; i--) {
+    PyAudioSharedCaptureBlock block =
+        header->blocks[(i - 1) % PYAUDIO_SHARED_CAPTURE_BLOCKS];
+    if (position < block.start_frame ||
+        position >= block.start_frame + block.num_frames) {
+      continue;
+    }
+    // Discard the entry if the writer reused it while we copied it.
+    uint64_t now = PyAudioAtomic_LoadU64(&header->block_count);
+    if (i - 1 + PYAUDIO_SHARED_CAPTURE_BLOCKS <= now) {
+      break;
+    }
+    return PyFloat_FromDouble(block.adc_time +
+                              (double)(position - block.start_frame) /
+                                  header->sample_rate);
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *reader_get_frame_time(PyAudioSharedCaptureReader *self,
+                                       PyObject *args) {
+  unsigned long long position;
+  if (!PyArg_ParseTuple(args, "K", &position)) {
+    return NULL;
+  }
+
+  if (begin_use(self) < 0) {
+    return NULL;
+  }
+  PyObject *rv = frame_time(self, position);
+  end_use(self);
+  return rv;
+}
+
+static PyObject *reader_close(PyAudioSharedCaptureReader *self,
+                              PyObject *args) {
+  reader_cleanup(self);
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+#define HEADER_GETTER(func_name, expr)                                    \
+  static PyObject *func_name(PyAudioSharedCaptureReader *self,            \
+                             void *closure) {                             \
+    if (begin_use(self) < 0) {                                            \
+      return NULL;                                                        \
+    }                                                                     \
+    PyAudioSharedCaptureHeader *header = self->header;                    \
+    PyObject *rv = expr;                                                  \
+    end_use(self);                                                        \
+    return rv;                                                            \
+  }
+
+HEADER_GETTER(get_format, PyLong_FromUnsignedLongLong(header->sample_format))
+HEADER_GETTER(get_channels, PyLong_FromUnsignedLong(header->channels))
+HEADER_GETTER(get_rate, PyFloat_FromDouble(header->sample_rate))
+HEADER_GETTER(get_closed,
+              PyBool_FromLong(PyAudioAtomic_LoadU32(&header->closed)))
+
+// Returns the reader's field named member, read under its lock.
+#define LOCKED_GETTER(func_name, type, member, convert)        \
+  static PyObject *func_name(PyAudioSharedCaptureReader *self, \
+                             void *closure) {                  \
+    PyAudioMutex_Lock(&self->lock);                            \
+    type value = self->member;                                 \
+    PyAudioMutex_Unlock(&self->lock);                          \
+    return convert(value);                                     \
+  }
+
+LOCKED_GETTER(get_position, uint64_t, cursor, PyLong_FromUnsignedLongLong)
+LOCKED_GETTER(get_overruns, unsigned long, overruns, PyLong_FromUnsignedLong)
+LOCKED_GETTER(get_frames_dropped, uint64_t, frames_dropped,
+              PyLong_FromUnsignedLongLong)
+
+static PyObject *get_capacity(PyAudioSharedCaptureReader *self,
+                              void *closure) {
+  if (begin_use(self) < 0) {
+    return NULL;
+  }
+  uint64_t capacity = self->capacity;
+  end_use(self);
+  return PyLong_FromUnsignedLongLong(capacity);
+}
+
+static int antiset(PyAudioSharedCaptureReader *self, PyObject *value,
+                   void *closure) {
+  /* read-only: do not allow users to change values */
+  PyErr_SetString(PyExc_AttributeError,
+                  "Fields read-only: cannot modify values");
+  return -1;
+}
+
+static PyMethodDef reader_methods[] = {
+    {"read", (PyCFunction)reader_read, METH_VARARGS | METH_KEYWORDS,
+     "Reads frames, waiting until they are available"},
+
+    {"read_into", (PyCFunction)reader_read_into, METH_VARARGS | METH_KEYWORDS,
+     "Reads frames into a writable buffer"},
+
+    {"get_read_available", (PyCFunction)reader_get_read_available,
+     METH_NOARGS,
+     "Returns the number of frames that can be read without waiting"},
+
+    {"get_frame_time", (PyCFunction)reader_get_frame_time, METH_VARARGS,
+     "Returns the capture time of a frame still in the ring"},
+
+    {"close", (PyCFunction)reader_close, METH_NOARGS,
+     "Detaches from the shared capture segment"},
+
+    {NULL, NULL, 0, NULL}};
+
+static PyGetSetDef reader_get_setters[] = {
+    {"format", (getter)get_format, (setter)antiset, "sample format", NULL},
+    {"channels", (getter)get_channels, (setter)antiset, "number of channels",
+     NULL},
+    {"rate", (getter)get_rate, (setter)antiset, "sample rate", NULL},
+    {"capacity", (getter)get_capacity, (setter)antiset,
+     "capacity of the ring, in frames", NULL},
+    {"position", (getter)get_position, (setter)antiset,
+     "position of the next frame to read", NULL},
+    {"closed", (getter)get_closed, (setter)antiset,
+     "whether the capturing stream is closed", NULL},
+    {"overruns", (getter)get_overruns, (setter)antiset,
+     "number of times this reader fell behind", NULL},
+    {"frames_dropped", (getter)get_frames_dropped, (setter)antiset,
+     "number of frames lost to overruns", NULL},
+    {NULL}};
+
+static PyType_Slot reader_slots[] = {
+    {Py_tp_dealloc, reader_dealloc},
+    {Py_tp_doc,
+     (void *)PyDoc_STR("Reader of a stream's shared-memory capture export")},
+    {Py_tp_methods, reader_methods},
+    {Py_tp_getset, reader_get_setters},
+    {Py_tp_init, reader_init},
+    {Py_tp_new, reader_new},
+    {0, NULL}};
+
+PyType_Spec PyAudioSharedCaptureReaderSpec = {
+    .name = "_portaudio.SharedCaptureReader",
+    .basicsize = sizeof(PyAudioSharedCaptureReader),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = reader_slots,
+};
+
+#else  // _WIN32
+
+PyAudioSharedCapture *PyAudioSharedCapture_Create(const char *name,
+                                                  uint64_t capacity,
+                                                  PaSampleFormat format,
+                                                  unsigned int channels,
+                                                  unsigned int frame_size,
+                                                  double sample_rate) {
+  PyErr_SetString(PyExc_NotImplementedError,
+                  "Shared capture requires POSIX shared memory");
+  return NULL;
+}
+
+void PyAudioSharedCapture_Write(PyAudioSharedCapture *capture,
+                                const char *frames, uint64_t num_frames,
+                                double adc_time,
+                                PaStreamCallbackFlags status_flags) {}
+
+void PyAudioSharedCapture_Destroy(PyAudioSharedCapture *capture) {}
+
+#endif  // _WIN32
@@ -0,0 +1,145 @@
+// Shared-memory export of captured input, for consumers in other processes.
+//
+// An input stream can publish its captured frames into a named POSIX
+// shared-memory segment (shm_open). Any process can then attach to the
+// segment by name and read the frames directly, with no serialization and
+// without involving the capturing process.
+//
+// Segment layout (version 1), in native byte order:
+//
+//   offset 0:            PyAudioSharedCaptureHeader (see below)
+//   offset header_size:  capacity * frame_size bytes of interleaved frames
+//
+// The frame data is a ring using the same protocol as ring_buffer.h: the
+// writer first advances reserve_pos, copies the frames, then advances
+// write_pos. Frame number n lives at data offset (n % capacity) * frame_size,
+// and is valid to a reader only while n >= reserve_pos - capacity. Readers
+// map the segment read-only, and neither side trusts the geometry fields after
+// the reader validates them on attach.
+//
+// For each captured block, the writer also records the block's position and
+// stream time in a fixed-size table, so readers can timestamp any frame that
+// is still in the ring.
+//
+// On Linux, readers block on the seq futex word, which the writer increments
+// (and wakes) after each block and on close. Elsewhere, readers poll.
+
+#ifndef SHARED_CAPTURE_H_
+#define SHARED_CAPTURE_H_
+
+#include <stdint.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "sync.h"
+
+// "PASC"
+#define PYAUDIO_SHARED_CAPTURE_MAGIC 0x43534150u
+#define PYAUDIO_SHARED_CAPTURE_VERSION 1
+#define PYAUDIO_SHARED_CAPTURE_BLOCKS 256
+
+typedef struct {
+  // Ring position of the block's first frame.
+  uint64_t start_frame;
+  // Number of frames in the block.
+  uint64_t num_frames;
+  // Stream time at which the block's first frame was captured (PortAudio's
+  // inputBufferAdcTime), in seconds.
+  double adc_time;
+  // PortAudio callback status flags of the block (e.g., paInputOverflow).
+  uint64_t status_flags;
+} PyAudioSharedCaptureBlock;
+
+typedef struct {
+  // PYAUDIO_SHARED_CAPTURE_MAGIC.
+  uint32_t magic;
+  // PYAUDIO_SHARED_CAPTURE_VERSION.
+  uint32_t version;
+  // Byte offset of the frame data from the start of the segment.
+  uint32_t header_size;
+  // Number of entries in blocks.
+  uint32_t block_capacity;
+  // PaSampleFormat of the frames.
+  uint64_t sample_format;
+  uint32_t channels;
+  // Frame size, in bytes.
+  uint32_t frame_size;
+  // Actual sample rate of the stream, in Hz.
+  double sample_rate;
+  // Capacity of the ring, in frames.
+  uint64_t capacity;
+  // Ring counters (atomic), as in PyAudioRing.
+  volatile uint64_t reserve_pos;
+  volatile uint64_t write_pos;
+  // Total number of blocks written (atomic). Block i is stored in
+  // blocks[i % block_capacity], and is valid while i >= block_count -
+  // block_capacity.
+  volatile uint64_t block_count;
+  // Futex word (atomic), incremented after each block and on close.
+  volatile uint32_t seq;
+  // Set once the stream is closed (atomic).
+  volatile uint32_t closed;
+  PyAudioSharedCaptureBlock blocks[PYAUDIO_SHARED_CAPTURE_BLOCKS];
+} PyAudioSharedCaptureHeader;
+
+// Writer side, owned by the stream.
+typedef struct PyAudioSharedCapture PyAudioSharedCapture;
+
+// Creates the shared-memory segment name, with room for capacity frames.
+// Fails if a segment with that name already exists. Returns NULL with an
+// exception set on failure.
+PyAudioSharedCapture *PyAudioSharedCapture_Create(const char *name,
+                                                  uint64_t capacity,
+                                                  PaSampleFormat format,
+                                                  unsigned int channels,
+                                                  unsigned int frame_size,
+                                                  double sample_rate);
+// Publishes a captured block. Never blocks; safe to call from the PortAudio
+// callback thread.
+void PyAudioSharedCapture_Write(PyAudioSharedCapture *capture,
+                                const char *frames, uint64_t num_frames,
+                                double adc_time,
+                                PaStreamCallbackFlags status_flags);
+// Marks the segment closed, wakes up readers, and removes the segment name.
+// Readers that already attached keep their mapping until they close.
+void PyAudioSharedCapture_Destroy(PyAudioSharedCapture *capture);
+
+// Reader side: _portaudio.SharedCaptureReader.
+typedef struct {
+  // clang-format off
+  PyObject_HEAD
+  // clang-format on
+  // Mapped segment. NULL until initialized, or once closed.
+  PyAudioSharedCaptureHeader *header;
+  size_t size;
+  // Ring geometry, validated when attaching.
+  size_t header_size;
+  uint64_t capacity;
+  unsigned int frame_size;
+  // Position of the next frame to read.
+  uint64_t cursor;
+  // Number of times this reader fell behind the writer.
+  unsigned long overruns;
+  // Total number of frames this reader lost due to overruns.
+  uint64_t frames_dropped;
+  // Guards the fields above, for threads sharing the reader. Never held
+  // while waiting for frames.
+  PyAudioMutex lock;
+  // Number of calls using the mapping (e.g., a read() waiting for frames
+  // without the GIL), which detaching waits for before unmapping it. While
+  // nonzero, header and the geometry stay unchanged. Guarded by lock, and
+  // signalled on cond when it drops to 0.
+  long in_use;
+  PyAudioCond cond;
+} PyAudioSharedCaptureReader;
+
+#ifndef _WIN32
+#define PYAUDIO_HAVE_SHARED_CAPTURE
+extern PyType_Spec PyAudioSharedCaptureReaderSpec;
+#endif
+
+#endif  // SHARED_CAPTURE_H_
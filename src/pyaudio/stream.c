@@ -8,9 +8,51 @@
 #include "Python.h"
 #include "portaudio.h"
 
+#include "module_state.h"
+#include "null_device.h"
+#include "stream_io.h"
+#include "stream_lifecycle.h"
+#include "stream_lookahead.h"
+#include "sync.h"
+
+const PyAudioStreamBackend PyAudioPortAudioBackend = {
+    .close = Pa_CloseStream,
+    .set_finished_callback = Pa_SetStreamFinishedCallback,
+    .start = Pa_StartStream,
+    .stop = Pa_StopStream,
+    .abort = Pa_AbortStream,
+    .is_stopped = Pa_IsStreamStopped,
+    .is_active = Pa_IsStreamActive,
+    .get_info = Pa_GetStreamInfo,
+    .get_time = Pa_GetStreamTime,
+    .get_cpu_load = Pa_GetStreamCpuLoad,
+    .read = Pa_ReadStream,
+    .write = Pa_WriteStream,
+    .get_read_available = Pa_GetStreamReadAvailable,
+    .get_write_available = Pa_GetStreamWriteAvailable,
+};
+
 static void dealloc(PyAudioStream *self) {
   PyAudioStream_Cleanup(self);
-  Py_TYPE(self)->tp_free((PyObject *)self);
+  if (self->sync_ready) {
+    PyAudioCond_Destroy(&self->cond);
+    PyAudioMutex_Destroy(&self->lock);
+  }
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+// Opens the stream; takes the same arguments as _portaudio.open().
+static int init(PyObject *_self, PyObject *args, PyObject *kwargs) {
+  PyAudioStream *self = (PyAudioStream *)_self;
+  if (PyAudioStream_IsOpen(self)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paInternalError,
+                                  "Stream already open"));
+    return -1;
+  }
+  return PyAudioStream_Open(self, args, kwargs);
 }
 
 static PyObject *get_structVersion(PyAudioStream *self, void *closure) {
@@ -20,7 +62,8 @@ static PyObject *get_structVersion(PyAudioStream *self, void *closure) {
     return NULL;
   }
 
-  const PaStreamInfo *stream_info = Pa_GetStreamInfo(self->context.stream);
+  const PaStreamInfo *stream_info =
+      self->context.backend->get_info(self->context.stream);
   if (!stream_info) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paInternalError,
@@ -38,7 +81,8 @@ static PyObject *get_inputLatency(PyAudioStream *self, void *closure) {
     return NULL;
   }
 
-  const PaStreamInfo *stream_info = Pa_GetStreamInfo(self->context.stream);
+  const PaStreamInfo *stream_info =
+      self->context.backend->get_info(self->context.stream);
   if (!stream_info) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paInternalError,
@@ -56,7 +100,8 @@ static PyObject *get_outputLatency(PyAudioStream *self, void *closure) {
     return NULL;
   }
 
-  const PaStreamInfo *stream_info = Pa_GetStreamInfo(self->context.stream);
+  const PaStreamInfo *stream_info =
+      self->context.backend->get_info(self->context.stream);
   if (!stream_info) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paInternalError,
@@ -74,7 +119,8 @@ static PyObject *get_sampleRate(PyAudioStream *self, void *closure) {
     return NULL;
   }
 
-  const PaStreamInfo *stream_info = Pa_GetStreamInfo(self->context.stream);
+  const PaStreamInfo *stream_info =
+      self->context.backend->get_info(self->context.stream);
   if (!stream_info) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paInternalError,
@@ -85,6 +131,135 @@ static PyObject *get_sampleRate(PyAudioStream *self, void *closure) {
   return PyFloat_FromDouble(stream_info->sampleRate);
 }
 
+static PyObject *get_reblockLatency(PyAudioStream *self, void *closure) {
+  if (!PyAudioStream_IsOpen(self)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  if (self->context.reblock == NULL) {
+    return PyFloat_FromDouble(0.0);
+  }
+  return PyFloat_FromDouble(PyAudioReblock_Latency(self->context.reblock));
+}
+
+static PyObject *get_time(PyAudioStream *stream, PyObject *unused) {
+  double time;
+
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  if (PyAudioStream_BeginIO(stream) != paNoError) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  time = stream->context.backend->get_time(stream->context.stream);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  PyAudioStream_EndIO(stream);
+
+  if (time == 0) {
+    PyAudioStream_Cleanup(stream);
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paInternalError, "Internal Error"));
+    return NULL;
+  }
+
+  return PyFloat_FromDouble(time);
+}
+
+static PyObject *get_cpu_load(PyAudioStream *stream, PyObject *unused) {
+  double cpuload;
+
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  if (PyAudioStream_BeginIO(stream) != paNoError) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  cpuload = stream->context.backend->get_cpu_load(stream->context.stream);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  PyAudioStream_EndIO(stream);
+
+  return PyFloat_FromDouble(cpuload);
+}
+
+static PyObject *take_virtual_output(PyAudioStream *stream, PyObject *unused) {
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+  if (stream->context.backend != &PyAudioNullBackend) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr,
+                                  "Not a virtual device stream"));
+    return NULL;
+  }
+
+  if (PyAudioStream_BeginIO(stream) != paNoError) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+  PyObject *output = PyAudioNull_TakeOutput(stream->context.stream);
+  PyAudioStream_EndIO(stream);
+  return output;
+}
+
+static PyObject *get_deadlineMisses(PyAudioStream *self, void *closure) {
+  if (!PyAudioStream_IsOpen(self)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  if (self->context.deadline == NULL) {
+    return PyLong_FromLong(0);
+  }
+  return PyLong_FromUnsignedLongLong(
+      PyAudioDeadline_Misses(self->context.deadline));
+}
+
+static PyObject *get_threadScheduling(PyAudioStream *self, void *closure) {
+  if (!PyAudioStream_IsOpen(self)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  if (self->context.thread_tuning == NULL) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  return PyAudioThreadTuning_GetApplied(self->context.thread_tuning);
+}
+
+static PyObject *get_lockedMemory(PyAudioStream *self, void *closure) {
+  if (!PyAudioStream_IsOpen(self)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  return PyLong_FromSize_t(self->context.locked_memory.locked_bytes);
+}
+
 static int antiset(PyAudioStream *self, PyObject *value, void *closure) {
   /* read-only: do not allow users to change values */
   PyErr_SetString(PyExc_AttributeError,
@@ -104,110 +279,776 @@ static PyGetSetDef get_setters[] = {{"structVersion", (getter)get_structVersion,
                                     {"sampleRate", (getter)get_sampleRate,
                                      (setter)antiset, "sample rate", NULL},
 
+                                    {"reblockLatency",
+                                     (getter)get_reblockLatency,
+                                     (setter)antiset,
+                                     "latency added by reblocking", NULL},
+
+                                    {"deadlineMisses",
+                                     (getter)get_deadlineMisses,
+                                     (setter)antiset,
+                                     "number of missed callback deadlines",
+                                     NULL},
+
+                                    {"threadScheduling",
+                                     (getter)get_threadScheduling,
+                                     (setter)antiset,
+                                     "scheduling and CPU affinity applied to "
+                                     "the callback thread and workers",
+                                     NULL},
+
+                                    {"lockedMemory",
+                                     (getter)get_lockedMemory,
+                                     (setter)antiset,
+                                     "bytes of stream buffers locked in "
+                                     "memory",
+                                     NULL},
+
                                     {NULL}};
 
-PyTypeObject PyAudioStreamType = {
-    // clang-format off
-    PyVarObject_HEAD_INIT(NULL, 0)
-    // clang-format on
-    .tp_name = "_portaudio.Stream",
-    .tp_basicsize = sizeof(PyAudioStream),
-    .tp_itemsize = 0,
-    .tp_dealloc = (destructor)dealloc,
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_doc = PyDoc_STR("PyAudio Stream"),
-    .tp_getset = get_setters,
-    .tp_new = PyType_GenericNew,
+PyDoc_STRVAR(
+    write_doc,
+    "write($self, /, frames, num_frames=None, exception_on_underflow=False)\n"
+    "--\n\n"
+    "Write samples to the stream for playback.\n\n"
+    "Do not call when using non-blocking mode.\n\n"
+    ":param frames: The frames of data.\n"
+    ":param num_frames: The number of frames to write. Defaults to None, in\n"
+    "   which this value will be automatically computed.\n"
+    ":param exception_on_underflow: Specifies whether an IOError exception\n"
+    "   should be thrown (or silently ignored) on buffer underflow. Defaults\n"
+    "   to False for improved performance, especially on slower platforms.\n\n"
+    "If the stream was opened with `write_coalesce_frames`, small writes are\n"
+    "buffered and may return before reaching PortAudio; see :py:func:`flush`."
+    "\n\n"
+    ":raises IOError: if the stream is not an output stream or if the write\n"
+    "   operation was unsuccessful.\n"
+    ":rtype: `None`");
+
+PyDoc_STRVAR(
+    flush_doc,
+    "flush($self, /)\n"
+    "--\n\n"
+    "Writes out frames buffered by `write_coalesce_frames`.\n\n"
+    "Blocks until PortAudio accepts them. Stopping or closing the stream\n"
+    "flushes automatically; aborting discards them. Does nothing for streams\n"
+    "that do not coalesce writes.\n\n"
+    ":raises IOError: if the write operation was unsuccessful.");
+
+PyDoc_STRVAR(
+    read_doc,
+    "read($self, /, num_frames, exception_on_overflow=True)\n"
+    "--\n\n"
+    "Read samples from the stream.\n\n"
+    "Do not call when using non-blocking mode.\n\n"
+    ":param num_frames: The number of frames to read.\n"
+    ":param exception_on_overflow: Specifies whether an IOError exception\n"
+    "   should be thrown (or silently ignored) on input buffer overflow.\n"
+    "   Defaults to True.\n"
+    ":raises IOError: if stream is not an input stream or if the read\n"
+    "   operation was unsuccessful.\n"
+    ":rtype: bytes");
+
+PyDoc_STRVAR(
+    wait_doc,
+    "wait($self, /, timeout=None)\n"
+    "--\n\n"
+    "Blocks until the stream is no longer active.\n\n"
+    "A callback stream becomes inactive once its callback completes and the\n"
+    "remaining output plays; any stream, once stopped. Waits without the GIL\n"
+    "and without polling, and returns immediately for a stream that is not\n"
+    "active.\n\n"
+    ":param timeout: The longest time to wait, in seconds. Defaults to None,\n"
+    "   which waits indefinitely.\n"
+    ":raises IOError: if the stream is closed.\n"
+    ":returns: Whether the stream is inactive, i.e., False on timeout.\n"
+    ":rtype: bool");
+
+PyDoc_STRVAR(
+    set_lookahead_doc,
+    "set_lookahead($self, num_buffers, /)\n"
+    "--\n\n"
+    "Sets how many buffers the callback runs ahead of the device.\n\n"
+    "Takes effect while the stream runs: more buffers tolerate longer GIL\n"
+    "stalls, at the cost of `frames_per_buffer` frames of latency each.\n"
+    "When lowered, the queue shrinks as the device plays it out.\n\n"
+    ":param num_buffers: Between 1 and `lookahead_max_buffers`.\n"
+    ":raises IOError: if the stream was not opened with `lookahead_buffers`.\n"
+    ":raises ValueError: if `num_buffers` is out of range.");
+
+static PyMethodDef methods[] = {
+    {"start_stream", (PyCFunction)PyAudioStream_Start, METH_NOARGS,
+     "start_stream($self, /)\n--\n\nStarts the stream."},
+
+    {"stop_stream", (PyCFunction)PyAudioStream_Stop, METH_NOARGS,
+     "stop_stream($self, /)\n--\n\nStops the stream."},
+
+    {"close", (PyCFunction)PyAudioStream_Close, METH_NOARGS,
+     "close($self, /)\n--\n\nCloses the stream.\n\n"
+     "Waits for reads and writes in progress on other threads to return;\n"
+     "later calls raise IOError."},
+
+    {"is_active", (PyCFunction)PyAudioStream_IsActive, METH_NOARGS,
+     "is_active($self, /)\n--\n\nReturns whether the stream is active.\n\n"
+     ":rtype: bool"},
+
+    {"is_stopped", (PyCFunction)PyAudioStream_IsStopped, METH_NOARGS,
+     "is_stopped($self, /)\n--\n\nReturns whether the stream is stopped.\n\n"
+     ":rtype: bool"},
+
+    {"wait", (PyCFunction)(void (*)(void))PyAudioStream_Wait,
+     METH_FASTCALL | METH_KEYWORDS, wait_doc},
+
+    {"get_time", (PyCFunction)get_time, METH_NOARGS,
+     "get_time($self, /)\n--\n\nReturns stream time.\n\n:rtype: float"},
+
+    {"get_cpu_load", (PyCFunction)get_cpu_load, METH_NOARGS,
+     "get_cpu_load($self, /)\n--\n\n"
+     "Return the CPU load. Always 0.0 when using the blocking API.\n\n"
+     ":rtype: float"},
+
+    {"write", (PyCFunction)(void (*)(void))PyAudioStream_Write,
+     METH_FASTCALL | METH_KEYWORDS, write_doc},
+
+    {"flush", (PyCFunction)PyAudioStream_Flush, METH_NOARGS, flush_doc},
+
+    {"read", (PyCFunction)(void (*)(void))PyAudioStream_Read,
+     METH_FASTCALL | METH_KEYWORDS, read_doc},
+
+    {"get_read_available", (PyCFunction)PyAudioStream_GetReadAvailable,
+     METH_NOARGS,
+     "get_read_available($self, /)\n--\n\n"
+     "Return the number of frames that can be read without waiting.\n\n"
+     ":rtype: integer"},
+
+    {"get_write_available", (PyCFunction)PyAudioStream_GetWriteAvailable,
+     METH_NOARGS,
+     "get_write_available($self, /)\n--\n\n"
+     "Return the number of frames that can be written without waiting.\n\n"
+     ":rtype: integer"},
+
+    {"set_lookahead", (PyCFunction)PyAudioStream_SetLookahead, METH_O,
+     set_lookahead_doc},
+
+    {"get_lookahead", (PyCFunction)PyAudioStream_GetLookahead, METH_NOARGS,
+     "get_lookahead($self, /)\n--\n\n"
+     "Returns the number of buffers the callback runs ahead of the device.\n\n"
+     "Zero if the stream was not opened with `lookahead_buffers`.\n\n"
+     ":rtype: integer"},
+
+    {"take_virtual_output", (PyCFunction)take_virtual_output, METH_NOARGS,
+     "take_virtual_output($self, /)\n--\n\n"
+     "Returns the output an offline virtual device stream kept in memory.\n\n"
+     "Returns the frames output since the last call, and releases them.\n\n"
+     ":raises IOError: if the stream is not on the virtual device.\n"
+     ":rtype: bytes"},
+
+    {NULL, NULL, 0, NULL}};
+
+static PyType_Slot slots[] = {
+    {Py_tp_dealloc, dealloc},
+    {Py_tp_doc, (void *)PyDoc_STR("PyAudio Stream")},
+    {Py_tp_methods, methods},
+    {Py_tp_getset, get_setters},
+    {Py_tp_init, init},
+    {Py_tp_new, PyType_GenericNew},
+    {0, NULL}};
+
+PyType_Spec PyAudioStreamSpec = {
+    .name = "_portaudio.Stream",
+    .basicsize = sizeof(PyAudioStream),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = slots,
 };
 
 int PyAudioStream_IsOpen(PyAudioStream *stream) {
   return (stream) && (stream->context.stream != NULL);
 }
 
-PyAudioStream *PyAudioStream_Create(void) {
-  PyAudioStream *stream =
-      (PyAudioStream *)PyObject_New(PyAudioStream, &PyAudioStreamType);
+PyAudioStream *PyAudioStream_Create(PyObject *module) {
+  PyAudioStream *stream = (PyAudioStream *)PyObject_New(
+      PyAudioStream, PyAudio_GetModuleState(module)->stream_type);
   if (!stream) {
     return NULL;
   }
   memset(&(stream->context), 0, sizeof(struct StreamContext));
+  stream->sync_ready = 0;
   return stream;
 }
 
+PyAudioStream *PyAudioStream_CheckArgs(PyObject *module, const char *func_name,
+                                       PyObject *const *args, Py_ssize_t nargs,
+                                       Py_ssize_t min_args,
+                                       Py_ssize_t max_args) {
+  if (nargs < min_args || nargs > max_args) {
+    if (min_args == max_args) {
+      PyErr_Format(PyExc_TypeError,
+                   "%s() takes exactly %zd argument%s (%zd given)", func_name,
+                   min_args, min_args == 1 ? "" : "s", nargs);
+    } else {
+      PyErr_Format(PyExc_TypeError,
+                   "%s() takes from %zd to %zd arguments (%zd given)",
+                   func_name, min_args, max_args, nargs);
+    }
+    return NULL;
+  }
+
+  PyTypeObject *stream_type = PyAudio_GetModuleState(module)->stream_type;
+  if (!PyObject_TypeCheck(args[0], stream_type)) {
+    PyErr_Format(PyExc_TypeError, "%s() argument 1 must be %s, not %.200s",
+                 func_name, stream_type->tp_name,
+                 Py_TYPE(args[0])->tp_name);
+    return NULL;
+  }
+  return (PyAudioStream *)args[0];
+}
+
+int PyAudioStream_UnpackArgs(const char *func_name, PyObject *const *args,
+                             Py_ssize_t nargs, PyObject *kwnames,
+                             const char *const *names, Py_ssize_t min_args,
+                             PyObject **values) {
+  Py_ssize_t max_args = 0;
+  while (names[max_args] != NULL) {
+    max_args++;
+  }
+  if (nargs > max_args) {
+    PyErr_Format(PyExc_TypeError,
+                 "%s() takes at most %zd positional arguments (%zd given)",
+                 func_name, max_args, nargs);
+    return -1;
+  }
+  for (Py_ssize_t i = 0; i < nargs; i++) {
+    values[i] = args[i];
+  }
+
+  Py_ssize_t num_kwargs = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+  for (Py_ssize_t k = 0; k < num_kwargs; k++) {
+    PyObject *kwname = PyTuple_GET_ITEM(kwnames, k);
+    Py_ssize_t i = 0;
+    while (i < max_args &&
+           PyUnicode_CompareWithASCIIString(kwname, names[i]) != 0) {
+      i++;
+    }
+    if (i == max_args) {
+      PyErr_Format(PyExc_TypeError,
+                   "%s() got an unexpected keyword argument '%U'", func_name,
+                   kwname);
+      return -1;
+    }
+    if (i < nargs) {
+      PyErr_Format(PyExc_TypeError,
+                   "%s() got multiple values for argument '%s'", func_name,
+                   names[i]);
+      return -1;
+    }
+    // Keyword argument values follow the positional ones.
+    values[i] = args[nargs + k];
+  }
+
+  for (Py_ssize_t i = 0; i < min_args; i++) {
+    if (values[i] == NULL) {
+      PyErr_Format(PyExc_TypeError,
+                   "%s() missing required argument '%s' (pos %zd)", func_name,
+                   names[i], i + 1);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void PyAudioStream_SignalFinished(PyAudioStream *stream) {
+  if (!stream->sync_ready) {
+    return;
+  }
+  // Clear the flag under the lock, so a waiter cannot check it and then miss
+  // the broadcast.
+  PyAudioMutex_Lock(&stream->lock);
+  PyAudioAtomic_StoreLong(&stream->context.active, 0);
+  PyAudioCond_Broadcast(&stream->cond);
+  PyAudioMutex_Unlock(&stream->lock);
+}
+
+PaError PyAudioStream_BeginIO(PyAudioStream *stream) {
+  if (!stream->sync_ready) {
+    return paBadStreamPtr;
+  }
+  // Check under the lock, which PyAudioStream_Cleanup() holds while it marks
+  // the stream closing and while it resets the context, since it releases the
+  // GIL in between.
+  PaError err = paNoError;
+  PyAudioMutex_Lock(&stream->lock);
+  if (!PyAudioStream_IsOpen(stream) || stream->context.closing) {
+    err = paBadStreamPtr;
+  } else {
+    stream->context.io_in_flight++;
+  }
+  PyAudioMutex_Unlock(&stream->lock);
+  return err;
+}
+
+void PyAudioStream_EndIO(PyAudioStream *stream) {
+  PyAudioMutex_Lock(&stream->lock);
+  if (--stream->context.io_in_flight == 0) {
+    PyAudioCond_Broadcast(&stream->cond);
+  }
+  PyAudioMutex_Unlock(&stream->lock);
+}
+
+// Longest span of frames, in seconds, read or written in one PortAudio call,
+// so that a blocking read or write sees the stream closing within about that
+// long, plus the device's latency.
+#define IO_CHUNK_SECONDS 0.1
+
+// Reads (or writes) num_frames in chunks of at most IO_CHUNK_SECONDS, until
+// done, an error other than an xrun, or the stream closing.
+static PaError transfer_frames(PyAudioStream *stream, int is_write, char *data,
+                               unsigned long num_frames) {
+  PaStream *pa_stream = stream->context.stream;
+  const PyAudioStreamBackend *backend = stream->context.backend;
+  unsigned long chunk_frames =
+      (unsigned long)(stream->context.sample_rate * IO_CHUNK_SECONDS);
+  if (chunk_frames == 0) {
+    chunk_frames = num_frames;
+  }
+  PaError xrun = paNoError;
+  while (num_frames > 0) {
+    unsigned long count = num_frames < chunk_frames ? num_frames : chunk_frames;
+    PaError err = is_write ? backend->write(pa_stream, data, count)
+                           : backend->read(pa_stream, data, count);
+    if (err == paOutputUnderflowed || err == paInputOverflowed) {
+      xrun = err;
+    } else if (err != paNoError) {
+      return err;
+    }
+    data += (size_t)count * stream->context.frame_size;
+    num_frames -= count;
+    if (num_frames > 0) {
+      PyAudioMutex_Lock(&stream->lock);
+      int closing = stream->context.closing;
+      PyAudioMutex_Unlock(&stream->lock);
+      if (closing) {
+        return paBadStreamPtr;
+      }
+    }
+  }
+  return xrun;
+}
+
+PaError PyAudioStream_ReadFrames(PyAudioStream *stream, void *data,
+                                 unsigned long num_frames) {
+  return transfer_frames(stream, 0, (char *)data, num_frames);
+}
+
+PaError PyAudioStream_WriteFrames(PyAudioStream *stream, const void *data,
+                                  unsigned long num_frames) {
+  return transfer_frames(stream, 1, (char *)data, num_frames);
+}
+
+int PyAudioStream_BeginControl(PyAudioStream *stream) {
+  if (!stream->sync_ready) {
+    return -1;
+  }
+  PyAudioMutex_Lock(&stream->lock);
+  int busy = stream->context.controlling;
+  if (!busy) {
+    stream->context.controlling = 1;
+  }
+  PyAudioMutex_Unlock(&stream->lock);
+  if (!busy) {
+    return 0;
+  }
+
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  PyAudioMutex_Lock(&stream->lock);
+  while (stream->context.controlling) {
+    PyAudioCond_TimedWait(&stream->cond, &stream->lock, -1);
+  }
+  stream->context.controlling = 1;
+  PyAudioMutex_Unlock(&stream->lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  return 0;
+}
+
+void PyAudioStream_EndControl(PyAudioStream *stream) {
+  PyAudioMutex_Lock(&stream->lock);
+  stream->context.controlling = 0;
+  PyAudioCond_Broadcast(&stream->cond);
+  PyAudioMutex_Unlock(&stream->lock);
+}
+
+// Claims the write buffer if free and the stream open. Must be called with
+// stream->lock held.
+static int try_claim_write_buffer(PyAudioStream *stream) {
+  if (stream->context.write_buffer.claimed || !PyAudioStream_IsOpen(stream) ||
+      stream->context.closing) {
+    return -1;
+  }
+  stream->context.write_buffer.claimed = 1;
+  return 0;
+}
+
+int PyAudioStream_ClaimWriteBuffer(PyAudioStream *stream, int wait) {
+  if (!stream->sync_ready) {
+    return -1;
+  }
+  PyAudioMutex_Lock(&stream->lock);
+  int result = try_claim_write_buffer(stream);
+  int busy = stream->context.write_buffer.claimed;
+  PyAudioMutex_Unlock(&stream->lock);
+  if (result == 0 || !wait || !busy) {
+    return result;
+  }
+
+  // Another thread is writing the buffer out, with the GIL released.
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  PyAudioMutex_Lock(&stream->lock);
+  while (stream->context.write_buffer.claimed) {
+    PyAudioCond_TimedWait(&stream->cond, &stream->lock, -1);
+  }
+  result = try_claim_write_buffer(stream);
+  PyAudioMutex_Unlock(&stream->lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  return result;
+}
+
+void PyAudioStream_ReleaseWriteBuffer(PyAudioStream *stream) {
+  PyAudioMutex_Lock(&stream->lock);
+  stream->context.write_buffer.claimed = 0;
+  PyAudioCond_Broadcast(&stream->cond);
+  PyAudioMutex_Unlock(&stream->lock);
+}
+
+void PyAudioStream_SetBufferedFrames(PyAudioStream *stream,
+                                     unsigned long num_frames) {
+  PyAudioMutex_Lock(&stream->lock);
+  if (stream->context.write_buffer.num_frames == 0 && num_frames > 0) {
+    stream->context.write_buffer.first_time = PyAudioTime_Now();
+    // Have the flusher wait for the new block to age.
+    PyAudioCond_Broadcast(&stream->cond);
+  }
+  stream->context.write_buffer.num_frames = num_frames;
+  PyAudioMutex_Unlock(&stream->lock);
+}
+
+// Shortest wait before checking again whether a stopped stream started, in
+// seconds.
+#define FLUSHER_RETRY_INTERVAL 0.01
+
+// Writes out coalesced frames once the oldest reaches the maximum age, unless
+// a writer claimed the buffer, which then does. Leaves the frames of a stream
+// that is not running, and checks again later. Runs without the GIL until the
+// stream closes.
+static void flusher_thread(void *arg) {
+  PyAudioStream *stream = (PyAudioStream *)arg;
+  PaStream *pa_stream = stream->context.stream;
+  const PyAudioStreamBackend *backend = stream->context.backend;
+  double max_age = stream->context.write_buffer.max_age;
+  double retry_time = 0;
+
+  PyAudioMutex_Lock(&stream->lock);
+  while (!stream->context.closing) {
+    double now = PyAudioTime_Now();
+    double flush_time = stream->context.write_buffer.first_time + max_age;
+    if (flush_time < retry_time) {
+      flush_time = retry_time;
+    }
+    if (stream->context.write_buffer.num_frames == 0 ||
+        stream->context.write_buffer.claimed || now < flush_time) {
+      int idle = stream->context.write_buffer.num_frames == 0 ||
+                 stream->context.write_buffer.claimed;
+      PyAudioCond_TimedWait(&stream->cond, &stream->lock,
+                            idle ? -1 : flush_time - now);
+      continue;
+    }
+
+    // Claim the buffer, and count the write as in flight for close().
+    stream->context.write_buffer.claimed = 1;
+    stream->context.io_in_flight++;
+    unsigned long num_frames = stream->context.write_buffer.num_frames;
+    PyAudioMutex_Unlock(&stream->lock);
+    int flushed = backend->is_active(pa_stream) == 1;
+    if (flushed) {
+      // Errors are left for the next write to report.
+      PyAudioStream_WriteFrames(stream, stream->context.write_buffer.data,
+                                num_frames);
+    }
+    PyAudioMutex_Lock(&stream->lock);
+    if (flushed) {
+      stream->context.write_buffer.num_frames = 0;
+      retry_time = 0;
+    } else {
+      retry_time = PyAudioTime_Now() + (max_age > FLUSHER_RETRY_INTERVAL
+                                            ? max_age
+                                            : FLUSHER_RETRY_INTERVAL);
+    }
+    stream->context.write_buffer.claimed = 0;
+    stream->context.io_in_flight--;
+    PyAudioCond_Broadcast(&stream->cond);
+  }
+  stream->context.write_buffer.flusher_running = 0;
+  PyAudioCond_Broadcast(&stream->cond);
+  PyAudioMutex_Unlock(&stream->lock);
+}
+
+int PyAudioStream_StartFlusher(PyAudioStream *stream) {
+  PyAudioMutex_Lock(&stream->lock);
+  stream->context.write_buffer.flusher_running = 1;
+  PyAudioMutex_Unlock(&stream->lock);
+  if (PyThread_start_new_thread(flusher_thread, stream) ==
+      PYTHREAD_INVALID_THREAD_ID) {
+    PyAudioMutex_Lock(&stream->lock);
+    stream->context.write_buffer.flusher_running = 0;
+    PyAudioMutex_Unlock(&stream->lock);
+    PyErr_SetString(PyExc_RuntimeError, "Cannot start write flusher thread");
+    return -1;
+  }
+  return 0;
+}
+
+// Waits for the flusher to notice the stream is closing, and exit.
+static void stop_flusher(PyAudioStream *stream) {
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  PyAudioMutex_Lock(&stream->lock);
+  PyAudioCond_Broadcast(&stream->cond);
+  while (stream->context.write_buffer.flusher_running) {
+    PyAudioCond_TimedWait(&stream->cond, &stream->lock, -1);
+  }
+  PyAudioMutex_Unlock(&stream->lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+}
+
+// How long closing waits for in-flight reads and writes to return at their
+// next chunk before aborting the stream, in seconds.
+#define CLOSE_IO_GRACE_SECONDS 1.0
+
+// Marks the stream closing, and waits for PortAudio calls in progress on other
+// threads to finish. Blocking reads and writes return at their next chunk
+// (see PyAudioStream_ReadFrames()), so closing does not abort the stream
+// while another thread is inside Pa_ReadStream() or Pa_WriteStream(). Only a
+// call stalled past CLOSE_IO_GRACE_SECONDS (e.g., on an unplugged device) gets
+// the stream aborted under it, as the last resort to make it return. Returns 0
+// if the stream was already closing.
+static int begin_close(PyAudioStream *stream) {
+  if (!stream->sync_ready) {
+    // Never opened, so there is no I/O to wait for.
+    return 1;
+  }
+  PyAudioMutex_Lock(&stream->lock);
+  int closing = stream->context.closing;
+  stream->context.closing = 1;
+  PyAudioMutex_Unlock(&stream->lock);
+  if (closing) {
+    return 0;
+  }
+
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  PyAudioMutex_Lock(&stream->lock);
+  double deadline = PyAudioTime_Now() + CLOSE_IO_GRACE_SECONDS;
+  while (stream->context.io_in_flight > 0) {
+    double timeout = deadline - PyAudioTime_Now();
+    if (timeout <= 0) {
+      break;
+    }
+    PyAudioCond_TimedWait(&stream->cond, &stream->lock, timeout);
+  }
+  int stalled = stream->context.io_in_flight > 0;
+  PyAudioMutex_Unlock(&stream->lock);
+  if (stalled && stream->context.stream != NULL) {
+    stream->context.backend->abort(stream->context.stream);
+  }
+
+  PyAudioMutex_Lock(&stream->lock);
+  while (stream->context.io_in_flight > 0) {
+    PyAudioCond_TimedWait(&stream->cond, &stream->lock, -1);
+  }
+  PyAudioMutex_Unlock(&stream->lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  return 1;
+}
+
+void PyAudioStream_ReleaseCallbackThreadState(PyAudioStream *stream) {
+  if (stream->context.stream == NULL) {
+    return;
+  }
+  // Also keeps any further callbacks from creating a thread state. The
+  // callback thread only changes callback_tstate with the GIL held.
+  PyAudioAtomic_StoreLong(&stream->context.release_callback_tstate, 1);
+  if (stream->context.callback_tstate == NULL || !stream->sync_ready) {
+    return;
+  }
+
+  // While the stream runs, its next callback deletes the thread state and
+  // wakes us up. Once inactive, the finished callback already did so on hosts
+  // calling it from the callback thread; on others, the thread state remains
+  // until the stream closes (see PyAudioStream_Cleanup()). Allow a couple of
+  // buffers' worth of time for the next callback.
+  double timeout = 0.1;
+  const PaStreamInfo *stream_info =
+      stream->context.backend->get_info(stream->context.stream);
+  if (stream_info) {
+    timeout += 2 * (stream_info->inputLatency + stream_info->outputLatency);
+  }
+
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  double deadline = PyAudioTime_Now() + timeout;
+  PyAudioMutex_Lock(&stream->lock);
+  while (PyAudioAtomic_LoadLong(&stream->context.release_callback_tstate) ==
+             1 &&
+         PyAudioAtomic_LoadLong(&stream->context.active)) {
+    double remaining = deadline - PyAudioTime_Now();
+    if (remaining <= 0) {
+      break;
+    }
+    PyAudioCond_TimedWait(&stream->cond, &stream->lock, remaining);
+  }
+  PyAudioMutex_Unlock(&stream->lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+}
+
 void PyAudioStream_Cleanup(PyAudioStream *stream) {
   // Note that this function may be called multiple times on the same stream.
   // For example, stream_lifecycle.c may call this when the user closes the
   // stream, and Python may call it again during deallocation, i.e., when the
   // stream Python object's reference count reaches 0.
+  //
+  // Another thread may call this while it waits for in-flight I/O below,
+  // e.g., when a concurrent read() fails because the stream is closing. Leave
+  // the cleanup to the first caller.
+  if (!begin_close(stream)) {
+    return;
+  }
+
+  PyAudioStream_ReleaseCallbackThreadState(stream);
+  // The lookahead thread uses the PortAudio stream, so stop it first, along
+  // with the deadline callback thread. The PortAudio callback may still use
+  // their buffers until the stream closes.
+  if (stream->context.lookahead != NULL) {
+    PyAudioLookahead_Stop(stream->context.lookahead);
+  }
+  if (stream->context.deadline != NULL) {
+    PyAudioDeadline_Stop(stream->context.deadline);
+  }
   if (stream->context.stream != NULL) {
     // clang-format off
     Py_BEGIN_ALLOW_THREADS
-    Pa_CloseStream(stream->context.stream);
+    stream->context.backend->close(stream->context.stream);
     Py_END_ALLOW_THREADS
     // clang-format on
     stream->context.stream = NULL;
   }
+  // Unlock buffers before they are freed.
+  PyAudioLockedMemory_Release(&stream->context.locked_memory);
+
+  // Once closed, the stream no longer records.
+  PyAudioTrace_Destroy(stream->context.trace);
+  stream->context.trace = NULL;
+
+  PyAudioLookahead_Destroy(stream->context.lookahead);
+  stream->context.lookahead = NULL;
+  PyAudioDeadline_Destroy(stream->context.deadline);
+  stream->context.deadline = NULL;
+  // Neither the callback nor the workers run anymore.
+  PyAudioThreadTuning_Destroy(stream->context.thread_tuning);
+  stream->context.thread_tuning = NULL;
+
+  // The stream is closed, so nothing runs in the subinterpreter anymore. Its
+  // callback is not ours to release.
+  if (stream->context.isolated != NULL) {
+    stream->context.callback = NULL;
+    PyAudioIsolated_Destroy(stream->context.isolated);
+    stream->context.isolated = NULL;
+  }
 
   if (stream->context.callback != NULL) {
     Py_XDECREF(stream->context.callback);
     stream->context.callback = NULL;
   }
 
-  // Just in case, zero out the entire struct.
-  memset(&(stream->context), 0, sizeof(struct StreamContext));
-}
+  // The stream is closed, so the callback can no longer access the schedule.
+  PyAudioSchedule_Destroy(stream->context.schedule);
+  stream->context.schedule = NULL;
 
-PyObject *PyAudio_GetStreamTime(PyObject *self, PyObject *args) {
-  double time;
+  // Wake up blocked readers; the ring itself lives on until the last reader
+  // releases it.
+  if (stream->context.capture_ring != NULL) {
+    PyAudioRing_Close(stream->context.capture_ring);
+    PyAudioRing_Decref(stream->context.capture_ring);
+    stream->context.capture_ring = NULL;
+  }
 
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
-    return NULL;
+  if (stream->context.result_ring != NULL) {
+    PyAudioRing_Close(stream->context.result_ring);
+    PyAudioRing_Decref(stream->context.result_ring);
+    stream->context.result_ring = NULL;
   }
 
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
-  if (!PyAudioStream_IsOpen(stream)) {
-    PyErr_SetObject(PyExc_IOError,
-                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
-    return NULL;
+  PyAudioSharedCapture_Destroy(stream->context.shared_capture);
+  stream->context.shared_capture = NULL;
+
+  if (stream->sync_ready) {
+    stop_flusher(stream);
   }
+  free(stream->context.write_buffer.data);
 
-  // clang-format off
-  Py_BEGIN_ALLOW_THREADS
-  time = Pa_GetStreamTime(stream->context.stream);
-  Py_END_ALLOW_THREADS
-  // clang-format on
+  PyAudioReblock_Destroy(stream->context.reblock);
+  stream->context.reblock = NULL;
 
-  if (time == 0) {
-    PyAudioStream_Cleanup(stream);
-    PyErr_SetObject(PyExc_IOError,
-                    Py_BuildValue("(i,s)", paInternalError, "Internal Error"));
-    return NULL;
+  // The stream is closed, so the callback no longer mixes broker clients.
+  PyAudioBroker_Destroy(stream->context.broker);
+  stream->context.broker = NULL;
+
+  // The callback thread deletes its thread state with its last callback, as
+  // the stream finishes on its thread, or when asked to before stopping or
+  // closing. One stalled past PyAudioStream_ReleaseCallbackThreadState()'s
+  // wait on a host that calls the finished callback elsewhere still owns it:
+  // deleting it from this thread would unbind this thread's own PyGILState,
+  // and leave the callback thread's dangling. The interpreter frees it when
+  // it finalizes.
+  stream->context.callback_tstate = NULL;
+
+  // Just in case, zero out the entire struct, but for a thread still
+  // controlling the stream, which ends that itself.
+  if (stream->sync_ready) {
+    PyAudioMutex_Lock(&stream->lock);
+  }
+  int controlling = stream->context.controlling;
+  memset(&(stream->context), 0, sizeof(struct StreamContext));
+  stream->context.controlling = controlling;
+  if (stream->sync_ready) {
+    PyAudioMutex_Unlock(&stream->lock);
   }
 
-  return PyFloat_FromDouble(time);
+  // A closed stream is no longer active.
+  PyAudioStream_SignalFinished(stream);
 }
 
-PyObject *PyAudio_GetStreamCpuLoad(PyObject *self, PyObject *args) {
-  double cpuload;
-
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
+PyObject *PyAudio_GetStreamTime(PyObject *self, PyObject *const *args,
+                                Py_ssize_t nargs) {
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "get_stream_time", args, nargs, 1, 1);
+  if (stream == NULL) {
     return NULL;
   }
+  return get_time(stream, NULL);
+}
 
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
-  if (!PyAudioStream_IsOpen(stream)) {
-    PyErr_SetObject(PyExc_IOError,
-                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+PyObject *PyAudio_GetStreamCpuLoad(PyObject *self, PyObject *const *args,
+                                   Py_ssize_t nargs) {
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "get_stream_cpu_load", args, nargs, 1, 1);
+  if (stream == NULL) {
     return NULL;
   }
-
-  // clang-format off
-  Py_BEGIN_ALLOW_THREADS
-  cpuload = Pa_GetStreamCpuLoad(stream->context.stream);
-  Py_END_ALLOW_THREADS
-  // clang-format on
-
-  return PyFloat_FromDouble(cpuload);
+  return get_cpu_load(stream, NULL);
 }
@@ -7,40 +7,230 @@
 #include "Python.h"
 #include "portaudio.h"
 
-typedef struct {
+#include "output_broker.h"
+#include "ring_buffer.h"
+#include "shared_capture.h"
+#include "stream_backend.h"
+#include "stream_deadline.h"
+#include "stream_isolated.h"
+#include "stream_lookahead.h"
+#include "stream_reblock.h"
+#include "stream_schedule.h"
+#include "stream_trace.h"
+#include "thread_tuning.h"
+#include "sync.h"
+
+typedef struct PyAudioStream {
   // clang-format off
   PyObject_HEAD
   // clang-format on
   struct StreamContext {
     // PortAudio stream object. NULL when the stream is closed.
     PaStream *stream;
+    // Functions operating on stream: PortAudio's, or those of the virtual
+    // null device.
+    const PyAudioStreamBackend *backend;
     // User audio callback routine, for when using callback mode.
     // NULL otherwise.
     PyObject *callback;
+    // Format and direction, as opened.
+    PaSampleFormat format;
+    int channels;
+    int is_input;
+    int is_output;
+    // Whether the stream was started (and not since stopped) through its
+    // start_stream() and stop_stream() methods, or the module functions.
+    // Only used by the thread controlling the stream (see
+    // PyAudioStream_BeginControl()).
+    int is_running;
+    // Whether a thread is starting, stopping or aborting the stream. Guarded
+    // by lock.
+    int controlling;
+    // Whether the stream is active (atomic): set when it starts, cleared by
+    // the PortAudio finished callback, or when it is stopped or closed.
+    volatile long active;
+    // Set once the stream starts closing; no new PortAudio calls begin.
+    // Guarded by lock.
+    int closing;
+    // Number of PortAudio calls in progress with the GIL released, e.g., a
+    // read() on one thread and a write() on another. Guarded by lock.
+    long io_in_flight;
     // Frame size, in bytes, for input and output. Equal to
     // num channels x bytes per sample.
     unsigned int frame_size;
     // Main thread ID.
     long main_thread_id;
+    // Interpreter that opened the stream, and runs its callback.
+    PyInterpreterState *interp;
+    // Python thread state of the PortAudio callback thread, created on the
+    // first callback and reused by later ones, instead of creating and
+    // deleting one per callback. Owned by the thread whose
+    // PyThread_get_thread_ident() is callback_thread_ident. NULL until the
+    // first callback, and once released.
+    PyThreadState *callback_tstate;
+    unsigned long callback_thread_ident;
+    // Set (atomic) to 1 to ask the callback thread to delete
+    // callback_tstate, which only the owning thread can do safely; set to 2
+    // by the callback thread once done. Reset to 0 when the stream starts.
+    volatile long release_callback_tstate;
+    // Actual sample rate of the stream, in Hz.
+    double sample_rate;
+    // Timeline of scheduled clips for callback-mode output streams. NULL
+    // otherwise.
+    PyAudioSchedule *schedule;
+    // Ring of captured input frames, for independent readers. NULL unless
+    // requested when opening an input stream.
+    PyAudioRing *capture_ring;
+    // Shared-memory export of captured input frames, for readers in other
+    // processes. NULL unless requested when opening an input stream.
+    PyAudioSharedCapture *shared_capture;
+    // Trace recording the arguments of each PortAudio callback. NULL unless
+    // requested when opening a callback-mode stream.
+    PyAudioTrace *trace;
+    // Scheduling and CPU affinity for the callback thread and workers. NULL
+    // unless requested when opening a callback-mode stream.
+    PyAudioThreadTuning *thread_tuning;
+    // Stream buffers locked in memory, if requested when opening.
+    PyAudioLockedMemory locked_memory;
+    // Output broker mixing other processes' audio into the output. NULL
+    // unless requested when opening an output stream.
+    PyAudioBroker *broker;
+    // Reblocker delivering fixed-size blocks to the Python callback. NULL
+    // unless requested when opening a callback-mode stream.
+    PyAudioReblock *reblock;
+    // FIFO filled ahead of the device by a dedicated thread running the
+    // Python callback. NULL unless requested when opening a callback-mode
+    // output stream.
+    PyAudioLookahead *lookahead;
+    // Thread running the Python callback under a deadline, with fallback
+    // output. NULL unless requested when opening a callback-mode stream with
+    // output.
+    PyAudioDeadline *deadline;
+    // Subinterpreter running the Python callback with its own GIL; callback
+    // and interp then belong to it. NULL unless requested when opening a
+    // callback-mode stream.
+    PyAudioIsolated *isolated;
+    // Ring of results returned by an isolated callback, for StreamReaders in
+    // the main interpreter. NULL unless requested along with isolated.
+    PyAudioRing *result_ring;
+    // Buffer coalescing small blocking writes into blocks of capacity
+    // frames. Unused (capacity 0) unless requested when opening a blocking
+    // output stream. Only the thread that claimed it (see
+    // PyAudioStream_ClaimWriteBuffer()) uses data, and changes num_frames and
+    // first_time, under lock, as others read them.
+    struct {
+      char *data;
+      unsigned long capacity;
+      unsigned long num_frames;
+      // Time at which the oldest buffered frame was written, and how old it
+      // may get before the block is written out anyway, in seconds.
+      double first_time;
+      double max_age;
+      // Whether a thread claimed the buffer. Guarded by lock.
+      int claimed;
+      // Whether the thread writing out blocks that reach max_age runs.
+      // Guarded by lock.
+      int flusher_running;
+    } write_buffer;
   } context;
+  // Per-stream lock and condition variable, signalled whenever
+  // context.active is cleared (for wait()), and when the last in-flight
+  // PortAudio call finishes (for close()). Unlike context, these outlive
+  // closing the stream, until deallocation.
+  PyAudioMutex lock;
+  PyAudioCond cond;
+  int sync_ready;
 } PyAudioStream;
 
-extern PyTypeObject PyAudioStreamType;
+extern PyType_Spec PyAudioStreamSpec;
 
 // "Internal" utilities for other stream_*.c modules.
 
-// Creates a PyAudioStream and zeros out the fields. Returns NULL if memory
-// allocation fails.
-PyAudioStream *PyAudioStream_Create(void);
+// Creates a PyAudioStream of the _portaudio module's Stream type and zeros
+// out the fields. Returns NULL if memory allocation fails.
+PyAudioStream *PyAudioStream_Create(PyObject *module);
+// Opens a PortAudio stream with the arguments of _portaudio.open(). Returns 0,
+// or -1 with an exception set, leaving stream closed.
+int PyAudioStream_Open(PyAudioStream *stream, PyObject *args,
+                       PyObject *kwargs);
 // Closes the PortAudio stream (if open) and garbage collects the fields within
 // a PyAudioStream. May be called multiple times on the same stream.
 void PyAudioStream_Cleanup(PyAudioStream *stream);
 // Returns whether the stream is open.
 int PyAudioStream_IsOpen(PyAudioStream *stream);
+// Marks the stream inactive and wakes up threads blocked in wait(). Safe to
+// call without the GIL, e.g. from the PortAudio finished callback.
+void PyAudioStream_SignalFinished(PyAudioStream *stream);
+// Brackets a PortAudio call made with the GIL released, or use of the
+// stream's context (e.g., its schedule) that another thread closing the
+// stream could race without a GIL, so that closing the stream waits for it to
+// finish. Must be called with the GIL held.
+// PyAudioStream_BeginIO() returns paBadStreamPtr if the stream is closed or
+// closing, in which case the call must not be made, nor
+// PyAudioStream_EndIO() called. Call PyAudioStream_EndIO() before
+// PyAudioStream_Cleanup().
+PaError PyAudioStream_BeginIO(PyAudioStream *stream);
+void PyAudioStream_EndIO(PyAudioStream *stream);
+// Blocking read and write of num_frames, made between PyAudioStream_BeginIO()
+// and PyAudioStream_EndIO() without the GIL. They read or write in short
+// chunks, and return paBadStreamPtr between chunks once the stream is closing,
+// so that closing does not wait for (or abort) the rest of a long transfer.
+// Otherwise return the first PortAudio error, or the last xrun reported.
+PaError PyAudioStream_ReadFrames(PyAudioStream *stream, void *data,
+                                 unsigned long num_frames);
+PaError PyAudioStream_WriteFrames(PyAudioStream *stream, const void *data,
+                                  unsigned long num_frames);
+// Brackets starting, stopping or aborting the stream, which release the GIL,
+// so that only one thread at a time does, and uses is_running. Must be called
+// with the GIL held. PyAudioStream_BeginControl() waits (without the GIL) for
+// another thread to finish, and returns 0, or -1 if the stream was never
+// opened, in which case PyAudioStream_EndControl() must not be called.
+int PyAudioStream_BeginControl(PyAudioStream *stream);
+void PyAudioStream_EndControl(PyAudioStream *stream);
+// Claims the coalesced write buffer for the calling thread, as writing it out
+// releases the GIL. If wait, waits (without the GIL) for another thread to
+// release it; otherwise fails if claimed. Must be called with the GIL held.
+// Returns 0, or -1 if not claimed, including if the stream is closed or
+// closing.
+int PyAudioStream_ClaimWriteBuffer(PyAudioStream *stream, int wait);
+void PyAudioStream_ReleaseWriteBuffer(PyAudioStream *stream);
+// Sets the number of coalesced frames, and when buffering the first one, the
+// time it was written. The calling thread must have claimed the write buffer.
+void PyAudioStream_SetBufferedFrames(PyAudioStream *stream,
+                                     unsigned long num_frames);
+// Has the callback thread delete its persistent thread state, waiting
+// briefly for its next callback if the stream is running. Must be called with
+// the GIL held, before stopping or closing the stream.
+void PyAudioStream_ReleaseCallbackThreadState(PyAudioStream *stream);
+// Checks the arguments of a METH_FASTCALL function of module named func_name,
+// which takes a stream followed by up to max_args - 1 other arguments. Returns
+// the stream, or NULL with a TypeError set.
+PyAudioStream *PyAudioStream_CheckArgs(PyObject *module, const char *func_name,
+                                       PyObject *const *args, Py_ssize_t nargs,
+                                       Py_ssize_t min_args,
+                                       Py_ssize_t max_args);
+// Unpacks the arguments of a METH_FASTCALL | METH_KEYWORDS method named
+// func_name into values, in the order of the NULL-terminated names. The first
+// min_args arguments are required; values of others not given are left
+// unchanged. Returns 0, or -1 with a TypeError set.
+int PyAudioStream_UnpackArgs(const char *func_name, PyObject *const *args,
+                             Py_ssize_t nargs, PyObject *kwnames,
+                             const char *const *names, Py_ssize_t min_args,
+                             PyObject **values);
+// Starts a thread writing out coalesced frames once the oldest reaches the
+// maximum age, even if no write follows. It stops when the stream closes.
+// Returns 0, or -1 with an exception set.
+int PyAudioStream_StartFlusher(PyAudioStream *stream);
+// Writes any coalesced frames to PortAudio. The calling thread must have
+// claimed the write buffer. Must be called with the GIL held; releases it
+// while writing. Returns the PortAudio error, if any.
+PaError PyAudioStream_FlushWrites(PyAudioStream *stream);
 
 // Exported functions.
 
-PyObject *PyAudio_GetStreamTime(PyObject *self, PyObject *args);
-PyObject *PyAudio_GetStreamCpuLoad(PyObject *self, PyObject *args);
+PyObject *PyAudio_GetStreamTime(PyObject *self, PyObject *const *args,
+                                Py_ssize_t nargs);
+PyObject *PyAudio_GetStreamCpuLoad(PyObject *self, PyObject *const *args,
+                                   Py_ssize_t nargs);
 
 #endif  // STREAM_H_
@@ -0,0 +1,35 @@
+// Stream backends: the PortAudio stream functions a stream calls, as a table,
+// so that a stream may run on PortAudio or on the virtual null device (see
+// null_device.h) through the same code paths.
+
+#ifndef STREAM_BACKEND_H_
+#define STREAM_BACKEND_H_
+
+#include "portaudio.h"
+
+// Functions with the signatures and semantics of their Pa_*Stream*()
+// counterparts.
+typedef struct {
+  PaError (*close)(PaStream *stream);
+  PaError (*set_finished_callback)(PaStream *stream,
+                                   PaStreamFinishedCallback *callback);
+  PaError (*start)(PaStream *stream);
+  PaError (*stop)(PaStream *stream);
+  PaError (*abort)(PaStream *stream);
+  PaError (*is_stopped)(PaStream *stream);
+  PaError (*is_active)(PaStream *stream);
+  const PaStreamInfo *(*get_info)(PaStream *stream);
+  PaTime (*get_time)(PaStream *stream);
+  double (*get_cpu_load)(PaStream *stream);
+  PaError (*read)(PaStream *stream, void *buffer, unsigned long frames);
+  PaError (*write)(PaStream *stream, const void *buffer, unsigned long frames);
+  signed long (*get_read_available)(PaStream *stream);
+  signed long (*get_write_available)(PaStream *stream);
+} PyAudioStreamBackend;
+
+// PortAudio itself.
+extern const PyAudioStreamBackend PyAudioPortAudioBackend;
+// The virtual null device.
+extern const PyAudioStreamBackend PyAudioNullBackend;
+
+#endif  // STREAM_BACKEND_H_
@@ -0,0 +1,384 @@
+#include "stream_deadline.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+#include "pythread.h"
+
+#include "stream.h"
+#include "stream_io.h"
+#include "sync.h"
+
+// States of the request exchanged with the callback thread.
+enum {
+  // No request pending; the PortAudio callback may post one.
+  REQUEST_IDLE = 0,
+  // Posted; the callback thread owns the request and output buffers.
+  REQUEST_POSTED,
+  // Done; the output is ready for the PortAudio callback.
+  REQUEST_DONE,
+};
+
+struct PyAudioDeadline {
+  unsigned long frames_per_buffer;
+  unsigned int frame_size;
+  PaSampleFormat format;
+  unsigned int channels;
+  double sample_rate;
+  double fraction;
+  PyAudioFallback fallback;
+
+  // The request: written by the PortAudio callback while idle, read by the
+  // callback thread while posted. input is NULL for output-only streams.
+  char *input;
+  unsigned long frame_count;
+  PaStreamCallbackTimeInfo time_info;
+  PaStreamCallbackFlags status_flags;
+  // The response: written by the callback thread while posted, read by the
+  // PortAudio callback once done.
+  char *output;
+  int result;
+  // Request state (atomic).
+  volatile long state;
+
+  // Last buffer played, for the fallback.
+  char *last_output;
+  unsigned long last_frames;
+  // Number of missed deadlines (atomic).
+  volatile uint64_t misses;
+
+  // Callback thread. Fields without atomics are only accessed with the GIL.
+  struct PyAudioStream *stream;
+  int started;
+  unsigned long thread_ident;
+  // Set (atomic) to ask the thread to exit.
+  volatile long stop_requested;
+  // Whether the thread is still running (atomic), cleared as it exits.
+  volatile long running;
+  // Reference count (atomic): one for the stream, one while the thread runs,
+  // and one per PyAudioDeadline_Stop() in progress. The thread outlives the
+  // stream's reference when the callback closes its own stream.
+  volatile long refcount;
+  PyAudioMutex lock;
+  PyAudioCond cond;
+};
+
+int PyAudioDeadline_ParseFallback(const char *name, PyAudioFallback *fallback) {
+  if (name == NULL || strcmp(name, "silence") == 0) {
+    *fallback = PYAUDIO_FALLBACK_SILENCE;
+  } else if (strcmp(name, "repeat") == 0) {
+    *fallback = PYAUDIO_FALLBACK_REPEAT;
+  } else if (strcmp(name, "fade") == 0) {
+    *fallback = PYAUDIO_FALLBACK_FADE;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "deadline_fallback must be 'silence', 'repeat' or 'fade'");
+    return -1;
+  }
+  return 0;
+}
+
+PyAudioDeadline *PyAudioDeadline_Create(unsigned long frames_per_buffer,
+                                        unsigned int frame_size,
+                                        PaSampleFormat format,
+                                        unsigned int channels,
+                                        double sample_rate, int input,
+                                        double fraction,
+                                        PyAudioFallback fallback) {
+  PyAudioDeadline *deadline =
+      (PyAudioDeadline *)calloc(1, sizeof(PyAudioDeadline));
+  if (!deadline) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  deadline->frames_per_buffer = frames_per_buffer;
+  deadline->frame_size = frame_size;
+  deadline->format = format;
+  deadline->channels = channels;
+  deadline->sample_rate = sample_rate;
+  deadline->fraction = fraction;
+  deadline->fallback = fallback;
+  deadline->refcount = 1;
+  PyAudioMutex_Init(&deadline->lock);
+  PyAudioCond_Init(&deadline->cond);
+
+  size_t buffer_size = (size_t)frames_per_buffer * frame_size;
+  deadline->output = (char *)malloc(buffer_size);
+  deadline->last_output = (char *)calloc(1, buffer_size);
+  if (input) {
+    deadline->input = (char *)malloc(buffer_size);
+  }
+  if (!deadline->output || !deadline->last_output ||
+      (input && !deadline->input)) {
+    PyAudioDeadline_Destroy(deadline);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  return deadline;
+}
+
+static void incref(PyAudioDeadline *deadline) {
+  PyAudioAtomic_AddLong(&deadline->refcount, 1);
+}
+
+// Releases a reference, and frees the deadline with the last one.
+static void decref(PyAudioDeadline *deadline) {
+  if (PyAudioAtomic_AddLong(&deadline->refcount, -1) > 0) {
+    return;
+  }
+  PyAudioCond_Destroy(&deadline->cond);
+  PyAudioMutex_Destroy(&deadline->lock);
+  free(deadline->input);
+  free(deadline->output);
+  free(deadline->last_output);
+  free(deadline);
+}
+
+void PyAudioDeadline_Destroy(PyAudioDeadline *deadline) {
+  if (deadline != NULL) {
+    decref(deadline);
+  }
+}
+
+void PyAudioDeadline_LockMemory(PyAudioDeadline *deadline,
+                                PyAudioLockedMemory *memory) {
+  size_t buffer_size =
+      (size_t)deadline->frames_per_buffer * deadline->frame_size;
+  PyAudioLockedMemory_Add(memory, deadline->input, buffer_size);
+  PyAudioLockedMemory_Add(memory, deadline->output, buffer_size);
+  PyAudioLockedMemory_Add(memory, deadline->last_output, buffer_size);
+}
+
+uint64_t PyAudioDeadline_Misses(PyAudioDeadline *deadline) {
+  return PyAudioAtomic_LoadU64(&deadline->misses);
+}
+
+// Sets the request state, and wakes up the other side.
+static void set_state(PyAudioDeadline *deadline, long state) {
+  PyAudioMutex_Lock(&deadline->lock);
+  PyAudioAtomic_StoreLong(&deadline->state, state);
+  PyAudioCond_Broadcast(&deadline->cond);
+  PyAudioMutex_Unlock(&deadline->lock);
+}
+
+static void callback_thread(void *arg) {
+  PyAudioDeadline *deadline = (PyAudioDeadline *)arg;
+  if (deadline->stream->context.thread_tuning != NULL) {
+    PyAudioThreadTuning_Apply(deadline->stream->context.thread_tuning,
+                              PYAUDIO_THREAD_WORKER);
+  }
+  PyThreadState *tstate = PyThreadState_New(deadline->stream->context.interp);
+
+  while (tstate != NULL) {
+    PyAudioMutex_Lock(&deadline->lock);
+    while (PyAudioAtomic_LoadLong(&deadline->state) != REQUEST_POSTED &&
+           !PyAudioAtomic_LoadLong(&deadline->stop_requested)) {
+      PyAudioCond_TimedWait(&deadline->cond, &deadline->lock, -1);
+    }
+    PyAudioMutex_Unlock(&deadline->lock);
+    if (PyAudioAtomic_LoadLong(&deadline->stop_requested)) {
+      break;
+    }
+
+    PyEval_RestoreThread(tstate);
+    deadline->result = PyAudioStream_InvokeCallback(
+        deadline->stream, deadline->input, deadline->output,
+        deadline->frame_count, deadline->frame_count, &deadline->time_info,
+        deadline->status_flags);
+    PyEval_SaveThread();
+
+    set_state(deadline, REQUEST_DONE);
+    if (deadline->result != paContinue) {
+      break;
+    }
+  }
+
+  if (tstate != NULL) {
+    PyEval_RestoreThread(tstate);
+    PyThreadState_Clear(tstate);
+    PyEval_SaveThread();
+    PyThreadState_Delete(tstate);
+  }
+
+  PyAudioMutex_Lock(&deadline->lock);
+  PyAudioAtomic_StoreLong(&deadline->running, 0);
+  PyAudioCond_Broadcast(&deadline->cond);
+  PyAudioMutex_Unlock(&deadline->lock);
+  decref(deadline);
+}
+
+int PyAudioDeadline_Start(PyAudioDeadline *deadline,
+                          struct PyAudioStream *stream) {
+  PyAudioDeadline_Stop(deadline);
+
+  deadline->stream = stream;
+  deadline->last_frames = 0;
+  PyAudioAtomic_StoreLong(&deadline->state, REQUEST_IDLE);
+  PyAudioAtomic_StoreLong(&deadline->stop_requested, 0);
+  PyAudioAtomic_StoreLong(&deadline->running, 1);
+  incref(deadline);
+  deadline->thread_ident = PyThread_start_new_thread(callback_thread, deadline);
+  if (deadline->thread_ident == PYTHREAD_INVALID_THREAD_ID) {
+    PyAudioAtomic_StoreLong(&deadline->running, 0);
+    decref(deadline);
+    PyErr_SetString(PyExc_RuntimeError, "Cannot start callback thread");
+    return -1;
+  }
+  deadline->started = 1;
+  return 0;
+}
+
+void PyAudioDeadline_Stop(PyAudioDeadline *deadline) {
+  if (!deadline->started) {
+    return;
+  }
+
+  PyAudioMutex_Lock(&deadline->lock);
+  PyAudioAtomic_StoreLong(&deadline->stop_requested, 1);
+  PyAudioCond_Broadcast(&deadline->cond);
+  PyAudioMutex_Unlock(&deadline->lock);
+
+  if (PyThread_get_thread_ident() == deadline->thread_ident) {
+    // Stopped from the Python callback, on the callback thread itself, which
+    // exits once the callback returns. Its own reference keeps the deadline
+    // alive until then, even if the stream closes and destroys it.
+    return;
+  }
+
+  // Keep the deadline alive while waiting, in case the callback closes the
+  // stream meanwhile.
+  incref(deadline);
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  PyAudioMutex_Lock(&deadline->lock);
+  while (PyAudioAtomic_LoadLong(&deadline->running)) {
+    PyAudioCond_TimedWait(&deadline->cond, &deadline->lock, -1);
+  }
+  PyAudioMutex_Unlock(&deadline->lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  deadline->started = 0;
+  decref(deadline);
+}
+
+// Multiplies the samples of frames frames by a gain ramping down to zero.
+static void fade_out(PyAudioDeadline *deadline, char *data,
+                     unsigned long frames) {
+  unsigned int channels = deadline->channels;
+  for (unsigned long i = 0; i < frames; i++) {
+    float gain = (float)(frames - 1 - i) / (float)frames;
+    for (unsigned int c = 0; c < channels; c++) {
+      size_t k = (size_t)i * channels + c;
+      switch (deadline->format) {
+        case paFloat32:
+          ((float *)data)[k] *= gain;
+          break;
+        case paInt32:
+          ((int32_t *)data)[k] = (int32_t)(((int32_t *)data)[k] * (double)gain);
+          break;
+        case paInt16:
+          ((int16_t *)data)[k] = (int16_t)(((int16_t *)data)[k] * gain);
+          break;
+        case paInt8:
+          ((int8_t *)data)[k] = (int8_t)(((int8_t *)data)[k] * gain);
+          break;
+      }
+    }
+  }
+}
+
+// Plays the fallback buffer into output, and counts the missed deadline.
+static void play_fallback(PyAudioDeadline *deadline, char *output,
+                          unsigned long frame_count) {
+  unsigned int frame_size = deadline->frame_size;
+  PyAudioAtomic_StoreU64(&deadline->misses,
+                         PyAudioAtomic_LoadU64(&deadline->misses) + 1);
+
+  int fade = deadline->fallback == PYAUDIO_FALLBACK_FADE &&
+             (deadline->format == paFloat32 || deadline->format == paInt32 ||
+              deadline->format == paInt16 || deadline->format == paInt8);
+  unsigned long frames = 0;
+  if (deadline->fallback == PYAUDIO_FALLBACK_REPEAT || fade) {
+    frames = deadline->last_frames < frame_count ? deadline->last_frames
+                                                 : frame_count;
+  }
+  memcpy(output, deadline->last_output, (size_t)frames * frame_size);
+  memset(output + (size_t)frames * frame_size, 0,
+         (size_t)(frame_count - frames) * frame_size);
+  if (fade) {
+    fade_out(deadline, output, frames);
+    // Further misses continue from silence.
+    deadline->last_frames = 0;
+  }
+}
+
+// Plays the callback's output into output, and returns its result.
+static int play_output(PyAudioDeadline *deadline, char *output,
+                       unsigned long frame_count) {
+  unsigned int frame_size = deadline->frame_size;
+  unsigned long frames = deadline->frame_count < frame_count
+                             ? deadline->frame_count
+                             : frame_count;
+  memcpy(output, deadline->output, (size_t)frames * frame_size);
+  memset(output + (size_t)frames * frame_size, 0,
+         (size_t)(frame_count - frames) * frame_size);
+  memcpy(deadline->last_output, output, (size_t)frames * frame_size);
+  deadline->last_frames = frames;
+
+  int result = deadline->result;
+  PyAudioAtomic_StoreLong(&deadline->state, REQUEST_IDLE);
+  return result;
+}
+
+int PyAudioDeadline_Process(PyAudioDeadline *deadline, const void *input,
+                            void *output, unsigned long frame_count,
+                            const PaStreamCallbackTimeInfo *time_info,
+                            PaStreamCallbackFlags status_flags) {
+  char *out = (char *)output;
+  long state = PyAudioAtomic_LoadLong(&deadline->state);
+  if (state == REQUEST_DONE) {
+    // The previous period's output, late.
+    return play_output(deadline, out, frame_count);
+  }
+  if (state == REQUEST_POSTED || frame_count > deadline->frames_per_buffer) {
+    // Still running the previous period's callback. (Buffers never exceed
+    // frames_per_buffer, which PortAudio guarantees for fixed sizes.)
+    play_fallback(deadline, out, frame_count);
+    return paContinue;
+  }
+
+  if (input != NULL) {
+    memcpy(deadline->input, input,
+           (size_t)frame_count * deadline->frame_size);
+  }
+  deadline->frame_count = frame_count;
+  deadline->time_info = *time_info;
+  deadline->status_flags = status_flags;
+
+  double timeout = deadline->fraction * frame_count / deadline->sample_rate;
+  double end = PyAudioTime_Now() + timeout;
+  PyAudioMutex_Lock(&deadline->lock);
+  PyAudioAtomic_StoreLong(&deadline->state, REQUEST_POSTED);
+  PyAudioCond_Broadcast(&deadline->cond);
+  while (PyAudioAtomic_LoadLong(&deadline->state) == REQUEST_POSTED) {
+    double remaining = end - PyAudioTime_Now();
+    if (remaining <= 0) {
+      break;
+    }
+    PyAudioCond_TimedWait(&deadline->cond, &deadline->lock, remaining);
+  }
+  state = PyAudioAtomic_LoadLong(&deadline->state);
+  PyAudioMutex_Unlock(&deadline->lock);
+
+  if (state == REQUEST_DONE) {
+    return play_output(deadline, out, frame_count);
+  }
+  play_fallback(deadline, out, frame_count);
+  return paContinue;
+}
@@ -0,0 +1,79 @@
+// Deadline-protected callbacks for callback-mode streams with output.
+//
+// CPython cannot acquire the GIL with a timeout, so the Python callback runs
+// on a dedicated thread instead: each period, the PortAudio callback hands it
+// the buffer and waits at most a fraction of the buffer period for its
+// output. If the callback misses that deadline (e.g., another thread holds the
+// GIL through a garbage collection), the device plays a fallback buffer
+// instead, and the miss is counted. The late output plays in the following
+// period, in place of calling the Python callback for it, so no output is
+// lost and the callback is not called twice concurrently.
+
+#ifndef STREAM_DEADLINE_H_
+#define STREAM_DEADLINE_H_
+
+#include <stdint.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "thread_tuning.h"
+
+struct PyAudioStream;
+
+// What to play when the callback misses its deadline.
+typedef enum {
+  PYAUDIO_FALLBACK_SILENCE = 0,
+  // The previous buffer, again.
+  PYAUDIO_FALLBACK_REPEAT,
+  // The previous buffer, faded out to silence. Formats other than paInt8,
+  // paInt16, paInt32 and paFloat32 play silence.
+  PYAUDIO_FALLBACK_FADE,
+} PyAudioFallback;
+
+typedef struct PyAudioDeadline PyAudioDeadline;
+
+// Parses a deadline_fallback name ("silence", "repeat" or "fade"). NULL
+// selects silence. Returns 0, or -1 with a ValueError set.
+int PyAudioDeadline_ParseFallback(const char *name, PyAudioFallback *fallback);
+
+// Allocates the buffers of a deadline-protected stream, which waits at most
+// fraction of each buffer period for the Python callback. Returns NULL with
+// an exception set on failure.
+PyAudioDeadline *PyAudioDeadline_Create(unsigned long frames_per_buffer,
+                                        unsigned int frame_size,
+                                        PaSampleFormat format,
+                                        unsigned int channels,
+                                        double sample_rate, int input,
+                                        double fraction,
+                                        PyAudioFallback fallback);
+// Releases the stream's reference to the buffers. If the callback thread is
+// still running (i.e., the callback closed its own stream), the thread frees
+// them as it exits; otherwise, the thread must be stopped.
+void PyAudioDeadline_Destroy(PyAudioDeadline *deadline);
+// Locks the request and response buffers in memory.
+void PyAudioDeadline_LockMemory(PyAudioDeadline *deadline,
+                                PyAudioLockedMemory *memory);
+
+// Starts the thread running the Python callback. Must be called with the GIL
+// held. Returns 0, or -1 with an exception set.
+int PyAudioDeadline_Start(PyAudioDeadline *deadline,
+                          struct PyAudioStream *stream);
+// Stops the callback thread, if running, and waits for it to exit. Must be
+// called with the GIL held; releases it while waiting.
+void PyAudioDeadline_Stop(PyAudioDeadline *deadline);
+
+// Runs one period from the PortAudio callback, without the GIL. Returns the
+// PaStreamCallbackResult.
+int PyAudioDeadline_Process(PyAudioDeadline *deadline, const void *input,
+                            void *output, unsigned long frame_count,
+                            const PaStreamCallbackTimeInfo *time_info,
+                            PaStreamCallbackFlags status_flags);
+
+// Returns the number of periods in which the callback missed its deadline.
+uint64_t PyAudioDeadline_Misses(PyAudioDeadline *deadline);
+
+#endif  // STREAM_DEADLINE_H_
@@ -1,7 +1,9 @@
 #include "stream_io.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 #ifndef PY_SSIZE_T_CLEAN
 #define PY_SSIZE_T_CLEAN
@@ -9,15 +11,19 @@
 #include "Python.h"
 #include "portaudio.h"
 
+#include "output_broker.h"
+#include "probes.h"
+#include "ring_buffer.h"
 #include "stream.h"
-
-int PyAudioStream_CallbackCFunc(const void *input, void *output,
-                                unsigned long frame_count,
-                                const PaStreamCallbackTimeInfo *time_info,
-                                PaStreamCallbackFlags status_flags,
-                                void *user_data) {
-  PyGILState_STATE _state = PyGILState_Ensure();
-
+#include "stream_deadline.h"
+#include "stream_lookahead.h"
+#include "stream_reblock.h"
+
+int PyAudioStream_InvokeCallback(PyAudioStream *stream, const void *input,
+                                 void *output, unsigned long frame_count,
+                                 unsigned long out_frames,
+                                 const PaStreamCallbackTimeInfo *time_info,
+                                 PaStreamCallbackFlags status_flags) {
 #ifdef VERBOSE
   if (status_flags != 0) {
     printf("Status flag set: ");
@@ -40,7 +46,6 @@ int PyAudioStream_CallbackCFunc(const void *input, void *output,
 #endif
 
   int return_val = paAbort;
-  PyAudioStream *stream = (PyAudioStream *)user_data;
   PyObject *py_callback = stream->context.callback;
   unsigned int bytes_per_frame = stream->context.frame_size;
   long main_thread_id = stream->context.main_thread_id;
@@ -70,6 +75,7 @@ int PyAudioStream_CallbackCFunc(const void *input, void *output,
   PyObject *callback_result = PyObject_CallFunctionObjArgs(
       py_callback, py_input_samples, py_frame_count, py_time_info,
       py_status_flags, NULL);
+  PYAUDIO_PROBE(python__returned, "python_returned", 'i', stream, 0);
   if (callback_result == NULL) {
 #ifdef VERBOSE
     fprintf(stderr, "An error occured while using the portaudio stream\n");
@@ -88,15 +94,21 @@ int PyAudioStream_CallbackCFunc(const void *input, void *output,
 
   // Parse the callback's response, which should be the samples to playback (if
   // output stream; ignored otherwise) and the desired next stream state
-  // (paContinue, pAbort, or paComplete):
+  // (paContinue, pAbort, or paComplete), and with a result ring, optionally
+  // results to hand back:
   const char *samples_for_output;
   Py_ssize_t output_len;
+  const char *result = NULL;
+  Py_ssize_t result_len = 0;
+  PyAudioRing *result_ring = stream->context.result_ring;
   // clang-format off
   if (!PyArg_ParseTuple(callback_result,
-                        "z#i",
+                        result_ring ? "z#i|y#" : "z#i",
                         &samples_for_output,
                         &output_len,
-                        &return_val)) {
+                        &return_val,
+                        &result,
+                        &result_len)) {
 // clang-format on
 #ifdef VERBOSE
     fprintf(stderr, "An error occured while using the portaudio stream\n");
@@ -128,10 +140,25 @@ int PyAudioStream_CallbackCFunc(const void *input, void *output,
     goto end;
   }
 
+  if (result_len > 0) {
+    if (result_len % result_ring->frame_size != 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Callback result is not a whole number of frames");
+      PyThreadState_SetAsyncExc(main_thread_id, PyErr_Occurred());
+      PyErr_Print();
+
+      Py_XDECREF(callback_result);
+      return_val = paAbort;  // Quit the callback loop
+      goto end;
+    }
+    PyAudioRing_Write(result_ring, result,
+                      (uint64_t)result_len / result_ring->frame_size);
+  }
+
   // Copy bytes for playback only if this is an output stream:
   if (output) {
     char *output_data = (char *)output;
-    size_t pa_max_num_bytes = bytes_per_frame * frame_count;
+    size_t pa_max_num_bytes = bytes_per_frame * out_frames;
     // Though PyArg_ParseTuple returns the size of samples_for_output in
     // output_len, a signed Py_ssize_t, that value should never be negative.
     assert(output_len >= 0);
@@ -148,6 +175,7 @@ int PyAudioStream_CallbackCFunc(const void *input, void *output,
       memset(output_data + bytes_to_copy, 0, pa_max_num_bytes - bytes_to_copy);
       return_val = paComplete;
     }
+    PYAUDIO_PROBE(memcpy__done, "memcpy_done", 'i', stream, bytes_to_copy);
   }
   Py_DECREF(callback_result);
 
@@ -159,7 +187,204 @@ end:
   Py_XDECREF(py_time_info);
   Py_XDECREF(py_status_flags);
 
-  PyGILState_Release(_state);
+  return return_val;
+}
+
+// Acquires the GIL on the PortAudio callback thread. Returns the stream's
+// persistent thread state for this thread, creating it on the first callback.
+// If the thread is already known to Python, or the stream's thread state is
+// being released, returns NULL after falling back to PyGILState_Ensure(), which
+// fills in gil_state. PyGILState_Ensure() only knows the main interpreter, so
+// isolated streams fall back to a temporary thread state instead, setting
+// *temporary, and return NULL only if they cannot create one.
+static PyThreadState *acquire_callback_gil(PyAudioStream *stream,
+                                           PyGILState_STATE *gil_state,
+                                           int *temporary) {
+  PyThreadState *tstate = stream->context.callback_tstate;
+  unsigned long thread_ident = PyThread_get_thread_ident();
+  if (tstate != NULL && stream->context.callback_thread_ident == thread_ident) {
+    PyEval_RestoreThread(tstate);
+    return tstate;
+  }
+
+  int isolated = stream->context.isolated != NULL;
+  if (PyAudioAtomic_LoadLong(&stream->context.release_callback_tstate) ||
+      (!isolated && PyGILState_GetThisThreadState() != NULL)) {
+    if (isolated) {
+      tstate = PyThreadState_New(stream->context.interp);
+      if (tstate != NULL) {
+        PyEval_RestoreThread(tstate);
+        *temporary = 1;
+      }
+      return tstate;
+    }
+    *gil_state = PyGILState_Ensure();
+    return NULL;
+  }
+
+  // First callback on this thread. A previous callback thread deleted its
+  // thread state when its run of the stream ended (see
+  // PyAudioStream_EndCallbackThread()).
+  tstate = PyThreadState_New(stream->context.interp);
+  if (tstate == NULL) {
+    if (!isolated) {
+      *gil_state = PyGILState_Ensure();
+    }
+    return NULL;
+  }
+  PyEval_RestoreThread(tstate);
+  stream->context.callback_tstate = tstate;
+  stream->context.callback_thread_ident = thread_ident;
+  return tstate;
+}
+
+// Deletes the persistent thread state, which must be current on this, its
+// owning, thread, and releases the GIL. Only the owning thread can do so
+// safely: deleting a thread state from another thread unbinds that thread's own
+// PyGILState on Python 3.12+.
+static void delete_callback_tstate(PyAudioStream *stream,
+                                   PyThreadState *tstate) {
+  stream->context.callback_tstate = NULL;
+  PyThreadState_Clear(tstate);
+  PyEval_SaveThread();
+  PyThreadState_Delete(tstate);
+
+  // Wake up PyAudioStream_ReleaseCallbackThreadState().
+  PyAudioMutex_Lock(&stream->lock);
+  PyAudioAtomic_StoreLong(&stream->context.release_callback_tstate, 2);
+  PyAudioCond_Broadcast(&stream->cond);
+  PyAudioMutex_Unlock(&stream->lock);
+}
+
+void PyAudioStream_EndCallbackThread(PyAudioStream *stream) {
+  // Only the owning thread changes callback_tstate while the stream is open.
+  PyThreadState *tstate = stream->context.callback_tstate;
+  if (tstate == NULL ||
+      stream->context.callback_thread_ident != PyThread_get_thread_ident()) {
+    return;
+  }
+  PyEval_RestoreThread(tstate);
+  delete_callback_tstate(stream, tstate);
+}
+
+// Releases the GIL acquired by acquire_callback_gil(). Deletes the persistent
+// thread state after the last callback, or when asked to.
+static void release_callback_gil(PyAudioStream *stream, PyThreadState *tstate,
+                                 PyGILState_STATE gil_state, int temporary,
+                                 int finished) {
+  if (tstate == NULL) {
+    PyGILState_Release(gil_state);
+    return;
+  }
+
+  if (temporary) {
+    PyThreadState_Clear(tstate);
+    PyThreadState_DeleteCurrent();
+    return;
+  }
+
+  if (!finished &&
+      PyAudioAtomic_LoadLong(&stream->context.release_callback_tstate) != 1) {
+    PyEval_SaveThread();
+    return;
+  }
+
+  delete_callback_tstate(stream, tstate);
+}
+
+int PyAudioStream_CallbackCFunc(const void *input, void *output,
+                                unsigned long frame_count,
+                                const PaStreamCallbackTimeInfo *time_info,
+                                PaStreamCallbackFlags status_flags,
+                                void *user_data) {
+  PyAudioStream *stream = (PyAudioStream *)user_data;
+  PYAUDIO_PROBE(callback__entry, "callback", 'B', stream, frame_count);
+  if (stream->context.thread_tuning != NULL) {
+    PyAudioThreadTuning_Apply(stream->context.thread_tuning,
+                              PYAUDIO_THREAD_CALLBACK);
+  }
+  if (status_flags & (paInputUnderflow | paInputOverflow | paOutputUnderflow |
+                      paOutputOverflow)) {
+    PYAUDIO_PROBE(xrun, "xrun", 'i', stream, status_flags);
+  }
+
+  // Record the arguments as PortAudio passed them, before any reblocking.
+  if (stream->context.trace != NULL) {
+    PyAudioTrace_Record(stream->context.trace, input, frame_count, time_info,
+                        status_flags);
+  }
+
+  // Publish captured frames to readers first, without the GIL, so readers
+  // never depend on Python scheduling.
+  if (input != NULL && stream->context.capture_ring != NULL) {
+    PyAudioRing_Write(stream->context.capture_ring, (const char *)input,
+                      frame_count);
+  }
+  if (input != NULL && stream->context.shared_capture != NULL) {
+    PyAudioSharedCapture_Write(stream->context.shared_capture,
+                               (const char *)input, frame_count,
+                               time_info->inputBufferAdcTime, status_flags);
+  }
+
+  int return_val = paContinue;
+  if (stream->context.lookahead != NULL) {
+    // The Python callback runs ahead, on the lookahead thread.
+    return_val =
+        PyAudioLookahead_Pull(stream->context.lookahead, output, frame_count,
+                              time_info, status_flags);
+  } else if (stream->context.deadline != NULL) {
+    // The Python callback runs on its own thread, under a deadline.
+    return_val =
+        PyAudioDeadline_Process(stream->context.deadline, input, output,
+                                frame_count, time_info, status_flags);
+  } else if (stream->context.callback == NULL) {
+    // Streams opened only to feed readers, or to play broker clients, have no
+    // Python callback.
+    if (output != NULL) {
+      memset(output, 0, (size_t)stream->context.frame_size * frame_count);
+    }
+  } else {
+    PyGILState_STATE gil_state = PyGILState_UNLOCKED;
+    int temporary = 0;
+    PyThreadState *tstate =
+        acquire_callback_gil(stream, &gil_state, &temporary);
+    PYAUDIO_PROBE(gil__acquired, "gil_acquired", 'i', stream, 0);
+    if (tstate == NULL && stream->context.isolated != NULL) {
+      // Out of memory for a thread state of the subinterpreter.
+      if (output != NULL) {
+        memset(output, 0, (size_t)stream->context.frame_size * frame_count);
+      }
+      return paAbort;
+    } else if (stream->context.reblock != NULL) {
+      return_val =
+          PyAudioReblock_Process(stream->context.reblock, stream, input, output,
+                                 frame_count, time_info, status_flags);
+    } else {
+      return_val = PyAudioStream_InvokeCallback(stream, input, output,
+                                                frame_count, frame_count,
+                                                time_info, status_flags);
+    }
+    release_callback_gil(stream, tstate, gil_state, temporary,
+                         return_val != paContinue);
+  }
+
+  if (output != NULL && return_val != paAbort) {
+    // Splice any scheduled clips that overlap with this buffer. Some host APIs
+    // do not report the DAC time, so fall back to the current stream time.
+    if (stream->context.schedule) {
+      double buffer_time = time_info->outputBufferDacTime > 0
+                               ? time_info->outputBufferDacTime
+                               : time_info->currentTime;
+      PyAudioSchedule_Splice(stream->context.schedule, (char *)output,
+                             frame_count, stream->context.frame_size,
+                             buffer_time, stream->context.sample_rate);
+    }
+    // Mix in the audio of broker clients.
+    if (stream->context.broker) {
+      PyAudioBroker_Mix(stream->context.broker, output, frame_count);
+    }
+  }
+  PYAUDIO_PROBE(callback__return, "callback", 'E', stream, return_val);
   return return_val;
 }
 
@@ -167,46 +392,156 @@ end:
  * Stream Read/Write
  *************************************************************/
 
-PyObject *PyAudio_WriteStream(PyObject *self, PyObject *args) {
+PaError PyAudioStream_FlushWrites(PyAudioStream *stream) {
+  unsigned long num_frames = stream->context.write_buffer.num_frames;
+  if (num_frames == 0) {
+    return paNoError;
+  }
+  PyAudioStream_SetBufferedFrames(stream, 0);
+
+  PaError err = PyAudioStream_BeginIO(stream);
+  if (err != paNoError) {
+    return err;
+  }
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  err = PyAudioStream_WriteFrames(stream, stream->context.write_buffer.data,
+                                  num_frames);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  PyAudioStream_EndIO(stream);
+  return err;
+}
+
+// Appends frames to the write buffer, and writes full blocks to PortAudio, or
+// partial ones whose oldest frame has reached the maximum age (which the
+// flusher thread also writes out between writes). Frames beyond whole blocks
+// are written directly rather than copied. The calling thread must have
+// claimed the write buffer. Returns the PortAudio error, if any.
+static PaError coalesce_write(PyAudioStream *stream, const char *data,
+                              unsigned long total_frames) {
+  unsigned int frame_size = stream->context.frame_size;
+  unsigned long capacity = stream->context.write_buffer.capacity;
+  PaError err = paNoError;
+
+  // Top up the buffer.
+  unsigned long buffered = stream->context.write_buffer.num_frames;
+  unsigned long num_frames = capacity - buffered;
+  if (num_frames > total_frames) {
+    num_frames = total_frames;
+  }
+  memcpy(stream->context.write_buffer.data + (size_t)buffered * frame_size,
+         data, (size_t)num_frames * frame_size);
+  PyAudioStream_SetBufferedFrames(stream, buffered + num_frames);
+  data += (size_t)num_frames * frame_size;
+  total_frames -= num_frames;
+
+  if (buffered + num_frames < capacity &&
+      PyAudioTime_Now() - stream->context.write_buffer.first_time <
+          stream->context.write_buffer.max_age) {
+    return paNoError;
+  }
+
+  err = PyAudioStream_FlushWrites(stream);
+  if (err != paNoError && err != paOutputUnderflowed) {
+    return err;
+  }
+
+  // Write whole blocks directly, and keep the remainder for later.
+  unsigned long direct_frames = total_frames - total_frames % capacity;
+  if (direct_frames > 0) {
+    PaError direct_err = PyAudioStream_BeginIO(stream);
+    if (direct_err != paNoError) {
+      return direct_err;
+    }
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    direct_err = PyAudioStream_WriteFrames(stream, data, direct_frames);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+    PyAudioStream_EndIO(stream);
+    if (direct_err != paNoError) {
+      return direct_err;
+    }
+    data += (size_t)direct_frames * frame_size;
+    total_frames -= direct_frames;
+  }
+  if (total_frames > 0) {
+    memcpy(stream->context.write_buffer.data, data,
+           (size_t)total_frames * frame_size);
+    PyAudioStream_SetBufferedFrames(stream, total_frames);
+  }
+  return err;
+}
+
+// Writes data_arg to an open stream. total_frames_arg may be None, to write all
+// whole frames in data_arg.
+static PyObject *write_stream(PyAudioStream *stream, PyObject *data_arg,
+                              PyObject *total_frames_arg,
+                              int should_throw_exception) {
   const char *data;
   Py_ssize_t total_size;
-  int total_frames;
+  Py_buffer view = {NULL};
+  long total_frames;
   int err;
-  int should_throw_exception = 0;
 
-  PyObject *stream_arg;
-  // clang-format off
-  if (!PyArg_ParseTuple(args, "O!s#i|i",
-                        &PyAudioStreamType,
-                        &stream_arg,
-                        &data,
-                        &total_size,
-                        &total_frames,
-                        &should_throw_exception)) {
-    return NULL;
+  // Accept str (as UTF-8) and any bytes-like object.
+  if (PyUnicode_Check(data_arg)) {
+    data = PyUnicode_AsUTF8AndSize(data_arg, &total_size);
+    if (data == NULL) {
+      return NULL;
+    }
+  } else {
+    if (PyObject_GetBuffer(data_arg, &view, PyBUF_SIMPLE) < 0) {
+      return NULL;
+    }
+    data = (const char *)view.buf;
+    total_size = view.len;
+  }
+
+  if (total_frames_arg == Py_None) {
+    // Write all whole frames in data.
+    total_frames = (long)(total_size / stream->context.frame_size);
+  } else {
+    total_frames = PyLong_AsLong(total_frames_arg);
+    if (total_frames == -1 && PyErr_Occurred()) {
+      PyBuffer_Release(&view);
+      return NULL;
+    }
   }
-  // clang-format on
 
   if (total_frames < 0) {
+    PyBuffer_Release(&view);
     PyErr_SetString(PyExc_ValueError, "Invalid number of frames");
     return NULL;
   }
 
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
-  if (!PyAudioStream_IsOpen(stream)) {
-    PyErr_SetObject(PyExc_IOError,
-                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
-    return NULL;
+  PYAUDIO_PROBE(write__begin, "write", 'B', stream, total_frames);
+  if (stream->context.write_buffer.capacity > 0) {
+    // Never read past the end of data.
+    if ((Py_ssize_t)total_frames * stream->context.frame_size > total_size) {
+      total_frames = (long)(total_size / stream->context.frame_size);
+    }
+    if (PyAudioStream_ClaimWriteBuffer(stream, 1) < 0) {
+      err = paBadStreamPtr;
+    } else {
+      err = coalesce_write(stream, data, (unsigned long)total_frames);
+      PyAudioStream_ReleaseWriteBuffer(stream);
+    }
+  } else if ((err = PyAudioStream_BeginIO(stream)) == paNoError) {
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    err = PyAudioStream_WriteFrames(stream, data, total_frames);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+    PyAudioStream_EndIO(stream);
   }
-
-  // clang-format off
-  Py_BEGIN_ALLOW_THREADS
-  err = Pa_WriteStream(stream->context.stream, data, total_frames);
-  Py_END_ALLOW_THREADS
-  // clang-format on
+  PyBuffer_Release(&view);
+  PYAUDIO_PROBE(write__end, "write", 'E', stream, err);
 
   if (err != paNoError) {
     if (err == paOutputUnderflowed) {
+      PYAUDIO_PROBE(xrun, "xrun", 'i', stream, err);
       if (should_throw_exception) {
         goto error;
       }
@@ -231,28 +566,120 @@ error:
   return NULL;
 }
 
-PyObject *PyAudio_ReadStream(PyObject *self, PyObject *args) {
+PyObject *PyAudio_WriteStream(PyObject *self, PyObject *const *args,
+                              Py_ssize_t nargs) {
+  int should_throw_exception = 0;
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "write_stream", args, nargs, 2, 4);
+  if (stream == NULL) {
+    return NULL;
+  }
+
+  if (nargs > 3) {
+    should_throw_exception = PyObject_IsTrue(args[3]);
+    if (should_throw_exception < 0) {
+      return NULL;
+    }
+  }
+
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  return write_stream(stream, args[1], nargs > 2 ? args[2] : Py_None,
+                      should_throw_exception);
+}
+
+PyObject *PyAudioStream_Write(PyAudioStream *stream, PyObject *const *args,
+                              Py_ssize_t nargs, PyObject *kwnames) {
+  static const char *const names[] = {"frames", "num_frames",
+                                      "exception_on_underflow", NULL};
+  PyObject *values[] = {NULL, Py_None, Py_False};
+  if (PyAudioStream_UnpackArgs("write", args, nargs, kwnames, names, 1,
+                               values) < 0) {
+    return NULL;
+  }
+
+  int should_throw_exception = PyObject_IsTrue(values[2]);
+  if (should_throw_exception < 0) {
+    return NULL;
+  }
+
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  if (!stream->context.is_output) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(s,i)", "Not output stream",
+                                  paCanNotWriteToAnInputOnlyStream));
+    return NULL;
+  }
+
+  return write_stream(stream, values[0], values[1], should_throw_exception);
+}
+
+PyObject *PyAudioStream_Flush(PyAudioStream *stream, PyObject *unused) {
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  PaError err = paNoError;
+  if (stream->context.write_buffer.capacity > 0) {
+    if (PyAudioStream_ClaimWriteBuffer(stream, 1) < 0) {
+      err = paBadStreamPtr;
+    } else {
+      err = PyAudioStream_FlushWrites(stream);
+      PyAudioStream_ReleaseWriteBuffer(stream);
+    }
+  }
+  if (err != paNoError && err != paOutputUnderflowed) {
+    PyAudioStream_Cleanup(stream);
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", err, Pa_GetErrorText(err)));
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyObject *PyAudio_FlushStream(PyObject *self, PyObject *const *args,
+                              Py_ssize_t nargs) {
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "flush_stream", args, nargs, 1, 1);
+  if (stream == NULL) {
+    return NULL;
+  }
+  return PyAudioStream_Flush(stream, NULL);
+}
+
+static PyObject *read_stream(PyAudioStream *stream, PyObject *num_frames_arg,
+                             int should_raise_exception) {
   int err;
   int total_frames;
-  int should_raise_exception = 0;
 
-  PyObject *stream_arg;
-  // clang-format off
-  if (!PyArg_ParseTuple(args, "O!i|i",
-                        &PyAudioStreamType,
-                        &stream_arg,
-                        &total_frames,
-                        &should_raise_exception)) {
+  long num_frames = PyLong_AsLong(num_frames_arg);
+  if (num_frames == -1 && PyErr_Occurred()) {
     return NULL;
   }
-  // clang-format on
+  if (num_frames > INT_MAX || num_frames < INT_MIN) {
+    PyErr_SetString(PyExc_OverflowError, "Number of frames is too large");
+    return NULL;
+  }
+  total_frames = (int)num_frames;
 
   if (total_frames < 0) {
     PyErr_SetString(PyExc_ValueError, "Invalid number of frames");
     return NULL;
   }
 
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
   if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
@@ -272,14 +699,21 @@ PyObject *PyAudio_ReadStream(PyObject *self, PyObject *args) {
     return NULL;
   }
 
+  if ((err = PyAudioStream_BeginIO(stream)) != paNoError) {
+    goto error;
+  }
+  PYAUDIO_PROBE(read__begin, "read", 'B', stream, total_frames);
   // clang-format off
   Py_BEGIN_ALLOW_THREADS
-  err = Pa_ReadStream(stream->context.stream, sample_block, total_frames);
+  err = PyAudioStream_ReadFrames(stream, sample_block, total_frames);
   Py_END_ALLOW_THREADS
   // clang-format on
+  PyAudioStream_EndIO(stream);
+  PYAUDIO_PROBE(read__end, "read", 'E', stream, err);
 
   if (err != paNoError) {
     if (err == paInputOverflowed) {
+      PYAUDIO_PROBE(xrun, "xrun", 'i', stream, err);
       if (should_raise_exception) {
         goto error;
       }
@@ -305,49 +739,126 @@ error:
   return NULL;
 }
 
-PyObject *PyAudio_GetStreamWriteAvailable(PyObject *self, PyObject *args) {
-  signed long frames;
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
+PyObject *PyAudio_ReadStream(PyObject *self, PyObject *const *args,
+                             Py_ssize_t nargs) {
+  int should_raise_exception = 0;
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "read_stream", args, nargs, 2, 3);
+  if (stream == NULL) {
+    return NULL;
+  }
+
+  if (nargs > 2) {
+    should_raise_exception = PyObject_IsTrue(args[2]);
+    if (should_raise_exception < 0) {
+      return NULL;
+    }
+  }
+  return read_stream(stream, args[1], should_raise_exception);
+}
+
+PyObject *PyAudioStream_Read(PyAudioStream *stream, PyObject *const *args,
+                             Py_ssize_t nargs, PyObject *kwnames) {
+  static const char *const names[] = {"num_frames", "exception_on_overflow",
+                                      NULL};
+  PyObject *values[] = {NULL, Py_True};
+  if (PyAudioStream_UnpackArgs("read", args, nargs, kwnames, names, 1,
+                               values) < 0) {
+    return NULL;
+  }
+
+  int should_raise_exception = PyObject_IsTrue(values[1]);
+  if (should_raise_exception < 0) {
+    return NULL;
+  }
+
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
     return NULL;
   }
 
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
+  if (!stream->context.is_input) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(s,i)", "Not input stream",
+                                  paCanNotReadFromAnOutputOnlyStream));
+    return NULL;
+  }
 
+  return read_stream(stream, values[0], should_raise_exception);
+}
+
+PyObject *PyAudioStream_GetWriteAvailable(PyAudioStream *stream, PyObject *unused) {
+  signed long frames;
   if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
     return NULL;
   }
 
+  if (PyAudioStream_BeginIO(stream) != paNoError) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
   // clang-format off
   Py_BEGIN_ALLOW_THREADS
-  frames = Pa_GetStreamWriteAvailable(stream->context.stream);
+  frames = stream->context.backend->get_write_available(stream->context.stream);
   Py_END_ALLOW_THREADS
   // clang-format on
-
+  PyAudioStream_EndIO(stream);
+
+  // Coalesced frames will take up room once flushed.
+  if (frames > 0 && stream->sync_ready) {
+    PyAudioMutex_Lock(&stream->lock);
+    unsigned long buffered = stream->context.write_buffer.num_frames;
+    PyAudioMutex_Unlock(&stream->lock);
+    frames = (unsigned long)frames > buffered ? frames - (long)buffered : 0;
+  }
   return PyLong_FromLong(frames);
 }
 
-PyObject *PyAudio_GetStreamReadAvailable(PyObject *self, PyObject *args) {
-  signed long frames;
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
+PyObject *PyAudio_GetStreamWriteAvailable(PyObject *self, PyObject *const *args,
+                                          Py_ssize_t nargs) {
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "get_stream_write_available", args, nargs,
+                              1, 1);
+  if (stream == NULL) {
     return NULL;
   }
+  return PyAudioStream_GetWriteAvailable(stream, NULL);
+}
 
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
+PyObject *PyAudioStream_GetReadAvailable(PyAudioStream *stream, PyObject *unused) {
+  signed long frames;
   if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
     return NULL;
   }
 
+  if (PyAudioStream_BeginIO(stream) != paNoError) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
   // clang-format off
   Py_BEGIN_ALLOW_THREADS
-  frames = Pa_GetStreamReadAvailable(stream->context.stream);
+  frames = stream->context.backend->get_read_available(stream->context.stream);
   Py_END_ALLOW_THREADS
   // clang-format on
+  PyAudioStream_EndIO(stream);
 
   return PyLong_FromLong(frames);
 }
+
+PyObject *PyAudio_GetStreamReadAvailable(PyObject *self, PyObject *const *args,
+                                         Py_ssize_t nargs) {
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "get_stream_read_available", args, nargs,
+                              1, 1);
+  if (stream == NULL) {
+    return NULL;
+  }
+  return PyAudioStream_GetReadAvailable(stream, NULL);
+}
@@ -7,15 +7,50 @@
 #include "Python.h"
 #include "portaudio.h"
 
+#include "stream.h"
+
 int PyAudioStream_CallbackCFunc(const void *input, void *output,
                                 unsigned long frameCount,
                                 const PaStreamCallbackTimeInfo *timeInfo,
                                 PaStreamCallbackFlags statusFlags,
                                 void *userData);
+// Deletes the persistent callback thread state, if called on the thread owning
+// it. Called without the GIL from the PortAudio finished callback, which most
+// host APIs (e.g., ALSA, WASAPI and the virtual device) call from the callback
+// thread as it exits, once no further callbacks run on it.
+void PyAudioStream_EndCallbackThread(PyAudioStream *stream);
+
+// Calls the stream's Python callback with frame_count input frames, and copies
+// out_frames frames of its output into output (unless output is NULL),
+// zero-padding short output. Must be called with the GIL held. Returns the
+// PaStreamCallbackResult.
+int PyAudioStream_InvokeCallback(PyAudioStream *stream, const void *input,
+                                 void *output, unsigned long frame_count,
+                                 unsigned long out_frames,
+                                 const PaStreamCallbackTimeInfo *time_info,
+                                 PaStreamCallbackFlags status_flags);
+
+// These are called once per buffer, so they use METH_FASTCALL.
+PyObject *PyAudio_WriteStream(PyObject *self, PyObject *const *args,
+                              Py_ssize_t nargs);
+PyObject *PyAudio_FlushStream(PyObject *self, PyObject *const *args,
+                              Py_ssize_t nargs);
+PyObject *PyAudio_ReadStream(PyObject *self, PyObject *const *args,
+                             Py_ssize_t nargs);
+PyObject *PyAudio_GetStreamWriteAvailable(PyObject *self, PyObject *const *args,
+                                          Py_ssize_t nargs);
+PyObject *PyAudio_GetStreamReadAvailable(PyObject *self, PyObject *const *args,
+                                         Py_ssize_t nargs);
 
-PyObject *PyAudio_WriteStream(PyObject *self, PyObject *args);
-PyObject *PyAudio_ReadStream(PyObject *self, PyObject *args);
-PyObject *PyAudio_GetStreamWriteAvailable(PyObject *self, PyObject *args);
-PyObject *PyAudio_GetStreamReadAvailable(PyObject *self, PyObject *args);
+// Methods of PyAudioStreamType.
+PyObject *PyAudioStream_Write(PyAudioStream *stream, PyObject *const *args,
+                              Py_ssize_t nargs, PyObject *kwnames);
+PyObject *PyAudioStream_Flush(PyAudioStream *stream, PyObject *unused);
+PyObject *PyAudioStream_Read(PyAudioStream *stream, PyObject *const *args,
+                             Py_ssize_t nargs, PyObject *kwnames);
+PyObject *PyAudioStream_GetWriteAvailable(PyAudioStream *stream,
+                                          PyObject *unused);
+PyObject *PyAudioStream_GetReadAvailable(PyAudioStream *stream,
+                                         PyObject *unused);
 
 #endif  // STREAM_IO_H
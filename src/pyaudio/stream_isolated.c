@@ -0,0 +1,255 @@
+#include "stream_isolated.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+
+#if PY_VERSION_HEX >= 0x030C0000
+
+struct PyAudioIsolated {
+  PyInterpreterState *interp;
+  // Thread state created with the subinterpreter, used to enter it from the
+  // thread opening or closing the stream.
+  PyThreadState *tstate;
+  PyObject *callback;
+};
+
+// A copy of the main interpreter's sys.path, which the subinterpreter does
+// not inherit.
+typedef struct {
+  char **entries;
+  Py_ssize_t size;
+} PathCopy;
+
+static void free_path(PathCopy *path) {
+  for (Py_ssize_t i = 0; i < path->size; i++) {
+    free(path->entries[i]);
+  }
+  free(path->entries);
+}
+
+static int copy_path(PathCopy *path) {
+  path->entries = NULL;
+  path->size = 0;
+  PyObject *sys_path = PySys_GetObject("path");
+  if (sys_path == NULL || !PyList_Check(sys_path)) {
+    return 0;
+  }
+  Py_ssize_t size = PyList_GET_SIZE(sys_path);
+  path->entries = (char **)calloc(size > 0 ? (size_t)size : 1, sizeof(char *));
+  if (path->entries == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  for (Py_ssize_t i = 0; i < size; i++) {
+    PyObject *entry = PyList_GET_ITEM(sys_path, i);
+    if (!PyUnicode_Check(entry)) {
+      continue;
+    }
+    const char *utf8 = PyUnicode_AsUTF8(entry);
+    if (utf8 == NULL) {
+      free_path(path);
+      return -1;
+    }
+    path->entries[path->size] = strdup(utf8);
+    if (path->entries[path->size] == NULL) {
+      free_path(path);
+      PyErr_NoMemory();
+      return -1;
+    }
+    path->size++;
+  }
+  return 0;
+}
+
+// Sets sys.path in the current (sub)interpreter. Returns 0, or -1 with an
+// exception set.
+static int set_path(const PathCopy *path) {
+  PyObject *sys_path = PyList_New(0);
+  if (sys_path == NULL) {
+    return -1;
+  }
+  for (Py_ssize_t i = 0; i < path->size; i++) {
+    PyObject *entry = PyUnicode_FromString(path->entries[i]);
+    if (entry == NULL || PyList_Append(sys_path, entry) < 0) {
+      Py_XDECREF(entry);
+      Py_DECREF(sys_path);
+      return -1;
+    }
+    Py_DECREF(entry);
+  }
+  int rv = PySys_SetObject("path", sys_path);
+  Py_DECREF(sys_path);
+  return rv;
+}
+
+// Imports the callback named by target in the current (sub)interpreter.
+// Returns a new reference, or NULL with an exception set.
+static PyObject *import_callback(const char *target) {
+  const char *colon = strchr(target, ':');
+  if (colon == NULL || colon == target || colon[1] == '\0' ||
+      strchr(colon + 1, ':') != NULL) {
+    PyErr_SetString(PyExc_ValueError,
+                    "isolated_callback must be \"module:function\"");
+    return NULL;
+  }
+
+  PyObject *module_name =
+      PyUnicode_FromStringAndSize(target, (Py_ssize_t)(colon - target));
+  if (module_name == NULL) {
+    return NULL;
+  }
+  PyObject *object = PyImport_Import(module_name);
+  Py_DECREF(module_name);
+
+  // Follow the dotted attribute path.
+  const char *name = colon + 1;
+  while (object != NULL) {
+    const char *dot = strchr(name, '.');
+    size_t length = dot ? (size_t)(dot - name) : strlen(name);
+    PyObject *attr_name =
+        PyUnicode_FromStringAndSize(name, (Py_ssize_t)length);
+    PyObject *attr =
+        attr_name ? PyObject_GetAttr(object, attr_name) : NULL;
+    Py_XDECREF(attr_name);
+    Py_DECREF(object);
+    object = attr;
+    if (dot == NULL) {
+      break;
+    }
+    name = dot + 1;
+  }
+
+  if (object != NULL && !PyCallable_Check(object)) {
+    Py_DECREF(object);
+    PyErr_SetString(PyExc_TypeError, "isolated_callback must be callable");
+    return NULL;
+  }
+  return object;
+}
+
+// Ends the subinterpreter of the current thread state, which must be
+// isolated->tstate, and switches back to main_tstate.
+static void end_interpreter(PyAudioIsolated *isolated,
+                            PyThreadState *main_tstate) {
+  // Py_EndInterpreter() requires the current thread state to be the last
+  // one. Callback threads normally delete theirs, but one may be left behind
+  // if the stream closed before its callback thread could release it.
+  PyThreadState *tstate = PyInterpreterState_ThreadHead(isolated->interp);
+  while (tstate != NULL) {
+    PyThreadState *next = PyThreadState_Next(tstate);
+    if (tstate != isolated->tstate) {
+      PyThreadState_Clear(tstate);
+      PyThreadState_Delete(tstate);
+    }
+    tstate = next;
+  }
+  Py_EndInterpreter(isolated->tstate);
+  PyThreadState_Swap(main_tstate);
+}
+
+PyAudioIsolated *PyAudioIsolated_Create(const char *target) {
+  PyAudioIsolated *isolated =
+      (PyAudioIsolated *)calloc(1, sizeof(PyAudioIsolated));
+  if (isolated == NULL) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  PathCopy path;
+  if (copy_path(&path) < 0) {
+    free(isolated);
+    return NULL;
+  }
+
+  PyThreadState *main_tstate = PyThreadState_Get();
+  PyInterpreterConfig config = {
+      .use_main_obmalloc = 0,
+      .allow_fork = 0,
+      .allow_exec = 0,
+      .allow_threads = 1,
+      .allow_daemon_threads = 0,
+      .check_multi_interp_extensions = 1,
+      .gil = PyInterpreterConfig_OWN_GIL,
+  };
+  PyStatus status = Py_NewInterpreterFromConfig(&isolated->tstate, &config);
+  if (PyStatus_Exception(status)) {
+    PyThreadState_Swap(main_tstate);
+    free_path(&path);
+    free(isolated);
+    PyErr_Format(PyExc_RuntimeError, "Cannot create subinterpreter: %s",
+                 status.err_msg ? status.err_msg : "unknown error");
+    return NULL;
+  }
+  isolated->interp = PyThreadState_GetInterpreter(isolated->tstate);
+
+  // Now in the subinterpreter. Exceptions cannot cross interpreters, so
+  // carry over a description of any error.
+  char error[512] = "";
+  if (set_path(&path) == 0) {
+    isolated->callback = import_callback(target);
+  }
+  free_path(&path);
+  if (isolated->callback == NULL) {
+    PyObject *exc = PyErr_GetRaisedException();
+    PyObject *message = exc ? PyObject_Str(exc) : NULL;
+    const char *message_utf8 = message ? PyUnicode_AsUTF8(message) : NULL;
+    snprintf(error, sizeof(error), "%s: %s",
+             exc ? Py_TYPE(exc)->tp_name : "Error",
+             message_utf8 ? message_utf8 : "");
+    Py_XDECREF(message);
+    Py_XDECREF(exc);
+    PyErr_Clear();
+
+    end_interpreter(isolated, main_tstate);
+    free(isolated);
+    PyErr_Format(PyExc_ImportError, "Cannot load isolated_callback %s (%s)",
+                 target, error);
+    return NULL;
+  }
+
+  // Back to the main interpreter, releasing the subinterpreter's GIL.
+  PyThreadState_Swap(main_tstate);
+  return isolated;
+}
+
+void PyAudioIsolated_Destroy(PyAudioIsolated *isolated) {
+  if (isolated == NULL) {
+    return;
+  }
+  PyThreadState *main_tstate = PyThreadState_Swap(isolated->tstate);
+  Py_CLEAR(isolated->callback);
+  end_interpreter(isolated, main_tstate);
+  free(isolated);
+}
+
+PyInterpreterState *PyAudioIsolated_Interp(PyAudioIsolated *isolated) {
+  return isolated->interp;
+}
+
+PyObject *PyAudioIsolated_Callback(PyAudioIsolated *isolated) {
+  return isolated->callback;
+}
+
+#else  // PY_VERSION_HEX >= 0x030C0000
+
+PyAudioIsolated *PyAudioIsolated_Create(const char *target) {
+  PyErr_SetString(PyExc_NotImplementedError,
+                  "isolated_callback requires Python 3.12 or later");
+  return NULL;
+}
+
+void PyAudioIsolated_Destroy(PyAudioIsolated *isolated) {}
+
+PyInterpreterState *PyAudioIsolated_Interp(PyAudioIsolated *isolated) {
+  return NULL;
+}
+
+PyObject *PyAudioIsolated_Callback(PyAudioIsolated *isolated) { return NULL; }
+
+#endif  // PY_VERSION_HEX >= 0x030C0000
@@ -0,0 +1,36 @@
+// Isolated callbacks: a stream's Python callback running in its own
+// subinterpreter, with its own GIL (PEP 684, Python 3.12+).
+//
+// Callbacks of different isolated streams never contend for a GIL, with each
+// other or with the main interpreter, so their throughput scales with cores.
+// Since objects cannot be shared across interpreters, the callback is named by
+// "module:function" and imported in the subinterpreter; results it wants to
+// hand back travel through the stream's result ring, a C frame ring read with
+// StreamReader (see open_result_reader()).
+
+#ifndef STREAM_ISOLATED_H_
+#define STREAM_ISOLATED_H_
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+
+typedef struct PyAudioIsolated PyAudioIsolated;
+
+// Creates a subinterpreter with its own GIL, with the current sys.path, and
+// imports the callback named by target ("module:function", where function
+// may be a dotted attribute path) in it. Must be called with the GIL held.
+// Returns NULL with an exception set on failure.
+PyAudioIsolated *PyAudioIsolated_Create(const char *target);
+// Releases the callback and ends the subinterpreter. Must be called with the
+// GIL held, once nothing runs in the subinterpreter anymore; deletes the
+// thread states callback threads left behind.
+void PyAudioIsolated_Destroy(PyAudioIsolated *isolated);
+
+// Returns the subinterpreter.
+PyInterpreterState *PyAudioIsolated_Interp(PyAudioIsolated *isolated);
+// Returns the callback, a borrowed reference owned by the subinterpreter.
+PyObject *PyAudioIsolated_Callback(PyAudioIsolated *isolated);
+
+#endif  // STREAM_ISOLATED_H_
@@ -1,6 +1,9 @@
 #include "stream_lifecycle.h"
 
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifndef PY_SSIZE_T_CLEAN
 #define PY_SSIZE_T_CLEAN
@@ -8,24 +11,234 @@
 #include "Python.h"
 #include "portaudio.h"
 
+#include "alsa_stream_info.h"
 #include "mac_core_stream_info.h"
+#include "module_state.h"
+#include "null_device.h"
+#include "output_broker.h"
+#include "ring_buffer.h"
+#include "shared_capture.h"
 #include "stream.h"
 #include "stream_io.h"
+#include "stream_reader.h"
+#include "stream_reblock.h"
+#include "stream_trace.h"
+#include "thread_tuning.h"
 
 #define DEFAULT_FRAMES_PER_BUFFER paFramesPerBufferUnspecified
 
-PyObject *PyAudio_OpenStream(PyObject *self, PyObject *args, PyObject *kwargs) {
-  int rate, channels;
-  int input_device_index = -1;
-  int output_device_index = -1;
-  PyObject *input_device_index_arg = NULL;
-  PyObject *output_device_index_arg = NULL;
-  PyObject *stream_callback = NULL;
-  PaSampleFormat format;
-  PaError err;
-  PyObject *input_device_index_long;
-  PyObject *output_device_index_long;
+// Type of the host-specific stream info objects open() accepts, if any.
+#if defined(MACOS)
+#define HOST_STREAM_INFO_TYPE(state) ((state)->mac_core_stream_info_type)
+#elif defined(PYAUDIO_HAVE_ALSA)
+#define HOST_STREAM_INFO_TYPE(state) ((state)->alsa_stream_info_type)
+#endif
+
+// Maximum time to wait without the GIL before checking for signals (e.g.,
+// KeyboardInterrupt), in seconds.
+#define SIGNAL_CHECK_INTERVAL 0.1
+
+// PortAudio calls this when the stream becomes inactive: once a callback
+// stream completes and drains, or when stopped or aborted. Called without the
+// GIL, from the callback thread or the one stopping the stream.
+static void stream_finished(void *user_data) {
+  PyAudioStream *stream = (PyAudioStream *)user_data;
+  PyAudioStream_EndCallbackThread(stream);
+  PyAudioStream_SignalFinished(stream);
+}
 
+// Locks the buffers the stream's real-time path touches, as far as the memory
+// lock limit allows. Buffers that do not fit stay unlocked; lockedMemory
+// reports how much was locked.
+static void lock_buffers(PyAudioStream *stream) {
+  PyAudioLockedMemory *memory = &stream->context.locked_memory;
+  PyAudioRing *rings[] = {stream->context.capture_ring,
+                          stream->context.result_ring};
+  for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++) {
+    if (rings[i] != NULL) {
+      PyAudioLockedMemory_Add(memory, rings[i]->data,
+                              (size_t)(rings[i]->capacity *
+                                       rings[i]->frame_size));
+    }
+  }
+  PyAudioLockedMemory_Add(memory, stream->context.write_buffer.data,
+                          (size_t)stream->context.write_buffer.capacity *
+                              stream->context.frame_size);
+
+  PyAudioReblock *reblock = stream->context.reblock;
+  if (reblock != NULL) {
+    PyAudioLockedMemory_Add(memory, reblock->in_window,
+                            (size_t)reblock->block_size * reblock->frame_size);
+    PyAudioLockedMemory_Add(
+        memory, reblock->out_fifo,
+        (size_t)reblock->out_capacity * reblock->frame_size);
+    PyAudioLockedMemory_Add(memory, reblock->hop_out,
+                            (size_t)reblock->hop_size * reblock->frame_size);
+  }
+  if (stream->context.lookahead != NULL) {
+    PyAudioLookahead_LockMemory(stream->context.lookahead, memory);
+  }
+  if (stream->context.deadline != NULL) {
+    PyAudioDeadline_LockMemory(stream->context.deadline, memory);
+  }
+  if (stream->context.trace != NULL) {
+    PyAudioTrace_LockMemory(stream->context.trace, memory);
+  }
+}
+
+/*************************************************************
+ * Open Options
+ *************************************************************/
+
+#if defined(MACOS)
+typedef PyAudioMacCoreStreamInfo HostStreamInfo;
+#elif defined(PYAUDIO_HAVE_ALSA)
+typedef PyAudioAlsaStreamInfo HostStreamInfo;
+#else
+/* mostly ignored...*/
+typedef PyObject HostStreamInfo;
+#endif
+
+// The options of open(), grouped by the feature they configure, and parsed
+// by one parse_*_options() function each. Objects are borrowed from open()'s
+// arguments.
+typedef struct {
+  struct {
+    int rate;
+    int channels;
+    PaSampleFormat format;
+    int input;
+    int output;
+    int input_device_index;
+    int output_device_index;
+    int frames_per_buffer;
+    HostStreamInfo *input_host_specific_stream_info;
+    HostStreamInfo *output_host_specific_stream_info;
+    PyObject *stream_callback;
+    const char *isolated_callback;
+    // Whether the stream runs a Python callback, in this interpreter or not.
+    int has_callback;
+  } stream;
+  struct {
+    int capture_frames;
+    const char *shared_capture_name;
+    int shared_capture_frames;
+    int result_frames;
+    int result_frame_size;
+  } ring;
+  struct {
+    const char *path;
+    int client_frames;
+  } broker;
+  struct {
+    int block_size;
+    int hop_size;
+  } reblock;
+  struct {
+    int frames;
+    double max_age;
+  } coalesce;
+  struct {
+    int buffers;
+    int max_buffers;
+  } lookahead;
+  struct {
+    double fraction;
+    PyAudioFallback fallback;
+  } deadline;
+  struct {
+    const char *mode;
+    PyObject *input;
+    PyAudioNullConfig config;
+  } virtual_device;
+  struct {
+    const char *path;
+    int input;
+  } trace;
+  struct {
+    const char *policy;
+    int priority;
+    PyObject *cpus;
+    int lock_memory;
+  } tuning;
+} OpenOptions;
+
+// Parses args and the keyword arguments named in kwlist, which are removed
+// from kwargs, like PyArg_ParseTupleAndKeywords() does. args may be NULL, for
+// keyword arguments only. Objects parsed with "O" stay borrowed from the
+// caller's own arguments. Returns 0, or -1 with an exception set.
+static int parse_options(PyObject *args, PyObject *kwargs, const char *format,
+                         char **kwlist, ...) {
+  PyObject *options = PyDict_New();
+  if (options == NULL) {
+    return -1;
+  }
+  for (char **name = kwlist; *name != NULL; name++) {
+    PyObject *value = PyDict_GetItemString(kwargs, *name);
+    if (value != NULL && (PyDict_SetItemString(options, *name, value) < 0 ||
+                          PyDict_DelItemString(kwargs, *name) < 0)) {
+      Py_DECREF(options);
+      return -1;
+    }
+  }
+
+  PyObject *no_args = NULL;
+  if (args == NULL) {
+    args = no_args = PyTuple_New(0);
+  }
+  int parsed = 0;
+  if (args != NULL) {
+    va_list values;
+    va_start(values, kwlist);
+    parsed = PyArg_VaParseTupleAndKeywords(args, options, format, kwlist,
+                                           values);
+    va_end(values);
+  }
+  Py_XDECREF(no_args);
+  Py_DECREF(options);
+  return parsed ? 0 : -1;
+}
+
+// Returns whether the stream needs the PortAudio callback: to run a Python
+// callback, or to feed readers and broker clients.
+static int needs_callback(const OpenOptions *options) {
+  return options->stream.has_callback || options->ring.capture_frames ||
+         options->ring.shared_capture_name || options->broker.path;
+}
+
+// Converts a device index argument (None for the default device) into
+// *device_index.
+static int parse_device_index(PyObject *arg, const char *name,
+                              int *device_index) {
+  if (arg == NULL || arg == Py_None) {
+#ifdef VERBOSE
+    printf("Using default %s\n", name);
+#endif
+    *device_index = -1;
+    return 0;
+  }
+
+  if (!PyNumber_Check(arg)) {
+    PyErr_Format(PyExc_ValueError, "%s_index must be integer (or None)", name);
+    return -1;
+  }
+  PyObject *device_index_long = PyNumber_Long(arg);
+  if (device_index_long == NULL) {
+    return -1;
+  }
+  *device_index = (int)PyLong_AsLong(device_index_long);
+  Py_DECREF(device_index_long);
+  if (*device_index == -1 && PyErr_Occurred()) {
+    return -1;
+  }
+#ifdef VERBOSE
+  printf("Using %s index number: %d\n", name, *device_index);
+#endif
+  return 0;
+}
+
+static int parse_stream_options(PyAudioStream *stream, PyObject *args,
+                                PyObject *kwargs, OpenOptions *options) {
   static char *kwlist[] = {"rate",
                            "channels",
                            "format",
@@ -37,179 +250,524 @@ PyObject *PyAudio_OpenStream(PyObject *self, PyObject *args, PyObject *kwargs) {
                            "input_host_api_specific_stream_info",
                            "output_host_api_specific_stream_info",
                            "stream_callback",
+                           "isolated_callback",
                            NULL};
+  PyObject *input_device_index_arg = NULL;
+  PyObject *output_device_index_arg = NULL;
+  options->stream.frames_per_buffer = DEFAULT_FRAMES_PER_BUFFER;
 
-#ifdef MACOS
-  PyAudioMacCoreStreamInfo *input_host_specific_stream_info = NULL;
-  PyAudioMacCoreStreamInfo *output_host_specific_stream_info = NULL;
-#else
-  /* mostly ignored...*/
-  PyObject *input_host_specific_stream_info = NULL;
-  PyObject *output_host_specific_stream_info = NULL;
+#ifdef HOST_STREAM_INFO_TYPE
+  PyAudioModuleState *state = PyAudio_GetModuleStateByType(Py_TYPE(stream));
+  if (state == NULL) {
+    return -1;
+  }
 #endif
 
-  /* default to neither output nor input */
-  int input = 0;
-  int output = 0;
-  int frames_per_buffer = DEFAULT_FRAMES_PER_BUFFER;
-
   // clang-format off
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs,
-#ifdef MACOS
-                                   "iik|iiOOiO!O!O",
+  if (parse_options(args, kwargs,
+#ifdef HOST_STREAM_INFO_TYPE
+                    "iik|iiOOiO!O!Oz",
 #else
-                                   "iik|iiOOiOOO",
+                    "iik|iiOOiOOOz",
 #endif
-                                   kwlist,
-                                   &rate, &channels, &format,
-                                   &input, &output,
-                                   &input_device_index_arg,
-                                   &output_device_index_arg,
-                                   &frames_per_buffer,
-#ifdef MACOS
-                                   &PyAudioMacCoreStreamInfoType,
+                    kwlist,
+                    &options->stream.rate,
+                    &options->stream.channels,
+                    &options->stream.format,
+                    &options->stream.input,
+                    &options->stream.output,
+                    &input_device_index_arg,
+                    &output_device_index_arg,
+                    &options->stream.frames_per_buffer,
+#ifdef HOST_STREAM_INFO_TYPE
+                    HOST_STREAM_INFO_TYPE(state),
 #endif
-                                   &input_host_specific_stream_info,
-#ifdef MACOS
-                                   &PyAudioMacCoreStreamInfoType,
+                    &options->stream.input_host_specific_stream_info,
+#ifdef HOST_STREAM_INFO_TYPE
+                    HOST_STREAM_INFO_TYPE(state),
 #endif
-                                   &output_host_specific_stream_info,
-                                   &stream_callback)) {
-
-    return NULL;
+                    &options->stream.output_host_specific_stream_info,
+                    &options->stream.stream_callback,
+                    &options->stream.isolated_callback) < 0) {
+    return -1;
   }
   // clang-format on
 
+  PyObject *stream_callback = options->stream.stream_callback;
   if (stream_callback && (PyCallable_Check(stream_callback) == 0)) {
     PyErr_SetString(PyExc_TypeError, "stream_callback must be callable");
-    return NULL;
+    return -1;
   }
 
-  if ((input_device_index_arg == NULL) || (input_device_index_arg == Py_None)) {
-#ifdef VERBOSE
-    printf("Using default input device\n");
-#endif
+  if (stream_callback && options->stream.isolated_callback) {
+    PyErr_SetString(PyExc_ValueError,
+                    "stream_callback and isolated_callback are mutually "
+                    "exclusive");
+    return -1;
+  }
+  options->stream.has_callback =
+      stream_callback != NULL || options->stream.isolated_callback != NULL;
+
+  if (parse_device_index(input_device_index_arg, "input_device",
+                         &options->stream.input_device_index) < 0 ||
+      parse_device_index(output_device_index_arg, "output_device",
+                         &options->stream.output_device_index) < 0) {
+    return -1;
+  }
 
-    input_device_index = -1;
-  } else {
-    if (!PyNumber_Check(input_device_index_arg)) {
-      PyErr_SetString(PyExc_ValueError,
-                      "input_device_index must be integer (or None)");
-      return NULL;
-    }
+  if (options->stream.input == 0 && options->stream.output == 0) {
+    PyErr_SetString(PyExc_ValueError, "Must specify either input or output");
+    return -1;
+  }
 
-    input_device_index_long = PyNumber_Long(input_device_index_arg);
+  if (options->stream.channels < 1) {
+    PyErr_SetString(PyExc_ValueError, "Invalid audio channels");
+    return -1;
+  }
+  return 0;
+}
 
-    input_device_index = (int)PyLong_AsLong(input_device_index_long);
-    Py_DECREF(input_device_index_long);
+// Capture rings and shared capture, for readers, and the result ring of an
+// isolated callback.
+static int parse_ring_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"capture_ring_frames", "shared_capture_name",
+                           "shared_capture_frames", "result_ring_frames",
+                           "result_frame_size", NULL};
+  options->ring.result_frame_size = 1;
+  if (parse_options(NULL, kwargs, "|iziii", kwlist,
+                    &options->ring.capture_frames,
+                    &options->ring.shared_capture_name,
+                    &options->ring.shared_capture_frames,
+                    &options->ring.result_frames,
+                    &options->ring.result_frame_size) < 0) {
+    return -1;
+  }
 
-#ifdef VERBOSE
-    printf("Using input device index number: %d\n", input_device_index);
-#endif
+  int input = options->stream.input;
+  if (options->ring.capture_frames < 0 ||
+      (options->ring.capture_frames > 0 && !input)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "capture_ring_frames requires a positive number of frames "
+                    "and an input stream");
+    return -1;
   }
 
-  if ((output_device_index_arg == NULL) ||
-      (output_device_index_arg == Py_None)) {
-#ifdef VERBOSE
-    printf("Using default output device\n");
-#endif
+  if (options->ring.shared_capture_frames < 0 ||
+      (options->ring.shared_capture_name != NULL && !input)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "shared_capture_name requires an input stream");
+    return -1;
+  }
 
-    output_device_index = -1;
-  } else {
-    if (!PyNumber_Check(output_device_index_arg)) {
-      PyErr_SetString(PyExc_ValueError,
-                      "output_device_index must be integer (or None)");
-      return NULL;
-    }
+  if (options->ring.result_frames < 0 || options->ring.result_frame_size <= 0 ||
+      (options->ring.result_frames > 0 && !options->stream.isolated_callback)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "result_ring_frames requires an isolated_callback, and "
+                    "result_frame_size must be positive");
+    return -1;
+  }
+  return 0;
+}
 
-    output_device_index_long = PyNumber_Long(output_device_index_arg);
-    output_device_index = (int)PyLong_AsLong(output_device_index_long);
-    Py_DECREF(output_device_index_long);
+static int parse_broker_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"broker_path", "broker_client_frames", NULL};
+  if (parse_options(NULL, kwargs, "|zi", kwlist, &options->broker.path,
+                    &options->broker.client_frames) < 0) {
+    return -1;
+  }
 
-#ifdef VERBOSE
-    printf("Using output device index number: %d\n", output_device_index);
-#endif
+  if (options->broker.client_frames < 0 ||
+      (options->broker.path != NULL && !options->stream.output)) {
+    PyErr_SetString(PyExc_ValueError, "broker_path requires an output stream");
+    return -1;
   }
+  return 0;
+}
 
-  if (input == 0 && output == 0) {
-    PyErr_SetString(PyExc_ValueError, "Must specify either input or output");
-    return NULL;
+static int parse_reblock_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"callback_block_size", "callback_hop_size", NULL};
+  if (parse_options(NULL, kwargs, "|ii", kwlist, &options->reblock.block_size,
+                    &options->reblock.hop_size) < 0) {
+    return -1;
   }
 
-  if (channels < 1) {
-    PyErr_SetString(PyExc_ValueError, "Invalid audio channels");
-    return NULL;
+  int block_size = options->reblock.block_size;
+  if (options->reblock.hop_size == 0) {
+    options->reblock.hop_size = block_size;
+  }
+  int hop_size = options->reblock.hop_size;
+  if (block_size < 0 || hop_size < 0 || hop_size > block_size ||
+      (block_size > 0 && !options->stream.has_callback) ||
+      (!options->stream.input && hop_size != block_size)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "callback_block_size requires a stream_callback, and "
+                    "callback_hop_size must be between 1 and "
+                    "callback_block_size (equal for output-only streams)");
+    return -1;
   }
+  return 0;
+}
+
+static int parse_coalesce_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"write_coalesce_frames", "write_coalesce_max_age",
+                           NULL};
+  options->coalesce.max_age = -1.0;
+  if (parse_options(NULL, kwargs, "|id", kwlist, &options->coalesce.frames,
+                    &options->coalesce.max_age) < 0) {
+    return -1;
+  }
+
+  if (options->coalesce.frames < 0 ||
+      (options->coalesce.frames > 0 &&
+       (options->stream.has_callback || !options->stream.output))) {
+    PyErr_SetString(PyExc_ValueError,
+                    "write_coalesce_frames requires a blocking output stream");
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_lookahead_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"lookahead_buffers", "lookahead_max_buffers", NULL};
+  if (parse_options(NULL, kwargs, "|ii", kwlist, &options->lookahead.buffers,
+                    &options->lookahead.max_buffers) < 0) {
+    return -1;
+  }
+
+  int buffers = options->lookahead.buffers;
+  if (options->lookahead.max_buffers == 0) {
+    options->lookahead.max_buffers = 4 * buffers;
+  }
+  if (buffers < 0 ||
+      (buffers > 0 &&
+       (!options->stream.stream_callback || options->stream.input ||
+        !options->stream.output || options->stream.frames_per_buffer <= 0 ||
+        options->reblock.block_size > 0 ||
+        options->lookahead.max_buffers < buffers))) {
+    PyErr_SetString(PyExc_ValueError,
+                    "lookahead_buffers requires a callback-mode output-only "
+                    "stream with frames_per_buffer, without "
+                    "callback_block_size, and lookahead_max_buffers of at "
+                    "least lookahead_buffers");
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_deadline_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"callback_deadline", "deadline_fallback", NULL};
+  const char *fallback_name = NULL;
+  if (parse_options(NULL, kwargs, "|dz", kwlist, &options->deadline.fraction,
+                    &fallback_name) < 0) {
+    return -1;
+  }
+
+  double fraction = options->deadline.fraction;
+  if (fraction < 0 || fraction > 1 ||
+      (fraction > 0 &&
+       (!options->stream.has_callback || !options->stream.output ||
+        options->stream.frames_per_buffer <= 0 ||
+        options->reblock.block_size > 0 || options->lookahead.buffers > 0))) {
+    PyErr_SetString(PyExc_ValueError,
+                    "callback_deadline must be between 0 and 1, and requires "
+                    "a callback-mode stream with output and "
+                    "frames_per_buffer, without callback_block_size or "
+                    "lookahead_buffers");
+    return -1;
+  }
+  return PyAudioDeadline_ParseFallback(fallback_name,
+                                       &options->deadline.fallback);
+}
+
+static int parse_trace_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"trace_path", "trace_input", NULL};
+  if (parse_options(NULL, kwargs, "|zi", kwlist, &options->trace.path,
+                    &options->trace.input) < 0) {
+    return -1;
+  }
+
+  if ((options->trace.path != NULL && !options->stream.has_callback) ||
+      (options->trace.input &&
+       (options->trace.path == NULL || !options->stream.input))) {
+    PyErr_SetString(PyExc_ValueError,
+                    "trace_path requires a callback-mode stream, and "
+                    "trace_input requires trace_path and an input stream");
+    return -1;
+  }
+  return 0;
+}
+
+// Real-time scheduling, CPU affinity and memory locking.
+static int parse_tuning_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"realtime_policy", "realtime_priority",
+                           "cpu_affinity", "lock_memory", NULL};
+  if (parse_options(NULL, kwargs, "|ziOi", kwlist, &options->tuning.policy,
+                    &options->tuning.priority, &options->tuning.cpus,
+                    &options->tuning.lock_memory) < 0) {
+    return -1;
+  }
+
+  if (options->tuning.cpus == Py_None) {
+    options->tuning.cpus = NULL;
+  }
+  // Only callback-mode streams run on threads PyAudio can tune; blocking
+  // streams tune their own threads with set_thread_scheduling().
+  if ((options->tuning.policy != NULL || options->tuning.cpus != NULL) &&
+      !needs_callback(options)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "realtime_policy and cpu_affinity require a callback-mode "
+                    "stream");
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_virtual_options(PyObject *kwargs, OpenOptions *options) {
+  static char *kwlist[] = {"virtual_device", "virtual_input",
+                           "virtual_output_path", "virtual_trace", NULL};
+  PyAudioNullConfig *config = &options->virtual_device.config;
+  if (parse_options(NULL, kwargs, "|zOzz", kwlist,
+                    &options->virtual_device.mode,
+                    &options->virtual_device.input, &config->output_path,
+                    &config->trace_path) < 0) {
+    return -1;
+  }
+
+  if (options->virtual_device.mode == NULL &&
+      (options->virtual_device.input != NULL || config->output_path != NULL ||
+       config->trace_path != NULL)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "virtual_input, virtual_output_path and virtual_trace "
+                    "require a virtual_device");
+    return -1;
+  }
+  if (options->virtual_device.mode != NULL &&
+      PyAudioNull_ParseMode(options->virtual_device.mode, config) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// Parses open()'s arguments into options. Returns 0, or -1 with an exception
+// set.
+static int parse_open_options(PyAudioStream *stream, PyObject *args,
+                              PyObject *kwargs, OpenOptions *options) {
+  memset(options, 0, sizeof(*options));
+  // Each parser takes its own keyword arguments out of a copy.
+  PyObject *remaining = kwargs != NULL ? PyDict_Copy(kwargs) : PyDict_New();
+  if (remaining == NULL) {
+    return -1;
+  }
+  // Later features check their options against earlier ones.
+  int result = -1;
+  if (parse_stream_options(stream, args, remaining, options) == 0 &&
+      parse_ring_options(remaining, options) == 0 &&
+      parse_broker_options(remaining, options) == 0 &&
+      parse_reblock_options(remaining, options) == 0 &&
+      parse_coalesce_options(remaining, options) == 0 &&
+      parse_lookahead_options(remaining, options) == 0 &&
+      parse_deadline_options(remaining, options) == 0 &&
+      parse_trace_options(remaining, options) == 0 &&
+      parse_tuning_options(remaining, options) == 0 &&
+      parse_virtual_options(remaining, options) == 0) {
+    PyObject *key;
+    PyObject *value;
+    Py_ssize_t pos = 0;
+    if (PyDict_Next(remaining, &pos, &key, &value)) {
+      PyErr_Format(PyExc_TypeError,
+                   "'%S' is an invalid keyword argument for this function",
+                   key);
+    } else {
+      result = 0;
+    }
+  }
+  Py_DECREF(remaining);
+  return result;
+}
+
+/*************************************************************
+ * Opening
+ *************************************************************/
+
+// Opens the PortAudio (or virtual device) stream, and sets up the stream's
+// core context. Returns 0, or -1 with an exception set.
+static int open_backend(PyAudioStream *stream, OpenOptions *options) {
+  int rate = options->stream.rate;
+  int channels = options->stream.channels;
+  PaSampleFormat format = options->stream.format;
+  int input = options->stream.input;
+  int output = options->stream.output;
+  int frames_per_buffer = options->stream.frames_per_buffer;
+  const char *virtual_device = options->virtual_device.mode;
+  PyObject *virtual_input = options->virtual_device.input;
+  PyAudioNullConfig *virtual_config = &options->virtual_device.config;
+#if defined(MACOS) || defined(PYAUDIO_HAVE_ALSA)
+  HostStreamInfo *input_host_specific_stream_info =
+      options->stream.input_host_specific_stream_info;
+  HostStreamInfo *output_host_specific_stream_info =
+      options->stream.output_host_specific_stream_info;
+#endif
+  PaError err;
 
   PaStreamParameters output_parameters;
-  if (output) {
-    if (output_device_index < 0) {
+  if (output && virtual_device) {
+    // The null device has no device index nor latency to choose.
+    output_parameters.device = paNoDevice;
+    output_parameters.channelCount = channels;
+    output_parameters.sampleFormat = format;
+    output_parameters.suggestedLatency = 0;
+    output_parameters.hostApiSpecificStreamInfo = NULL;
+  } else if (output) {
+    if (options->stream.output_device_index < 0) {
       output_parameters.device = Pa_GetDefaultOutputDevice();
     } else {
-      output_parameters.device = output_device_index;
+      output_parameters.device = options->stream.output_device_index;
+    }
+#ifdef PYAUDIO_HAVE_ALSA
+    // A device string names the ALSA device instead.
+    if (output_host_specific_stream_info &&
+        output_host_specific_stream_info->device_string) {
+      output_parameters.device = paUseHostApiSpecificDeviceSpecification;
     }
+#endif
 
     /* final check -- ensure that there is a default device */
-    if (output_parameters.device < 0 ||
-        output_parameters.device >= Pa_GetDeviceCount()) {
+    if (output_parameters.device != paUseHostApiSpecificDeviceSpecification &&
+        (output_parameters.device < 0 ||
+         output_parameters.device >= Pa_GetDeviceCount())) {
       PyErr_SetObject(PyExc_IOError,
                       Py_BuildValue("(i,s)", paInvalidDevice,
                                     "Invalid output device "
                                     "(no default output device)"));
-      return NULL;
+      return -1;
     }
 
     output_parameters.channelCount = channels;
     output_parameters.sampleFormat = format;
+    // Without a device index, ask for the lowest latency: the buffer is then
+    // sized by frames_per_buffer and the number of periods.
     output_parameters.suggestedLatency =
-        Pa_GetDeviceInfo(output_parameters.device)->defaultLowOutputLatency;
+        output_parameters.device == paUseHostApiSpecificDeviceSpecification
+            ? 0
+            : Pa_GetDeviceInfo(output_parameters.device)
+                  ->defaultLowOutputLatency;
     output_parameters.hostApiSpecificStreamInfo = NULL;
-#ifdef MACOS
+#if defined(MACOS)
     if (output_host_specific_stream_info) {
       output_parameters.hostApiSpecificStreamInfo =
           &output_host_specific_stream_info->stream_info;
     }
+#elif defined(PYAUDIO_HAVE_ALSA)
+    if (output_parameters.device == paUseHostApiSpecificDeviceSpecification) {
+      output_parameters.hostApiSpecificStreamInfo =
+          &output_host_specific_stream_info->stream_info;
+    }
 #endif
   }
 
   PaStreamParameters input_parameters;
-  if (input) {
-    if (input_device_index < 0) {
+  if (input && virtual_device) {
+    input_parameters.device = paNoDevice;
+    input_parameters.channelCount = channels;
+    input_parameters.sampleFormat = format;
+    input_parameters.suggestedLatency = 0;
+    input_parameters.hostApiSpecificStreamInfo = NULL;
+  } else if (input) {
+    if (options->stream.input_device_index < 0) {
       input_parameters.device = Pa_GetDefaultInputDevice();
     } else {
-      input_parameters.device = input_device_index;
+      input_parameters.device = options->stream.input_device_index;
     }
+#ifdef PYAUDIO_HAVE_ALSA
+    if (input_host_specific_stream_info &&
+        input_host_specific_stream_info->device_string) {
+      input_parameters.device = paUseHostApiSpecificDeviceSpecification;
+    }
+#endif
 
     /* final check -- ensure that there is a default device */
-    if (input_parameters.device < 0) {
+    if (input_parameters.device != paUseHostApiSpecificDeviceSpecification &&
+        input_parameters.device < 0) {
       PyErr_SetObject(PyExc_IOError,
                       Py_BuildValue("(i,s)", paInvalidDevice,
                                     "Invalid input device "
                                     "(no default output device)"));
-      return NULL;
+      return -1;
     }
 
     input_parameters.channelCount = channels;
     input_parameters.sampleFormat = format;
     input_parameters.suggestedLatency =
-        Pa_GetDeviceInfo(input_parameters.device)->defaultLowInputLatency;
+        input_parameters.device == paUseHostApiSpecificDeviceSpecification
+            ? 0
+            : Pa_GetDeviceInfo(input_parameters.device)->defaultLowInputLatency;
     input_parameters.hostApiSpecificStreamInfo = NULL;
-#ifdef MACOS
+#if defined(MACOS)
     if (input_host_specific_stream_info) {
       input_parameters.hostApiSpecificStreamInfo =
           &input_host_specific_stream_info->stream_info;
     }
+#elif defined(PYAUDIO_HAVE_ALSA)
+    if (input_parameters.device == paUseHostApiSpecificDeviceSpecification) {
+      input_parameters.hostApiSpecificStreamInfo =
+          &input_host_specific_stream_info->stream_info;
+    }
 #endif
   }
 
-  PyAudioStream *stream = PyAudioStream_Create();
-  if (!stream) {
-    PyErr_SetString(PyExc_MemoryError, "Cannot allocate stream object");
-    return NULL;
+#ifdef PYAUDIO_HAVE_ALSA
+  int alsa_realtime_scheduling =
+      !virtual_device &&
+      ((input && input_host_specific_stream_info &&
+        input_host_specific_stream_info->realtime_scheduling) ||
+       (output && output_host_specific_stream_info &&
+        output_host_specific_stream_info->realtime_scheduling));
+  // PaAlsa_EnableRealtimeScheduling() assumes an ALSA stream.
+  if (alsa_realtime_scheduling &&
+      ((input && !PyAudioAlsa_IsAlsaDevice(input_parameters.device)) ||
+       (output && !PyAudioAlsa_IsAlsaDevice(output_parameters.device)))) {
+    PyErr_SetObject(
+        PyExc_IOError,
+        Py_BuildValue("(i,s)", paIncompatibleHostApiSpecificStreamInfo,
+                      "Real-time scheduling requires an ALSA device"));
+    return -1;
   }
+#endif
+
+  // Feed readers through the callback too, if there are any.
+  PaStreamCallback *callback_cfunc =
+      needs_callback(options) ? PyAudioStream_CallbackCFunc : NULL;
 
   PaStream *pa_stream = NULL;
+  const PyAudioStreamBackend *backend = &PyAudioPortAudioBackend;
+  err = paNoError;
+  if (virtual_device) {
+    // The input is a source name or path, or frames.
+    Py_buffer input_frames = {NULL};
+    if (virtual_input != NULL && PyUnicode_Check(virtual_input)) {
+      virtual_config->input = PyUnicode_AsUTF8(virtual_input);
+      if (virtual_config->input == NULL) {
+        return -1;
+      }
+    } else if (virtual_input != NULL) {
+      if (PyObject_GetBuffer(virtual_input, &input_frames, PyBUF_SIMPLE) < 0) {
+        return -1;
+      }
+      virtual_config->input_data = (const char *)input_frames.buf;
+      virtual_config->input_size = input_frames.len;
+    }
+    pa_stream = PyAudioNull_OpenStream(input ? &input_parameters : NULL,
+                                       output ? &output_parameters : NULL,
+                                       rate, frames_per_buffer, callback_cfunc,
+                                       stream, virtual_config);
+    PyBuffer_Release(&input_frames);
+    if (pa_stream == NULL) {
+      return -1;
+    }
+    backend = &PyAudioNullBackend;
+  }
   // clang-format off
+  if (!virtual_device) {
   Py_BEGIN_ALLOW_THREADS
   err = Pa_OpenStream(&pa_stream,
                       /* input/output parameters */
@@ -223,11 +781,12 @@ PyObject *PyAudio_OpenStream(PyObject *self, PyObject *args, PyObject *kwargs) {
                       /* we won't output out of range samples
                          so don't bother clipping them */
                       paClipOff,
-                      /* callback, if specified */
-                      stream_callback ? PyAudioStream_CallbackCFunc : NULL,
+                      /* callback, if specified or needed to feed readers */
+                      callback_cfunc,
                       /* callback userData, if applicable */
                       stream);
   Py_END_ALLOW_THREADS
+  }
   // clang-format on
 
   if (err != paNoError) {
@@ -236,33 +795,282 @@ PyObject *PyAudio_OpenStream(PyObject *self, PyObject *args, PyObject *kwargs) {
     fprintf(stderr, "Error number: %d\n", err);
     fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
 #endif
-    // Decrement reference, which automatically cleanups & deallocates stream.
-    Py_DECREF(stream);
 
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", err, Pa_GetErrorText(err)));
-    return NULL;
+    return -1;
+  }
+#ifdef PYAUDIO_HAVE_ALSA
+  if (alsa_realtime_scheduling) {
+    // Applies to the callback thread, once the stream starts.
+    PaAlsa_EnableRealtimeScheduling(pa_stream, 1);
   }
+#endif
 
   stream->context.stream = pa_stream;
+  stream->context.backend = backend;
+  if (!stream->sync_ready) {
+    PyAudioMutex_Init(&stream->lock);
+    PyAudioCond_Init(&stream->cond);
+    stream->sync_ready = 1;
+  }
+  err = backend->set_finished_callback(pa_stream, stream_finished);
+  if (err != paNoError) {
+    PyAudioStream_Cleanup(stream);
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", err, Pa_GetErrorText(err)));
+    return -1;
+  }
+  stream->context.format = format;
+  stream->context.channels = channels;
+  stream->context.is_input = input;
+  stream->context.is_output = output;
   stream->context.frame_size = Pa_GetSampleSize(format) * channels;
   stream->context.main_thread_id = PyThreadState_Get()->thread_id;
+  stream->context.interp = PyThreadState_Get()->interp;
+  stream->context.sample_rate = rate;
+  const PaStreamInfo *stream_info = backend->get_info(pa_stream);
+  if (stream_info && stream_info->sampleRate > 0) {
+    stream->context.sample_rate = stream_info->sampleRate;
+  }
+  return 0;
+}
+
+// Sets up the Python callback, or the isolated callback's subinterpreter.
+static int setup_callback(PyAudioStream *stream, const OpenOptions *options) {
   stream->context.callback = NULL;
-  if (stream_callback) {
-    Py_INCREF(stream_callback);
-    stream->context.callback = stream_callback;
+  if (options->stream.stream_callback) {
+    Py_INCREF(options->stream.stream_callback);
+    stream->context.callback = options->stream.stream_callback;
   }
 
-  return (PyObject *)stream;
+  if (options->stream.isolated_callback) {
+    stream->context.isolated =
+        PyAudioIsolated_Create(options->stream.isolated_callback);
+    if (!stream->context.isolated) {
+      return -1;
+    }
+    // Both belong to the subinterpreter. Its callback errors are printed
+    // there, as they cannot be raised in this interpreter's main thread.
+    stream->context.callback =
+        PyAudioIsolated_Callback(stream->context.isolated);
+    stream->context.interp = PyAudioIsolated_Interp(stream->context.isolated);
+    stream->context.main_thread_id = 0;
+  }
+  return 0;
 }
 
-PyObject *PyAudio_CloseStream(PyObject *self, PyObject *args) {
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
+static int setup_rings(PyAudioStream *stream, const OpenOptions *options) {
+  if (options->ring.result_frames > 0) {
+    stream->context.result_ring =
+        PyAudioRing_Create((uint64_t)options->ring.result_frames,
+                           (unsigned int)options->ring.result_frame_size);
+    if (!stream->context.result_ring) {
+      PyErr_SetString(PyExc_MemoryError, "Cannot allocate result ring");
+      return -1;
+    }
+  }
+
+  if (options->ring.capture_frames > 0) {
+    stream->context.capture_ring = PyAudioRing_Create(
+        (uint64_t)options->ring.capture_frames, stream->context.frame_size);
+    if (!stream->context.capture_ring) {
+      PyErr_SetString(PyExc_MemoryError, "Cannot allocate capture ring");
+      return -1;
+    }
+  }
+
+  if (options->ring.shared_capture_name != NULL) {
+    // Default to one second of audio.
+    uint64_t capacity = options->ring.shared_capture_frames > 0
+                            ? (uint64_t)options->ring.shared_capture_frames
+                            : (uint64_t)stream->context.sample_rate;
+    stream->context.shared_capture = PyAudioSharedCapture_Create(
+        options->ring.shared_capture_name, capacity, options->stream.format,
+        (unsigned int)options->stream.channels, stream->context.frame_size,
+        stream->context.sample_rate);
+    if (!stream->context.shared_capture) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int setup_trace(PyAudioStream *stream, const OpenOptions *options) {
+  if (options->trace.path == NULL) {
+    return 0;
+  }
+  stream->context.trace = PyAudioTrace_Create(
+      options->trace.path, options->stream.format,
+      (unsigned int)options->stream.channels, stream->context.frame_size,
+      stream->context.sample_rate, options->stream.input,
+      options->stream.output, options->trace.input);
+  return stream->context.trace ? 0 : -1;
+}
+
+static int setup_tuning(PyAudioStream *stream, const OpenOptions *options) {
+  if (options->tuning.policy == NULL && options->tuning.cpus == NULL) {
+    return 0;
+  }
+  stream->context.thread_tuning = PyAudioThreadTuning_Create(
+      options->tuning.policy, options->tuning.priority, options->tuning.cpus);
+  return stream->context.thread_tuning ? 0 : -1;
+}
+
+static int setup_schedule(PyAudioStream *stream, const OpenOptions *options) {
+  if (!options->stream.has_callback || !options->stream.output) {
+    return 0;
+  }
+  stream->context.schedule = PyAudioSchedule_Create();
+  if (!stream->context.schedule) {
+    PyErr_SetString(PyExc_MemoryError, "Cannot allocate stream schedule");
+    return -1;
+  }
+  return 0;
+}
+
+static int setup_reblock(PyAudioStream *stream, const OpenOptions *options) {
+  if (options->reblock.block_size <= 0) {
+    return 0;
+  }
+  stream->context.reblock = PyAudioReblock_Create(
+      (unsigned long)options->reblock.block_size,
+      (unsigned long)options->reblock.hop_size, stream->context.frame_size,
+      stream->context.sample_rate, options->stream.input,
+      options->stream.output);
+  return stream->context.reblock ? 0 : -1;
+}
+
+static int setup_lookahead(PyAudioStream *stream, const OpenOptions *options) {
+  if (options->lookahead.buffers <= 0) {
+    return 0;
+  }
+  stream->context.lookahead = PyAudioLookahead_Create(
+      (unsigned long)options->stream.frames_per_buffer,
+      stream->context.frame_size, stream->context.sample_rate,
+      (unsigned int)options->lookahead.buffers,
+      (unsigned int)options->lookahead.max_buffers);
+  return stream->context.lookahead ? 0 : -1;
+}
+
+static int setup_deadline(PyAudioStream *stream, const OpenOptions *options) {
+  if (options->deadline.fraction <= 0) {
+    return 0;
+  }
+  stream->context.deadline = PyAudioDeadline_Create(
+      (unsigned long)options->stream.frames_per_buffer,
+      stream->context.frame_size, options->stream.format,
+      (unsigned int)options->stream.channels, stream->context.sample_rate,
+      options->stream.input, options->deadline.fraction,
+      options->deadline.fallback);
+  return stream->context.deadline ? 0 : -1;
+}
+
+static int setup_coalesce(PyAudioStream *stream, const OpenOptions *options) {
+  int frames = options->coalesce.frames;
+  if (frames <= 0) {
+    return 0;
+  }
+  stream->context.write_buffer.data =
+      (char *)malloc((size_t)frames * stream->context.frame_size);
+  if (!stream->context.write_buffer.data) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  stream->context.write_buffer.capacity = (unsigned long)frames;
+  // By default, a write arriving once the oldest frame has waited as long as
+  // it takes to play a block writes it out.
+  stream->context.write_buffer.max_age =
+      options->coalesce.max_age >= 0 ? options->coalesce.max_age
+                                     : frames / stream->context.sample_rate;
+  // Otherwise, every write writes out the buffer.
+  if (stream->context.write_buffer.max_age > 0) {
+    return PyAudioStream_StartFlusher(stream);
+  }
+  return 0;
+}
+
+static int setup_broker(PyAudioStream *stream, const OpenOptions *options) {
+  if (options->broker.path == NULL) {
+    return 0;
+  }
+  // Default to four device buffers, or 1/10 second if unspecified.
+  int broker_client_frames = options->broker.client_frames;
+  int frames_per_buffer = options->stream.frames_per_buffer;
+  uint64_t client_frames =
+      broker_client_frames > 0 ? (uint64_t)broker_client_frames
+      : frames_per_buffer > 0  ? 4 * (uint64_t)frames_per_buffer
+                               : (uint64_t)(stream->context.sample_rate / 10);
+  const PaStreamInfo *stream_info =
+      stream->context.backend->get_info(stream->context.stream);
+  stream->context.broker = PyAudioBroker_Create(
+      options->broker.path, options->stream.format,
+      (unsigned int)options->stream.channels, stream->context.frame_size,
+      stream->context.sample_rate, stream_info ? stream_info->outputLatency : 0,
+      client_frames);
+  return stream->context.broker ? 0 : -1;
+}
+
+int PyAudioStream_Open(PyAudioStream *stream, PyObject *args,
+                       PyObject *kwargs) {
+  OpenOptions options;
+  if (parse_open_options(stream, args, kwargs, &options) < 0 ||
+      open_backend(stream, &options) < 0) {
+    return -1;
+  }
+
+  if (setup_callback(stream, &options) < 0 ||
+      setup_rings(stream, &options) < 0 || setup_trace(stream, &options) < 0 ||
+      setup_tuning(stream, &options) < 0 ||
+      setup_schedule(stream, &options) < 0 ||
+      setup_reblock(stream, &options) < 0 ||
+      setup_lookahead(stream, &options) < 0 ||
+      setup_deadline(stream, &options) < 0 ||
+      setup_coalesce(stream, &options) < 0 ||
+      setup_broker(stream, &options) < 0) {
+    PyAudioStream_Cleanup(stream);
+    return -1;
+  }
+
+  if (options.tuning.lock_memory) {
+    lock_buffers(stream);
+  }
+  return 0;
+}
+
+PyObject *PyAudio_OpenStream(PyObject *self, PyObject *args, PyObject *kwargs) {
+  PyAudioStream *stream = PyAudioStream_Create(self);
+  if (!stream) {
+    PyErr_SetString(PyExc_MemoryError, "Cannot allocate stream object");
     return NULL;
   }
 
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
+  if (PyAudioStream_Open(stream, args, kwargs) < 0) {
+    Py_DECREF(stream);
+    return NULL;
+  }
+  return (PyObject *)stream;
+}
+
+// Writes out coalesced frames if the stream is running, or else discards them.
+// Errors are left for the caller's next PortAudio call to report. Does not
+// wait for a write in progress on another thread, which keeps its frames.
+static void flush_coalesced_writes(PyAudioStream *stream) {
+  if (!PyAudioStream_IsOpen(stream) ||
+      stream->context.write_buffer.capacity == 0 ||
+      PyAudioStream_ClaimWriteBuffer(stream, 0) < 0) {
+    return;
+  }
+  if (stream->context.write_buffer.num_frames > 0 &&
+      stream->context.backend->is_active(stream->context.stream) == 1) {
+    PyAudioStream_FlushWrites(stream);
+  }
+  PyAudioStream_SetBufferedFrames(stream, 0);
+  PyAudioStream_ReleaseWriteBuffer(stream);
+}
+
+PyObject *PyAudioStream_Close(PyAudioStream *stream, PyObject *unused) {
+  flush_coalesced_writes(stream);
   // Closes the PortAudio stream and cleans up.
   PyAudioStream_Cleanup(stream);
 
@@ -270,29 +1078,56 @@ PyObject *PyAudio_CloseStream(PyObject *self, PyObject *args) {
   return Py_None;
 }
 
+PyObject *PyAudio_CloseStream(PyObject *self, PyObject *args) {
+  PyObject *stream_arg;
+  if (!PyArg_ParseTuple(args, "O!", PyAudio_GetModuleState(self)->stream_type,
+                        &stream_arg)) {
+    return NULL;
+  }
+  return PyAudioStream_Close((PyAudioStream *)stream_arg, NULL);
+}
+
 /*************************************************************
  * Stream Start / Stop / Info
  *************************************************************/
 
-PyObject *PyAudio_StartStream(PyObject *self, PyObject *args) {
+static PyObject *start_stream(PyAudioStream *stream) {
   int err;
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
-    return NULL;
-  }
-
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
   if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
     return NULL;
   }
 
-  // clang-format off
-  Py_BEGIN_ALLOW_THREADS
-  err = Pa_StartStream(stream->context.stream);
-  Py_END_ALLOW_THREADS
-  // clang-format on
+  // A new run may create a new callback thread state.
+  PyAudioAtomic_StoreLong(&stream->context.release_callback_tstate, 0);
+  // Prime the lookahead FIFO, unless the stream is already running.
+  if (stream->context.lookahead != NULL && !stream->context.is_running &&
+      PyAudioLookahead_Start(stream->context.lookahead, stream) < 0) {
+    return NULL;
+  }
+  if (stream->context.deadline != NULL && !stream->context.is_running &&
+      PyAudioDeadline_Start(stream->context.deadline, stream) < 0) {
+    return NULL;
+  }
+
+  // Set before starting, since a short stream may finish before
+  // Pa_StartStream() returns.
+  PyAudioAtomic_StoreLong(&stream->context.active, 1);
+
+  if ((err = PyAudioStream_BeginIO(stream)) == paNoError) {
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    err = stream->context.backend->start(stream->context.stream);
+    if (err == paStreamIsNotStopped &&
+        stream->context.backend->is_active(stream->context.stream) != 1) {
+      // Started earlier, and since completed.
+      PyAudioStream_SignalFinished(stream);
+    }
+    Py_END_ALLOW_THREADS
+    // clang-format on
+    PyAudioStream_EndIO(stream);
+  }
 
   if ((err != paNoError) && (err != paStreamIsNotStopped)) {
     PyAudioStream_Cleanup(stream);
@@ -308,28 +1143,36 @@ PyObject *PyAudio_StartStream(PyObject *self, PyObject *args) {
     return NULL;
   }
 
+  stream->context.is_running = 1;
   Py_INCREF(Py_None);
   return Py_None;
 }
 
-PyObject *PyAudio_StopStream(PyObject *self, PyObject *args) {
+static PyObject *stop_stream(PyAudioStream *stream) {
   int err;
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
-    return NULL;
-  }
-
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
   if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetString(PyExc_IOError, "Stream not open");
     return NULL;
   }
 
-  // clang-format off
-  Py_BEGIN_ALLOW_THREADS
-  err = Pa_StopStream(stream->context.stream);
-  Py_END_ALLOW_THREADS
-  // clang-format on
+  flush_coalesced_writes(stream);
+  PyAudioStream_ReleaseCallbackThreadState(stream);
+
+  if ((err = PyAudioStream_BeginIO(stream)) == paNoError) {
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    err = stream->context.backend->stop(stream->context.stream);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+    PyAudioStream_EndIO(stream);
+  }
+  PyAudioStream_SignalFinished(stream);
+  if (stream->context.lookahead != NULL) {
+    PyAudioLookahead_Stop(stream->context.lookahead);
+  }
+  if (stream->context.deadline != NULL) {
+    PyAudioDeadline_Stop(stream->context.deadline);
+  }
 
   if ((err != paNoError) && (err != paStreamIsStopped)) {
     PyAudioStream_Cleanup(stream);
@@ -345,28 +1188,42 @@ PyObject *PyAudio_StopStream(PyObject *self, PyObject *args) {
     return NULL;
   }
 
+  stream->context.is_running = 0;
   Py_INCREF(Py_None);
   return Py_None;
 }
 
-PyObject *PyAudio_AbortStream(PyObject *self, PyObject *args) {
+static PyObject *abort_stream(PyAudioStream *stream) {
   int err;
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
-    return NULL;
-  }
-
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
   if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetString(PyExc_IOError, "Stream not open");
     return NULL;
   }
 
-  // clang-format off
-  Py_BEGIN_ALLOW_THREADS
-  err = Pa_AbortStream(stream->context.stream);
-  Py_END_ALLOW_THREADS
-  // clang-format on
+  PyAudioStream_ReleaseCallbackThreadState(stream);
+
+  if ((err = PyAudioStream_BeginIO(stream)) == paNoError) {
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    err = stream->context.backend->abort(stream->context.stream);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+    PyAudioStream_EndIO(stream);
+  }
+  // Abort drops pending output, including coalesced frames. A write in
+  // progress on another thread returns once aborted.
+  if (stream->context.write_buffer.capacity > 0 &&
+      PyAudioStream_ClaimWriteBuffer(stream, 1) == 0) {
+    PyAudioStream_SetBufferedFrames(stream, 0);
+    PyAudioStream_ReleaseWriteBuffer(stream);
+  }
+  PyAudioStream_SignalFinished(stream);
+  if (stream->context.lookahead != NULL) {
+    PyAudioLookahead_Stop(stream->context.lookahead);
+  }
+  if (stream->context.deadline != NULL) {
+    PyAudioDeadline_Stop(stream->context.deadline);
+  }
 
   if ((err != paNoError) && (err != paStreamIsStopped)) {
     PyAudioStream_Cleanup(stream);
@@ -382,29 +1239,85 @@ PyObject *PyAudio_AbortStream(PyObject *self, PyObject *args) {
     return NULL;
   }
 
+  stream->context.is_running = 0;
   Py_INCREF(Py_None);
   return Py_None;
 }
 
-PyObject *PyAudio_IsStreamStopped(PyObject *self, PyObject *args) {
-  int err;
+// Runs action on the stream, as the only thread starting, stopping or aborting
+// it. Does nothing if skip_if_running is is_running (-1 never skips).
+static PyObject *control_stream(PyAudioStream *stream,
+                                PyObject *(*action)(PyAudioStream *),
+                                int skip_if_running) {
+  if (PyAudioStream_BeginControl(stream) < 0) {
+    // Never opened: the action raises.
+    return action(stream);
+  }
+  PyObject *rv;
+  if (stream->context.is_running == skip_if_running) {
+    Py_INCREF(Py_None);
+    rv = Py_None;
+  } else {
+    rv = action(stream);
+  }
+  PyAudioStream_EndControl(stream);
+  return rv;
+}
+
+PyObject *PyAudio_StartStream(PyObject *self, PyObject *args) {
   PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
+  if (!PyArg_ParseTuple(args, "O!", PyAudio_GetModuleState(self)->stream_type,
+                        &stream_arg)) {
     return NULL;
   }
+  return control_stream((PyAudioStream *)stream_arg, start_stream, -1);
+}
 
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
+PyObject *PyAudio_StopStream(PyObject *self, PyObject *args) {
+  PyObject *stream_arg;
+  if (!PyArg_ParseTuple(args, "O!", PyAudio_GetModuleState(self)->stream_type,
+                        &stream_arg)) {
+    return NULL;
+  }
+  return control_stream((PyAudioStream *)stream_arg, stop_stream, -1);
+}
+
+PyObject *PyAudio_AbortStream(PyObject *self, PyObject *args) {
+  PyObject *stream_arg;
+  if (!PyArg_ParseTuple(args, "O!", PyAudio_GetModuleState(self)->stream_type,
+                        &stream_arg)) {
+    return NULL;
+  }
+  return control_stream((PyAudioStream *)stream_arg, abort_stream, -1);
+}
+
+// Unlike the module functions, the methods do nothing if the stream is
+// already started or stopped.
+
+PyObject *PyAudioStream_Start(PyAudioStream *stream, PyObject *unused) {
+  return control_stream(stream, start_stream, 1);
+}
+
+PyObject *PyAudioStream_Stop(PyAudioStream *stream, PyObject *unused) {
+  return control_stream(stream, stop_stream, 0);
+}
+
+PyObject *PyAudioStream_IsStopped(PyAudioStream *stream, PyObject *unused) {
+  int err;
   if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetObject(PyExc_IOError,
                     Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
     return NULL;
   }
 
-  // clang-format off
-  Py_BEGIN_ALLOW_THREADS
-  err = Pa_IsStreamStopped(stream->context.stream);
-  Py_END_ALLOW_THREADS
-  // clang-format on
+  if ((err = PyAudioStream_BeginIO(stream)) == paNoError) {
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    err = stream->context.backend->is_stopped(stream->context.stream);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+    PyAudioStream_EndIO(stream);
+  }
 
   if (err < 0) {
     PyAudioStream_Cleanup(stream);
@@ -429,45 +1342,98 @@ PyObject *PyAudio_IsStreamStopped(PyObject *self, PyObject *args) {
   return Py_False;
 }
 
-PyObject *PyAudio_IsStreamActive(PyObject *self, PyObject *args) {
-  int is_active;
-  PyObject *stream_arg;
-  if (!PyArg_ParseTuple(args, "O!", &PyAudioStreamType, &stream_arg)) {
-    return NULL;
-  }
-
-  PyAudioStream *stream = (PyAudioStream *)stream_arg;
+PyObject *PyAudioStream_IsActive(PyAudioStream *stream, PyObject *unused) {
   if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetString(PyExc_IOError, "Stream not open");
     return NULL;
   }
 
-  // clang-format off
-  Py_BEGIN_ALLOW_THREADS
-  is_active = Pa_IsStreamActive(stream->context.stream);
-  Py_END_ALLOW_THREADS
-  // clang-format on
+  // Cached from the finished callback, so neither PortAudio nor the device
+  // lock is involved.
+  if (PyAudioAtomic_LoadLong(&stream->context.active)) {
+    Py_INCREF(Py_True);
+    return Py_True;
+  }
 
-  if (is_active < 0) {
-    PaError err = is_active;
-    PyAudioStream_Cleanup(stream);
+  Py_INCREF(Py_False);
+  return Py_False;
+}
 
-#ifdef VERBOSE
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error number: %d\n", err);
-    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-#endif
+PyObject *PyAudioStream_Wait(PyAudioStream *stream, PyObject *const *args,
+                             Py_ssize_t nargs, PyObject *kwnames) {
+  static const char *const names[] = {"timeout", NULL};
+  PyObject *values[] = {Py_None};
+  double timeout;
+  if (PyAudioStream_UnpackArgs("wait", args, nargs, kwnames, names, 0,
+                               values) < 0 ||
+      PyAudioStreamReader_ParseTimeout(values[0], &timeout) < 0) {
+    return NULL;
+  }
 
+  if (!PyAudioStream_IsOpen(stream)) {
     PyErr_SetObject(PyExc_IOError,
-                    Py_BuildValue("(i,s)", err, Pa_GetErrorText(err)));
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
     return NULL;
   }
 
-  if (is_active) {
-    Py_INCREF(Py_True);
-    return Py_True;
+  double deadline = timeout < 0 ? -1 : PyAudioTime_Now() + timeout;
+  long active = PyAudioAtomic_LoadLong(&stream->context.active);
+  while (active) {
+    // Wake up periodically to check for signals; completion itself wakes the
+    // condition variable.
+    double wait = SIGNAL_CHECK_INTERVAL;
+    if (deadline >= 0) {
+      double remaining = deadline - PyAudioTime_Now();
+      if (remaining <= 0) {
+        break;
+      }
+      if (remaining < wait) {
+        wait = remaining;
+      }
+    }
+
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    PyAudioMutex_Lock(&stream->lock);
+    if (PyAudioAtomic_LoadLong(&stream->context.active)) {
+      PyAudioCond_TimedWait(&stream->cond, &stream->lock,
+                            wait);
+    }
+    active = PyAudioAtomic_LoadLong(&stream->context.active);
+    PyAudioMutex_Unlock(&stream->lock);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+
+    if (active && PyErr_CheckSignals() < 0) {
+      return NULL;
+    }
   }
 
-  Py_INCREF(Py_False);
-  return Py_False;
+  if (active) {
+    Py_INCREF(Py_False);
+    return Py_False;
+  }
+
+  Py_INCREF(Py_True);
+  return Py_True;
+}
+
+PyObject *PyAudio_IsStreamStopped(PyObject *self, PyObject *const *args,
+                                  Py_ssize_t nargs) {
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "is_stream_stopped", args, nargs, 1, 1);
+  if (stream == NULL) {
+    return NULL;
+  }
+  return PyAudioStream_IsStopped(stream, NULL);
+}
+
+PyObject *PyAudio_IsStreamActive(PyObject *self, PyObject *const *args,
+                                 Py_ssize_t nargs) {
+  PyAudioStream *stream =
+      PyAudioStream_CheckArgs(self, "is_stream_active", args, nargs, 1, 1);
+  if (stream == NULL) {
+    return NULL;
+  }
+  return PyAudioStream_IsActive(stream, NULL);
 }
@@ -6,12 +6,25 @@
 #endif
 #include "Python.h"
 
+#include "stream.h"
+
 PyObject *PyAudio_OpenStream(PyObject *self, PyObject *args, PyObject *kwargs);
 PyObject *PyAudio_CloseStream(PyObject *self, PyObject *args);
 PyObject *PyAudio_StartStream(PyObject *self, PyObject *args);
 PyObject *PyAudio_StopStream(PyObject *self, PyObject *args);
 PyObject *PyAudio_AbortStream(PyObject *self, PyObject *args);
-PyObject *PyAudio_IsStreamStopped(PyObject *self, PyObject *args);
-PyObject *PyAudio_IsStreamActive(PyObject *self, PyObject *args);
+PyObject *PyAudio_IsStreamStopped(PyObject *self, PyObject *const *args,
+                                  Py_ssize_t nargs);
+PyObject *PyAudio_IsStreamActive(PyObject *self, PyObject *const *args,
+                                 Py_ssize_t nargs);
+
+// Methods of PyAudioStreamType.
+PyObject *PyAudioStream_Close(PyAudioStream *stream, PyObject *unused);
+PyObject *PyAudioStream_Start(PyAudioStream *stream, PyObject *unused);
+PyObject *PyAudioStream_Stop(PyAudioStream *stream, PyObject *unused);
+PyObject *PyAudioStream_IsStopped(PyAudioStream *stream, PyObject *unused);
+PyObject *PyAudioStream_IsActive(PyAudioStream *stream, PyObject *unused);
+PyObject *PyAudioStream_Wait(PyAudioStream *stream, PyObject *const *args,
+                             Py_ssize_t nargs, PyObject *kwnames);
 
 #endif  // STREAM_LIFECYCLE_H_
@@ -0,0 +1,443 @@
+#include "stream_lookahead.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+#include "pythread.h"
+
+#include "stream.h"
+#include "stream_io.h"
+#include "sync.h"
+
+struct PyAudioLookahead {
+  unsigned long frames_per_buffer;
+  unsigned int frame_size;
+  double sample_rate;
+  // FIFO of capacity frames. Frames from read_pos (advanced by the consumer)
+  // to write_pos (advanced by the producer) are queued (atomic).
+  char *data;
+  uint64_t capacity;
+  volatile uint64_t read_pos;
+  volatile uint64_t write_pos;
+  // Number of buffers the producer keeps queued (atomic), up to max_buffers.
+  volatile long num_buffers;
+  unsigned int max_buffers;
+  // Stream time at which the frame at FIFO position 0 plays, as the bits of a
+  // double (atomic). Estimated when starting, then updated by the consumer.
+  volatile uint64_t dac_origin;
+  // PaStreamCallbackFlags for the next Python callback (atomic).
+  volatile long pending_flags;
+  // Result of the last Python callback (atomic): paContinue, until the
+  // callback completes or aborts.
+  volatile long result;
+  // One buffer of callback output.
+  char *scratch;
+
+  // Lookahead thread. Fields without atomics are only accessed with the GIL.
+  struct PyAudioStream *stream;
+  int started;
+  unsigned long thread_ident;
+  // Set (atomic) to ask the thread to exit.
+  volatile long stop_requested;
+  // Whether the thread is still running (atomic), cleared as it exits.
+  volatile long running;
+  // Whether the thread is waiting for room in the FIFO (atomic). Lets the
+  // consumer skip the wakeup otherwise.
+  volatile long waiting;
+  // Reference count (atomic): one for the stream, one while the thread runs,
+  // and one per PyAudioLookahead_Stop() in progress. The thread outlives the
+  // stream's reference when the callback closes its own stream.
+  volatile long refcount;
+  PyAudioMutex lock;
+  PyAudioCond cond;
+};
+
+static void store_double(volatile uint64_t *value, double new_value) {
+  uint64_t bits;
+  memcpy(&bits, &new_value, sizeof(bits));
+  PyAudioAtomic_StoreU64(value, bits);
+}
+
+static double load_double(volatile uint64_t *value) {
+  uint64_t bits = PyAudioAtomic_LoadU64(value);
+  double result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+PyAudioLookahead *PyAudioLookahead_Create(unsigned long frames_per_buffer,
+                                          unsigned int frame_size,
+                                          double sample_rate,
+                                          unsigned int num_buffers,
+                                          unsigned int max_buffers) {
+  PyAudioLookahead *lookahead =
+      (PyAudioLookahead *)calloc(1, sizeof(PyAudioLookahead));
+  if (!lookahead) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  lookahead->frames_per_buffer = frames_per_buffer;
+  lookahead->frame_size = frame_size;
+  lookahead->sample_rate = sample_rate;
+  lookahead->capacity = (uint64_t)max_buffers * frames_per_buffer;
+  lookahead->num_buffers = (long)num_buffers;
+  lookahead->max_buffers = max_buffers;
+  lookahead->result = paContinue;
+  lookahead->refcount = 1;
+  PyAudioMutex_Init(&lookahead->lock);
+  PyAudioCond_Init(&lookahead->cond);
+
+  lookahead->data = (char *)malloc((size_t)lookahead->capacity * frame_size);
+  lookahead->scratch = (char *)malloc((size_t)frames_per_buffer * frame_size);
+  if (!lookahead->data || !lookahead->scratch) {
+    PyAudioLookahead_Destroy(lookahead);
+    PyErr_NoMemory();
+    return NULL;
+  }
+  return lookahead;
+}
+
+static void incref(PyAudioLookahead *lookahead) {
+  PyAudioAtomic_AddLong(&lookahead->refcount, 1);
+}
+
+// Releases a reference, and frees the lookahead with the last one.
+static void decref(PyAudioLookahead *lookahead) {
+  if (PyAudioAtomic_AddLong(&lookahead->refcount, -1) > 0) {
+    return;
+  }
+  PyAudioCond_Destroy(&lookahead->cond);
+  PyAudioMutex_Destroy(&lookahead->lock);
+  free(lookahead->data);
+  free(lookahead->scratch);
+  free(lookahead);
+}
+
+void PyAudioLookahead_Destroy(PyAudioLookahead *lookahead) {
+  if (lookahead != NULL) {
+    decref(lookahead);
+  }
+}
+
+void PyAudioLookahead_LockMemory(PyAudioLookahead *lookahead,
+                                 PyAudioLockedMemory *memory) {
+  PyAudioLockedMemory_Add(memory, lookahead->data,
+                          (size_t)lookahead->capacity * lookahead->frame_size);
+  PyAudioLockedMemory_Add(
+      memory, lookahead->scratch,
+      (size_t)lookahead->frames_per_buffer * lookahead->frame_size);
+}
+
+// Returns whether the producer has room for another buffer within the
+// current target.
+static int has_room(PyAudioLookahead *lookahead) {
+  uint64_t queued = PyAudioAtomic_LoadU64(&lookahead->write_pos) -
+                    PyAudioAtomic_LoadU64(&lookahead->read_pos);
+  uint64_t target = (uint64_t)PyAudioAtomic_LoadLong(&lookahead->num_buffers) *
+                    lookahead->frames_per_buffer;
+  return queued + lookahead->frames_per_buffer <= target;
+}
+
+static void wake_producer(PyAudioLookahead *lookahead) {
+  // As in the capture ring: either the producer, about to wait, observes the
+  // new state, or we observe it waiting and take the lock it holds until it
+  // sleeps.
+  if (PyAudioAtomic_LoadLong(&lookahead->waiting)) {
+    PyAudioMutex_Lock(&lookahead->lock);
+    PyAudioCond_Broadcast(&lookahead->cond);
+    PyAudioMutex_Unlock(&lookahead->lock);
+  }
+}
+
+// Blocks until there is room for another buffer, or the thread is asked to
+// stop. Returns whether to produce a buffer. Must be called without the GIL.
+static int wait_for_room(PyAudioLookahead *lookahead) {
+  int produce = 0;
+  PyAudioMutex_Lock(&lookahead->lock);
+  PyAudioAtomic_StoreLong(&lookahead->waiting, 1);
+  while (!PyAudioAtomic_LoadLong(&lookahead->stop_requested)) {
+    if (has_room(lookahead)) {
+      produce = 1;
+      break;
+    }
+    PyAudioCond_TimedWait(&lookahead->cond, &lookahead->lock, -1);
+  }
+  PyAudioAtomic_StoreLong(&lookahead->waiting, 0);
+  PyAudioMutex_Unlock(&lookahead->lock);
+  return produce;
+}
+
+// Returns the time info of the next buffer to produce. Calls into PortAudio,
+// so should be called without the GIL.
+static PaStreamCallbackTimeInfo next_time_info(PyAudioLookahead *lookahead) {
+  PaStreamCallbackTimeInfo time_info;
+  time_info.inputBufferAdcTime = 0;
+  time_info.currentTime =
+      lookahead->stream->context.backend->get_time(
+          lookahead->stream->context.stream);
+  time_info.outputBufferDacTime =
+      load_double(&lookahead->dac_origin) +
+      (double)PyAudioAtomic_LoadU64(&lookahead->write_pos) /
+          lookahead->sample_rate;
+  return time_info;
+}
+
+// Runs the Python callback for one buffer, and queues its output. Must be
+// called with the GIL held. Returns the PaStreamCallbackResult.
+static int produce(PyAudioLookahead *lookahead,
+                   const PaStreamCallbackTimeInfo *time_info) {
+  unsigned long frames = lookahead->frames_per_buffer;
+  unsigned int frame_size = lookahead->frame_size;
+  PaStreamCallbackFlags status_flags = (PaStreamCallbackFlags)
+      PyAudioAtomic_ExchangeLong(&lookahead->pending_flags, 0);
+  int result =
+      PyAudioStream_InvokeCallback(lookahead->stream, NULL, lookahead->scratch,
+                                   frames, frames, time_info, status_flags);
+
+  if (result != paAbort) {
+    // Only the producer advances write_pos, and has_room() guarantees the
+    // buffer fits.
+    uint64_t pos = PyAudioAtomic_LoadU64(&lookahead->write_pos);
+    uint64_t index = pos % lookahead->capacity;
+    uint64_t first = lookahead->capacity - index;
+    if (first > frames) {
+      first = frames;
+    }
+    memcpy(lookahead->data + index * frame_size, lookahead->scratch,
+           (size_t)(first * frame_size));
+    memcpy(lookahead->data, lookahead->scratch + first * frame_size,
+           (size_t)((frames - first) * frame_size));
+    PyAudioAtomic_StoreU64(&lookahead->write_pos, pos + frames);
+  }
+  if (result != paContinue) {
+    // Published after the final frames, so the consumer plays them all.
+    PyAudioAtomic_StoreLong(&lookahead->result, result);
+  }
+  return result;
+}
+
+static void lookahead_thread(void *arg) {
+  PyAudioLookahead *lookahead = (PyAudioLookahead *)arg;
+  if (lookahead->stream->context.thread_tuning != NULL) {
+    PyAudioThreadTuning_Apply(lookahead->stream->context.thread_tuning,
+                              PYAUDIO_THREAD_WORKER);
+  }
+  PyThreadState *tstate =
+      PyThreadState_New(lookahead->stream->context.interp);
+
+  while (tstate != NULL && wait_for_room(lookahead)) {
+    PaStreamCallbackTimeInfo time_info = next_time_info(lookahead);
+    PyEval_RestoreThread(tstate);
+    int result = produce(lookahead, &time_info);
+    PyEval_SaveThread();
+    if (result != paContinue) {
+      break;
+    }
+  }
+
+  if (tstate != NULL) {
+    PyEval_RestoreThread(tstate);
+    PyThreadState_Clear(tstate);
+    PyEval_SaveThread();
+    PyThreadState_Delete(tstate);
+  }
+
+  PyAudioMutex_Lock(&lookahead->lock);
+  PyAudioAtomic_StoreLong(&lookahead->running, 0);
+  PyAudioCond_Broadcast(&lookahead->cond);
+  PyAudioMutex_Unlock(&lookahead->lock);
+  decref(lookahead);
+}
+
+int PyAudioLookahead_Start(PyAudioLookahead *lookahead,
+                           struct PyAudioStream *stream) {
+  PyAudioLookahead_Stop(lookahead);
+
+  lookahead->stream = stream;
+  PyAudioAtomic_StoreU64(&lookahead->read_pos, 0);
+  PyAudioAtomic_StoreU64(&lookahead->write_pos, 0);
+  PyAudioAtomic_StoreLong(&lookahead->pending_flags, 0);
+  PyAudioAtomic_StoreLong(&lookahead->result, paContinue);
+  PyAudioAtomic_StoreLong(&lookahead->stop_requested, 0);
+
+  // Until the first device callback, assume the first frame plays once the
+  // device's output latency elapses.
+  const PaStreamInfo *stream_info =
+      stream->context.backend->get_info(stream->context.stream);
+  double now;
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  now = stream->context.backend->get_time(stream->context.stream);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  store_double(&lookahead->dac_origin,
+               now + (stream_info ? stream_info->outputLatency : 0));
+
+  // Prime the FIFO, so the device starts with queued frames.
+  while (has_room(lookahead)) {
+    PaStreamCallbackTimeInfo time_info;
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    time_info = next_time_info(lookahead);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+    if (produce(lookahead, &time_info) != paContinue) {
+      // The stream still plays the primed frames, if any.
+      return 0;
+    }
+  }
+
+  PyAudioAtomic_StoreLong(&lookahead->running, 1);
+  incref(lookahead);
+  lookahead->thread_ident =
+      PyThread_start_new_thread(lookahead_thread, lookahead);
+  if (lookahead->thread_ident == PYTHREAD_INVALID_THREAD_ID) {
+    PyAudioAtomic_StoreLong(&lookahead->running, 0);
+    decref(lookahead);
+    PyErr_SetString(PyExc_RuntimeError, "Cannot start lookahead thread");
+    return -1;
+  }
+  lookahead->started = 1;
+  return 0;
+}
+
+void PyAudioLookahead_Stop(PyAudioLookahead *lookahead) {
+  if (!lookahead->started) {
+    return;
+  }
+
+  PyAudioMutex_Lock(&lookahead->lock);
+  PyAudioAtomic_StoreLong(&lookahead->stop_requested, 1);
+  PyAudioCond_Broadcast(&lookahead->cond);
+  PyAudioMutex_Unlock(&lookahead->lock);
+
+  if (PyThread_get_thread_ident() == lookahead->thread_ident) {
+    // Stopped from the Python callback, on the lookahead thread itself, which
+    // exits once the callback returns. Its own reference keeps the lookahead
+    // alive until then, even if the stream closes and destroys it.
+    return;
+  }
+
+  // Keep the lookahead alive while waiting, in case the callback closes the
+  // stream meanwhile.
+  incref(lookahead);
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  PyAudioMutex_Lock(&lookahead->lock);
+  while (PyAudioAtomic_LoadLong(&lookahead->running)) {
+    PyAudioCond_TimedWait(&lookahead->cond, &lookahead->lock, -1);
+  }
+  PyAudioMutex_Unlock(&lookahead->lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  lookahead->started = 0;
+  decref(lookahead);
+}
+
+int PyAudioLookahead_Pull(PyAudioLookahead *lookahead, void *output,
+                          unsigned long frame_count,
+                          const PaStreamCallbackTimeInfo *time_info,
+                          PaStreamCallbackFlags status_flags) {
+  unsigned int frame_size = lookahead->frame_size;
+  // Load the result before write_pos: once the callback is done, all its
+  // frames are queued.
+  long result = PyAudioAtomic_LoadLong(&lookahead->result);
+  if (result == paAbort) {
+    return paAbort;
+  }
+
+  uint64_t pos = PyAudioAtomic_LoadU64(&lookahead->read_pos);
+  uint64_t available = PyAudioAtomic_LoadU64(&lookahead->write_pos) - pos;
+
+  // Some host APIs do not report the DAC time, so fall back to the current
+  // stream time.
+  double buffer_time = time_info->outputBufferDacTime > 0
+                           ? time_info->outputBufferDacTime
+                           : time_info->currentTime;
+  store_double(&lookahead->dac_origin,
+               buffer_time - (double)pos / lookahead->sample_rate);
+  if (status_flags != 0) {
+    PyAudioAtomic_OrLong(&lookahead->pending_flags, (long)status_flags);
+  }
+
+  uint64_t num_frames = available < frame_count ? available : frame_count;
+  uint64_t index = pos % lookahead->capacity;
+  uint64_t first = lookahead->capacity - index;
+  if (first > num_frames) {
+    first = num_frames;
+  }
+  char *out = (char *)output;
+  memcpy(out, lookahead->data + index * frame_size,
+         (size_t)(first * frame_size));
+  memcpy(out + first * frame_size, lookahead->data,
+         (size_t)((num_frames - first) * frame_size));
+  memset(out + num_frames * frame_size, 0,
+         (size_t)((frame_count - num_frames) * frame_size));
+  PyAudioAtomic_StoreU64(&lookahead->read_pos, pos + num_frames);
+  wake_producer(lookahead);
+
+  if (num_frames == available && result == paComplete) {
+    // Played the callback's last frames.
+    return paComplete;
+  }
+  if (num_frames < frame_count) {
+    PyAudioAtomic_OrLong(&lookahead->pending_flags, paOutputUnderflow);
+  }
+  return paContinue;
+}
+
+PyObject *PyAudioStream_SetLookahead(PyAudioStream *stream,
+                                     PyObject *num_buffers_arg) {
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  PyAudioLookahead *lookahead = stream->context.lookahead;
+  if (lookahead == NULL) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paNullCallback,
+                                  "Stream not opened with lookahead_buffers"));
+    return NULL;
+  }
+
+  long num_buffers = PyLong_AsLong(num_buffers_arg);
+  if (num_buffers == -1 && PyErr_Occurred()) {
+    return NULL;
+  }
+  if (num_buffers < 1 || num_buffers > (long)lookahead->max_buffers) {
+    PyErr_Format(PyExc_ValueError,
+                 "num_buffers must be between 1 and %u (lookahead_max_buffers)",
+                 lookahead->max_buffers);
+    return NULL;
+  }
+
+  PyAudioMutex_Lock(&lookahead->lock);
+  PyAudioAtomic_StoreLong(&lookahead->num_buffers, num_buffers);
+  PyAudioCond_Broadcast(&lookahead->cond);
+  PyAudioMutex_Unlock(&lookahead->lock);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+PyObject *PyAudioStream_GetLookahead(PyAudioStream *stream, PyObject *unused) {
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  PyAudioLookahead *lookahead = stream->context.lookahead;
+  if (lookahead == NULL) {
+    return PyLong_FromLong(0);
+  }
+  return PyLong_FromLong(PyAudioAtomic_LoadLong(&lookahead->num_buffers));
+}
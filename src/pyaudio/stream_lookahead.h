@@ -0,0 +1,71 @@
+// Lookahead mode for callback-mode output streams.
+//
+// A dedicated Python thread runs the stream's callback ahead of the device,
+// keeping up to num_buffers buffers of frames_per_buffer frames queued in a
+// FIFO. The PortAudio callback only copies frames out of the FIFO and never
+// takes the GIL, so Python threads holding the GIL cannot cause underruns, at
+// the cost of num_buffers buffers of extra latency.
+//
+// The time_info passed to the Python callback still describes the buffer
+// being produced: its output_buffer_dac_time is extrapolated from the DAC time
+// of the frames the device consumed last. If the FIFO runs dry, the device
+// plays silence, and the next Python callback sees paOutputUnderflow.
+//
+// The FIFO is single-producer (the lookahead thread, or the thread starting
+// the stream while it primes the FIFO), single-consumer (the PortAudio
+// callback thread).
+
+#ifndef STREAM_LOOKAHEAD_H_
+#define STREAM_LOOKAHEAD_H_
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "thread_tuning.h"
+
+struct PyAudioStream;
+
+typedef struct PyAudioLookahead PyAudioLookahead;
+
+// Allocates a lookahead FIFO with room for max_buffers buffers, initially
+// targeting num_buffers. Returns NULL with an exception set on failure.
+PyAudioLookahead *PyAudioLookahead_Create(unsigned long frames_per_buffer,
+                                          unsigned int frame_size,
+                                          double sample_rate,
+                                          unsigned int num_buffers,
+                                          unsigned int max_buffers);
+// Releases the stream's reference to the FIFO. If the lookahead thread is still
+// running (i.e., the callback closed its own stream), the thread frees it as it
+// exits; otherwise, the thread must be stopped.
+void PyAudioLookahead_Destroy(PyAudioLookahead *lookahead);
+// Locks the FIFO and scratch buffer in memory.
+void PyAudioLookahead_LockMemory(PyAudioLookahead *lookahead,
+                                 PyAudioLockedMemory *memory);
+
+// Empties the FIFO, primes it by running the Python callback on this thread,
+// and starts the lookahead thread. Call before starting the PortAudio stream,
+// with the GIL held. Returns 0, or -1 with an exception set.
+int PyAudioLookahead_Start(PyAudioLookahead *lookahead,
+                           struct PyAudioStream *stream);
+// Stops the lookahead thread, if running, and waits for it to exit. Must be
+// called with the GIL held; releases it while waiting.
+void PyAudioLookahead_Stop(PyAudioLookahead *lookahead);
+
+// Copies frame_count frames from the FIFO into output, padding with silence
+// if it runs dry. Called from the PortAudio callback, without the GIL. Returns
+// the PaStreamCallbackResult.
+int PyAudioLookahead_Pull(PyAudioLookahead *lookahead, void *output,
+                          unsigned long frame_count,
+                          const PaStreamCallbackTimeInfo *time_info,
+                          PaStreamCallbackFlags status_flags);
+
+// Methods of PyAudioStreamType.
+PyObject *PyAudioStream_SetLookahead(struct PyAudioStream *stream,
+                                     PyObject *num_buffers_arg);
+PyObject *PyAudioStream_GetLookahead(struct PyAudioStream *stream,
+                                     PyObject *unused);
+
+#endif  // STREAM_LOOKAHEAD_H_
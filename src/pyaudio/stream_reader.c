@@ -0,0 +1,330 @@
+#include "stream_reader.h"
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "module_state.h"
+#include "ring_buffer.h"
+#include "stream.h"
+#include "sync.h"
+
+// Maximum time to wait without the GIL before checking for signals (e.g.,
+// KeyboardInterrupt), in seconds.
+#define SIGNAL_CHECK_INTERVAL 0.1
+
+static void dealloc(PyAudioStreamReader *self) {
+  PyAudioMutex_Destroy(&self->lock);
+  PyAudioRing_Decref(self->ring);
+  self->ring = NULL;
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+// Returns the number of frames the reader can read without waiting, counting
+// an overrun if it fell behind.
+static uint64_t available(PyAudioStreamReader *self) {
+  uint64_t dropped = 0;
+  PyAudioMutex_Lock(&self->lock);
+  uint64_t frames = PyAudioRing_Available(self->ring, &self->cursor, &dropped);
+  if (dropped > 0) {
+    self->overruns++;
+    self->frames_dropped += dropped;
+  }
+  PyAudioMutex_Unlock(&self->lock);
+  return frames;
+}
+
+// Reads exactly num_frames frames into buffer, unless the timeout (in seconds;
+// negative waits indefinitely) expires or the stream closes first. Stores the
+// number of frames read in *frames_read. Returns 0 on success, or -1 with an
+// exception set.
+static int read_frames(PyAudioStreamReader *self, char *buffer,
+                       uint64_t num_frames, double timeout,
+                       uint64_t *frames_read) {
+  PyAudioRing *ring = self->ring;
+  uint64_t total = 0;
+  // The ring wakes us up before it fills, possibly several times per read.
+  double deadline = PyAudioTime_Now() + timeout;
+
+  while (1) {
+    uint64_t dropped = 0;
+    PyAudioMutex_Lock(&self->lock);
+    total += PyAudioRing_Read(ring, &self->cursor,
+                              buffer + total * ring->frame_size,
+                              num_frames - total, &dropped);
+    if (dropped > 0) {
+      self->overruns++;
+      self->frames_dropped += dropped;
+    }
+    uint64_t cursor = self->cursor;
+    PyAudioMutex_Unlock(&self->lock);
+    if (total == num_frames) {
+      break;
+    }
+
+    double wait = SIGNAL_CHECK_INTERVAL;
+    if (timeout >= 0) {
+      double remaining = deadline - PyAudioTime_Now();
+      if (remaining < wait) {
+        wait = remaining > 0 ? remaining : 0;
+      }
+    }
+
+    int result;
+    // clang-format off
+    Py_BEGIN_ALLOW_THREADS
+    result = PyAudioRing_Wait(ring, cursor, num_frames - total, wait);
+    Py_END_ALLOW_THREADS
+    // clang-format on
+
+    if (result == -2 && available(self) == 0) {
+      if (total > 0) {
+        break;
+      }
+      PyErr_SetObject(PyExc_IOError,
+                      Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+      return -1;
+    }
+
+    if (PyErr_CheckSignals() < 0) {
+      return -1;
+    }
+
+    if (result == -1 && timeout >= 0 && PyAudioTime_Now() >= deadline) {
+      break;
+    }
+  }
+
+  *frames_read = total;
+  return 0;
+}
+
+int PyAudioStreamReader_ParseTimeout(PyObject *timeout_arg, double *timeout) {
+  *timeout = -1;
+  if (timeout_arg == NULL || timeout_arg == Py_None) {
+    return 0;
+  }
+  *timeout = PyFloat_AsDouble(timeout_arg);
+  if (*timeout == -1 && PyErr_Occurred()) {
+    return -1;
+  }
+  if (*timeout < 0) {
+    PyErr_SetString(PyExc_ValueError, "timeout must be non-negative");
+    return -1;
+  }
+  return 0;
+}
+
+static PyObject *read_frames_to_bytes(PyAudioStreamReader *self,
+                                      PyObject *args, PyObject *kwargs) {
+  int num_frames;
+  PyObject *timeout_arg = NULL;
+  double timeout;
+
+  static char *kwlist[] = {"num_frames", "timeout", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|O", kwlist, &num_frames,
+                                   &timeout_arg)) {
+    return NULL;
+  }
+
+  if (num_frames < 0) {
+    PyErr_SetString(PyExc_ValueError, "Invalid number of frames");
+    return NULL;
+  }
+
+  if (PyAudioStreamReader_ParseTimeout(timeout_arg, &timeout) < 0) {
+    return NULL;
+  }
+
+  PyObject *rv = PyBytes_FromStringAndSize(
+      NULL, (Py_ssize_t)num_frames * self->ring->frame_size);
+  if (rv == NULL) {
+    return NULL;
+  }
+
+  uint64_t frames_read;
+  if (read_frames(self, PyBytes_AS_STRING(rv), (uint64_t)num_frames, timeout,
+                  &frames_read) < 0) {
+    Py_DECREF(rv);
+    return NULL;
+  }
+
+  if (frames_read < (uint64_t)num_frames) {
+    if (_PyBytes_Resize(&rv, (Py_ssize_t)(frames_read *
+                                          self->ring->frame_size)) < 0) {
+      return NULL;
+    }
+  }
+  return rv;
+}
+
+static PyObject *read_into(PyAudioStreamReader *self, PyObject *args,
+                           PyObject *kwargs) {
+  Py_buffer buffer;
+  PyObject *timeout_arg = NULL;
+  double timeout;
+
+  static char *kwlist[] = {"buffer", "timeout", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "w*|O", kwlist, &buffer,
+                                   &timeout_arg)) {
+    return NULL;
+  }
+
+  if (PyAudioStreamReader_ParseTimeout(timeout_arg, &timeout) < 0) {
+    PyBuffer_Release(&buffer);
+    return NULL;
+  }
+
+  uint64_t frames_read;
+  uint64_t num_frames = (uint64_t)buffer.len / self->ring->frame_size;
+  int result =
+      read_frames(self, (char *)buffer.buf, num_frames, timeout, &frames_read);
+  PyBuffer_Release(&buffer);
+  if (result < 0) {
+    return NULL;
+  }
+
+  return PyLong_FromUnsignedLongLong(frames_read);
+}
+
+static PyObject *get_read_available(PyAudioStreamReader *self,
+                                    PyObject *args) {
+  return PyLong_FromUnsignedLongLong(available(self));
+}
+
+static PyObject *get_overruns(PyAudioStreamReader *self, void *closure) {
+  PyAudioMutex_Lock(&self->lock);
+  unsigned long overruns = self->overruns;
+  PyAudioMutex_Unlock(&self->lock);
+  return PyLong_FromUnsignedLong(overruns);
+}
+
+static PyObject *get_frames_dropped(PyAudioStreamReader *self,
+                                    void *closure) {
+  PyAudioMutex_Lock(&self->lock);
+  uint64_t frames_dropped = self->frames_dropped;
+  PyAudioMutex_Unlock(&self->lock);
+  return PyLong_FromUnsignedLongLong(frames_dropped);
+}
+
+static int antiset(PyAudioStreamReader *self, PyObject *value,
+                   void *closure) {
+  /* read-only: do not allow users to change values */
+  PyErr_SetString(PyExc_AttributeError,
+                  "Fields read-only: cannot modify values");
+  return -1;
+}
+
+static PyMethodDef methods[] = {
+    {"read", (PyCFunction)read_frames_to_bytes, METH_VARARGS | METH_KEYWORDS,
+     "Reads frames, waiting until they are available"},
+
+    {"read_into", (PyCFunction)read_into, METH_VARARGS | METH_KEYWORDS,
+     "Reads frames into a writable buffer"},
+
+    {"get_read_available", (PyCFunction)get_read_available, METH_NOARGS,
+     "Returns the number of frames that can be read without waiting"},
+
+    {NULL, NULL, 0, NULL}};
+
+static PyGetSetDef get_setters[] = {
+    {"overruns", (getter)get_overruns, (setter)antiset,
+     "number of times this reader fell behind", NULL},
+
+    {"frames_dropped", (getter)get_frames_dropped, (setter)antiset,
+     "number of frames lost to overruns", NULL},
+
+    {NULL}};
+
+// Readers are only created by open_reader().
+static PyObject *new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+  PyErr_Format(PyExc_TypeError, "cannot create '%.100s' instances",
+               type->tp_name);
+  return NULL;
+}
+
+static PyType_Slot slots[] = {
+    {Py_tp_dealloc, dealloc},
+    {Py_tp_doc, (void *)PyDoc_STR("Independent reader of an input stream")},
+    {Py_tp_methods, methods},
+    {Py_tp_getset, get_setters},
+    {Py_tp_new, new},
+    {0, NULL}};
+
+PyType_Spec PyAudioStreamReaderSpec = {
+    .name = "_portaudio.StreamReader",
+    .basicsize = sizeof(PyAudioStreamReader),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = slots,
+};
+
+// Opens a reader over the ring of the stream in args, selected by
+// get_ring(), which returns NULL with an exception set if it has none.
+static PyObject *open_reader(PyObject *self, PyObject *args,
+                             PyAudioRing *(*get_ring)(PyAudioStream *)) {
+  PyAudioModuleState *state = PyAudio_GetModuleState(self);
+  PyObject *stream_arg;
+  if (!PyArg_ParseTuple(args, "O!", state->stream_type, &stream_arg)) {
+    return NULL;
+  }
+
+  PyAudioStream *stream = (PyAudioStream *)stream_arg;
+  if (!PyAudioStream_IsOpen(stream)) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+
+  PyAudioRing *ring = get_ring(stream);
+  if (ring == NULL) {
+    return NULL;
+  }
+
+  PyAudioStreamReader *reader = (PyAudioStreamReader *)PyObject_New(
+      PyAudioStreamReader, state->stream_reader_type);
+  if (!reader) {
+    return NULL;
+  }
+
+  PyAudioRing_Incref(ring);
+  reader->ring = ring;
+  // Readers only see frames written after they open.
+  reader->cursor = PyAudioAtomic_LoadU64(&ring->write_pos);
+  reader->overruns = 0;
+  reader->frames_dropped = 0;
+  PyAudioMutex_Init(&reader->lock);
+  return (PyObject *)reader;
+}
+
+static PyAudioRing *get_capture_ring(PyAudioStream *stream) {
+  if (stream->context.capture_ring == NULL) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paInvalidFlag,
+                                  "Stream has no capture ring "
+                                  "(see capture_ring_frames)"));
+  }
+  return stream->context.capture_ring;
+}
+
+static PyAudioRing *get_result_ring(PyAudioStream *stream) {
+  if (stream->context.result_ring == NULL) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paInvalidFlag,
+                                  "Stream has no result ring "
+                                  "(see result_ring_frames)"));
+  }
+  return stream->context.result_ring;
+}
+
+PyObject *PyAudio_OpenStreamReader(PyObject *self, PyObject *args) {
+  return open_reader(self, args, get_capture_ring);
+}
+
+PyObject *PyAudio_OpenResultReader(PyObject *self, PyObject *args) {
+  return open_reader(self, args, get_result_ring);
+}
@@ -0,0 +1,46 @@
+// Independent readers over an input stream's capture ring, or the result ring
+// of a stream with an isolated callback.
+
+#ifndef STREAM_READER_H_
+#define STREAM_READER_H_
+
+#include <stdint.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+
+#include "ring_buffer.h"
+#include "sync.h"
+
+typedef struct {
+  // clang-format off
+  PyObject_HEAD
+  // clang-format on
+  // Capture (or result) ring, shared with the stream and other readers.
+  PyAudioRing *ring;
+  // Position of the next frame to read.
+  uint64_t cursor;
+  // Number of times this reader fell behind the writer.
+  unsigned long overruns;
+  // Total number of frames this reader lost due to overruns.
+  uint64_t frames_dropped;
+  // Guards cursor, overruns and frames_dropped, for threads sharing the
+  // reader. Never held while waiting for frames.
+  PyAudioMutex lock;
+} PyAudioStreamReader;
+
+extern PyType_Spec PyAudioStreamReaderSpec;
+
+// Parses an optional timeout argument, in seconds, for reader methods. None
+// (or NULL) yields -1, i.e., wait indefinitely. Returns 0 on success, or -1
+// with an exception set.
+int PyAudioStreamReader_ParseTimeout(PyObject *timeout_arg, double *timeout);
+
+// Exported functions.
+
+PyObject *PyAudio_OpenStreamReader(PyObject *self, PyObject *args);
+PyObject *PyAudio_OpenResultReader(PyObject *self, PyObject *args);
+
+#endif  // STREAM_READER_H_
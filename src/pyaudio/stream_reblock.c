@@ -0,0 +1,204 @@
+#include "stream_reblock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "stream.h"
+#include "stream_io.h"
+
+PyAudioReblock *PyAudioReblock_Create(unsigned long block_size,
+                                      unsigned long hop_size,
+                                      unsigned int frame_size,
+                                      double sample_rate, int input,
+                                      int output) {
+  PyAudioReblock *reblock = (PyAudioReblock *)calloc(1, sizeof(PyAudioReblock));
+  if (!reblock) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  reblock->block_size = block_size;
+  reblock->hop_size = hop_size;
+  reblock->frame_size = frame_size;
+  reblock->sample_rate = sample_rate;
+
+  if (input) {
+    reblock->in_window = (char *)malloc((size_t)block_size * frame_size);
+    if (!reblock->in_window) {
+      goto error;
+    }
+  }
+
+  if (output) {
+    // The FIFO never holds more than the initial silence, or one hop.
+    reblock->out_capacity = block_size + hop_size;
+    reblock->out_fifo =
+        (char *)calloc((size_t)reblock->out_capacity, frame_size);
+    reblock->hop_out = (char *)malloc((size_t)hop_size * frame_size);
+    if (!reblock->out_fifo || !reblock->hop_out) {
+      goto error;
+    }
+    if (input) {
+      reblock->out_len = block_size;
+    }
+  }
+  return reblock;
+
+error:
+  PyAudioReblock_Destroy(reblock);
+  PyErr_NoMemory();
+  return NULL;
+}
+
+void PyAudioReblock_Destroy(PyAudioReblock *reblock) {
+  if (reblock == NULL) {
+    return;
+  }
+  free(reblock->in_window);
+  free(reblock->out_fifo);
+  free(reblock->hop_out);
+  free(reblock);
+}
+
+double PyAudioReblock_Latency(PyAudioReblock *reblock) {
+  unsigned long frames;
+  if (reblock->in_window && reblock->out_fifo) {
+    // Initial silence in the output FIFO.
+    frames = reblock->block_size;
+  } else {
+    // A frame waits up to one hop for the next block to complete (input), or
+    // behind the rest of the previous hop (output).
+    frames = reblock->hop_size - 1;
+  }
+  return (double)frames / reblock->sample_rate;
+}
+
+// Moves num_frames frames from the output FIFO to dst, padding with silence if
+// the FIFO runs short.
+static void pop_output(PyAudioReblock *reblock, char *dst,
+                       unsigned long num_frames) {
+  unsigned int frame_size = reblock->frame_size;
+  unsigned long available =
+      reblock->out_len < num_frames ? reblock->out_len : num_frames;
+  unsigned long first = reblock->out_capacity - reblock->out_head;
+  if (first > available) {
+    first = available;
+  }
+  memcpy(dst, reblock->out_fifo + (size_t)reblock->out_head * frame_size,
+         (size_t)first * frame_size);
+  memcpy(dst + (size_t)first * frame_size, reblock->out_fifo,
+         (size_t)(available - first) * frame_size);
+  memset(dst + (size_t)available * frame_size, 0,
+         (size_t)(num_frames - available) * frame_size);
+  reblock->out_head = (reblock->out_head + available) % reblock->out_capacity;
+  reblock->out_len -= available;
+}
+
+static void push_output(PyAudioReblock *reblock, const char *src,
+                        unsigned long num_frames) {
+  unsigned int frame_size = reblock->frame_size;
+  unsigned long tail =
+      (reblock->out_head + reblock->out_len) % reblock->out_capacity;
+  unsigned long first = reblock->out_capacity - tail;
+  if (first > num_frames) {
+    first = num_frames;
+  }
+  memcpy(reblock->out_fifo + (size_t)tail * frame_size, src,
+         (size_t)first * frame_size);
+  memcpy(reblock->out_fifo, src + (size_t)first * frame_size,
+         (size_t)(num_frames - first) * frame_size);
+  reblock->out_len += num_frames;
+}
+
+// Runs the Python callback on one block. position is the host buffer frame at
+// which the block completes.
+static int run_block(PyAudioReblock *reblock, PyAudioStream *stream,
+                     unsigned long position,
+                     const PaStreamCallbackTimeInfo *time_info,
+                     PaStreamCallbackFlags status_flags) {
+  // The block's input ends just before position; its output plays after the
+  // frames already queued in the output FIFO.
+  PaStreamCallbackTimeInfo block_time = *time_info;
+  block_time.inputBufferAdcTime +=
+      ((double)position - (double)reblock->block_size) / reblock->sample_rate;
+  block_time.outputBufferDacTime +=
+      (double)(position + reblock->out_len) / reblock->sample_rate;
+
+  int result = PyAudioStream_InvokeCallback(
+      stream, reblock->in_window, reblock->out_fifo ? reblock->hop_out : NULL,
+      reblock->in_window ? reblock->block_size : reblock->hop_size,
+      reblock->hop_size, &block_time, status_flags);
+
+  if (reblock->out_fifo) {
+    push_output(reblock, reblock->hop_out, reblock->hop_size);
+  }
+  if (reblock->in_window) {
+    unsigned long keep = reblock->block_size - reblock->hop_size;
+    memmove(
+        reblock->in_window,
+        reblock->in_window + (size_t)reblock->hop_size * reblock->frame_size,
+        (size_t)keep * reblock->frame_size);
+    reblock->in_len = keep;
+  }
+  return result;
+}
+
+int PyAudioReblock_Process(PyAudioReblock *reblock,
+                           struct PyAudioStream *stream, const void *input,
+                           void *output, unsigned long frame_count,
+                           const PaStreamCallbackTimeInfo *time_info,
+                           PaStreamCallbackFlags status_flags) {
+  unsigned int frame_size = reblock->frame_size;
+  const char *in = (const char *)input;
+  char *out = (char *)output;
+  // Once the callback completes, drain the output already produced and stop
+  // calling it.
+  int result = paContinue;
+  unsigned long position = 0;
+
+  while (position < frame_count) {
+    unsigned long num_frames = frame_count - position;
+    if (in != NULL && result != paContinue) {
+      // Discard input once the callback completed.
+    } else if (in != NULL) {
+      unsigned long room = reblock->block_size - reblock->in_len;
+      if (num_frames > room) {
+        num_frames = room;
+      }
+    } else if (reblock->out_len == 0 && result == paContinue) {
+      // Output-only: produce a hop whenever the FIFO runs dry.
+      result = run_block(reblock, stream, position, time_info, status_flags);
+      if (result == paAbort) {
+        return paAbort;
+      }
+      continue;
+    } else if (reblock->out_len > 0 && num_frames > reblock->out_len) {
+      num_frames = reblock->out_len;
+    }
+
+    if (out != NULL) {
+      pop_output(reblock, out + (size_t)position * frame_size, num_frames);
+    }
+    if (in != NULL && result == paContinue) {
+      memcpy(reblock->in_window + (size_t)reblock->in_len * frame_size,
+             in + (size_t)position * frame_size,
+             (size_t)num_frames * frame_size);
+      reblock->in_len += num_frames;
+    }
+    position += num_frames;
+
+    if (in != NULL && reblock->in_len == reblock->block_size &&
+        result == paContinue) {
+      result = run_block(reblock, stream, position, time_info, status_flags);
+      if (result == paAbort) {
+        return paAbort;
+      }
+    }
+  }
+  return result;
+}
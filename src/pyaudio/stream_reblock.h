@@ -0,0 +1,65 @@
+// Reblocking of callback-mode streams into fixed-size blocks.
+//
+// Lets the host run at its preferred (possibly variable) buffer size, while the
+// Python callback always sees exactly block_size input frames, advancing by
+// hop_size frames per call (hop_size < block_size overlaps consecutive
+// blocks). Each call produces hop_size output frames.
+//
+// Input frames are collected into a block_size window; output frames are
+// queued in a FIFO that the host buffers drain. For duplex streams, the output
+// FIFO starts with block_size frames of silence, so it never runs dry however
+// the host sizes its buffers.
+
+#ifndef STREAM_REBLOCK_H_
+#define STREAM_REBLOCK_H_
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+struct PyAudioStream;
+
+typedef struct {
+  unsigned long block_size;
+  unsigned long hop_size;
+  unsigned int frame_size;
+  double sample_rate;
+  // Input window, holding in_len of block_size frames. NULL for output-only
+  // streams.
+  char *in_window;
+  unsigned long in_len;
+  // Output FIFO, a ring of out_capacity frames holding out_len frames from
+  // out_head. NULL for input-only streams.
+  char *out_fifo;
+  unsigned long out_capacity;
+  unsigned long out_head;
+  unsigned long out_len;
+  // Scratch space for one hop of callback output.
+  char *hop_out;
+} PyAudioReblock;
+
+// Allocates a reblocker for a stream with the given directions. Returns NULL
+// with an exception set on failure.
+PyAudioReblock *PyAudioReblock_Create(unsigned long block_size,
+                                      unsigned long hop_size,
+                                      unsigned int frame_size,
+                                      double sample_rate, int input,
+                                      int output);
+void PyAudioReblock_Destroy(PyAudioReblock *reblock);
+
+// Returns the worst-case latency the reblocker adds, in seconds.
+double PyAudioReblock_Latency(PyAudioReblock *reblock);
+
+// Feeds one host buffer through the reblocker, calling the stream's Python
+// callback for every complete block. Must be called with the GIL held. Returns
+// the PaStreamCallbackResult.
+int PyAudioReblock_Process(PyAudioReblock *reblock,
+                           struct PyAudioStream *stream,
+                           const void *input, void *output,
+                           unsigned long frame_count,
+                           const PaStreamCallbackTimeInfo *time_info,
+                           PaStreamCallbackFlags status_flags);
+
+#endif  // STREAM_REBLOCK_H_
@@ -0,0 +1,237 @@
+#include "stream_schedule.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "module_state.h"
+#include "stream.h"
+#include "sync.h"
+
+static void free_clips(PyAudioScheduledClip *clip) {
+  while (clip != NULL) {
+    PyAudioScheduledClip *next = clip->next;
+    free(clip->data);
+    free(clip);
+    clip = next;
+  }
+}
+
+PyAudioSchedule *PyAudioSchedule_Create(void) {
+  PyAudioSchedule *schedule =
+      (PyAudioSchedule *)calloc(1, sizeof(PyAudioSchedule));
+  if (!schedule) {
+    return NULL;
+  }
+  PyAudioMutex_Init(&schedule->lock);
+  schedule->next_id = 1;
+  return schedule;
+}
+
+void PyAudioSchedule_Destroy(PyAudioSchedule *schedule) {
+  if (schedule == NULL) {
+    return;
+  }
+  free_clips(schedule->pending);
+  free_clips(schedule->done);
+  PyAudioMutex_Destroy(&schedule->lock);
+  free(schedule);
+}
+
+void PyAudioSchedule_Splice(PyAudioSchedule *schedule, char *output,
+                            unsigned long frame_count, unsigned int frame_size,
+                            double buffer_time, double sample_rate) {
+  size_t buffer_bytes = (size_t)frame_count * frame_size;
+
+  PyAudioMutex_Lock(&schedule->lock);
+  PyAudioScheduledClip **link = &schedule->pending;
+  while (*link != NULL) {
+    PyAudioScheduledClip *clip = *link;
+    size_t start_byte = 0;
+
+    if (clip->start_time < 0) {
+      // Not yet started: locate the frame within this buffer that
+      // corresponds to the requested stream time. Clips scheduled in the past
+      // start immediately, at the beginning of this buffer.
+      double offset = floor((clip->at_time - buffer_time) * sample_rate + 0.5);
+      if (offset >= (double)frame_count) {
+        link = &clip->next;
+        continue;
+      }
+      unsigned long start_frame = offset > 0 ? (unsigned long)offset : 0;
+      clip->start_time = buffer_time + start_frame / sample_rate;
+      start_byte = (size_t)start_frame * frame_size;
+    }
+
+    size_t remaining = clip->num_bytes - clip->offset;
+    size_t available = buffer_bytes - start_byte;
+    size_t bytes_to_copy = remaining < available ? remaining : available;
+    memcpy(output + start_byte, clip->data + clip->offset, bytes_to_copy);
+    clip->offset += bytes_to_copy;
+
+    if (clip->offset < clip->num_bytes) {
+      link = &clip->next;
+      continue;
+    }
+
+    // Finished: release the samples and move the clip to the done list.
+    free(clip->data);
+    clip->data = NULL;
+    *link = clip->next;
+    clip->next = schedule->done;
+    schedule->done = clip;
+    schedule->num_done++;
+  }
+  PyAudioMutex_Unlock(&schedule->lock);
+}
+
+// Schedules a clip on an open stream.
+static PyObject *schedule_clip(PyAudioStream *stream, const char *data,
+                               Py_ssize_t total_size, double at_time) {
+  if (stream->context.schedule == NULL) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paNullCallback,
+                                  "Scheduling requires an output stream in "
+                                  "callback mode"));
+    return NULL;
+  }
+
+  if (total_size == 0 || total_size % stream->context.frame_size != 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Scheduled data must contain a whole number of frames");
+    return NULL;
+  }
+
+  PyAudioScheduledClip *clip =
+      (PyAudioScheduledClip *)calloc(1, sizeof(PyAudioScheduledClip));
+  char *clip_data = (char *)malloc(total_size);
+  if (!clip || !clip_data) {
+    free(clip);
+    free(clip_data);
+    PyErr_SetObject(PyExc_IOError, Py_BuildValue("(i,s)", paInsufficientMemory,
+                                                 "Out of memory"));
+    return NULL;
+  }
+  memcpy(clip_data, data, total_size);
+  clip->at_time = at_time;
+  clip->start_time = -1;
+  clip->data = clip_data;
+  clip->num_bytes = (size_t)total_size;
+
+  // Append, so that clips scheduled for the same time keep their order.
+  PyAudioSchedule *schedule = stream->context.schedule;
+  PyAudioMutex_Lock(&schedule->lock);
+  clip->id = schedule->next_id++;
+  PyAudioScheduledClip **link = &schedule->pending;
+  while (*link != NULL) {
+    link = &(*link)->next;
+  }
+  *link = clip;
+  long clip_id = clip->id;
+
+  // Forget the oldest finished clips, so that the done list (walked by
+  // queries) stays bounded. They are freed here rather than by the callback.
+  PyAudioScheduledClip *forgotten = NULL;
+  if (schedule->num_done > PYAUDIO_SCHEDULE_MAX_DONE) {
+    link = &schedule->done;
+    for (size_t i = 0; i < PYAUDIO_SCHEDULE_MAX_DONE; i++) {
+      link = &(*link)->next;
+    }
+    forgotten = *link;
+    *link = NULL;
+    schedule->num_done = PYAUDIO_SCHEDULE_MAX_DONE;
+  }
+  PyAudioMutex_Unlock(&schedule->lock);
+  free_clips(forgotten);
+
+  return PyLong_FromLong(clip_id);
+}
+
+PyObject *PyAudio_ScheduleStream(PyObject *self, PyObject *args) {
+  const char *data;
+  Py_ssize_t total_size;
+  double at_time;
+
+  PyObject *stream_arg;
+  // clang-format off
+  if (!PyArg_ParseTuple(args, "O!y#d",
+                        PyAudio_GetModuleState(self)->stream_type,
+                        &stream_arg,
+                        &data,
+                        &total_size,
+                        &at_time)) {
+    return NULL;
+  }
+  // clang-format on
+
+  // Keeps another thread from closing the stream, and destroying the
+  // schedule, while in use.
+  PyAudioStream *stream = (PyAudioStream *)stream_arg;
+  if (PyAudioStream_BeginIO(stream) != paNoError) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+  PyObject *rv = schedule_clip(stream, data, total_size, at_time);
+  PyAudioStream_EndIO(stream);
+  return rv;
+}
+
+// Returns the start time of a clip scheduled on an open stream.
+static PyObject *get_start_time(PyAudioStream *stream, long clip_id) {
+  PyAudioSchedule *schedule = stream->context.schedule;
+  int found = 0;
+  double start_time = -1;
+  if (schedule != NULL) {
+    PyAudioMutex_Lock(&schedule->lock);
+    PyAudioScheduledClip *lists[] = {schedule->pending, schedule->done};
+    for (int i = 0; i < 2 && !found; ++i) {
+      for (PyAudioScheduledClip *clip = lists[i]; clip; clip = clip->next) {
+        if (clip->id == clip_id) {
+          found = 1;
+          start_time = clip->start_time;
+          break;
+        }
+      }
+    }
+    PyAudioMutex_Unlock(&schedule->lock);
+  }
+
+  if (!found) {
+    PyErr_SetString(PyExc_KeyError, "Unknown scheduled clip");
+    return NULL;
+  }
+
+  if (start_time < 0) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  return PyFloat_FromDouble(start_time);
+}
+
+PyObject *PyAudio_GetScheduledStartTime(PyObject *self, PyObject *args) {
+  long clip_id;
+
+  PyObject *stream_arg;
+  if (!PyArg_ParseTuple(args, "O!l", PyAudio_GetModuleState(self)->stream_type,
+                        &stream_arg, &clip_id)) {
+    return NULL;
+  }
+
+  PyAudioStream *stream = (PyAudioStream *)stream_arg;
+  if (PyAudioStream_BeginIO(stream) != paNoError) {
+    PyErr_SetObject(PyExc_IOError,
+                    Py_BuildValue("(i,s)", paBadStreamPtr, "Stream closed"));
+    return NULL;
+  }
+  PyObject *rv = get_start_time(stream, clip_id);
+  PyAudioStream_EndIO(stream);
+  return rv;
+}
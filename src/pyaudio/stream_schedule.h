@@ -0,0 +1,65 @@
+// Sample-accurate scheduled playback for callback-mode output streams.
+//
+// Scheduled clips live on a C-side timeline keyed by stream time. Each
+// period, the stream callback splices pending clips into the output buffer at
+// the exact frame that corresponds to the clip's requested stream time, using
+// PortAudio's outputBufferDacTime as the reference.
+
+#ifndef STREAM_SCHEDULE_H_
+#define STREAM_SCHEDULE_H_
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "sync.h"
+
+// Number of finished clips whose start times are remembered.
+#define PYAUDIO_SCHEDULE_MAX_DONE 1024
+
+typedef struct PyAudioScheduledClip {
+  long id;
+  // Requested stream time for the first frame.
+  double at_time;
+  // Actual stream (DAC) time of the first frame, or -1 if not yet started.
+  double start_time;
+  // Clip samples. Released (NULL) once the clip has been fully played.
+  char *data;
+  size_t num_bytes;
+  // Number of bytes already spliced into the output.
+  size_t offset;
+  struct PyAudioScheduledClip *next;
+} PyAudioScheduledClip;
+
+typedef struct {
+  // Protects the lists below. Held only for short, bounded list operations.
+  PyAudioMutex lock;
+  // Clips that have not finished playing, in scheduling order.
+  PyAudioScheduledClip *pending;
+  // Clips that have finished playing, most recent first, retained to report
+  // start times. Trimmed to PYAUDIO_SCHEDULE_MAX_DONE clips as clips are
+  // scheduled.
+  PyAudioScheduledClip *done;
+  size_t num_done;
+  long next_id;
+} PyAudioSchedule;
+
+// Allocates an empty schedule. Returns NULL if memory allocation fails.
+PyAudioSchedule *PyAudioSchedule_Create(void);
+// Releases the schedule and all of its clips.
+void PyAudioSchedule_Destroy(PyAudioSchedule *schedule);
+// Splices pending clips into the output buffer, which holds frame_count
+// frames whose first frame plays at stream time buffer_time. Does not require
+// the GIL.
+void PyAudioSchedule_Splice(PyAudioSchedule *schedule, char *output,
+                            unsigned long frame_count, unsigned int frame_size,
+                            double buffer_time, double sample_rate);
+
+// Exported functions.
+
+PyObject *PyAudio_ScheduleStream(PyObject *self, PyObject *args);
+PyObject *PyAudio_GetScheduledStartTime(PyObject *self, PyObject *args);
+
+#endif  // STREAM_SCHEDULE_H_
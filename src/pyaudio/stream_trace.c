@@ -0,0 +1,255 @@
+#include "stream_trace.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+#include "pythread.h"
+
+#include "sync.h"
+
+// The ring holds at least this many bytes, and two seconds of input when
+// recording input.
+#define MIN_RING_BYTES (1 << 20)
+#define RING_SECONDS 2
+// How often the writer thread drains the ring, in seconds. The PortAudio
+// callback does not signal it, to stay free of locks.
+#define WRITER_INTERVAL 0.02
+
+struct PyAudioTrace {
+  FILE *file;
+  unsigned int frame_size;
+  int input;
+
+  // Byte ring of whole records, written by the PortAudio callback and read
+  // by the writer thread.
+  char *ring;
+  uint64_t capacity;
+  // Total bytes written to and read from the ring (atomic).
+  volatile uint64_t write_pos;
+  volatile uint64_t read_pos;
+  // Records dropped since the last recorded one. Only the PortAudio callback
+  // uses it.
+  uint32_t pending_dropped;
+  // Total records dropped (atomic).
+  volatile uint64_t dropped;
+
+  PyAudioMutex lock;
+  PyAudioCond cond;
+  // Guarded by lock.
+  int stop_requested;
+  int thread_running;
+};
+
+// Copies size bytes of data, or zeros if data is NULL, into the ring at pos.
+static void ring_put(PyAudioTrace *trace, uint64_t pos, const void *data,
+                     size_t size) {
+  size_t offset = (size_t)(pos % trace->capacity);
+  size_t first = (size_t)trace->capacity - offset;
+  if (first > size) {
+    first = size;
+  }
+  if (data == NULL) {
+    memset(trace->ring + offset, 0, first);
+    memset(trace->ring, 0, size - first);
+    return;
+  }
+  memcpy(trace->ring + offset, data, first);
+  memcpy(trace->ring, (const char *)data + first, size - first);
+}
+
+// Writes the records in the ring to the file. Returns whether there were any.
+static int drain(PyAudioTrace *trace) {
+  uint64_t read_pos = trace->read_pos;
+  uint64_t write_pos = PyAudioAtomic_LoadU64(&trace->write_pos);
+  if (write_pos == read_pos) {
+    return 0;
+  }
+  size_t offset = (size_t)(read_pos % trace->capacity);
+  size_t size = (size_t)(write_pos - read_pos);
+  size_t first = (size_t)trace->capacity - offset;
+  if (first > size) {
+    first = size;
+  }
+  fwrite(trace->ring + offset, 1, first, trace->file);
+  fwrite(trace->ring, 1, size - first, trace->file);
+  PyAudioAtomic_StoreU64(&trace->read_pos, write_pos);
+  return 1;
+}
+
+static void writer_thread(void *arg) {
+  PyAudioTrace *trace = (PyAudioTrace *)arg;
+  PyAudioMutex_Lock(&trace->lock);
+  for (;;) {
+    int stop = trace->stop_requested;
+    PyAudioMutex_Unlock(&trace->lock);
+    // After a stop request, the callback no longer records: write out what
+    // is left, and exit.
+    while (drain(trace)) {
+    }
+    PyAudioMutex_Lock(&trace->lock);
+    if (stop) {
+      break;
+    }
+    if (!trace->stop_requested) {
+      PyAudioCond_TimedWait(&trace->cond, &trace->lock, WRITER_INTERVAL);
+    }
+  }
+  fflush(trace->file);
+  trace->thread_running = 0;
+  PyAudioCond_Broadcast(&trace->cond);
+  PyAudioMutex_Unlock(&trace->lock);
+}
+
+static void free_trace(PyAudioTrace *trace) {
+  if (trace->file != NULL) {
+    fclose(trace->file);
+  }
+  free(trace->ring);
+  PyAudioCond_Destroy(&trace->cond);
+  PyAudioMutex_Destroy(&trace->lock);
+  free(trace);
+}
+
+PyAudioTrace *PyAudioTrace_Create(const char *path, PaSampleFormat format,
+                                  unsigned int channels,
+                                  unsigned int frame_size, double sample_rate,
+                                  int is_input, int is_output, int input) {
+  PyAudioTrace *trace = (PyAudioTrace *)calloc(1, sizeof(PyAudioTrace));
+  if (trace == NULL) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  PyAudioMutex_Init(&trace->lock);
+  PyAudioCond_Init(&trace->cond);
+  trace->frame_size = frame_size;
+  trace->input = input;
+
+  trace->capacity = MIN_RING_BYTES;
+  if (input) {
+    uint64_t input_bytes =
+        (uint64_t)(RING_SECONDS * sample_rate) * frame_size;
+    if (trace->capacity < input_bytes) {
+      trace->capacity = input_bytes;
+    }
+  }
+  trace->ring = (char *)malloc((size_t)trace->capacity);
+  if (trace->ring == NULL) {
+    free_trace(trace);
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  trace->file = fopen(path, "wb");
+  if (trace->file == NULL) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    free_trace(trace);
+    return NULL;
+  }
+  PyAudioTraceHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PYAUDIO_TRACE_MAGIC, sizeof(header.magic));
+  header.version = PYAUDIO_TRACE_VERSION;
+  header.flags = (input ? PYAUDIO_TRACE_INPUT : 0) |
+                 (is_input ? PYAUDIO_TRACE_STREAM_INPUT : 0) |
+                 (is_output ? PYAUDIO_TRACE_STREAM_OUTPUT : 0);
+  header.sample_format = format;
+  header.channels = channels;
+  header.frame_size = frame_size;
+  header.sample_rate = sample_rate;
+  if (fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    free_trace(trace);
+    return NULL;
+  }
+
+  trace->thread_running = 1;
+  if (PyThread_start_new_thread(writer_thread, trace) ==
+      PYTHREAD_INVALID_THREAD_ID) {
+    PyErr_SetString(PyExc_RuntimeError, "Cannot start trace writer thread");
+    free_trace(trace);
+    return NULL;
+  }
+  return trace;
+}
+
+void PyAudioTrace_Destroy(PyAudioTrace *trace) {
+  if (trace == NULL) {
+    return;
+  }
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  PyAudioMutex_Lock(&trace->lock);
+  trace->stop_requested = 1;
+  PyAudioCond_Broadcast(&trace->cond);
+  while (trace->thread_running) {
+    PyAudioCond_TimedWait(&trace->cond, &trace->lock, -1);
+  }
+  PyAudioMutex_Unlock(&trace->lock);
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  free_trace(trace);
+}
+
+void PyAudioTrace_Record(PyAudioTrace *trace, const void *input,
+                         unsigned long frame_count,
+                         const PaStreamCallbackTimeInfo *time_info,
+                         PaStreamCallbackFlags status_flags) {
+  size_t frames_size =
+      trace->input ? (size_t)frame_count * trace->frame_size : 0;
+  size_t size = sizeof(PyAudioTraceRecord) + frames_size;
+  uint64_t write_pos = trace->write_pos;
+  uint64_t read_pos = PyAudioAtomic_LoadU64(&trace->read_pos);
+  if (size > trace->capacity - (write_pos - read_pos)) {
+    // The writer fell behind: drop the whole record.
+    trace->pending_dropped++;
+    PyAudioAtomic_StoreU64(&trace->dropped, trace->dropped + 1);
+    return;
+  }
+
+  PyAudioTraceRecord record;
+  record.frame_count = (uint32_t)frame_count;
+  record.dropped = trace->pending_dropped;
+  record.status_flags = status_flags;
+  record.input_buffer_adc_time = time_info->inputBufferAdcTime;
+  record.current_time = time_info->currentTime;
+  record.output_buffer_dac_time = time_info->outputBufferDacTime;
+  ring_put(trace, write_pos, &record, sizeof(record));
+  write_pos += sizeof(record);
+  // Periods without input frames record silence.
+  ring_put(trace, write_pos, input, frames_size);
+  write_pos += frames_size;
+  trace->pending_dropped = 0;
+  // Publish the whole record at once.
+  PyAudioAtomic_StoreU64(&trace->write_pos, write_pos);
+}
+
+void PyAudioTrace_LockMemory(PyAudioTrace *trace, PyAudioLockedMemory *memory) {
+  PyAudioLockedMemory_Add(memory, trace->ring, (size_t)trace->capacity);
+}
+
+uint64_t PyAudioTrace_Dropped(PyAudioTrace *trace) {
+  return PyAudioAtomic_LoadU64(&trace->dropped);
+}
+
+int PyAudioTrace_ReadHeader(FILE *file, PyAudioTraceHeader *header) {
+  if (fread(header, sizeof(*header), 1, file) != 1 ||
+      memcmp(header->magic, PYAUDIO_TRACE_MAGIC, sizeof(header->magic)) !=
+          0) {
+    PyErr_SetString(PyExc_ValueError, "Not a PyAudio trace file");
+    return -1;
+  }
+  if (header->version != PYAUDIO_TRACE_VERSION) {
+    PyErr_Format(PyExc_ValueError,
+                 "Unsupported trace version %u (or byte order)",
+                 (unsigned int)header->version);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+// Callback traces: a record of what PortAudio handed the stream callback each
+// period, to reproduce glitches offline.
+//
+// The PortAudio callback copies each period's frame count, time info, status
+// flags and, optionally, input frames into a ring, without blocking; a writer
+// thread drains the ring into the trace file. If the writer falls behind, the
+// ring drops whole records and the next record counts them. The virtual null
+// device replays a trace (see null_device.h), calling the stream callback
+// with the recorded arguments.
+//
+// A trace file is a PyAudioTraceHeader followed by records, each a
+// PyAudioTraceRecord and, if the header has PYAUDIO_TRACE_INPUT,
+// frame_count * frame_size bytes of input. Both structs have no padding, and
+// are stored in the byte order of the recording machine.
+
+#ifndef STREAM_TRACE_H_
+#define STREAM_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "portaudio.h"
+
+#include "thread_tuning.h"
+
+#define PYAUDIO_TRACE_MAGIC "PYATRACE"
+#define PYAUDIO_TRACE_VERSION 1
+
+// Header flags.
+// Records include the input frames.
+#define PYAUDIO_TRACE_INPUT 1
+// The recorded stream had input, and output.
+#define PYAUDIO_TRACE_STREAM_INPUT 2
+#define PYAUDIO_TRACE_STREAM_OUTPUT 4
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t sample_format;
+  uint32_t channels;
+  uint32_t frame_size;
+  double sample_rate;
+} PyAudioTraceHeader;
+
+typedef struct {
+  uint32_t frame_count;
+  // Number of records dropped just before this one.
+  uint32_t dropped;
+  uint64_t status_flags;
+  double input_buffer_adc_time;
+  double current_time;
+  double output_buffer_dac_time;
+} PyAudioTraceRecord;
+
+typedef struct PyAudioTrace PyAudioTrace;
+
+// Creates the trace file at path, writes its header, and starts the writer
+// thread. With input, records include input frames. Must be called with the
+// GIL held. Returns NULL with an exception set on failure.
+PyAudioTrace *PyAudioTrace_Create(const char *path, PaSampleFormat format,
+                                  unsigned int channels,
+                                  unsigned int frame_size, double sample_rate,
+                                  int is_input, int is_output, int input);
+// Stops the writer thread once it has written all records, closes the file
+// and frees the trace. The stream must no longer record. Must be called with
+// the GIL held; releases it while waiting.
+void PyAudioTrace_Destroy(PyAudioTrace *trace);
+// Locks the ring in memory.
+void PyAudioTrace_LockMemory(PyAudioTrace *trace, PyAudioLockedMemory *memory);
+
+// Records one period, from the PortAudio callback. Never blocks.
+void PyAudioTrace_Record(PyAudioTrace *trace, const void *input,
+                         unsigned long frame_count,
+                         const PaStreamCallbackTimeInfo *time_info,
+                         PaStreamCallbackFlags status_flags);
+
+// Returns the number of records dropped because the writer fell behind.
+uint64_t PyAudioTrace_Dropped(PyAudioTrace *trace);
+
+// Reads and checks the header of a trace file. Returns 0, or -1 with an
+// exception set.
+int PyAudioTrace_ReadHeader(FILE *file, PyAudioTraceHeader *header);
+
+#endif  // STREAM_TRACE_H_
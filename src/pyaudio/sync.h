@@ -0,0 +1,253 @@
+// Minimal portable synchronization primitives, safe to use without the GIL
+// (e.g., from the PortAudio callback thread).
+
+#ifndef PYAUDIO_SYNC_H_
+#define PYAUDIO_SYNC_H_
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION PyAudioMutex;
+typedef CONDITION_VARIABLE PyAudioCond;
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+typedef pthread_mutex_t PyAudioMutex;
+typedef pthread_cond_t PyAudioCond;
+#endif
+
+static inline void PyAudioMutex_Init(PyAudioMutex *mutex) {
+#ifdef _WIN32
+  InitializeCriticalSection(mutex);
+#else
+  pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static inline void PyAudioMutex_Destroy(PyAudioMutex *mutex) {
+#ifdef _WIN32
+  DeleteCriticalSection(mutex);
+#else
+  pthread_mutex_destroy(mutex);
+#endif
+}
+
+static inline void PyAudioMutex_Lock(PyAudioMutex *mutex) {
+#ifdef _WIN32
+  EnterCriticalSection(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+static inline void PyAudioMutex_Unlock(PyAudioMutex *mutex) {
+#ifdef _WIN32
+  LeaveCriticalSection(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+// A mutex for process-wide state, usable without initialization (declare it
+// static, initialized to PYAUDIO_STATIC_MUTEX_INIT).
+#ifdef _WIN32
+typedef SRWLOCK PyAudioStaticMutex;
+#define PYAUDIO_STATIC_MUTEX_INIT SRWLOCK_INIT
+#else
+typedef pthread_mutex_t PyAudioStaticMutex;
+#define PYAUDIO_STATIC_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+static inline void PyAudioStaticMutex_Lock(PyAudioStaticMutex *mutex) {
+#ifdef _WIN32
+  AcquireSRWLockExclusive(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+static inline void PyAudioStaticMutex_Unlock(PyAudioStaticMutex *mutex) {
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+static inline void PyAudioCond_Init(PyAudioCond *cond) {
+#ifdef _WIN32
+  InitializeConditionVariable(cond);
+#else
+  pthread_cond_init(cond, NULL);
+#endif
+}
+
+static inline void PyAudioCond_Destroy(PyAudioCond *cond) {
+#ifndef _WIN32
+  pthread_cond_destroy(cond);
+#endif
+}
+
+static inline void PyAudioCond_Broadcast(PyAudioCond *cond) {
+#ifdef _WIN32
+  WakeAllConditionVariable(cond);
+#else
+  pthread_cond_broadcast(cond);
+#endif
+}
+
+// Waits on cond, with mutex held, for at most timeout seconds. A negative
+// timeout waits indefinitely. Returns 0 if woken, or -1 on timeout. As with
+// any condition variable, callers must re-check their predicate.
+static inline int PyAudioCond_TimedWait(PyAudioCond *cond, PyAudioMutex *mutex,
+                                        double timeout) {
+#ifdef _WIN32
+  DWORD ms = timeout < 0 ? INFINITE : (DWORD)(timeout * 1000.0);
+  if (!SleepConditionVariableCS(cond, mutex, ms)) {
+    return -1;
+  }
+  return 0;
+#else
+  if (timeout < 0) {
+    pthread_cond_wait(cond, mutex);
+    return 0;
+  }
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  long long nsec = deadline.tv_nsec + (long long)(timeout * 1e9);
+  deadline.tv_sec += (time_t)(nsec / 1000000000LL);
+  deadline.tv_nsec = (long)(nsec % 1000000000LL);
+  return pthread_cond_timedwait(cond, mutex, &deadline) == ETIMEDOUT ? -1 : 0;
+#endif
+}
+
+// Returns a monotonic timestamp, in seconds.
+static inline double PyAudioTime_Now(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+// Sequentially-consistent atomic operations on shared counters.
+
+static inline uint64_t PyAudioAtomic_LoadU64(volatile uint64_t *value) {
+#ifdef _MSC_VER
+  return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)value, 0,
+                                                0);
+#else
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void PyAudioAtomic_StoreU64(volatile uint64_t *value,
+                                          uint64_t new_value) {
+#ifdef _MSC_VER
+  InterlockedExchange64((volatile LONG64 *)value, (LONG64)new_value);
+#else
+  __atomic_store_n(value, new_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline long PyAudioAtomic_LoadLong(volatile long *value) {
+#ifdef _MSC_VER
+  return InterlockedCompareExchange(value, 0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void PyAudioAtomic_StoreLong(volatile long *value,
+                                           long new_value) {
+#ifdef _MSC_VER
+  InterlockedExchange(value, new_value);
+#else
+  __atomic_store_n(value, new_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Adds delta to value and returns the new value.
+static inline long PyAudioAtomic_AddLong(volatile long *value, long delta) {
+#ifdef _MSC_VER
+  return InterlockedExchangeAdd(value, delta) + delta;
+#else
+  return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Stores new_value and returns the previous value.
+static inline long PyAudioAtomic_ExchangeLong(volatile long *value,
+                                              long new_value) {
+#ifdef _MSC_VER
+  return InterlockedExchange(value, new_value);
+#else
+  return __atomic_exchange_n(value, new_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Sets the bits of mask in value.
+static inline void PyAudioAtomic_OrLong(volatile long *value, long mask) {
+#ifdef _MSC_VER
+  InterlockedOr(value, mask);
+#else
+  __atomic_or_fetch(value, mask, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline uint32_t PyAudioAtomic_LoadU32(volatile uint32_t *value) {
+#ifdef _MSC_VER
+  return (uint32_t)InterlockedCompareExchange((volatile LONG *)value, 0, 0);
+#else
+  return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void PyAudioAtomic_StoreU32(volatile uint32_t *value,
+                                          uint32_t new_value) {
+#ifdef _MSC_VER
+  InterlockedExchange((volatile LONG *)value, (LONG)new_value);
+#else
+  __atomic_store_n(value, new_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Adds delta to value (wrapping around) and returns the new value.
+static inline uint32_t PyAudioAtomic_AddU32(volatile uint32_t *value,
+                                            uint32_t delta) {
+#ifdef _MSC_VER
+  return (uint32_t)InterlockedExchangeAdd((volatile LONG *)value,
+                                          (LONG)delta) + delta;
+#else
+  return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Fences ordering plain (non-atomic) memory accesses around the atomics above,
+// e.g., for a seqlock. A release fence keeps accesses before it from moving
+// past stores after it; an acquire fence keeps loads before it from moving past
+// accesses after it.
+static inline void PyAudioAtomic_ReleaseFence(void) {
+#ifdef _MSC_VER
+  MemoryBarrier();
+#else
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+}
+
+static inline void PyAudioAtomic_AcquireFence(void) {
+#ifdef _MSC_VER
+  MemoryBarrier();
+#else
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+#endif  // PYAUDIO_SYNC_H_
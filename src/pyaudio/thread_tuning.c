@@ -0,0 +1,596 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+#include "thread_tuning.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <dlfcn.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+#include "pythread.h"
+
+#include "sync.h"
+
+#define DEFAULT_PRIORITY 10
+// rtkit's default RTTimeUSecMax and MaxRealtimePriority.
+#define RTKIT_RTTIME_USEC 200000
+#define RTKIT_MAX_PRIORITY 20
+#define RTKIT_TIMEOUT_MS 1000
+
+typedef enum { POLICY_NONE = 0, POLICY_FIFO, POLICY_RR } Policy;
+
+typedef struct {
+  int applied;
+  // Thread the report is for.
+  unsigned long thread_ident;
+  const char *policy;
+  int priority;
+  int rtkit;
+  int has_cpus;
+  unsigned char cpus[PYAUDIO_MAX_CPUS / 8];
+} Report;
+
+struct PyAudioThreadTuning {
+  Policy policy;
+  int priority;
+  int has_cpus;
+  unsigned char cpus[PYAUDIO_MAX_CPUS / 8];
+  // Thread each role was last applied to, or 0. Only written by that thread.
+  unsigned long thread_ident[2];
+  PyAudioMutex lock;
+  // What each role's thread got. Guarded by lock.
+  Report reports[2];
+  // One for the owner, and one per rtkit request in progress.
+  volatile long refcount;
+};
+
+static int cpu_isset(const unsigned char *cpus, int cpu) {
+  return (cpus[cpu / 8] >> (cpu % 8)) & 1;
+}
+
+static void cpu_set(unsigned char *cpus, int cpu) {
+  cpus[cpu / 8] |= (unsigned char)(1 << (cpu % 8));
+}
+
+#ifndef _WIN32
+// Reports a scheduling policy, as returned by pthread_getschedparam().
+static void report_policy(Report *report, int policy, int priority) {
+#ifdef SCHED_RESET_ON_FORK
+  policy &= ~SCHED_RESET_ON_FORK;
+#endif
+  if (policy == SCHED_FIFO) {
+    report->policy = "fifo";
+  } else if (policy == SCHED_RR) {
+    report->policy = "rr";
+  } else {
+    report->policy = "other";
+  }
+  report->priority = priority;
+}
+#endif
+
+static void incref(PyAudioThreadTuning *tuning) {
+  PyAudioAtomic_AddLong(&tuning->refcount, 1);
+}
+
+// Releases a reference, and frees the tuning with the last one.
+static void decref(PyAudioThreadTuning *tuning) {
+  if (PyAudioAtomic_AddLong(&tuning->refcount, -1) > 0) {
+    return;
+  }
+  PyAudioMutex_Destroy(&tuning->lock);
+  free(tuning);
+}
+
+/*************************************************************
+ * rtkit
+ *************************************************************/
+
+#ifdef __linux__
+// Layout of libdbus's DBusError.
+typedef struct {
+  const char *name;
+  const char *message;
+  unsigned int dummy;
+  void *padding;
+} DBusErrorStub;
+
+#define DBUS_BUS_SYSTEM 1
+#define DBUS_TYPE_INVALID 0
+#define DBUS_TYPE_UINT32 ((int)'u')
+#define DBUS_TYPE_UINT64 ((int)'t')
+
+// Asks rtkit to make the thread with kernel ID thread SCHED_RR at priority,
+// through libdbus, loaded on first use so that PyAudio does not depend on it.
+// Blocks until rtkit answers, so it must not run on an audio thread. Returns 0
+// if granted.
+static int rtkit_make_realtime(uint64_t thread, int priority) {
+  void *lib = dlopen("libdbus-1.so.3", RTLD_NOW | RTLD_LOCAL);
+  if (lib == NULL) {
+    return -1;
+  }
+  // libdbus stays loaded, as it may have registered hooks.
+  void (*error_init)(DBusErrorStub *) =
+      (void (*)(DBusErrorStub *))dlsym(lib, "dbus_error_init");
+  void (*error_free)(DBusErrorStub *) =
+      (void (*)(DBusErrorStub *))dlsym(lib, "dbus_error_free");
+  void *(*bus_get_private)(int, DBusErrorStub *) =
+      (void *(*)(int, DBusErrorStub *))dlsym(lib, "dbus_bus_get_private");
+  void (*set_exit_on_disconnect)(void *, unsigned int) =
+      (void (*)(void *, unsigned int))dlsym(
+          lib, "dbus_connection_set_exit_on_disconnect");
+  void *(*new_method_call)(const char *, const char *, const char *,
+                           const char *) =
+      (void *(*)(const char *, const char *, const char *, const char *))dlsym(
+          lib, "dbus_message_new_method_call");
+  unsigned int (*append_args)(void *, int, ...) =
+      (unsigned int (*)(void *, int, ...))dlsym(lib,
+                                                 "dbus_message_append_args");
+  void *(*send_with_reply_and_block)(void *, void *, int, DBusErrorStub *) =
+      (void *(*)(void *, void *, int, DBusErrorStub *))dlsym(
+          lib, "dbus_connection_send_with_reply_and_block");
+  void (*message_unref)(void *) =
+      (void (*)(void *))dlsym(lib, "dbus_message_unref");
+  void (*connection_close)(void *) =
+      (void (*)(void *))dlsym(lib, "dbus_connection_close");
+  void (*connection_unref)(void *) =
+      (void (*)(void *))dlsym(lib, "dbus_connection_unref");
+  if (!error_init || !error_free || !bus_get_private ||
+      !set_exit_on_disconnect || !new_method_call || !append_args ||
+      !send_with_reply_and_block || !message_unref || !connection_close ||
+      !connection_unref) {
+    return -1;
+  }
+
+  DBusErrorStub error;
+  error_init(&error);
+  void *connection = bus_get_private(DBUS_BUS_SYSTEM, &error);
+  if (connection == NULL) {
+    error_free(&error);
+    return -1;
+  }
+  set_exit_on_disconnect(connection, 0);
+
+  // rtkit only serves processes that limit their real-time CPU time, so limit
+  // it only now that rtkit can be asked. The hard limit cannot be raised back,
+  // but the soft limit is restored (as far as the new hard limit allows) if
+  // rtkit refuses.
+  struct rlimit saved;
+  int lowered = 0;
+  if (getrlimit(RLIMIT_RTTIME, &saved) == 0 &&
+      (saved.rlim_max == RLIM_INFINITY || saved.rlim_max > RTKIT_RTTIME_USEC)) {
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = RTKIT_RTTIME_USEC;
+    lowered = setrlimit(RLIMIT_RTTIME, &limit) == 0;
+  }
+
+  int result = -1;
+  // Retry at rtkit's default maximum priority, if above it.
+  uint32_t priorities[2] = {(uint32_t)priority, RTKIT_MAX_PRIORITY};
+  int num_priorities = priority > RTKIT_MAX_PRIORITY ? 2 : 1;
+  for (int i = 0; i < num_priorities && result < 0; i++) {
+    void *message = new_method_call(
+        "org.freedesktop.RealtimeKit1", "/org/freedesktop/RealtimeKit1",
+        "org.freedesktop.RealtimeKit1", "MakeThreadRealtime");
+    if (message == NULL) {
+      break;
+    }
+    if (append_args(message, DBUS_TYPE_UINT64, &thread, DBUS_TYPE_UINT32,
+                    &priorities[i], DBUS_TYPE_INVALID)) {
+      error_free(&error);
+      error_init(&error);
+      void *reply = send_with_reply_and_block(connection, message,
+                                              RTKIT_TIMEOUT_MS, &error);
+      if (reply != NULL) {
+        message_unref(reply);
+        result = 0;
+      }
+    }
+    message_unref(message);
+  }
+  connection_close(connection);
+  connection_unref(connection);
+  error_free(&error);
+
+  if (result < 0 && lowered) {
+    struct rlimit limit;
+    limit.rlim_max = RTKIT_RTTIME_USEC;
+    limit.rlim_cur = saved.rlim_cur != RLIM_INFINITY &&
+                             saved.rlim_cur < RTKIT_RTTIME_USEC
+                         ? saved.rlim_cur
+                         : RTKIT_RTTIME_USEC;
+    setrlimit(RLIMIT_RTTIME, &limit);
+  }
+  return result;
+}
+
+// Reads back the scheduling of the thread with kernel ID thread, which need not
+// be the calling thread.
+static void read_scheduling(uint64_t thread, Report *report) {
+  struct sched_param param;
+  int policy = sched_getscheduler((pid_t)thread);
+  if (policy >= 0 && sched_getparam((pid_t)thread, &param) == 0) {
+    report_policy(report, policy, param.sched_priority);
+  }
+}
+
+typedef struct {
+  PyAudioThreadTuning *tuning;
+  PyAudioThreadRole role;
+  // The thread to make real-time, as PyThread_get_thread_ident() and kernel
+  // IDs.
+  unsigned long thread_ident;
+  uint64_t thread;
+} RtkitRequest;
+
+static void rtkit_thread(void *arg) {
+  RtkitRequest *request = (RtkitRequest *)arg;
+  PyAudioThreadTuning *tuning = request->tuning;
+  if (rtkit_make_realtime(request->thread, tuning->priority) == 0) {
+    PyAudioMutex_Lock(&tuning->lock);
+    // Unless the role has moved to another thread since.
+    Report *report = &tuning->reports[request->role];
+    if (report->thread_ident == request->thread_ident) {
+      report->rtkit = 1;
+      read_scheduling(request->thread, report);
+    }
+    PyAudioMutex_Unlock(&tuning->lock);
+  }
+  decref(tuning);
+  free(request);
+}
+
+// Asks rtkit to make the calling thread real-time from a helper thread, as
+// the D-Bus round trip would stall the caller, and the report of role is
+// updated when rtkit answers.
+static void request_rtkit(PyAudioThreadTuning *tuning, PyAudioThreadRole role,
+                          unsigned long thread_ident) {
+  RtkitRequest *request = (RtkitRequest *)malloc(sizeof(RtkitRequest));
+  if (request == NULL) {
+    return;
+  }
+  request->tuning = tuning;
+  request->role = role;
+  request->thread_ident = thread_ident;
+  request->thread = (uint64_t)syscall(SYS_gettid);
+  incref(tuning);
+  if (PyThread_start_new_thread(rtkit_thread, request) ==
+      PYTHREAD_INVALID_THREAD_ID) {
+    decref(tuning);
+    free(request);
+  }
+}
+#endif
+
+/*************************************************************
+ * Applying
+ *************************************************************/
+
+// Applies the scheduling and affinity of tuning to the calling thread, and
+// reads back what it got. Sets *need_rtkit if only rtkit may grant the
+// scheduling, which is left for the caller to ask.
+static void apply(const PyAudioThreadTuning *tuning, Report *report,
+                  int *need_rtkit) {
+  memset(report, 0, sizeof(*report));
+  report->applied = 1;
+  report->thread_ident = PyThread_get_thread_ident();
+  *need_rtkit = 0;
+#ifdef _WIN32
+  HANDLE thread = GetCurrentThread();
+  if (tuning->policy != POLICY_NONE) {
+    SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL);
+  }
+  report->priority = GetThreadPriority(thread);
+  report->policy = report->priority == THREAD_PRIORITY_TIME_CRITICAL
+                       ? "time_critical"
+                       : "other";
+  if (tuning->has_cpus) {
+    DWORD_PTR mask = 0;
+    for (int cpu = 0; cpu < (int)sizeof(mask) * 8; cpu++) {
+      if (cpu_isset(tuning->cpus, cpu)) {
+        mask |= (DWORD_PTR)1 << cpu;
+      }
+    }
+    if (mask != 0 && SetThreadAffinityMask(thread, mask) != 0) {
+      report->has_cpus = 1;
+      for (int cpu = 0; cpu < (int)sizeof(mask) * 8; cpu++) {
+        if (mask & ((DWORD_PTR)1 << cpu)) {
+          cpu_set(report->cpus, cpu);
+        }
+      }
+    }
+  }
+#else
+  pthread_t thread = pthread_self();
+  struct sched_param param;
+  if (tuning->policy != POLICY_NONE) {
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = tuning->priority;
+    int err = pthread_setschedparam(
+        thread, tuning->policy == POLICY_FIFO ? SCHED_FIFO : SCHED_RR,
+        &param);
+#ifdef __linux__
+    *need_rtkit = err == EPERM;
+#else
+    (void)err;
+#endif
+  }
+  int policy;
+  report->policy = "other";
+  if (pthread_getschedparam(thread, &policy, &param) == 0) {
+    report_policy(report, policy, param.sched_priority);
+  }
+
+#ifdef __linux__
+  // cpu_set_t holds PYAUDIO_MAX_CPUS CPUs.
+  cpu_set_t cpus;
+  if (tuning->has_cpus) {
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < PYAUDIO_MAX_CPUS; cpu++) {
+      if (cpu_isset(tuning->cpus, cpu)) {
+        CPU_SET(cpu, &cpus);
+      }
+    }
+    pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+  }
+  if (pthread_getaffinity_np(thread, sizeof(cpus), &cpus) == 0) {
+    report->has_cpus = 1;
+    for (int cpu = 0; cpu < PYAUDIO_MAX_CPUS; cpu++) {
+      if (CPU_ISSET(cpu, &cpus)) {
+        cpu_set(report->cpus, cpu);
+      }
+    }
+  }
+#endif
+#endif
+}
+
+static PyObject *report_to_dict(const Report *report) {
+  if (!report->applied) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+  PyObject *cpus;
+  if (report->has_cpus) {
+    cpus = PyList_New(0);
+    for (int cpu = 0; cpus != NULL && cpu < PYAUDIO_MAX_CPUS; cpu++) {
+      if (!cpu_isset(report->cpus, cpu)) {
+        continue;
+      }
+      PyObject *item = PyLong_FromLong(cpu);
+      if (item == NULL || PyList_Append(cpus, item) < 0) {
+        Py_XDECREF(item);
+        Py_CLEAR(cpus);
+        break;
+      }
+      Py_DECREF(item);
+    }
+    if (cpus == NULL) {
+      return NULL;
+    }
+    PyObject *list = cpus;
+    cpus = PyList_AsTuple(list);
+    Py_DECREF(list);
+    if (cpus == NULL) {
+      return NULL;
+    }
+  } else {
+    Py_INCREF(Py_None);
+    cpus = Py_None;
+  }
+  // clang-format off
+  return Py_BuildValue("{s:s,s:i,s:O,s:N}",
+                       "policy", report->policy,
+                       "priority", report->priority,
+                       "rtkit", report->rtkit ? Py_True : Py_False,
+                       "cpus", cpus);
+  // clang-format on
+}
+
+PyAudioThreadTuning *PyAudioThreadTuning_Create(const char *policy,
+                                                int priority, PyObject *cpus) {
+  PyAudioThreadTuning *tuning =
+      (PyAudioThreadTuning *)calloc(1, sizeof(PyAudioThreadTuning));
+  if (tuning == NULL) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  PyAudioMutex_Init(&tuning->lock);
+  tuning->refcount = 1;
+
+  if (policy == NULL) {
+    tuning->policy = POLICY_NONE;
+  } else if (strcmp(policy, "fifo") == 0) {
+    tuning->policy = POLICY_FIFO;
+  } else if (strcmp(policy, "rr") == 0) {
+    tuning->policy = POLICY_RR;
+  } else {
+    PyErr_Format(PyExc_ValueError, "Invalid realtime_policy '%s'", policy);
+    goto error;
+  }
+  tuning->priority = priority > 0 ? priority : DEFAULT_PRIORITY;
+#ifndef _WIN32
+  if (tuning->policy != POLICY_NONE) {
+    int sched_policy = tuning->policy == POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+    if (tuning->priority < sched_get_priority_min(sched_policy) ||
+        tuning->priority > sched_get_priority_max(sched_policy)) {
+      PyErr_Format(PyExc_ValueError,
+                   "realtime_priority must be between %d and %d",
+                   sched_get_priority_min(sched_policy),
+                   sched_get_priority_max(sched_policy));
+      goto error;
+    }
+  }
+#endif
+
+  if (cpus != NULL && cpus != Py_None) {
+    PyObject *iterator = PyObject_GetIter(cpus);
+    if (iterator == NULL) {
+      goto error;
+    }
+    PyObject *item;
+    while ((item = PyIter_Next(iterator)) != NULL) {
+      long cpu = PyLong_AsLong(item);
+      Py_DECREF(item);
+      if (cpu == -1 && PyErr_Occurred()) {
+        Py_DECREF(iterator);
+        goto error;
+      }
+      if (cpu < 0 || cpu >= PYAUDIO_MAX_CPUS) {
+        Py_DECREF(iterator);
+        PyErr_Format(PyExc_ValueError, "Invalid CPU %ld", cpu);
+        goto error;
+      }
+      cpu_set(tuning->cpus, (int)cpu);
+      tuning->has_cpus = 1;
+    }
+    Py_DECREF(iterator);
+    if (PyErr_Occurred()) {
+      goto error;
+    }
+    if (!tuning->has_cpus) {
+      PyErr_SetString(PyExc_ValueError, "cpu_affinity has no CPUs");
+      goto error;
+    }
+  }
+  return tuning;
+
+error:
+  PyAudioThreadTuning_Destroy(tuning);
+  return NULL;
+}
+
+void PyAudioThreadTuning_Destroy(PyAudioThreadTuning *tuning) {
+  if (tuning != NULL) {
+    decref(tuning);
+  }
+}
+
+void PyAudioThreadTuning_Apply(PyAudioThreadTuning *tuning,
+                               PyAudioThreadRole role) {
+  unsigned long thread_ident = PyThread_get_thread_ident();
+  if (tuning->thread_ident[role] == thread_ident) {
+    return;
+  }
+  tuning->thread_ident[role] = thread_ident;
+  Report report;
+  int need_rtkit;
+  apply(tuning, &report, &need_rtkit);
+  PyAudioMutex_Lock(&tuning->lock);
+  tuning->reports[role] = report;
+  PyAudioMutex_Unlock(&tuning->lock);
+#ifdef __linux__
+  if (need_rtkit) {
+    request_rtkit(tuning, role, thread_ident);
+  }
+#endif
+}
+
+PyObject *PyAudioThreadTuning_GetApplied(PyAudioThreadTuning *tuning) {
+  Report reports[2];
+  PyAudioMutex_Lock(&tuning->lock);
+  memcpy(reports, tuning->reports, sizeof(reports));
+  PyAudioMutex_Unlock(&tuning->lock);
+  // clang-format off
+  return Py_BuildValue("{s:N,s:N}",
+                       "callback", report_to_dict(&reports[0]),
+                       "worker", report_to_dict(&reports[1]));
+  // clang-format on
+}
+
+PyObject *PyAudio_SetThreadScheduling(PyObject *self, PyObject *args,
+                                      PyObject *kwargs) {
+  const char *policy = NULL;
+  int priority = 0;
+  PyObject *cpus = NULL;
+  static char *kwlist[] = {"policy", "priority", "cpus", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ziO", kwlist, &policy,
+                                   &priority, &cpus)) {
+    return NULL;
+  }
+  PyAudioThreadTuning *tuning =
+      PyAudioThreadTuning_Create(policy, priority, cpus);
+  if (tuning == NULL) {
+    return NULL;
+  }
+  Report report;
+  int need_rtkit;
+  // Asking rtkit may take a while, which only stalls the caller here.
+  // clang-format off
+  Py_BEGIN_ALLOW_THREADS
+  apply(tuning, &report, &need_rtkit);
+#ifdef __linux__
+  if (need_rtkit) {
+    uint64_t thread = (uint64_t)syscall(SYS_gettid);
+    if (rtkit_make_realtime(thread, tuning->priority) == 0) {
+      report.rtkit = 1;
+      read_scheduling(thread, &report);
+    }
+  }
+#endif
+  Py_END_ALLOW_THREADS
+  // clang-format on
+  PyAudioThreadTuning_Destroy(tuning);
+  return report_to_dict(&report);
+}
+
+/*************************************************************
+ * Memory Locking
+ *************************************************************/
+
+int PyAudioLockedMemory_Add(PyAudioLockedMemory *memory, const void *addr,
+                            size_t size) {
+  if (addr == NULL || size == 0) {
+    return 0;
+  }
+  if (memory->num_regions == PYAUDIO_MAX_LOCKED_REGIONS) {
+    return -1;
+  }
+#ifdef _WIN32
+  if (!VirtualLock((LPVOID)addr, size)) {
+    return -1;
+  }
+#else
+  if (mlock(addr, size) != 0) {
+    return -1;
+  }
+#endif
+  memory->regions[memory->num_regions].addr = addr;
+  memory->regions[memory->num_regions].size = size;
+  memory->num_regions++;
+  memory->locked_bytes += size;
+  return 0;
+}
+
+void PyAudioLockedMemory_Release(PyAudioLockedMemory *memory) {
+  // Locks do not nest: this also unlocks pages shared with other locked
+  // memory, which then may (but rarely does) page out.
+  for (int i = 0; i < memory->num_regions; i++) {
+#ifdef _WIN32
+    VirtualUnlock((LPVOID)memory->regions[i].addr, memory->regions[i].size);
+#else
+    munlock(memory->regions[i].addr, memory->regions[i].size);
+#endif
+  }
+  memory->num_regions = 0;
+  memory->locked_bytes = 0;
+}
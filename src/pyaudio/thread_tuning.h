@@ -0,0 +1,90 @@
+// Real-time scheduling and CPU affinity for audio threads, and locking stream
+// buffers in memory.
+//
+// A stream's tuning applies to the PortAudio callback thread on its first
+// callback (of each run, should the host change threads), and to the worker
+// threads that run its Python callback (lookahead and deadline threads) as
+// they start. It only changes the threads it applies to.
+//
+// Real-time scheduling needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance on
+// Linux. Without them, PyAudio asks RealtimeKit (rtkit) over D-Bus, which
+// grants SCHED_RR up to its own maximum priority, and requires limiting
+// RLIMIT_RTTIME: once the system bus is reachable, a higher hard limit is
+// lowered to rtkit's default of 200 ms. If neither works, the thread keeps
+// its scheduling. Each role's report says what the thread actually got; for a
+// stream's threads, rtkit is asked from a helper thread, so its answer shows
+// up in the report shortly after the tuning applies.
+
+#ifndef THREAD_TUNING_H_
+#define THREAD_TUNING_H_
+
+#include <stddef.h>
+
+#ifndef PY_SSIZE_T_CLEAN
+#define PY_SSIZE_T_CLEAN
+#endif
+#include "Python.h"
+
+// Highest CPU index accepted for affinity, plus 1.
+#define PYAUDIO_MAX_CPUS 1024
+
+typedef enum {
+  // The PortAudio callback thread.
+  PYAUDIO_THREAD_CALLBACK = 0,
+  // Threads the stream creates to run its Python callback.
+  PYAUDIO_THREAD_WORKER = 1,
+} PyAudioThreadRole;
+
+typedef struct PyAudioThreadTuning PyAudioThreadTuning;
+
+// Creates a tuning for policy ("fifo", "rr", or NULL to leave scheduling
+// alone) at priority (0 for a default of 10), and affinity to the CPUs in
+// the iterable cpus (NULL or None to leave affinity alone). Must be called
+// with the GIL held. Returns NULL with an exception set on failure.
+PyAudioThreadTuning *PyAudioThreadTuning_Create(const char *policy,
+                                                int priority, PyObject *cpus);
+// Releases the tuning, freed once no rtkit request for it is in progress. No
+// thread may be applying it.
+void PyAudioThreadTuning_Destroy(PyAudioThreadTuning *tuning);
+
+// Applies the tuning to the calling thread in the given role, unless already
+// applied to it: afterwards, costs a comparison. Never waits for rtkit. Does
+// not need the GIL.
+void PyAudioThreadTuning_Apply(PyAudioThreadTuning *tuning,
+                               PyAudioThreadRole role);
+
+// Returns what each role's thread got, as a dict of "callback" and "worker",
+// each None until applied, or a dict of "policy" ("fifo", "rr", "other", or
+// "time_critical" on Windows), "priority", "rtkit" (whether granted by
+// rtkit), and "cpus" (a tuple of the CPUs the thread may run on, or None
+// where unknown). Must be called with the GIL held.
+PyObject *PyAudioThreadTuning_GetApplied(PyAudioThreadTuning *tuning);
+
+#define PYAUDIO_MAX_LOCKED_REGIONS 16
+
+// Buffers locked in memory (mlock()), so that the real-time path never
+// faults on them.
+typedef struct {
+  struct {
+    const void *addr;
+    size_t size;
+  } regions[PYAUDIO_MAX_LOCKED_REGIONS];
+  int num_regions;
+  // Total size of the regions, in bytes.
+  size_t locked_bytes;
+} PyAudioLockedMemory;
+
+// Locks size bytes at addr (ignored if NULL), if the memory lock limit
+// (RLIMIT_MEMLOCK) allows. Returns 0, or -1 if it could not be locked.
+int PyAudioLockedMemory_Add(PyAudioLockedMemory *memory, const void *addr,
+                            size_t size);
+// Unlocks all regions, before their memory is freed.
+void PyAudioLockedMemory_Release(PyAudioLockedMemory *memory);
+
+// Module function: applies real-time scheduling and CPU affinity to the
+// calling thread, e.g., a thread doing blocking reads or writes, and returns
+// what it got (as a role in PyAudioThreadTuning_GetApplied()).
+PyObject *PyAudio_SetThreadScheduling(PyObject *self, PyObject *args,
+                                      PyObject *kwargs);
+
+#endif  // THREAD_TUNING_H_
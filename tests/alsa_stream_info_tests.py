@@ -0,0 +1,92 @@
+"""PyAudio ALSA Stream Info Tests."""
+
+import os
+import unittest
+
+import pyaudio
+import alsa_utils
+
+# To skip tests requiring hardware, set this environment variable:
+SKIP_HW_TESTS = 'PYAUDIO_SKIP_HW_TESTS' in os.environ
+# ALSA device to open by device string. Defaults to the null plugin, which
+# needs no hardware; snd-aloop's 'plughw:Loopback' works too.
+ALSA_DEVICE_STRING = os.environ.get('PYAUDIO_ALSA_DEVICE_STRING', 'null')
+
+setUpModule = alsa_utils.disable_error_handler_output
+tearDownModule = alsa_utils.disable_error_handler_output
+
+
+@unittest.skipUnless(hasattr(pyaudio, 'PaAlsaStreamInfo'), 'ALSA-only test.')
+class AlsaStreamInfoTests(unittest.TestCase):
+
+    def test_getters(self):
+        stream_info = pyaudio.PaAlsaStreamInfo(device_string='hw:0,0',
+                                               realtime_scheduling=True)
+        self.assertEqual(stream_info.device_string, 'hw:0,0')
+        self.assertTrue(stream_info.realtime_scheduling)
+        with self.assertRaises(AttributeError):
+            stream_info.device_string = 'hw:1,0'
+
+    def test_default(self):
+        stream_info = pyaudio.PaAlsaStreamInfo()
+        self.assertEqual(stream_info.device_string, None)
+        self.assertFalse(stream_info.realtime_scheduling)
+
+    def test_invalid_arguments(self):
+        with self.assertRaises(ValueError):
+            pyaudio.PaAlsaStreamInfo(device_string='')
+        with self.assertRaises(ValueError):
+            pyaudio.alsa_set_num_periods(1)
+        with self.assertRaises(ValueError):
+            pyaudio.alsa_set_retries_busy(-1)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Hardware device required.')
+    def test_device_string(self):
+        p = pyaudio.PyAudio()
+        # Two periods of 256 frames, for minimal latency.
+        pyaudio.alsa_set_num_periods(2)
+        pyaudio.alsa_set_retries_busy(10)
+        try:
+            stream = p.open(
+                format=pyaudio.paInt16,
+                channels=2,
+                rate=44100,
+                output=True,
+                frames_per_buffer=256,
+                # Instantiate inline, so PaAlsaStreamInfo instance could get
+                # GCed subsequently. Ensure the stream still works.
+                output_host_api_specific_stream_info=pyaudio.PaAlsaStreamInfo(
+                    device_string=ALSA_DEVICE_STRING))
+            stream.write(b'\0' * 4 * 1024)
+            self.assertGreater(stream.get_output_latency(), 0)
+            stream.close()
+        finally:
+            pyaudio.alsa_set_num_periods(4)
+            p.terminate()
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Hardware device required.')
+    def test_realtime_scheduling(self):
+        p = pyaudio.PyAudio()
+        calls = []
+
+        def callback(in_data, frame_count, time_info, status):
+            calls.append(frame_count)
+            flag = pyaudio.paComplete if len(calls) == 4 else pyaudio.paContinue
+            return (in_data, flag)
+
+        stream_info = pyaudio.PaAlsaStreamInfo(
+            device_string=ALSA_DEVICE_STRING, realtime_scheduling=True)
+        stream = p.open(
+            format=pyaudio.paInt16,
+            channels=2,
+            rate=44100,
+            input=True,
+            output=True,
+            frames_per_buffer=256,
+            input_host_api_specific_stream_info=stream_info,
+            output_host_api_specific_stream_info=stream_info,
+            stream_callback=callback)
+        stream.wait()
+        stream.close()
+        p.terminate()
+        self.assertEqual(len(calls), 4)
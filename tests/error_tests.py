@@ -113,6 +113,25 @@ class PyAudioErrorTests(unittest.TestCase):
         e = cm.exception
         self.assertEqual(e.args[0], pyaudio.paBadStreamPtr)
 
+    @unittest.skipIf(SKIP_HW_TESTS, 'Hardware device required.')
+    def test_invalid_stream_arguments(self):
+        stream = self.p.open(channels=1,
+                             rate=44100,
+                             format=pyaudio.paInt16,
+                             output=True)
+        # pylint: disable=protected-access
+        with self.assertRaises(TypeError):
+            pyaudio.pa.get_stream_time(None)
+        with self.assertRaises(TypeError):
+            pyaudio.pa.is_stream_active()
+        with self.assertRaises(TypeError):
+            pyaudio.pa.is_stream_active(stream._stream, 1)
+        with self.assertRaises(TypeError):
+            pyaudio.pa.write_stream(stream._stream, 1)
+        with self.assertRaises(TypeError):
+            pyaudio.pa.read_stream(stream._stream, 'frames')
+        stream.close()
+
     def test_invalid_format_supported(self):
         with self.assertRaises(ValueError) as cm:
             self.p.is_format_supported(8000, -1, 1, pyaudio.paInt16)
@@ -1,7 +1,11 @@
 """PyAudio Host API and Device API tests."""
 
 import os
+import subprocess
+import sys
+import tempfile
 import unittest
+import unittest.mock
 
 import pyaudio
 import alsa_utils
@@ -62,6 +66,93 @@ class HostDeviceApiTests(unittest.TestCase):
         with self.assertRaises(IOError):
             self.p.get_device_info_by_index(-2)
 
+    @unittest.skipIf(SKIP_HW_TESTS, 'Hardware device required.')
+    def test_shared_initialization(self):
+        """Instances share one reference-counted initialization"""
+        count = pyaudio.pa.get_init_count()
+        other = pyaudio.PyAudio()
+        self.assertEqual(pyaudio.pa.get_init_count(), count + 1)
+        other.terminate()
+        other.terminate()
+        self.assertEqual(pyaudio.pa.get_init_count(), count)
+        self.assertGreater(self.p.get_device_count(), 0)
+
+        # Initialized at import, in the background, and kept initialized.
+        script = ('import pyaudio; pyaudio.ready.result(timeout=30); '
+                  'pyaudio.PyAudio().terminate(); '
+                  'print(pyaudio.pa.get_init_count())')
+        output = subprocess.check_output(
+            [sys.executable, '-c', script],
+            env=dict(os.environ, PYAUDIO_INIT_IN_BACKGROUND='1'),
+            stderr=subprocess.DEVNULL)
+        self.assertEqual(output.split()[-1], b'1')
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Hardware device required.')
+    def test_device_snapshot(self):
+        """Device snapshot matches the per-index Device and Host APIs"""
+        devices, host_apis = self.p.get_device_snapshot()
+        self.assertEqual(len(devices), self.p.get_device_count())
+        self.assertEqual(len(host_apis), self.p.get_host_api_count())
+        for index, record in enumerate(devices):
+            info = self.p.get_device_info_by_index(index)
+            self.assertDictEqual(
+                info, {key: getattr(record, key) for key in info})
+        for index, record in enumerate(host_apis):
+            info = self.p.get_host_api_info_by_index(index)
+            self.assertDictEqual(
+                info, {key: getattr(record, key) for key in info})
+
+        # Cached until PortAudio is initialized again.
+        self.assertIs(self.p.get_device_snapshot()[0], devices)
+        self.p.terminate()
+        self.p = pyaudio.PyAudio()
+        self.assertIsNot(self.p.get_device_snapshot()[0], devices)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Hardware device required.')
+    def test_probe_formats(self):
+        """Probed formats match is_format_supported, and are cached"""
+        device = self.p.get_default_output_device_info()
+        rates = [8000, 44100, 48000, 1234567]
+        channels = [1, device['maxOutputChannels'] + 1]
+        formats = [pyaudio.paInt16, pyaudio.paFloat32]
+
+        def supported(rate, num_channels, fmt):
+            try:
+                return self.p.is_format_supported(
+                    rate, output_device=device['index'],
+                    output_channels=num_channels, output_format=fmt)
+            except ValueError:
+                return False
+
+        expected = [(rate, num_channels, fmt)
+                    for rate in rates
+                    for num_channels in channels
+                    for fmt in formats
+                    if supported(rate, num_channels, fmt)]
+        self.assertEqual(
+            self.p.probe_formats(device['index'], rates, channels, formats),
+            expected)
+
+        with tempfile.TemporaryDirectory() as cache_dir:
+            cache_path = os.path.join(cache_dir, 'formats.json')
+            self.assertEqual(
+                self.p.probe_formats(device['index'], rates, channels,
+                                     formats, cache_path=cache_path),
+                expected)
+            # Served from the cache, without probing.
+            with unittest.mock.patch.object(pyaudio.pa, 'probe_formats',
+                                            side_effect=AssertionError):
+                self.assertEqual(
+                    self.p.probe_formats(device['index'], rates, channels,
+                                         formats, cache_path=cache_path),
+                    expected)
+
+        with self.assertRaises(ValueError):
+            self.p.probe_formats(device['index'], rates, channels, formats,
+                                 direction='sideways')
+        with self.assertRaises(IOError):
+            self.p.probe_formats(-2, rates, channels, formats)
+
     @unittest.skipIf(SKIP_HW_TESTS, 'Hardware device required.')
     def test_format_supported(self):
         with self.assertRaises(ValueError):
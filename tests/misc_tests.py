@@ -1,5 +1,6 @@
 """PyAudio misc tests."""
 
+import importlib.util
 import unittest
 
 import pyaudio
@@ -53,3 +54,16 @@ class MiscTests(unittest.TestCase):
 
     def test_get_portaudio_version_text(self):
         self.assertGreater(len(pyaudio.get_portaudio_version_text()), 0)
+
+    def test_module_instances_are_independent(self):
+        spec = pyaudio.pa.__spec__
+        other = importlib.util.module_from_spec(spec)
+        spec.loader.exec_module(other)
+        self.assertIsNot(other.Stream, pyaudio.pa.Stream)
+        self.assertEqual(other.get_sample_size(other.paInt16), 2)
+        with self.assertRaises(TypeError):
+            other.StreamReader()
+        # Functions only accept streams of their own module instance.
+        stream = pyaudio.pa.Stream.__new__(pyaudio.pa.Stream)
+        with self.assertRaises(TypeError):
+            other.is_stream_active(stream)
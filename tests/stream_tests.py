@@ -1,9 +1,16 @@
 """Stream tests."""
 
+import collections
+import math
 import os
+import struct
+import subprocess
+import sys
+import tempfile
 import time
 import threading
 import unittest
+import weakref
 
 import pyaudio
 import alsa_utils
@@ -601,3 +608,1338 @@ class StreamTests(unittest.TestCase):
         event.wait()
         time.sleep(0.1)
         self.p.terminate()
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_scheduled_playback(self):
+        """Ensure scheduled clips start at the requested stream time."""
+        width = 2
+        channels = 2
+        rate = 44100
+        bytes_per_frame = width * channels
+
+        def out_callback(in_data, frame_count, time_info, status):
+            return (b'\0' * frame_count * bytes_per_frame, pyaudio.paContinue)
+
+        out_stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=rate,
+            output=True,
+            output_device_index=self.output_device,
+            stream_callback=out_callback)
+
+        at_time = out_stream.get_time() + 0.2
+        clip_id = out_stream.schedule(b'\1' * 256 * bytes_per_frame, at_time)
+        self.assertIsNone(out_stream.get_scheduled_start_time(clip_id))
+        time.sleep(0.5)
+        start_time = out_stream.get_scheduled_start_time(clip_id)
+        self.assertIsNotNone(start_time)
+        self.assertAlmostEqual(start_time, at_time, delta=1.0 / rate)
+
+        # Clips scheduled in the past start as soon as possible.
+        late_id = out_stream.schedule(b'\1' * bytes_per_frame, 0)
+        time.sleep(0.2)
+        self.assertGreater(out_stream.get_scheduled_start_time(late_id), 0)
+
+        with self.assertRaises(KeyError):
+            out_stream.get_scheduled_start_time(-1)
+        with self.assertRaises(ValueError):
+            out_stream.schedule(b'\1' * (bytes_per_frame + 1), at_time)
+        out_stream.close()
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_schedule_requires_callback(self):
+        out_stream = self.p.open(
+            format=self.p.get_format_from_width(2),
+            channels=2,
+            rate=44100,
+            output=True,
+            output_device_index=self.output_device)
+        with self.assertRaises(IOError) as err:
+            out_stream.schedule(b'\0' * 4, 0)
+        self.assertEqual(err.exception.args[0], pyaudio.paNullCallback)
+        out_stream.close()
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_capture_ring_readers(self):
+        """Ensure independent readers each receive the same input."""
+        width = 2
+        bytes_per_frame = width * self.input_channels
+        in_stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=self.input_channels,
+            rate=44100,
+            input=True,
+            input_device_index=self.input_device,
+            capture_ring_frames=44100)
+        fast_reader = in_stream.open_reader()
+        slow_reader = in_stream.open_reader()
+
+        samples = fast_reader.read(1024)
+        self.assertEqual(len(samples), 1024 * bytes_per_frame)
+        self.assertEqual(slow_reader.read(1024), samples)
+
+        buffer = bytearray(512 * bytes_per_frame)
+        self.assertEqual(fast_reader.read_into(buffer), 512)
+        self.assertEqual(fast_reader.overruns, 0)
+
+        # Readers time out rather than wait forever.
+        self.assertLess(len(fast_reader.read(44100 * 10, timeout=0.1)),
+                        44100 * 10 * bytes_per_frame)
+
+        # A reader that falls behind loses its oldest frames, without
+        # affecting the stream.
+        time.sleep(1.5)
+        slow_reader.read(1)
+        self.assertGreater(slow_reader.overruns, 0)
+        self.assertGreater(slow_reader.frames_dropped, 0)
+        self.assertTrue(in_stream.is_active())
+
+        in_stream.close()
+        # Frames captured before the stream closed remain readable.
+        self.assertLessEqual(len(fast_reader.read(44100 * 2)),
+                             44100 * bytes_per_frame)
+        with self.assertRaises(IOError):
+            fast_reader.read(1)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_reader_requires_capture_ring(self):
+        in_stream = self.p.open(
+            format=self.p.get_format_from_width(2),
+            channels=self.input_channels,
+            rate=44100,
+            input=True,
+            input_device_index=self.input_device)
+        with self.assertRaises(IOError):
+            in_stream.open_reader()
+        in_stream.close()
+
+        with self.assertRaises(ValueError):
+            self.p.open(
+                format=self.p.get_format_from_width(2),
+                channels=2,
+                rate=44100,
+                output=True,
+                capture_ring_frames=1024)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    @unittest.skipUnless(hasattr(pyaudio, 'SharedCaptureReader'),
+                         'POSIX shared memory required.')
+    def test_shared_capture_reader(self):
+        """Ensure other processes can read a stream's input."""
+        width = 2
+        bytes_per_frame = width * self.input_channels
+        name = 'pyaudio-test-{}'.format(os.getpid())
+        in_stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=self.input_channels,
+            rate=44100,
+            input=True,
+            input_device_index=self.input_device,
+            shared_capture_name=name,
+            shared_capture_frames=44100)
+
+        # A segment name can only be published once.
+        with self.assertRaises(FileExistsError):
+            self.p.open(
+                format=self.p.get_format_from_width(width),
+                channels=self.input_channels,
+                rate=44100,
+                input=True,
+                input_device_index=self.input_device,
+                shared_capture_name=name)
+
+        reader = pyaudio.SharedCaptureReader(name)
+        self.assertEqual(reader.format, self.p.get_format_from_width(width))
+        self.assertEqual(reader.channels, self.input_channels)
+        self.assertEqual(reader.capacity, 44100)
+
+        position = reader.position
+        samples = reader.read(1024, timeout=5)
+        self.assertEqual(len(samples), 1024 * bytes_per_frame)
+        self.assertIsNotNone(reader.get_frame_time(position + 1023))
+        self.assertIsNone(reader.get_frame_time(position + 44100 * 10))
+
+        child = subprocess.run(
+            [sys.executable, '-c',
+             'import pyaudio, sys\n'
+             'reader = pyaudio.SharedCaptureReader(sys.argv[1])\n'
+             'print(len(reader.read(1024, timeout=5)))\n',
+             name],
+            capture_output=True, text=True, timeout=30, check=True)
+        self.assertEqual(int(child.stdout), 1024 * bytes_per_frame)
+
+        in_stream.close()
+        self.assertTrue(reader.closed)
+        # Frames captured before the stream closed remain readable.
+        reader.read(44100 * 2)
+        with self.assertRaises(IOError):
+            reader.read(1)
+        reader.close()
+
+        # The segment is removed when the stream closes.
+        with self.assertRaises(FileNotFoundError):
+            pyaudio.SharedCaptureReader(name)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    @unittest.skipUnless(hasattr(pyaudio, 'BrokerClient'), 'Linux required.')
+    def test_output_broker(self):
+        """Ensure several clients can play through one output stream."""
+        width = 2
+        channels = 2
+        rate = 44100
+        path = os.path.join('/tmp', 'pyaudio-test-{}.sock'.format(os.getpid()))
+        out_stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=rate,
+            output=True,
+            output_device_index=self.output_device,
+            frames_per_buffer=512,
+            broker_path=path)
+
+        client = pyaudio.BrokerClient(path)
+        self.assertEqual(client.format, self.p.get_format_from_width(width))
+        self.assertEqual(client.channels, channels)
+        self.assertEqual(client.rate, rate)
+        # Default client ring: four buffers, plus the device latency.
+        self.assertGreaterEqual(client.latency, 4 * 512 / rate)
+        capacity = client.get_write_available()
+        self.assertEqual(capacity, 4 * 512)
+
+        # A second process plays concurrently.
+        child = subprocess.run(
+            [sys.executable, '-c',
+             'import pyaudio, sys\n'
+             'with pyaudio.BrokerClient(sys.argv[1]) as client:\n'
+             '    client.write(b"\\x01\\x00" * 2 * 22050)\n'
+             '    print(client.flush(5))\n',
+             path],
+            capture_output=True, text=True, timeout=30, check=True)
+        self.assertEqual(child.stdout.strip(), 'True')
+
+        # Writes block until the broker drains the ring, rather than drop
+        # frames.
+        start = time.time()
+        client.write(b'\x00' * (width * channels * rate // 2))
+        self.assertTrue(client.flush(5))
+        self.assertGreater(time.time() - start, 0.4)
+        self.assertEqual(client.get_write_available(), capacity)
+
+        out_stream.close()
+        with self.assertRaises(IOError):
+            client.write(b'\x00' * width * channels)
+        client.close()
+        self.assertFalse(os.path.exists(path))
+
+        with self.assertRaises(ValueError):
+            self.p.open(
+                format=self.p.get_format_from_width(2),
+                channels=self.input_channels,
+                rate=44100,
+                input=True,
+                input_device_index=self.input_device,
+                broker_path=path)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_callback_reblocking(self):
+        """Ensure the callback sees fixed-size, overlapping blocks."""
+        width = 2
+        channels = 1
+        rate = 44100
+        block_size = 512
+        hop_size = 128
+        bytes_per_frame = width * channels
+        frame_counts = []
+        input_lengths = []
+        adc_times = []
+
+        def callback(in_data, frame_count, time_info, status):
+            frame_counts.append(frame_count)
+            input_lengths.append(len(in_data))
+            adc_times.append(time_info['input_buffer_adc_time'])
+            return (in_data[-hop_size * bytes_per_frame:], pyaudio.paContinue)
+
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=rate,
+            input=True,
+            output=True,
+            input_device_index=self.input_device,
+            output_device_index=self.output_device,
+            stream_callback=callback,
+            callback_block_size=block_size,
+            callback_hop_size=hop_size)
+        self.assertAlmostEqual(stream.get_reblock_latency(), block_size / rate)
+        time.sleep(0.5)
+        stream.close()
+
+        self.assertGreater(len(frame_counts), 0)
+        self.assertEqual(set(frame_counts), {block_size})
+        self.assertEqual(set(input_lengths), {block_size * bytes_per_frame})
+        # Blocks advance by one hop.
+        for earlier, later in zip(adc_times, adc_times[1:]):
+            self.assertGreater(later, earlier)
+
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=rate,
+            input=True,
+            input_device_index=self.input_device,
+            stream_callback=callback,
+            callback_block_size=block_size)
+        self.assertAlmostEqual(stream.get_reblock_latency(),
+                               (block_size - 1) / rate)
+        stream.close()
+
+        with self.assertRaises(ValueError):
+            self.p.open(
+                format=self.p.get_format_from_width(width),
+                channels=channels,
+                rate=rate,
+                output=True,
+                output_device_index=self.output_device,
+                stream_callback=callback,
+                callback_block_size=block_size,
+                callback_hop_size=hop_size)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_write_coalescing(self):
+        """Ensure coalesced small writes are played and flushed."""
+        width = 2
+        channels = 2
+        rate = 44100
+        packet = b'\x01\x00' * channels * 16
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=rate,
+            output=True,
+            output_device_index=self.output_device,
+            write_coalesce_frames=1024,
+            write_coalesce_max_age=10.0)
+        available = stream.get_write_available()
+
+        # Fewer than a block of frames stays buffered in C.
+        for _ in range(8):
+            stream.write(packet)
+        self.assertEqual(stream.get_write_available(),
+                         max(available - 8 * 16, 0))
+
+        # Crossing the block size writes it out, with the remainder buffered.
+        for _ in range(64):
+            stream.write(packet)
+        stream.flush()
+        stream.flush()
+        stream.stop_stream()
+        stream.close()
+
+        with self.assertRaises(ValueError):
+            self.p.open(
+                format=self.p.get_format_from_width(width),
+                channels=channels,
+                rate=rate,
+                output=True,
+                output_device_index=self.output_device,
+                stream_callback=lambda *args: (None, pyaudio.paContinue),
+                write_coalesce_frames=1024)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_callback_thread_state_persists(self):
+        """Ensure callbacks on one thread share a Python thread state."""
+        width = 2
+        channels = 1
+        local = threading.local()
+        calls_seen = []
+
+        def callback(in_data, frame_count, time_info, status):
+            # Thread-local data lives in the thread state, so it only survives
+            # between callbacks if the thread state does.
+            local.calls = getattr(local, 'calls', 0) + 1
+            calls_seen.append(local.calls)
+            return (b'\x00' * frame_count * width * channels,
+                    pyaudio.paContinue)
+
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=44100,
+            output=True,
+            output_device_index=self.output_device,
+            stream_callback=callback)
+        for _ in range(2):
+            time.sleep(0.2)
+            stream.stop_stream()
+            self.assertGreater(len(calls_seen), 1)
+            self.assertGreater(max(calls_seen), 1)
+            del calls_seen[:]
+            stream.start_stream()
+        stream.close()
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_native_stream_methods(self):
+        """Ensure Stream methods are implemented by the extension type."""
+        width = 2
+        channels = 2
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=44100,
+            output=True,
+            output_device_index=self.output_device,
+            start=False)
+        self.assertIsInstance(stream, pyaudio.pa.Stream)
+        self.assertIs(type(stream).write, pyaudio.pa.Stream.write)
+
+        # Starting a started stream, or stopping a stopped one, does nothing.
+        stream.stop_stream()
+        self.assertTrue(stream.is_stopped())
+        stream.start_stream()
+        stream.start_stream()
+        self.assertTrue(stream.is_active())
+
+        frames = b'\0' * width * channels * 256
+        stream.write(frames=frames, num_frames=128)
+        stream.write(frames, exception_on_underflow=False)
+        with self.assertRaises(TypeError):
+            stream.write(frames, frames=frames)
+        with self.assertRaises(TypeError):
+            stream.write(frames, 256, False, None)
+        with self.assertRaises(TypeError):
+            stream.write(data=frames)
+        with self.assertRaises(IOError):
+            stream.read(num_frames=256)
+
+        stream.stop_stream()
+        stream.stop_stream()
+        stream.close()
+        with self.assertRaises(IOError):
+            stream.write(frames)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_wait_for_completion(self):
+        """Ensure wait() returns once a callback stream completes."""
+        width = 2
+        channels = 2
+        frames_per_buffer = 512
+        calls = []
+
+        def callback(in_data, frame_count, time_info, status):
+            calls.append(frame_count)
+            flag = pyaudio.paComplete if len(calls) == 4 else pyaudio.paContinue
+            return (b'\0' * width * channels * frame_count, flag)
+
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=44100,
+            output=True,
+            output_device_index=self.output_device,
+            frames_per_buffer=frames_per_buffer,
+            stream_callback=callback)
+        self.assertTrue(stream.wait(timeout=10))
+        self.assertEqual(len(calls), 4)
+        self.assertFalse(stream.is_active())
+        self.assertTrue(stream.wait())
+        stream.stop_stream()
+        self.assertTrue(stream.wait(0))
+
+        # Blocking streams stay active until stopped.
+        stream.close()
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=44100,
+            output=True,
+            output_device_index=self.output_device)
+        self.assertFalse(stream.wait(timeout=0.05))
+        self.assertTrue(stream.is_active())
+        with self.assertRaises(ValueError):
+            stream.wait(-1)
+
+        stopper = threading.Timer(0.1, stream.stop_stream)
+        stopper.start()
+        self.assertTrue(stream.wait(timeout=10))
+        stopper.join()
+        stream.close()
+        with self.assertRaises(IOError):
+            stream.wait()
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_lookahead(self):
+        """Ensure lookahead streams run the callback ahead of the device."""
+        width = 2
+        channels = 2
+        rate = 44100
+        frames_per_buffer = 256
+        calls = []
+
+        def callback(in_data, frame_count, time_info, status):
+            calls.append((threading.get_ident(),
+                          time_info['output_buffer_dac_time']))
+            flag = pyaudio.paComplete if len(calls) == 20 else pyaudio.paContinue
+            return (b'\1' * width * channels * frame_count, flag)
+
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=rate,
+            output=True,
+            output_device_index=self.output_device,
+            frames_per_buffer=frames_per_buffer,
+            stream_callback=callback,
+            lookahead_buffers=3)
+        # Starting the stream primes the queue on this thread.
+        self.assertGreaterEqual(len(calls), 3)
+        self.assertEqual(calls[0][0], threading.get_ident())
+        self.assertEqual(stream.get_lookahead(), 3)
+        stream.set_lookahead(5)
+        self.assertEqual(stream.get_lookahead(), 5)
+        with self.assertRaises(ValueError):
+            stream.set_lookahead(13)
+
+        self.assertTrue(stream.wait(timeout=10))
+        self.assertEqual(len(calls), 20)
+        self.assertNotEqual(calls[-1][0], threading.get_ident())
+        dac_times = [dac_time for _, dac_time in calls]
+        self.assertEqual(dac_times, sorted(dac_times))
+        self.assertAlmostEqual((dac_times[-1] - dac_times[0]) / 19,
+                               frames_per_buffer / rate, delta=0.002)
+        stream.close()
+
+        for kwargs in ({'input': True}, {'frames_per_buffer': 0},
+                       {'stream_callback': None}):
+            arguments = {
+                'format': self.p.get_format_from_width(width),
+                'channels': channels,
+                'rate': rate,
+                'output': True,
+                'frames_per_buffer': frames_per_buffer,
+                'stream_callback': callback,
+                'lookahead_buffers': 3,
+            }
+            arguments.update(kwargs)
+            with self.assertRaises(ValueError):
+                self.p.open(**arguments)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_callback_deadline(self):
+        """Ensure slow callbacks are replaced by fallback output."""
+        width = 2
+        channels = 2
+        rate = 44100
+        frames_per_buffer = 512
+        period = frames_per_buffer / rate
+        calls = []
+
+        def callback(in_data, frame_count, time_info, status):
+            calls.append(frame_count)
+            if len(calls) == 3:
+                # Miss this period's deadline.
+                time.sleep(1.5 * period)
+            flag = pyaudio.paComplete if len(calls) == 8 else pyaudio.paContinue
+            return (b'\1' * width * channels * frame_count, flag)
+
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=rate,
+            output=True,
+            output_device_index=self.output_device,
+            frames_per_buffer=frames_per_buffer,
+            stream_callback=callback,
+            callback_deadline=0.5,
+            deadline_fallback='repeat')
+        self.assertTrue(stream.wait(timeout=10))
+        self.assertEqual(len(calls), 8)
+        self.assertGreaterEqual(stream.get_deadline_misses(), 1)
+        stream.close()
+
+        for kwargs in ({'callback_deadline': 1.5},
+                       {'frames_per_buffer': 0},
+                       {'deadline_fallback': 'loop'},
+                       {'lookahead_buffers': 2}):
+            arguments = {
+                'format': self.p.get_format_from_width(width),
+                'channels': channels,
+                'rate': rate,
+                'output': True,
+                'frames_per_buffer': frames_per_buffer,
+                'stream_callback': callback,
+                'callback_deadline': 0.5,
+            }
+            arguments.update(kwargs)
+            with self.assertRaises(ValueError):
+                self.p.open(**arguments)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    @unittest.skipIf(sys.version_info < (3, 12),
+                     'Subinterpreters with their own GIL required.')
+    def test_isolated_callback(self):
+        """Ensure isolated callbacks run and hand back results."""
+        frames_per_buffer = 256
+        arguments = {
+            'format': pyaudio.paInt16,
+            'channels': 2,
+            'rate': 44100,
+            'output': True,
+            'output_device_index': self.output_device,
+            'frames_per_buffer': frames_per_buffer,
+        }
+        stream = self.p.open(
+            isolated_callback='isolated_callbacks:count_frames',
+            result_ring_frames=16,
+            result_frame_size=4,
+            start=False,
+            **arguments)
+        reader = stream.open_result_reader()
+        stream.start_stream()
+        self.assertTrue(stream.wait(timeout=10))
+        results = reader.read(5, timeout=1)
+        stream.close()
+        self.assertEqual(list(struct.iter_unpack('=I', results)),
+                         [(frames_per_buffer,)] * 5)
+
+        for kwargs in ({'isolated_callback': 'isolated_callbacks'},
+                       {'isolated_callback': 'isolated_callbacks:missing'},
+                       {'isolated_callback': 'isolated_callbacks:count_frames',
+                        'stream_callback': lambda *args: (None, 0)}):
+            with self.assertRaises((ImportError, ValueError)):
+                self.p.open(**arguments, **kwargs)
+
+    @unittest.skipIf(SKIP_HW_TESTS, 'Sound hardware required.')
+    def test_concurrent_duplex_io(self):
+        """Ensure concurrent reads and writes survive closing the stream."""
+        width = 2
+        rate = 44100
+        frames_per_buffer = 256
+        channels = min(self.input_channels, 2)
+        stream = self.p.open(
+            format=self.p.get_format_from_width(width),
+            channels=channels,
+            rate=rate,
+            input=True,
+            output=True,
+            input_device_index=self.input_device,
+            output_device_index=self.output_device,
+            frames_per_buffer=frames_per_buffer)
+
+        counts = {'read': 0, 'write': 0}
+        errors = []
+        silence = b'\0' * width * channels * frames_per_buffer
+
+        def run(name, io):
+            try:
+                while True:
+                    io()
+                    counts[name] += 1
+            except OSError:
+                pass
+            except Exception as err:  # pylint: disable=broad-except
+                errors.append(err)
+
+        threads = [
+            threading.Thread(target=run, args=('read', lambda: stream.read(
+                frames_per_buffer, exception_on_overflow=False))),
+            threading.Thread(target=run, args=('write', lambda: stream.write(
+                silence))),
+        ]
+        for thread in threads:
+            thread.start()
+        time.sleep(1)
+        # Close while both threads are (most likely) blocked in PortAudio.
+        stream.close()
+        for thread in threads:
+            thread.join(timeout=5)
+            self.assertFalse(thread.is_alive())
+
+        self.assertEqual(errors, [])
+        self.assertGreater(counts['read'], 0)
+        self.assertGreater(counts['write'], 0)
+        with self.assertRaises(OSError):
+            stream.read(frames_per_buffer)
+
+
+class VirtualDeviceTests(unittest.TestCase):
+    """Streams on the virtual null device, which need no hardware."""
+
+    def setUp(self):
+        self.p = pyaudio.PyAudio()
+        self.tmpdir = tempfile.TemporaryDirectory()
+
+    def tearDown(self):
+        self.p.terminate()
+        self.tmpdir.cleanup()
+
+    def test_callback_duplex(self):
+        """Ensure callbacks see the injected input and capture output."""
+        rate = 8000
+        frames_per_buffer = 64
+        output_path = os.path.join(self.tmpdir.name, 'output.raw')
+        played = []
+
+        times = []
+
+        def callback(in_data, frame_count, time_info, status):
+            played.append(in_data)
+            times.append(time_info['current_time'])
+            flag = pyaudio.paComplete if len(played) == 8 else pyaudio.paContinue
+            return (in_data, flag)
+
+        start = time.monotonic()
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=2,
+            rate=rate,
+            input=True,
+            output=True,
+            frames_per_buffer=frames_per_buffer,
+            stream_callback=callback,
+            virtual_device='fast',
+            virtual_input='tone',
+            virtual_output_path=output_path)
+        self.assertTrue(stream.wait(timeout=10))
+        # Fast mode does not wait for the 64 ms of audio.
+        self.assertLess(time.monotonic() - start, 0.05)
+        self.assertFalse(stream.is_active())
+        # Stream time advances by the frames processed.
+        self.assertAlmostEqual(stream.get_time() - times[0],
+                               8 * frames_per_buffer / rate)
+        self.assertAlmostEqual(times[7] - times[0],
+                               7 * frames_per_buffer / rate)
+        stream.close()
+
+        self.assertEqual(len(played), 8)
+        # A 440 Hz sine at half scale, on both channels.
+        samples = struct.unpack('<%dh' % (2 * frames_per_buffer), played[0])
+        for i in (0, 5, 17):
+            expected = int(0.5 * math.sin(2 * math.pi * 440 * i / rate) *
+                           32767)
+            self.assertEqual(samples[2 * i], expected)
+            self.assertEqual(samples[2 * i + 1], expected)
+        with open(output_path, 'rb') as output:
+            self.assertEqual(output.read(), b''.join(played))
+
+    def test_blocking_io(self):
+        """Ensure blocking streams read from and write to files."""
+        input_path = os.path.join(self.tmpdir.name, 'input.raw')
+        output_path = os.path.join(self.tmpdir.name, 'output.raw')
+        # Three frames, and a partial one which is ignored.
+        with open(input_path, 'wb') as input_file:
+            input_file.write(bytes([1, 2, 3, 4, 5, 6, 7]))
+
+        stream = self.p.open(
+            format=pyaudio.paUInt8,
+            channels=2,
+            rate=8000,
+            input=True,
+            output=True,
+            virtual_device='fast',
+            virtual_input=input_path,
+            virtual_output_path=output_path)
+        # The input loops.
+        self.assertEqual(stream.read(4), bytes([1, 2, 3, 4, 5, 6, 1, 2]))
+        stream.write(b'abcd')
+        stream.write(b'ef')
+        self.assertGreater(stream.get_read_available(), 0)
+        self.assertGreater(stream.get_write_available(), 0)
+        stream.stop_stream()
+        with self.assertRaises(IOError):
+            stream.write(b'gh')
+        stream.close()
+        with open(output_path, 'rb') as output:
+            self.assertEqual(output.read(), b'abcdef')
+
+    def test_realtime_pacing(self):
+        """Ensure realtime streams run at the sample rate."""
+        rate = 8000
+        frames_per_buffer = 256
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=rate,
+            output=True,
+            frames_per_buffer=frames_per_buffer,
+            virtual_device='realtime')
+        start = time.monotonic()
+        # Half a second of silence, which plays out in stop_stream().
+        stream.write(b'\0\0' * (rate // 2))
+        stream.stop_stream()
+        self.assertGreaterEqual(time.monotonic() - start, 0.45)
+        self.assertGreater(stream.get_output_latency(), 0)
+        stream.close()
+
+        calls = []
+
+        def callback(in_data, frame_count, time_info, status):
+            calls.append(time_info['current_time'])
+            return (b'\0\0' * frame_count, pyaudio.paContinue)
+
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=rate,
+            output=True,
+            frames_per_buffer=frames_per_buffer,
+            stream_callback=callback,
+            virtual_device='realtime')
+        time.sleep(0.3)
+        stream.stop_stream()
+        stream.close()
+        # About 0.3 s worth of 32 ms periods.
+        self.assertGreaterEqual(len(calls), 5)
+        self.assertLessEqual(len(calls), 12)
+        self.assertEqual(calls, sorted(calls))
+
+    def test_open_options(self):
+        """Ensure each feature's options are parsed, and unknown ones fail."""
+        stream = pyaudio.pa.Stream(8000, 1, pyaudio.paInt16, output=True,
+                                   frames_per_buffer=64,
+                                   stream_callback=lambda *args: (None, 0),
+                                   lookahead_buffers=2, realtime_policy=None,
+                                   virtual_device='fast')
+        stream.close()
+        with self.assertRaises(TypeError):
+            pyaudio.pa.Stream(8000, 1, pyaudio.paInt16, output=True,
+                              virtual_device='fast', no_such_option=1)
+        with self.assertRaises(TypeError):
+            pyaudio.pa.Stream(8000, 1, pyaudio.paInt16, output=True,
+                              virtual_device='fast', lookahead_buffers='2')
+        with self.assertRaises(ValueError):
+            pyaudio.pa.Stream(8000, 1, pyaudio.paInt16, output=True,
+                              virtual_device='fast', lookahead_buffers=2)
+
+    def test_concurrent_coalesced_writes(self):
+        """Ensure coalesced writes from several threads keep every frame."""
+        # Realtime writes block, so that threads write while others wait.
+        output_path = os.path.join(self.tmpdir.name, 'output.raw')
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=8000,
+            output=True,
+            frames_per_buffer=64,
+            virtual_device='realtime',
+            virtual_output_path=output_path,
+            write_coalesce_frames=100)
+
+        def write(value):
+            for _ in range(50):
+                stream.write(bytes([value, 0]) * 16)
+
+        threads = [threading.Thread(target=write, args=(value,))
+                   for value in range(1, 5)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        stream.flush()
+        stream.close()
+
+        with open(output_path, 'rb') as f:
+            samples = f.read()[::2]
+        for value in range(1, 5):
+            self.assertEqual(samples.count(value), 50 * 16)
+
+    def test_reader_reads_more_than_capacity(self):
+        """Ensure a read larger than the capture ring loses no frames."""
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=48000,
+            input=True,
+            frames_per_buffer=256,
+            virtual_device='realtime',
+            virtual_input='tone',
+            capture_ring_frames=1024)
+        reader = stream.open_reader()
+        samples = reader.read(4096, timeout=5)
+        self.assertEqual(len(samples), 4096 * 2)
+        self.assertEqual(reader.overruns, 0)
+        stream.close()
+
+    @unittest.skipUnless(hasattr(pyaudio, 'SharedCaptureReader'),
+                         'POSIX shared memory required.')
+    def test_shared_capture_reads_more_than_capacity(self):
+        """Ensure another process can read more than the shared ring holds."""
+        name = 'pyaudio-test-{}'.format(os.getpid())
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=48000,
+            input=True,
+            frames_per_buffer=256,
+            virtual_device='realtime',
+            virtual_input='tone',
+            shared_capture_name=name,
+            shared_capture_frames=1024)
+        child = subprocess.run(
+            [sys.executable, '-c',
+             'import pyaudio, sys\n'
+             'reader = pyaudio.SharedCaptureReader(sys.argv[1])\n'
+             'samples = reader.read(4096, timeout=5)\n'
+             'print(len(samples), reader.overruns)\n',
+             name],
+            capture_output=True, text=True, timeout=30, check=True)
+        stream.close()
+        self.assertEqual(child.stdout.split(), [str(4096 * 2), '0'])
+
+    @unittest.skipUnless(hasattr(pyaudio, 'SharedCaptureReader'),
+                         'POSIX shared memory required.')
+    def test_shared_capture_reader_closed_while_reading(self):
+        """Ensure closing a shared capture reader ends a read in progress."""
+        name = 'pyaudio-test-{}'.format(os.getpid())
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=8000,
+            input=True,
+            frames_per_buffer=64,
+            virtual_device='realtime',
+            virtual_input='tone',
+            shared_capture_name=name,
+            start=False)
+        reader = pyaudio.SharedCaptureReader(name)
+        errors = []
+
+        def read():
+            try:
+                reader.read(1024)
+            except IOError as e:
+                errors.append(e)
+
+        # The stream is stopped, so the read waits until the reader closes.
+        thread = threading.Thread(target=read)
+        thread.start()
+        time.sleep(0.2)
+        reader.close()
+        thread.join(timeout=5)
+        self.assertFalse(thread.is_alive())
+        self.assertEqual(len(errors), 1)
+        stream.close()
+
+    @unittest.skipUnless(hasattr(pyaudio, 'BrokerClient'), 'Linux required.')
+    def test_broker_client_closed_while_writing(self):
+        """Ensure closing a broker client ends a write waiting for room."""
+        path = os.path.join(self.tmpdir.name, 'broker.sock')
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=8000,
+            output=True,
+            frames_per_buffer=64,
+            virtual_device='realtime',
+            broker_path=path,
+            broker_client_frames=256,
+            start=False)
+        client = pyaudio.BrokerClient(path)
+        with self.assertRaises(ValueError):
+            client.write(b'\0')
+        errors = []
+
+        def write():
+            try:
+                client.write(b'\0\0' * 1024)
+            except IOError as e:
+                errors.append(e)
+
+        # The stream is stopped, so the write waits until the client closes.
+        thread = threading.Thread(target=write)
+        thread.start()
+        time.sleep(0.2)
+        client.close()
+        thread.join(timeout=5)
+        self.assertFalse(thread.is_alive())
+        self.assertEqual(len(errors), 1)
+        self.assertTrue(client.closed)
+        stream.close()
+
+    def test_coalesced_writes_flushed_by_age(self):
+        """Ensure a partial block is written out once it reaches its age."""
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=8000,
+            output=True,
+            frames_per_buffer=64,
+            virtual_device='realtime',
+            write_coalesce_frames=1000,
+            write_coalesce_max_age=0.05)
+        available = stream.get_write_available()
+        stream.write(b'\1\0' * 16)
+        self.assertEqual(stream.get_write_available(), available - 16)
+        # No write follows, so only the flusher writes the frames out, and
+        # the device then plays them.
+        time.sleep(0.3)
+        self.assertEqual(stream.get_write_available(), available)
+        stream.close()
+
+    def test_schedule_forgets_old_clips(self):
+        """Ensure only the most recent finished clips are remembered."""
+        def callback(in_data, frame_count, time_info, status):
+            return (b'\0\0' * frame_count, pyaudio.paContinue)
+
+        stream = self.p.open(
+            format=pyaudio.paInt16,
+            channels=1,
+            rate=8000,
+            output=True,
+            frames_per_buffer=64,
+            stream_callback=callback,
+            virtual_device='realtime')
+        # One-frame clips in the past all finish with the next buffer.
+        clip_ids = [stream.schedule(b'\1\0', 0) for _ in range(1025)]
+        time.sleep(0.1)
+        last_id = stream.schedule(b'\1\0', 0)
+        time.sleep(0.1)
+        with self.assertRaises(KeyError):
+            stream.get_scheduled_start_time(clip_ids[0])
+        self.assertIsNotNone(stream.get_scheduled_start_time(clip_ids[1]))
+        self.assertIsNotNone(stream.get_scheduled_start_time(last_id))
+        stream.close()
+
+    def test_render(self):
+        """Ensure render() runs callbacks over the input, offline."""
+        rate = 48000
+        frames_per_buffer = 256
+        # Ten seconds of 16-bit mono, not a whole number of buffers.
+        num_frames = 10 * rate + 100
+        input_data = struct.pack('<%dh' % num_frames,
+                                 *(i % 1000 for i in range(num_frames)))
+        times = []
+        calls = []
+
+        def invert(in_data, frame_count, time_info, status):
+            times.append(time_info['current_time'])
+            calls.append((frame_count, status))
+            return (bytes(b ^ 0xff for b in in_data), pyaudio.paContinue)
+
+        output = self.p.render(invert, rate, 1, pyaudio.paInt16,
+                               input_data=input_data,
+                               frames_per_buffer=frames_per_buffer)
+        self.assertEqual(output, bytes(b ^ 0xff for b in input_data))
+        self.assertEqual(len(times), -(-num_frames // frames_per_buffer))
+        self.assertEqual(set(calls), {(frames_per_buffer, 0)})
+        self.assertAlmostEqual(times[-1] - times[0],
+                               (len(times) - 1) * frames_per_buffer / rate)
+
+        # From and to files, input only, and output only.
+        input_path = os.path.join(self.tmpdir.name, 'input.raw')
+        output_path = os.path.join(self.tmpdir.name, 'output.raw')
+        with open(input_path, 'wb') as input_file:
+            input_file.write(input_data)
+        self.assertIsNone(
+            self.p.render(invert, rate, 1, pyaudio.paInt16,
+                          input_path=input_path, output_path=output_path))
+        with open(output_path, 'rb') as output_file:
+            self.assertEqual(output_file.read(), output)
+
+        captured = []
+
+        def capture(in_data, frame_count, time_info, status):
+            captured.append(in_data)
+            return (None, pyaudio.paContinue)
+
+        self.assertIsNone(self.p.render(capture, rate, 1, pyaudio.paInt16,
+                                        input_path=input_path, output=False))
+        self.assertEqual(b''.join(captured)[:len(input_data)], input_data)
+
+        def generate(in_data, frame_count, time_info, status):
+            flag = pyaudio.paComplete if len(times) == 2 else pyaudio.paContinue
+            times.append(time_info['current_time'])
+            return (b'\x01\x00' * frame_count, flag)
+
+        times = []
+        self.assertEqual(self.p.render(generate, rate, 1, pyaudio.paInt16),
+                         b'\x01\x00' * 3 * 1024)
+
+    def test_trace_replay(self):
+        """Ensure a recorded callback trace replays with the same arguments."""
+        trace_path = os.path.join(self.tmpdir.name, 'session.trace')
+        recorded = []
+
+        def record(in_data, frame_count, time_info, status):
+            recorded.append((in_data, frame_count, time_info, status))
+            flag = (pyaudio.paComplete if len(recorded) == 20
+                    else pyaudio.paContinue)
+            return (in_data, flag)
+
+        stream = self.p.open(format=pyaudio.paInt16, channels=2, rate=16000,
+                             input=True, output=True, frames_per_buffer=128,
+                             stream_callback=record, virtual_device='fast',
+                             virtual_input='tone', trace_path=trace_path,
+                             trace_input=True)
+        stream.wait()
+        stream.close()
+
+        header, records = pyaudio.read_trace(trace_path, input=True)
+        self.assertEqual(header, {
+            'format': pyaudio.paInt16, 'channels': 2, 'rate': 16000,
+            'input': True, 'output': True, 'has_input_frames': True})
+        self.assertEqual(
+            [(r['input'], r['frame_count'], r['time_info'], r['status_flags'])
+             for r in records],
+            recorded)
+        self.assertEqual({r['dropped'] for r in records}, {0})
+
+        replayed = []
+
+        def replay(in_data, frame_count, time_info, status):
+            replayed.append((in_data, frame_count, time_info, status))
+            return (in_data, pyaudio.paContinue)
+
+        calls, output = self.p.replay_trace(trace_path, replay)
+        self.assertEqual(replayed, recorded)
+        self.assertEqual([call['frame_count'] for call in calls],
+                         [args[1] for args in recorded])
+        self.assertTrue(all(call['duration'] >= 0 for call in calls))
+        self.assertEqual(output, b''.join(args[0] for args in recorded))
+
+        # Without input frames, replays silence.
+        stream = self.p.open(format=pyaudio.paInt16, channels=2, rate=16000,
+                             input=True, frames_per_buffer=128,
+                             stream_callback=record, virtual_device='fast',
+                             virtual_input='tone', trace_path=trace_path)
+        recorded.clear()
+        stream.wait()
+        stream.close()
+        replayed.clear()
+        self.p.replay_trace(trace_path, replay)
+        self.assertEqual([args[1:] for args in replayed],
+                         [args[1:] for args in recorded])
+        self.assertEqual({args[0] for args in replayed}, {b'\0' * 512})
+
+        with self.assertRaises(ValueError):
+            self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                        output=True, virtual_device='fast',
+                        trace_path=trace_path, start=False)
+        with self.assertRaises(ValueError):
+            self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                        output=True, stream_callback=replay,
+                        virtual_device='offline', virtual_trace=trace_path,
+                        start=False)
+
+    def test_probe_recording(self):
+        """Ensure the hot path's probe events export as a Chrome trace."""
+        calls = []
+
+        def callback(in_data, frame_count, time_info, status):
+            calls.append(frame_count)
+            flag = pyaudio.paComplete if len(calls) == 5 else pyaudio.paContinue
+            return (in_data, flag)
+
+        pyaudio.start_probe_recording()
+        try:
+            stream = self.p.open(format=pyaudio.paInt16, channels=1,
+                                 rate=8000, input=True, output=True,
+                                 frames_per_buffer=64,
+                                 stream_callback=callback,
+                                 virtual_device='fast')
+            stream.wait()
+            stream.close()
+            stream = self.p.open(format=pyaudio.paInt16, channels=1,
+                                 rate=8000, input=True, output=True,
+                                 frames_per_buffer=64, virtual_device='fast')
+            stream.write(stream.read(64))
+            stream.close()
+        finally:
+            pyaudio.stop_probe_recording()
+
+        events = pyaudio.get_chrome_trace()['traceEvents']
+        counts = collections.Counter((e['name'], e['ph']) for e in events)
+        for name in ('gil_acquired', 'python_returned', 'memcpy_done'):
+            self.assertEqual(counts[(name, 'i')], 5)
+        for name, num_spans in (('callback', 5), ('read', 1), ('write', 1)):
+            self.assertEqual(counts[(name, 'B')], num_spans)
+            self.assertEqual(counts[(name, 'E')], num_spans)
+        begins = [e for e in events if e['name'] == 'callback'
+                  and e['ph'] == 'B']
+        self.assertEqual([e['args']['frame_count'] for e in begins], calls)
+
+        # Nothing is recorded once stopped, and starting again clears.
+        self.p.render(lambda *args: (None, pyaudio.paComplete), 8000, 1,
+                      pyaudio.paInt16)
+        self.assertEqual(len(pyaudio.get_chrome_trace()['traceEvents']),
+                         len(events))
+        pyaudio.start_probe_recording(4)
+        pyaudio.stop_probe_recording()
+        self.assertEqual(pyaudio.get_chrome_trace()['traceEvents'], [])
+
+    @unittest.skipUnless(hasattr(os, 'sched_getaffinity'),
+                         'CPU affinity is not supported')
+    def test_thread_scheduling(self):
+        """Ensure callback threads get the requested CPU affinity."""
+        cpus = os.sched_getaffinity(0)
+        cpu = min(cpus)
+        calls = []
+
+        def callback(in_data, frame_count, time_info, status):
+            calls.append(os.sched_getaffinity(0))
+            flag = pyaudio.paComplete if len(calls) == 4 else pyaudio.paContinue
+            return (bytes(2 * frame_count), flag)
+
+        stream = self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                             output=True, frames_per_buffer=64,
+                             stream_callback=callback, virtual_device='fast',
+                             cpu_affinity=[cpu], lock_memory=True,
+                             lookahead_buffers=2)
+        stream.wait()
+        applied = stream.get_thread_scheduling()
+        stream.close()
+        # The lookahead thread runs the Python callback.
+        self.assertEqual(calls, [{cpu}] * 4)
+        for role in ('callback', 'worker'):
+            self.assertEqual(applied[role]['cpus'], (cpu,))
+            self.assertIsInstance(applied[role]['policy'], str)
+            self.assertFalse(applied[role]['rtkit'])
+
+        stream = self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                             output=True, virtual_device='fast',
+                             stream_callback=callback, lock_memory=True)
+        self.assertIsNone(stream.get_thread_scheduling())
+        self.assertGreaterEqual(stream.get_locked_memory(), 0)
+        stream.close()
+
+        # Blocking streams tune their own threads.
+        try:
+            applied = pyaudio.set_thread_scheduling(cpus=[cpu])
+            self.assertEqual(applied['cpus'], (cpu,))
+            self.assertEqual(os.sched_getaffinity(0), {cpu})
+        finally:
+            os.sched_setaffinity(0, cpus)
+
+        for kwargs in ({'realtime_policy': 'idle'},
+                       {'realtime_policy': 'fifo', 'realtime_priority': 1000},
+                       {'cpu_affinity': [-1]}):
+            with self.assertRaises(ValueError):
+                self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                            output=True, virtual_device='fast',
+                            stream_callback=callback, **kwargs)
+        with self.assertRaises(ValueError):
+            self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                        output=True, virtual_device='fast',
+                        cpu_affinity=[cpu])
+
+    def test_callback_thread_state_released(self):
+        """Ensure the callback thread state is released as the stream ends."""
+
+        class Token:
+            pass
+
+        input_path = os.path.join(self.tmpdir.name, 'input.raw')
+        with open(input_path, 'wb') as input_file:
+            input_file.write(bytes(2 * 64 * 3))
+        local = threading.local()
+        tokens = []
+
+        def callback(in_data, frame_count, time_info, status):
+            if not hasattr(local, 'token'):
+                local.token = Token()
+                tokens.append(weakref.ref(local.token))
+            return (None, pyaudio.paContinue)
+
+        # The end of the input ends the stream, with no further callback to
+        # release the thread state.
+        stream = self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                             input=True, frames_per_buffer=64,
+                             stream_callback=callback,
+                             virtual_device='offline',
+                             virtual_input=input_path)
+        self.assertTrue(stream.wait(timeout=10))
+        # The thread state, and with it the thread-local token, is gone once
+        # the callback thread exits, without waiting for the stream to close.
+        self.assertEqual(len(tokens), 1)
+        self.assertIsNone(tokens[0]())
+        stream.close()
+
+    def test_close_during_blocking_write(self):
+        """Ensure closing stops long blocking writes without aborting them."""
+        rate = 8000
+        stream = self.p.open(format=pyaudio.paInt16, channels=1, rate=rate,
+                             output=True, frames_per_buffer=64,
+                             virtual_device='realtime')
+        errors = []
+
+        def write():
+            try:
+                # Ten seconds of audio.
+                stream.write(bytes(2 * 10 * rate))
+            except OSError as err:
+                errors.append(err)
+
+        writer = threading.Thread(target=write)
+        writer.start()
+        time.sleep(0.1)
+        start = time.monotonic()
+        stream.close()
+        self.assertLess(time.monotonic() - start, 1)
+        writer.join(timeout=5)
+        self.assertFalse(writer.is_alive())
+        self.assertEqual(len(errors), 1)
+        # The write saw the stream closing between chunks, rather than the
+        # stream stopping under it.
+        self.assertEqual(errors[0].errno, pyaudio.paBadStreamPtr)
+
+    def test_close_during_blocking_read(self):
+        """Ensure closing stops long blocking reads without aborting them."""
+        rate = 8000
+        stream = self.p.open(format=pyaudio.paInt16, channels=1, rate=rate,
+                             input=True, frames_per_buffer=64,
+                             virtual_device='realtime')
+        errors = []
+
+        def read():
+            try:
+                stream.read(10 * rate)
+            except OSError as err:
+                errors.append(err)
+
+        reader = threading.Thread(target=read)
+        reader.start()
+        time.sleep(0.1)
+        start = time.monotonic()
+        stream.close()
+        self.assertLess(time.monotonic() - start, 1)
+        reader.join(timeout=5)
+        self.assertFalse(reader.is_alive())
+        self.assertEqual(len(errors), 1)
+        self.assertEqual(errors[0].errno, pyaudio.paBadStreamPtr)
+
+    def test_callback_closes_stream(self):
+        """Ensure callbacks on worker threads can close their own stream."""
+        for kwargs in ({'lookahead_buffers': 2}, {'callback_deadline': 0.5}):
+            calls = []
+            streams = []
+
+            def callback(in_data, frame_count, time_info, status):
+                calls.append(frame_count)
+                if len(calls) == 4:
+                    streams[0].close()
+                return (bytes(2 * frame_count), pyaudio.paContinue)
+
+            streams.append(
+                self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                            output=True, frames_per_buffer=64,
+                            stream_callback=callback, virtual_device='fast',
+                            **kwargs))
+            deadline = time.monotonic() + 10
+            while len(calls) < 4 and time.monotonic() < deadline:
+                time.sleep(0.01)
+            # The worker thread exits, and frees its state, after the close.
+            time.sleep(0.1)
+            self.assertEqual(len(calls), 4)
+            with self.assertRaises(IOError):
+                streams[0].is_active()
+
+    def test_invalid_arguments(self):
+        """Ensure invalid virtual device arguments are rejected."""
+        with self.assertRaises(ValueError):
+            self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                        output=True, virtual_device='slow')
+        with self.assertRaises(IOError):
+            self.p.open(format=pyaudio.paInt16, channels=1, rate=8000,
+                        input=True, virtual_device='fast',
+                        virtual_input=os.path.join(self.tmpdir.name,
+                                                   'missing.raw'))